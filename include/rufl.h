@@ -47,6 +47,27 @@ typedef enum {
 /** rufl_paint flags */
 #define rufl_BLEND_FONT 0x01
 
+/** Output context. Each has a separate pool of font handles, so that, for
+ * example, printing does not evict the handles used for the screen. */
+typedef enum {
+	/** The screen, or a sprite that output has been redirected to. */
+	rufl_OUTPUT_SCREEN,
+	/** A printer driver. */
+	rufl_OUTPUT_PRINTER,
+	/** A buffer selected with Font_SwitchOutputToBuffer. */
+	rufl_OUTPUT_BUFFER,
+} rufl_output;
+
+/** rufl_invalidate_cache_reason reasons */
+/** The screen mode has changed. */
+#define rufl_INVALIDATE_MODE_CHANGE 0x01
+/** VDU output has been redirected to or from a sprite. */
+#define rufl_INVALIDATE_REDIRECTION 0x02
+/** A print job has finished, or the printer driver has changed. */
+#define rufl_INVALIDATE_PRINTER 0x04
+/** A buffer output destination has changed. */
+#define rufl_INVALIDATE_BUFFER 0x08
+
 /** Last Font Manager error. */
 extern os_error *rufl_fm_error;
 
@@ -70,6 +91,58 @@ struct rufl_decomp_funcs {
 	rufl_cubic_to_func cubic_to;
 };
 
+/** Path verbs used by rufl_decompose_string */
+typedef enum {
+	/** Start a subpath; one point. */
+	rufl_PATH_MOVE_TO,
+	/** Straight line; one point. */
+	rufl_PATH_LINE_TO,
+	/** Cubic Bezier curve; two control points and the end point. */
+	rufl_PATH_CUBIC_TO,
+	/** Close the subpath; no points. */
+	rufl_PATH_CLOSE,
+} rufl_path_verb;
+
+/** A glyph in a struct rufl_path. */
+struct rufl_path_glyph {
+	/** Index of the glyph's first verb in verbs. */
+	size_t verb;
+	/** Index of the glyph's first point in points. */
+	size_t point;
+	/** Advance to the origin of the next glyph / Draw units. */
+	int x_advance;
+	int y_advance;
+};
+
+/** Flat path output of rufl_decompose_string. Points are in Draw units
+ * (1/46080 inch), relative to the origin of each glyph. The verbs and points
+ * of glyph i end where those of glyph i + 1 start, or at verbs_used and
+ * points_used for the last glyph.
+ *
+ * The structure must be zeroed before its first use. The library then
+ * allocates the arrays and sets allocated. The path may be passed again, and
+ * the arrays are reused and grown, until they are freed with rufl_path_free,
+ * which also makes the path ready to use again. Alternatively the caller may
+ * provide the arrays, with their capacities in the _size members and allocated
+ * false. They are never grown or freed. */
+struct rufl_path {
+	/** Path verbs, as rufl_path_verb values. */
+	unsigned char *verbs;
+	size_t verbs_used;
+	size_t verbs_size;
+	/** Points used by the verbs. */
+	os_coord *points;
+	size_t points_used;
+	size_t points_size;
+	/** One entry for each character of the string. */
+	struct rufl_path_glyph *glyphs;
+	size_t glyphs_used;
+	size_t glyphs_size;
+	/** The arrays were allocated by the library. False when the caller
+	 * provides them. */
+	bool allocated;
+};
+
 /**
  * Initialise RUfl.
  *
@@ -141,6 +214,8 @@ rufl_code rufl_paint_callback(const char *font_family, rufl_style font_style,
 
 /**
  * Decompose a glyph to a path.
+ *
+ * The callbacks must not call rufl_decompose_glyph() themselves.
  */
 
 rufl_code rufl_decompose_glyph(const char *font_family,
@@ -149,6 +224,90 @@ rufl_code rufl_decompose_glyph(const char *font_family,
 		struct rufl_decomp_funcs *funcs, void *user);
 
 
+/**
+ * Decompose a string to flat arrays of path verbs and points.
+ *
+ * Returns rufl_OUT_OF_MEMORY if memory is exhausted or caller provided
+ * arrays are too small.
+ */
+
+rufl_code rufl_decompose_string(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		struct rufl_path *path);
+
+
+/**
+ * Flatten the curves of a path from rufl_decompose_string to straight lines.
+ *
+ * Each rufl_PATH_CUBIC_TO is replaced by rufl_PATH_LINE_TO verbs within
+ * tolerance Draw units of the curve. out is as for rufl_decompose_string, and
+ * must not be the same as in.
+ */
+
+rufl_code rufl_path_flatten(const struct rufl_path *in, int tolerance,
+		struct rufl_path *out);
+
+
+/**
+ * Free arrays allocated by rufl_decompose_string.
+ */
+
+void rufl_path_free(struct rufl_path *path);
+
+
+/**
+ * Set the memory budget of the glyph outline cache.
+ *
+ * rufl_decompose_glyph() remembers the outlines of recently decomposed single
+ * glyphs at a reference size, and scales them to the size requested,
+ * discarding the least recently used to stay within the budget. A budget of 0
+ * disables the cache.
+ */
+
+void rufl_outline_cache_set_budget(size_t bytes);
+
+
+/**
+ * Save the glyph outline cache to disk, next to the character set cache.
+ */
+
+rufl_code rufl_outline_cache_save(void);
+
+
+/**
+ * Load glyph outlines saved by rufl_outline_cache_save().
+ *
+ * Call after rufl_init(). A missing or out of date file is not an error.
+ */
+
+rufl_code rufl_outline_cache_load(void);
+
+
+/**
+ * Render text to an 8-bit coverage buffer, without the Font Manager painting.
+ *
+ * x is the position of the text origin and y the position of the baseline in
+ * the buffer, in pixels of 1/90 inch, with y counted from the top row. stride
+ * is the number of bytes from one row of the buffer to the next. Glyphs are
+ * rasterised from their outlines and cached as bitmaps.
+ */
+
+rufl_code rufl_render_to_buffer(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		unsigned char *buffer, int width, int height, int stride);
+
+
+/**
+ * Set the memory budget of the glyph bitmap cache used by
+ * rufl_render_to_buffer. A budget of 0 disables the cache.
+ */
+
+void rufl_bitmap_cache_set_budget(size_t bytes);
+
+
 /**
  * Read metrics for a font
  */
@@ -162,6 +321,9 @@ rufl_code rufl_font_metrics(const char *font_family, rufl_style font_style,
 
 /**
  * Read metrics for a glyph
+ *
+ * Values are in millipoints. A character which is in no font gives the
+ * metrics of the box of hex digits that rufl_paint() draws for it.
  */
 
 rufl_code rufl_glyph_metrics(const char *font_family,
@@ -172,6 +334,229 @@ rufl_code rufl_glyph_metrics(const char *font_family,
 		int *x_advance, int *y_advance);
 
 
+/**
+ * Read metrics for every glyph of a string
+ *
+ * Each array receives one entry per character of the string, so needs at
+ * least length entries, and may be 0 if not required. count is updated to the
+ * number of entries stored. Values are as for rufl_glyph_metrics(), and are
+ * shared with it through the glyph metrics cache.
+ */
+
+rufl_code rufl_glyph_metrics_string(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance,
+		size_t *count);
+
+
+/** Glyph metrics cache statistics. */
+struct rufl_glyph_cache_stats {
+	/** Maximum memory used by entries / bytes. */
+	size_t budget;
+	/** Memory used by entries / bytes. */
+	size_t used;
+	/** Number of glyphs cached. */
+	unsigned int entries;
+	/** Number of lookups satisfied by the cache. */
+	unsigned long hits;
+	/** Number of lookups which needed the Font Manager. */
+	unsigned long misses;
+	/** Number of entries discarded to keep within the budget. */
+	unsigned long evictions;
+};
+
+
+/**
+ * Set the memory budget of the glyph metrics cache.
+ *
+ * rufl_glyph_metrics() remembers the metrics of recently measured glyphs,
+ * discarding the least recently used to stay within the budget. A budget of 0
+ * disables the cache.
+ */
+
+void rufl_glyph_cache_set_budget(size_t bytes);
+
+
+/**
+ * Read the statistics of the glyph metrics cache.
+ */
+
+void rufl_glyph_cache_get_stats(struct rufl_glyph_cache_stats *stats);
+
+
+/**
+ * Reset the hit, miss, and eviction counts of the glyph metrics cache.
+ */
+
+void rufl_glyph_cache_reset_stats(void);
+
+
+/** Public functions, for Font Manager call statistics. */
+typedef enum {
+	rufl_API_NONE,		/**< outside any public function */
+	rufl_API_INIT,
+	rufl_API_PAINT,
+	rufl_API_WIDTH,
+	rufl_API_X_TO_OFFSET,
+	rufl_API_SPLIT,
+	rufl_API_PAINT_CALLBACK,
+	rufl_API_DECOMPOSE_GLYPH,
+	rufl_API_DECOMPOSE_STRING,
+	rufl_API_RENDER_TO_BUFFER,
+	rufl_API_FONT_METRICS,
+	rufl_API_GLYPH_METRICS,
+	rufl_API_GLYPH_METRICS_STRING,
+	rufl_API_FONT_BBOX,
+	rufl_API_INVALIDATE_CACHE,	/**< and rufl_invalidate_cache_reason */
+	rufl_API_QUIT,
+	rufl_API_COUNT
+} rufl_api;
+
+/** Font Manager SWIs, for Font Manager call statistics. */
+typedef enum {
+	rufl_FM_FIND_FONT,
+	rufl_FM_LOSE_FONT,
+	rufl_FM_READ_INFO,
+	rufl_FM_SET_FONT,
+	rufl_FM_PAINT,
+	rufl_FM_SCAN_STRING,
+	rufl_FM_LIST_FONTS,
+	rufl_FM_ENUMERATE_CHARACTERS,
+	rufl_FM_READ_FONT_METRICS,
+	rufl_FM_READ_ENCODING_FILENAME,
+	rufl_FM_SWITCH_OUTPUT_TO_BUFFER,
+	rufl_FM_CACHE_ADDR,
+	rufl_FM_COUNT
+} rufl_fm_swi;
+
+/** Font Manager call statistics. */
+struct rufl_fm_stats {
+	/** Number of calls of each public function, not counting calls made
+	 * by the library itself. */
+	unsigned long calls[rufl_API_COUNT];
+	/** Number of calls of each SWI made by each public function,
+	 * including those made by public functions that it called. */
+	unsigned long swis[rufl_API_COUNT][rufl_FM_COUNT];
+};
+
+
+/**
+ * Read the Font Manager call statistics of the calling thread.
+ */
+
+void rufl_fm_get_stats(struct rufl_fm_stats *stats);
+
+
+/**
+ * Reset the Font Manager call statistics of the calling thread to 0.
+ */
+
+void rufl_fm_reset_stats(void);
+
+
+/**
+ * Count the Font Manager calls made by a public function.
+ */
+
+unsigned long rufl_fm_stats_total(const struct rufl_fm_stats *stats,
+		rufl_api api);
+
+
+/** Number of buckets in a latency histogram. */
+#define rufl_LATENCY_BUCKETS 40
+
+/** Latency histogram of a public function. Bucket i counts calls which took
+ * from 2^i ns to less than 2^(i + 1) ns, except that bucket 0 also counts
+ * faster calls, and the last bucket slower ones. */
+struct rufl_latency_histogram {
+	/** Number of calls. */
+	unsigned long count;
+	/** Total time / ns. */
+	unsigned long long total;
+	/** Longest time / ns. */
+	unsigned long long max;
+	unsigned long bucket[rufl_LATENCY_BUCKETS];
+};
+
+
+/**
+ * Read the latency histogram of a public function.
+ *
+ * Only calls by the client are timed, not calls made by the library itself.
+ * Histograms are only recorded if the library was built with RUFL_PROFILE
+ * defined (make RUFL_PROFILE=yes), and false is returned otherwise. Each
+ * thread has its own histograms.
+ */
+
+bool rufl_latency_get(rufl_api api, struct rufl_latency_histogram *histogram);
+
+
+/**
+ * Reset all latency histograms of the calling thread to 0.
+ */
+
+void rufl_latency_reset(void);
+
+
+/** Types of trace event. */
+typedef enum {
+	/** A span of characters in one font was processed. */
+	rufl_TRACE_SPAN,
+	/** A span of characters in no font was processed, so is shown as
+	 * hex codes, or a glyph was measured in Corpus.Medium. */
+	rufl_TRACE_NOT_AVAILABLE,
+	/** A font handle was found in the cache. */
+	rufl_TRACE_CACHE_HIT,
+	/** A font handle was not in the cache, so the font was found. */
+	rufl_TRACE_CACHE_MISS,
+	/** A font handle was lost to make room in the cache. */
+	rufl_TRACE_CACHE_EVICT,
+	/** rufl_init() started to scan the character set of a font. */
+	rufl_TRACE_SCAN,
+} rufl_trace_type;
+
+/** A trace event. */
+struct rufl_trace_event {
+	rufl_trace_type type;
+	/** Time from a monotonic clock / ns. */
+	unsigned long long time;
+	/** Public function called by the client. */
+	rufl_api api;
+	/** Font identifier, or 0 for rufl_TRACE_NOT_AVAILABLE spans. */
+	const char *font;
+	/** Font size / 16ths of a point, or 0 for rufl_TRACE_SCAN. */
+	unsigned int size;
+	/** Characters in span, for rufl_TRACE_SPAN and
+	 * rufl_TRACE_NOT_AVAILABLE. */
+	unsigned int length;
+	/** Operation the span was processed for, for rufl_TRACE_SPAN and
+	 * rufl_TRACE_NOT_AVAILABLE. This differs from api when a public
+	 * function uses another, such as rufl_decompose_glyph() painting. */
+	rufl_api action;
+	/** Index of the font and number of fonts, for rufl_TRACE_SCAN. */
+	unsigned int index, total;
+};
+
+/** Type of tracing function for rufl_set_tracer(). The event is only valid
+ * during the call, which must not call the library. Threads using different
+ * contexts may call it at once. */
+typedef void (*rufl_trace_func)(const struct rufl_trace_event *event,
+		void *context);
+
+
+/**
+ * Install a function to receive trace events, or remove it.
+ *
+ * With no tracer, tracing costs one test of a pointer at each point where an
+ * event could be emitted.
+ */
+
+void rufl_set_tracer(rufl_trace_func tracer, void *context);
+
+
 /**
  * Determine the maximum bounding box of a font.
  */
@@ -181,8 +566,52 @@ rufl_code rufl_font_bbox(const char *font_family, rufl_style font_style,
 		int *bbox);
 
 
+/** Log levels, for rufl_log_set_level() and RUFL_LOG_LEVEL. */
+#define rufl_LOG_NONE 0
+#define rufl_LOG_ERROR 1
+#define rufl_LOG_WARNING 2
+#define rufl_LOG_INFO 3
+#define rufl_LOG_DEBUG 4
+
+
+/**
+ * Set the most verbose level of message to log.
+ *
+ * Messages are kept in a ring buffer of recent messages, and are only
+ * formatted when dumped. The default level is rufl_LOG_INFO. Messages more
+ * verbose than RUFL_LOG_LEVEL, if the library was built with it defined,
+ * are not compiled in.
+ */
+
+void rufl_log_set_level(int level);
+
+
+/**
+ * Also write each message to stderr as it is logged. The default is false.
+ */
+
+void rufl_log_set_echo(bool echo);
+
+
+/**
+ * Write the messages in the log to stdout, oldest first.
+ */
+
+void rufl_log_dump(void);
+
+
+/**
+ * Discard the messages in the log.
+ */
+
+void rufl_log_clear(void);
+
+
 /**
  * Dump the internal library state to stdout.
+ *
+ * The latency histograms are included if they are recorded, followed by the
+ * log.
  */
 
 void rufl_dump_state(void);
@@ -191,12 +620,34 @@ void rufl_dump_state(void);
 /**
  * Clear the internal font handle cache.
  *
- * Call this function on mode changes or output redirection changes.
+ * All handles in every output context are lost. Prefer
+ * rufl_invalidate_cache_reason(), which keeps handles that are unaffected.
  */
 
 void rufl_invalidate_cache(void);
 
 
+/**
+ * Clear the font handles affected by a change in the output environment.
+ *
+ * reasons is a combination of rufl_INVALIDATE_* values. Mode changes and
+ * output redirection only affect the screen handles, and printer changes only
+ * the printer handles.
+ */
+
+void rufl_invalidate_cache_reason(unsigned int reasons);
+
+
+/**
+ * Select the output context for subsequent rendering and measurement.
+ *
+ * The default is rufl_OUTPUT_SCREEN. Select rufl_OUTPUT_PRINTER while a print
+ * job is in progress, and rufl_OUTPUT_SCREEN again afterwards.
+ */
+
+void rufl_set_output(rufl_output output);
+
+
 /**
  * Free all resources used by the library.
  */
@@ -204,4 +655,156 @@ void rufl_invalidate_cache(void);
 void rufl_quit(void);
 
 
+/** An independent instance of the library, with its own font list, font
+ * handles, caches, and last Font Manager error. The functions above use a
+ * default context, and the process-global variables above belong to it.
+ *
+ * Each rufl_ctx_ function is as the function without ctx_, but uses the
+ * given context. A context must not be used by two threads at once, but
+ * different contexts may be used by different threads, and contexts made by
+ * rufl_ctx_create_shared() let threads share one scan of the fonts. The
+ * Font Manager call statistics and latency histograms are kept for each
+ * thread; the tracer and log are shared. Threads are only supported by the
+ * host backend, as RISC OS tasks have a single thread. */
+struct rufl_context;
+
+
+/**
+ * Create a context and initialise it, as rufl_init().
+ *
+ * All available fonts are scanned. May take some time.
+ */
+
+rufl_code rufl_ctx_create(struct rufl_context **ctx);
+
+
+/**
+ * Create a context which shares the font list of another, without scanning
+ * the fonts.
+ *
+ * The new context has its own font handles, caches, and last Font Manager
+ * error, so it may be used by one thread while parent and the other
+ * contexts sharing its fonts are used by others. It must be destroyed before
+ * parent.
+ */
+
+rufl_code rufl_ctx_create_shared(struct rufl_context *parent,
+		struct rufl_context **ctx);
+
+
+/**
+ * Free all resources used by a context, as rufl_quit(), and the context.
+ */
+
+void rufl_ctx_destroy(struct rufl_context *ctx);
+
+
+/**
+ * Read the last Font Manager error of a context.
+ */
+
+os_error *rufl_ctx_fm_error(const struct rufl_context *ctx);
+
+
+/**
+ * Read the list of available font families of a context.
+ */
+
+const char **rufl_ctx_family_list(const struct rufl_context *ctx,
+		unsigned int *entries);
+
+
+/**
+ * Read the menu of font families of a context.
+ */
+
+void *rufl_ctx_family_menu(const struct rufl_context *ctx);
+
+
+rufl_code rufl_ctx_paint(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y, unsigned int flags);
+rufl_code rufl_ctx_width(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int *width);
+rufl_code rufl_ctx_x_to_offset(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int click_x,
+		size_t *char_offset, int *actual_x);
+rufl_code rufl_ctx_split(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int width,
+		size_t *char_offset, int *actual_x);
+rufl_code rufl_ctx_paint_callback(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		rufl_callback_t callback, void *context);
+rufl_code rufl_ctx_decompose_glyph(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		struct rufl_decomp_funcs *funcs, void *user);
+rufl_code rufl_ctx_decompose_string(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		struct rufl_path *path);
+void rufl_ctx_outline_cache_set_budget(struct rufl_context *ctx,
+		size_t bytes);
+rufl_code rufl_ctx_outline_cache_save(struct rufl_context *ctx);
+rufl_code rufl_ctx_outline_cache_load(struct rufl_context *ctx);
+rufl_code rufl_ctx_render_to_buffer(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		unsigned char *buffer, int width, int height, int stride);
+void rufl_ctx_bitmap_cache_set_budget(struct rufl_context *ctx,
+		size_t bytes);
+rufl_code rufl_ctx_font_metrics(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		os_box *bbox, int *xkern, int *ykern, int *italic,
+		int *ascent, int *descent,
+		int *xheight, int *cap_height,
+		signed char *uline_position, unsigned char *uline_thickness);
+rufl_code rufl_ctx_glyph_metrics(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance);
+rufl_code rufl_ctx_glyph_metrics_string(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance,
+		size_t *count);
+void rufl_ctx_glyph_cache_set_budget(struct rufl_context *ctx, size_t bytes);
+void rufl_ctx_glyph_cache_get_stats(struct rufl_context *ctx,
+		struct rufl_glyph_cache_stats *stats);
+void rufl_ctx_glyph_cache_reset_stats(struct rufl_context *ctx);
+rufl_code rufl_ctx_font_bbox(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		int *bbox);
+void rufl_ctx_dump_state(struct rufl_context *ctx);
+void rufl_ctx_invalidate_cache(struct rufl_context *ctx);
+void rufl_ctx_invalidate_cache_reason(struct rufl_context *ctx,
+		unsigned int reasons);
+void rufl_ctx_set_output(struct rufl_context *ctx, rufl_output output);
+
+
 #endif
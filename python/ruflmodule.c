@@ -5,12 +5,71 @@
  * Copyright 2006 James Bursa <james@semichrome.net>
  */
 
-/* Python module for RUfl. */
-
+/* Python 3 module for RUfl.
+ *
+ * Strings may be str, which is measured through its cached UTF-8 form, or any
+ * object supporting the buffer protocol (bytes, bytearray, memoryview, mmap)
+ * holding UTF-8, which is measured in place. Offsets are in characters for
+ * str and in bytes otherwise.
+ *
+ * On host builds the GIL is released while the library runs, so other Python
+ * threads continue; calls into the library are serialised by a lock. */
+
+#define PY_SSIZE_T_CLEAN
 #include "Python.h"
+#include "pythread.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
 #include "rufl.h"
 
 
+/** A string argument, borrowed from a str or a buffer. */
+struct pyrufl_string {
+	const char *s;
+	size_t length;
+	/** The argument was a str: offsets are in characters. */
+	bool unicode;
+	/** The argument exported a buffer, which must be released. */
+	bool view_held;
+	Py_buffer view;
+};
+
+/** The result of a call into the library, saved before the lock is released
+ * for pyrufl_raise(). */
+struct pyrufl_result {
+	rufl_code code;
+	int errnum;
+	char errmess[252];
+};
+
+#ifdef RUFL_HOST
+/** Serialises calls into the library, which are made without the GIL. */
+static PyThread_type_lock pyrufl_lock;
+#define PYRUFL_BEGIN Py_BEGIN_ALLOW_THREADS \
+		PyThread_acquire_lock(pyrufl_lock, WAIT_LOCK);
+#define PYRUFL_END PyThread_release_lock(pyrufl_lock); \
+		Py_END_ALLOW_THREADS
+#else
+#define PYRUFL_BEGIN {
+#define PYRUFL_END }
+#endif
+
+/** rufl.Error exception. */
+static PyObject *pyrufl_error;
+/** array.array type, for results of the batch functions. */
+static PyObject *pyrufl_array;
+
+
+static int pyrufl_string_get(PyObject *object, struct pyrufl_string *string);
+static void pyrufl_string_release(struct pyrufl_string *string);
+static size_t pyrufl_offset(const struct pyrufl_string *string,
+		size_t offset);
+static void pyrufl_result_save(rufl_code code, struct pyrufl_result *result);
+static PyObject *pyrufl_raise(const struct pyrufl_result *result);
+static PyObject *pyrufl_array_new(const int *values, size_t count);
+
+
 static char pyrufl_paint__doc__[] =
 "paint(font_family, font_style, font_size, string, x, y, flags)\n\n"
 "Render Unicode text."
@@ -20,24 +79,32 @@ static PyObject *
 pyrufl_paint(PyObject *self /* Not used */, PyObject *args)
 {
 	const char *font_family;
-	rufl_style font_style;
+	int font_style;
 	unsigned int font_size;
-	const char *string;
-	int length;
+	PyObject *object;
+	struct pyrufl_string string;
 	int x;
 	int y;
 	unsigned int flags;
+	struct pyrufl_result result;
 
-	if (!PyArg_ParseTuple(args, "siIs#iiI",
+	if (!PyArg_ParseTuple(args, "siIOiiI",
 			&font_family, &font_style, &font_size,
-			&string, &length, &x, &y, &flags))
+			&object, &x, &y, &flags))
+		return NULL;
+	if (!pyrufl_string_get(object, &string))
 		return NULL;
 
-	rufl_paint(font_family, font_style, font_size, string, length,
-			x, y, flags);
+	PYRUFL_BEGIN
+	pyrufl_result_save(rufl_paint(font_family, font_style, font_size,
+			string.s, string.length, x, y, flags), &result);
+	PYRUFL_END
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	pyrufl_string_release(&string);
+	if (result.code != rufl_OK)
+		return pyrufl_raise(&result);
+
+	Py_RETURN_NONE;
 }
 
 
@@ -50,21 +117,29 @@ static PyObject *
 pyrufl_width(PyObject *self /* Not used */, PyObject *args)
 {
 	const char *font_family;
-	rufl_style font_style;
+	int font_style;
 	unsigned int font_size;
-	const char *string;
-	int length;
+	PyObject *object;
+	struct pyrufl_string string;
 	int width = 0;
+	struct pyrufl_result result;
 
-	if (!PyArg_ParseTuple(args, "siIs#",
-			&font_family, &font_style, &font_size,
-			&string, &length))
+	if (!PyArg_ParseTuple(args, "siIO",
+			&font_family, &font_style, &font_size, &object))
+		return NULL;
+	if (!pyrufl_string_get(object, &string))
 		return NULL;
 
-	rufl_width(font_family, font_style, font_size, string, length,
-			&width);
+	PYRUFL_BEGIN
+	pyrufl_result_save(rufl_width(font_family, font_style, font_size,
+			string.s, string.length, &width), &result);
+	PYRUFL_END
 
-	return PyInt_FromLong(width);
+	pyrufl_string_release(&string);
+	if (result.code != rufl_OK)
+		return pyrufl_raise(&result);
+
+	return PyLong_FromLong(width);
 }
 
 
@@ -78,24 +153,34 @@ static PyObject *
 pyrufl_x_to_offset(PyObject *self /* Not used */, PyObject *args)
 {
 	const char *font_family;
-	rufl_style font_style;
+	int font_style;
 	unsigned int font_size;
-	const char *string;
-	int length;
+	PyObject *object;
+	struct pyrufl_string string;
 	int click_x;
 	size_t char_offset = 0;
 	int actual_x = 0;
+	struct pyrufl_result result;
 
-	if (!PyArg_ParseTuple(args, "siIs#i",
+	if (!PyArg_ParseTuple(args, "siIOi",
 			&font_family, &font_style, &font_size,
-			&string, &length, &click_x))
+			&object, &click_x))
+		return NULL;
+	if (!pyrufl_string_get(object, &string))
 		return NULL;
 
-	rufl_x_to_offset(font_family, font_style, font_size, string, length,
-			click_x,
-			&char_offset, &actual_x);
+	PYRUFL_BEGIN
+	pyrufl_result_save(rufl_x_to_offset(font_family, font_style,
+			font_size, string.s, string.length, click_x,
+			&char_offset, &actual_x), &result);
+	PYRUFL_END
+
+	char_offset = pyrufl_offset(&string, char_offset);
+	pyrufl_string_release(&string);
+	if (result.code != rufl_OK)
+		return pyrufl_raise(&result);
 
-	return Py_BuildValue("ii", (int) char_offset, actual_x);
+	return Py_BuildValue("ni", (Py_ssize_t) char_offset, actual_x);
 }
 
 
@@ -109,24 +194,178 @@ static PyObject *
 pyrufl_split(PyObject *self /* Not used */, PyObject *args)
 {
 	const char *font_family;
-	rufl_style font_style;
+	int font_style;
 	unsigned int font_size;
-	const char *string;
-	int length;
+	PyObject *object;
+	struct pyrufl_string string;
 	int width;
 	size_t char_offset = 0;
 	int actual_x = 0;
+	struct pyrufl_result result;
 
-	if (!PyArg_ParseTuple(args, "siIs#i",
+	if (!PyArg_ParseTuple(args, "siIOi",
 			&font_family, &font_style, &font_size,
-			&string, &length, &width))
+			&object, &width))
+		return NULL;
+	if (!pyrufl_string_get(object, &string))
+		return NULL;
+
+	PYRUFL_BEGIN
+	pyrufl_result_save(rufl_split(font_family, font_style, font_size,
+			string.s, string.length, width,
+			&char_offset, &actual_x), &result);
+	PYRUFL_END
+
+	char_offset = pyrufl_offset(&string, char_offset);
+	pyrufl_string_release(&string);
+	if (result.code != rufl_OK)
+		return pyrufl_raise(&result);
+
+	return Py_BuildValue("ni", (Py_ssize_t) char_offset, actual_x);
+}
+
+
+static char pyrufl_widths__doc__[] =
+"widths(font_family, font_style, font_size, strings)\n\n"
+"Return the width of each string of a sequence, as an array.array of\n"
+"type 'i'. The strings are measured with one call into the module."
+;
+
+static PyObject *
+pyrufl_widths(PyObject *self /* Not used */, PyObject *args)
+{
+	const char *font_family;
+	int font_style;
+	unsigned int font_size;
+	PyObject *sequence;
+	PyObject *tuple;
+	PyObject *array = NULL;
+	struct pyrufl_string *strings = NULL;
+	int *widths = NULL;
+	Py_ssize_t count, got = 0, i;
+	struct pyrufl_result result;
+
+	if (!PyArg_ParseTuple(args, "siIO",
+			&font_family, &font_style, &font_size, &sequence))
 		return NULL;
 
-	rufl_split(font_family, font_style, font_size, string, length,
-			width,
-			&char_offset, &actual_x);
+	/* a tuple keeps the strings alive while the GIL is released */
+	tuple = PySequence_Tuple(sequence);
+	if (!tuple)
+		return NULL;
+	count = PyTuple_GET_SIZE(tuple);
+
+	strings = PyMem_New(struct pyrufl_string, count ? count : 1);
+	widths = PyMem_New(int, count ? count : 1);
+	if (!strings || !widths) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (got = 0; got != count; got++)
+		if (!pyrufl_string_get(PyTuple_GET_ITEM(tuple, got),
+				&strings[got]))
+			goto out;
+
+	result.code = rufl_OK;
+	PYRUFL_BEGIN
+	for (i = 0; i != count && result.code == rufl_OK; i++)
+		pyrufl_result_save(rufl_width(font_family, font_style,
+				font_size, strings[i].s, strings[i].length,
+				&widths[i]), &result);
+	PYRUFL_END
+
+	if (result.code != rufl_OK)
+		pyrufl_raise(&result);
+	else
+		array = pyrufl_array_new(widths, count);
+
+out:
+	for (i = 0; i != got; i++)
+		pyrufl_string_release(&strings[i]);
+	PyMem_Free(strings);
+	PyMem_Free(widths);
+	Py_DECREF(tuple);
+	return array;
+}
+
 
-	return Py_BuildValue("ii", (int) char_offset, actual_x);
+static char pyrufl_carets__doc__[] =
+"carets(font_family, font_style, font_size, string, kerning=False)\n\n"
+"Return the x coordinate of each character boundary of string, from the\n"
+"start to the end, as an array.array of type 'i' with one more entry than\n"
+"there are characters. Each is the sum of the advances of the characters\n"
+"before it, measured in one pass. If kerning is true, each is instead the\n"
+"width of the text before it, so includes kerning, but this measures every\n"
+"prefix of string, so costs time quadratic in its length."
+;
+
+static PyObject *
+pyrufl_carets(PyObject *self /* Not used */, PyObject *args)
+{
+	const char *font_family;
+	int font_style;
+	unsigned int font_size;
+	PyObject *object;
+	int kerning = 0;
+	PyObject *array = NULL;
+	struct pyrufl_string string;
+	int *carets;
+	int x = 0;
+	size_t count = 1, offset, i;
+	struct pyrufl_result result;
+
+	if (!PyArg_ParseTuple(args, "siIO|p",
+			&font_family, &font_style, &font_size, &object,
+			&kerning))
+		return NULL;
+	if (!pyrufl_string_get(object, &string))
+		return NULL;
+
+	/* room for the start and an advance per byte, which is at least one
+	 * per character */
+	carets = PyMem_New(int, string.length + 1);
+	if (!carets) {
+		pyrufl_string_release(&string);
+		return PyErr_NoMemory();
+	}
+
+	result.code = rufl_OK;
+	carets[0] = 0;
+	PYRUFL_BEGIN
+	if (kerning) {
+		/* one entry per character boundary: the start, each UTF-8
+		 * lead byte, and the end */
+		for (offset = 1; offset <= string.length &&
+				result.code == rufl_OK; offset++) {
+			if (offset != string.length &&
+					(string.s[offset] & 0xc0) == 0x80)
+				continue;
+			pyrufl_result_save(rufl_width(font_family,
+					font_style, font_size, string.s,
+					offset, &carets[count]), &result);
+			count++;
+		}
+	} else if (string.length) {
+		/* advances are in millipoints, 400 per OS unit */
+		pyrufl_result_save(rufl_glyph_metrics_string(font_family,
+				font_style, font_size, string.s,
+				string.length, 0, 0, 0, 0, carets + 1, 0,
+				&count), &result);
+		for (i = 1; i <= count; i++) {
+			x += carets[i];
+			carets[i] = x / 400;
+		}
+		count++;
+	}
+	PYRUFL_END
+
+	pyrufl_string_release(&string);
+	if (result.code != rufl_OK)
+		pyrufl_raise(&result);
+	else
+		array = pyrufl_array_new(carets, count);
+	PyMem_Free(carets);
+	return array;
 }
 
 
@@ -142,10 +381,173 @@ pyrufl_invalidate_cache(PyObject *self /* Not used */, PyObject *args)
 	if (!PyArg_ParseTuple(args, ""))
 		return NULL;
 
+	PYRUFL_BEGIN
 	rufl_invalidate_cache();
+	PYRUFL_END
+
+	Py_RETURN_NONE;
+}
+
+
+/**
+ * Borrow the UTF-8 of a str, or the contents of a buffer, without copying.
+ *
+ * \param  object  str or object supporting the buffer protocol
+ * \param  string  updated to string, to be released with
+ *                 pyrufl_string_release()
+ * \return  1, or 0 with an exception set
+ */
 
-	Py_INCREF(Py_None);
-	return Py_None;
+int pyrufl_string_get(PyObject *object, struct pyrufl_string *string)
+{
+	Py_ssize_t length;
+
+	string->view_held = false;
+
+	if (PyUnicode_Check(object)) {
+		/* the UTF-8 is cached in the str, and is the str itself
+		 * for ASCII */
+		string->s = PyUnicode_AsUTF8AndSize(object, &length);
+		if (!string->s)
+			return 0;
+		string->length = length;
+		string->unicode = true;
+		return 1;
+	}
+
+	if (PyObject_GetBuffer(object, &string->view, PyBUF_SIMPLE) != 0) {
+		PyErr_Format(PyExc_TypeError, "expected str or bytes-like "
+				"object, not %.200s", Py_TYPE(object)->tp_name);
+		return 0;
+	}
+	string->s = string->view.buf;
+	string->length = string->view.len;
+	string->unicode = false;
+	string->view_held = true;
+	return 1;
+}
+
+
+/**
+ * Release a string from pyrufl_string_get().
+ */
+
+void pyrufl_string_release(struct pyrufl_string *string)
+{
+	if (string->view_held)
+		PyBuffer_Release(&string->view);
+	string->view_held = false;
+}
+
+
+/**
+ * Convert a byte offset from the library to an offset for Python.
+ *
+ * \param  string  string the offset is in
+ * \param  offset  offset in bytes of UTF-8
+ * \return  offset in characters for a str, otherwise offset
+ */
+
+size_t pyrufl_offset(const struct pyrufl_string *string, size_t offset)
+{
+	size_t chars = 0, i;
+
+	if (!string->unicode)
+		return offset;
+
+	for (i = 0; i != offset && i != string->length; i++)
+		if ((string->s[i] & 0xc0) != 0x80)
+			chars++;
+	return chars;
+}
+
+
+/**
+ * Save the result of a call into the library, with the error details which
+ * may be overwritten once the lock is released.
+ *
+ * \param  code    return code from the library
+ * \param  result  updated with code and error details
+ */
+
+void pyrufl_result_save(rufl_code code, struct pyrufl_result *result)
+{
+	result->code = code;
+	result->errnum = 0;
+	result->errmess[0] = 0;
+
+	if (code == rufl_FONT_MANAGER_ERROR && rufl_fm_error) {
+		result->errnum = rufl_fm_error->errnum;
+		strncpy(result->errmess, rufl_fm_error->errmess,
+				sizeof result->errmess - 1);
+		result->errmess[sizeof result->errmess - 1] = 0;
+	} else if (code == rufl_IO_ERROR) {
+		result->errnum = errno;
+	}
+}
+
+
+/**
+ * Raise the exception for a failed call into the library.
+ *
+ * rufl_OUT_OF_MEMORY raises MemoryError. Other errors raise rufl.Error with
+ * arguments (code, message), where code is one of the error constants of the
+ * module.
+ *
+ * \param  result  result saved by pyrufl_result_save()
+ * \return  NULL
+ */
+
+PyObject *pyrufl_raise(const struct pyrufl_result *result)
+{
+	PyObject *args;
+	char message[300];
+
+	switch (result->code) {
+	case rufl_OUT_OF_MEMORY:
+		return PyErr_NoMemory();
+	case rufl_FONT_MANAGER_ERROR:
+		snprintf(message, sizeof message, "Font Manager error 0x%x: %s",
+				result->errnum, result->errmess);
+		break;
+	case rufl_FONT_NOT_FOUND:
+		snprintf(message, sizeof message, "font not found");
+		break;
+	case rufl_IO_ERROR:
+		snprintf(message, sizeof message, "input / output error: %s",
+				strerror(result->errnum));
+		break;
+	case rufl_IO_EOF:
+		snprintf(message, sizeof message, "unexpected end of file");
+		break;
+	default:
+		snprintf(message, sizeof message, "rufl error %i",
+				result->code);
+		break;
+	}
+
+	args = Py_BuildValue("(is)", result->code, message);
+	if (args) {
+		PyErr_SetObject(pyrufl_error, args);
+		Py_DECREF(args);
+	}
+	return NULL;
+}
+
+
+/**
+ * Create an array.array of type 'i'.
+ *
+ * \param  values  contents of the array
+ * \param  count   number of values
+ * \return  new array, or NULL with an exception set
+ */
+
+PyObject *pyrufl_array_new(const int *values, size_t count)
+{
+	return PyObject_CallFunction(pyrufl_array, "sy#", "i",
+			(const char *) values,
+			(Py_ssize_t) (count * sizeof *values));
 }
 
 
@@ -157,6 +559,10 @@ static struct PyMethodDef pyrufl_methods[] = {
 	{"x_to_offset", (PyCFunction)pyrufl_x_to_offset, METH_VARARGS,
 			pyrufl_x_to_offset__doc__},
 	{"split", (PyCFunction)pyrufl_split, METH_VARARGS, pyrufl_split__doc__},
+	{"widths", (PyCFunction)pyrufl_widths, METH_VARARGS,
+			pyrufl_widths__doc__},
+	{"carets", (PyCFunction)pyrufl_carets, METH_VARARGS,
+			pyrufl_carets__doc__},
 	{"invalidate_cache", (PyCFunction)pyrufl_invalidate_cache, METH_VARARGS,
 			pyrufl_invalidate_cache__doc__},
 
@@ -164,40 +570,94 @@ static struct PyMethodDef pyrufl_methods[] = {
 };
 
 
-/* Initialization function for the module (*must* be called initrufl) */
-
 static char pyrufl_module_documentation[] =
-"This module provides access to the RISC OS Unicode font library\n"
-"All string parameters must be in UTF-8."
+"This module provides access to the RISC OS Unicode font library.\n"
+"Strings may be str, or bytes-like objects holding UTF-8. Offsets are in\n"
+"characters for str and in bytes otherwise. Failures raise rufl.Error."
 ;
 
-void
-initrufl(void)
-{
-	PyObject *module;
-	rufl_code code;
+static struct PyModuleDef pyrufl_module = {
+	PyModuleDef_HEAD_INIT,
+	"rufl",
+	pyrufl_module_documentation,
+	-1,
+	pyrufl_methods,
+	NULL, NULL, NULL, NULL
+};
 
-	code = rufl_init();
-	if (code != rufl_OK)
-		Py_FatalError("rufl_init() failed");
 
-	Py_AtExit(rufl_quit);
+/* Initialization function for the module (*must* be called PyInit_rufl) */
+
+PyMODINIT_FUNC
+PyInit_rufl(void)
+{
+	PyObject *module;
+	PyObject *array_module;
+	struct pyrufl_result result;
 
 	/* Create the module and add the functions */
-	module = Py_InitModule4("rufl", pyrufl_methods,
-			pyrufl_module_documentation,
-			(PyObject *) NULL, PYTHON_API_VERSION);
+	module = PyModule_Create(&pyrufl_module);
+	if (!module)
+		return NULL;
+
+	array_module = PyImport_ImportModule("array");
+	if (!array_module)
+		goto error;
+	pyrufl_array = PyObject_GetAttrString(array_module, "array");
+	Py_DECREF(array_module);
+	if (!pyrufl_array)
+		goto error;
+
+	pyrufl_error = PyErr_NewExceptionWithDoc("rufl.Error",
+			"A call into rufl failed. The arguments are the error "
+			"code\nand a message.", NULL, NULL);
+	if (!pyrufl_error)
+		goto error;
+	Py_INCREF(pyrufl_error);
+	if (PyModule_AddObject(module, "Error", pyrufl_error) != 0) {
+		Py_DECREF(pyrufl_error);
+		goto error;
+	}
+
+#ifdef RUFL_HOST
+	pyrufl_lock = PyThread_allocate_lock();
+	if (!pyrufl_lock) {
+		PyErr_NoMemory();
+		goto error;
+	}
+#endif
 
 	/* Add some symbolic constants to the module */
-	PyModule_AddIntConstant(module, "regular", rufl_REGULAR);
-	PyModule_AddIntConstant(module, "slanted", rufl_SLANTED);
-	PyModule_AddIntConstant(module, "bold", rufl_BOLD);
-	PyModule_AddIntConstant(module, "bold_slanted", rufl_BOLD_SLANTED);
+	if (PyModule_AddIntConstant(module, "regular",
+					rufl_WEIGHT_400) ||
+			PyModule_AddIntConstant(module, "slanted",
+					rufl_WEIGHT_400 | rufl_SLANTED) ||
+			PyModule_AddIntConstant(module, "bold",
+					rufl_WEIGHT_700) ||
+			PyModule_AddIntConstant(module, "bold_slanted",
+					rufl_WEIGHT_700 | rufl_SLANTED) ||
+			PyModule_AddIntConstant(module, "blend",
+					rufl_BLEND_FONT) ||
+			PyModule_AddIntConstant(module, "font_manager_error",
+					rufl_FONT_MANAGER_ERROR) ||
+			PyModule_AddIntConstant(module, "font_not_found",
+					rufl_FONT_NOT_FOUND) ||
+			PyModule_AddIntConstant(module, "io_error",
+					rufl_IO_ERROR) ||
+			PyModule_AddIntConstant(module, "io_eof",
+					rufl_IO_EOF))
+		goto error;
+
+	pyrufl_result_save(rufl_init(), &result);
+	if (result.code != rufl_OK) {
+		pyrufl_raise(&result);
+		goto error;
+	}
+	Py_AtExit(rufl_quit);
 
-	PyModule_AddIntConstant(module, "blend", rufl_BLEND_FONT);
+	return module;
 
-	/* Check for errors */
-	if (PyErr_Occurred())
-		Py_FatalError("can't initialize module rufl");
+error:
+	Py_DECREF(module);
+	return NULL;
 }
-
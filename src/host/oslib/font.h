@@ -0,0 +1,111 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host subset of OSLib's oslib/font.h, as used by RUfl. */
+
+#ifndef RUFL_HOST_OSLIB_FONT_H
+#define RUFL_HOST_OSLIB_FONT_H
+
+#include "oslib/os.h"
+
+typedef byte font_f;
+typedef bits font_string_flags;
+typedef bits font_output_flags;
+typedef int font_list_context;
+typedef bits font_metrics_flags;
+
+typedef struct {
+	os_coord space;
+	os_coord letter;
+	int split_char;
+	os_box bbox;
+} font_scan_block;
+
+typedef struct {
+	os_box rubout;
+	os_coord space;
+	os_coord letter;
+} font_paint_block;
+
+typedef struct {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+	int xkern;
+	int ykern;
+	int italic_correction;
+	signed char underline_position;
+	unsigned char underline_thickness;
+	int cap_height;
+	int xheight;
+	int descender;
+	int ascender;
+	int reserved;
+} font_metrics_misc_info;
+
+typedef struct font_bbox_info font_bbox_info;
+typedef struct font_width_info font_width_info;
+typedef struct font_kern_info font_kern_info;
+
+#define font_OS_UNITS ((font_string_flags) 0x10u)
+#define font_GIVEN_BLOCK ((font_string_flags) 0x20u)
+#define font_GIVEN_TRFM ((font_string_flags) 0x40u)
+#define font_GIVEN_LENGTH ((font_string_flags) 0x80u)
+#define font_GIVEN_FONT ((font_string_flags) 0x100u)
+#define font_KERN ((font_string_flags) 0x200u)
+#define font_RIGHT_TO_LEFT ((font_string_flags) 0x400u)
+#define font_BLEND_FONT ((font_string_flags) 0x800u)
+#define font_GIVEN16_BIT ((font_string_flags) 0x1000u)
+#define font_GIVEN32_BIT ((font_string_flags) 0x2000u)
+#define font_RETURN_CARET_POS ((font_string_flags) 0x20000u)
+#define font_RETURN_BBOX ((font_string_flags) 0x40000u)
+#define font_RETURN_MATRIX ((font_string_flags) 0x80000u)
+#define font_RETURN_SPLIT_COUNT ((font_string_flags) 0x100000u)
+
+#define font_RETURN_FONT_NAME ((font_list_context) 0x10000)
+#define font_RETURN_LOCAL_FONT_NAME ((font_list_context) 0x20000)
+
+#define font_ADD_HINTS ((font_output_flags) 0x2u)
+#define font_OUTPUT_SKELETON ((font_output_flags) 0x4u)
+#define font_NO_OUTPUT ((font_output_flags) 0x8u)
+
+#define error_FONT_NOT_FOUND 0x20Bu
+#define error_FONT_BAD_FONT_FILE 0x20Cu
+#define error_FONT_ENCODING_NOT_FOUND 0x225u
+
+os_error *xfont_cache_addr(int *version, int *cache_size, int *cache_used);
+os_error *xfont_find_font(char const *font_name, int xsize, int ysize,
+		int xres, int yres, font_f *font, int *xres_out,
+		int *yres_out);
+os_error *xfont_lose_font(font_f font);
+os_error *xfont_read_info(font_f font, int *x0, int *y0, int *x1, int *y1);
+os_error *xfont_set_font(font_f font);
+os_error *xfont_paint(font_f font, char const *string,
+		font_string_flags flags, int xpos, int ypos,
+		font_paint_block const *block, os_trfm const *trfm,
+		int length);
+os_error *xfont_scan_string(font_f font, char const *s,
+		font_string_flags flags, int x, int y,
+		font_scan_block *block, os_trfm const *trfm, int length,
+		char **split_point, int *x_out, int *y_out, int *length_out);
+os_error *xfont_list_fonts(byte *buffer1, font_list_context context,
+		int size1, byte *buffer2, int size2, char const *tick_font,
+		font_list_context *context_out, int *used1, int *used2);
+os_error *xfont_switch_output_to_buffer(font_output_flags flags,
+		byte *buffer, char **end);
+os_error *xfont_read_font_metrics(font_f font, font_bbox_info *bbox_info,
+		font_width_info *xwidth_info, font_width_info *ywidth_info,
+		font_metrics_misc_info *misc_info, font_kern_info *kern_info,
+		font_metrics_flags *flags_out, int *bbox_info_size,
+		int *xwidth_info_size, int *ywidth_info_size,
+		int *misc_info_size, int *kern_info_size);
+os_error *xfont_read_encoding_filename(font_f font, char *buffer, int size,
+		char **end);
+os_error *xfont_enumerate_characters(font_f font, int character,
+		int *next_character, int *internal_character_code);
+
+#endif
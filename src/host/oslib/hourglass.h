@@ -0,0 +1,21 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host subset of OSLib's oslib/hourglass.h, as used by RUfl. */
+
+#ifndef RUFL_HOST_OSLIB_HOURGLASS_H
+#define RUFL_HOST_OSLIB_HOURGLASS_H
+
+#include "oslib/os.h"
+
+os_error *xhourglass_on(void);
+os_error *xhourglass_off(void);
+os_error *xhourglass_percentage(int percent);
+os_error *xhourglass_leds(bits eor_mask, bits and_mask, bits *old_leds);
+os_error *xhourglass_colours(os_colour sand, os_colour glass,
+		os_colour *old_sand, os_colour *old_glass);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host subset of OSLib's oslib/os.h, as used by RUfl. */
+
+#ifndef RUFL_HOST_OSLIB_OS_H
+#define RUFL_HOST_OSLIB_OS_H
+
+typedef unsigned char byte;
+typedef unsigned int bits;
+typedef int osbool;
+typedef unsigned int os_colour;
+typedef int os_t;
+
+typedef struct {
+	int errnum;
+	char errmess[252];
+} os_error;
+
+typedef struct {
+	int x;
+	int y;
+} os_coord;
+
+typedef struct {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} os_box;
+
+typedef struct {
+	int entries[3][2];
+} os_trfm;
+
+typedef int os_mode;
+typedef int os_mode_var;
+
+#define os_CURRENT_MODE ((os_mode) -1)
+#define os_MODEVAR_XEIG_FACTOR ((os_mode_var) 4)
+#define os_MODEVAR_YEIG_FACTOR ((os_mode_var) 5)
+#define os_MODEVAR_XWIND_LIMIT ((os_mode_var) 11)
+#define os_MODEVAR_YWIND_LIMIT ((os_mode_var) 12)
+
+#define error_FILE_NOT_FOUND 0xD6u
+
+os_error *xos_read_mode_variable(os_mode mode, os_mode_var var,
+		int *var_val, bits *psr);
+os_error *xos_read_monotonic_time(os_t *t);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host subset of OSLib's oslib/osfscontrol.h, as used by RUfl. */
+
+#ifndef RUFL_HOST_OSLIB_OSFSCONTROL_H
+#define RUFL_HOST_OSLIB_OSFSCONTROL_H
+
+#include "oslib/os.h"
+
+os_error *xosfscontrol_canonicalise_path(char const *path_name,
+		char *buffer, char const *var, char const *path, int size,
+		int *spare);
+
+#endif
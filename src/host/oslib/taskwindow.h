@@ -0,0 +1,16 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host subset of OSLib's oslib/taskwindow.h, as used by RUfl. */
+
+#ifndef RUFL_HOST_OSLIB_TASKWINDOW_H
+#define RUFL_HOST_OSLIB_TASKWINDOW_H
+
+#include "oslib/os.h"
+
+os_error *xtaskwindowtaskinfo_window_task(osbool *window_task);
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host subset of OSLib's oslib/wimp.h, as used by RUfl. Only the types
+ * needed for the family menu and the init status window are provided. */
+
+#ifndef RUFL_HOST_OSLIB_WIMP_H
+#define RUFL_HOST_OSLIB_WIMP_H
+
+#include <stddef.h>
+#include "oslib/os.h"
+
+typedef struct wimp_w_ *wimp_w;
+typedef struct wimp_t_ *wimp_t;
+typedef int wimp_i;
+/* wider than OSLib's byte, so that colours shifted into icon flags do not
+ * overflow int */
+typedef bits wimp_colour;
+typedef bits wimp_icon_flags;
+typedef bits wimp_window_flags;
+typedef byte wimp_extra_window_flags;
+typedef bits wimp_menu_flags;
+typedef bits wimp_poll_flags;
+typedef int wimp_event_no;
+
+typedef union {
+	char text[12];
+	char sprite[12];
+	char text_and_sprite[12];
+	struct {
+		char *text;
+		char const *validation;
+		int size;
+	} indirected_text;
+} wimp_icon_data;
+
+typedef struct {
+	os_box extent;
+	wimp_icon_flags flags;
+	wimp_icon_data data;
+} wimp_icon;
+
+#define wimp_WINDOW_MEMBERS						\
+	os_box visible;							\
+	int xscroll;							\
+	int yscroll;							\
+	wimp_w next;							\
+	wimp_window_flags flags;					\
+	wimp_colour title_fg;						\
+	wimp_colour title_bg;						\
+	wimp_colour work_fg;						\
+	wimp_colour work_bg;						\
+	wimp_colour scroll_outer;					\
+	wimp_colour scroll_inner;					\
+	wimp_colour highlight_bg;					\
+	wimp_extra_window_flags extra_flags;				\
+	os_box extent;							\
+	wimp_icon_flags title_flags;					\
+	wimp_icon_flags work_flags;					\
+	void *sprite_area;						\
+	short xmin;							\
+	short ymin;							\
+	wimp_icon_data title_data;					\
+	int icon_count;
+
+#define wimp_WINDOW(N) struct { wimp_WINDOW_MEMBERS wimp_icon icons[N]; }
+
+typedef struct { wimp_WINDOW_MEMBERS } wimp_window;
+
+typedef struct {
+	wimp_w w;
+	os_box visible;
+	int xscroll;
+	int yscroll;
+	wimp_w next;
+} wimp_open;
+
+typedef struct {
+	wimp_w w;
+	os_box visible;
+	int xscroll;
+	int yscroll;
+	wimp_w next;
+	wimp_window_flags flags;
+} wimp_window_state;
+
+typedef union {
+	char text[12];
+	struct {
+		char *text;
+		char const *reserved[2];
+	} indirected_text;
+} wimp_menu_data;
+
+typedef struct wimp_menu wimp_menu;
+
+typedef struct {
+	wimp_menu_flags menu_flags;
+	wimp_menu *sub_menu;
+	wimp_icon_flags icon_flags;
+	wimp_icon_data data;
+} wimp_menu_entry;
+
+struct wimp_menu {
+	wimp_menu_data title_data;
+	wimp_colour title_fg;
+	wimp_colour title_bg;
+	wimp_colour work_fg;
+	wimp_colour work_bg;
+	int width;
+	int height;
+	int gap;
+	wimp_menu_entry entries[1];
+};
+
+#define wimp_SIZEOF_MENU(N) \
+	(offsetof(wimp_menu, entries) + (N) * sizeof (wimp_menu_entry))
+
+typedef union {
+	int reserved[64];
+} wimp_block;
+
+#define wimp_TOP ((wimp_w) -1)
+#define wimp_NO_SUB_MENU ((wimp_menu *) -1)
+
+#define wimp_WINDOW_AUTO_REDRAW ((wimp_window_flags) 0x10u)
+#define wimp_WINDOW_NEW_FORMAT ((wimp_window_flags) 0x80000000u)
+
+#define wimp_COLOUR_WHITE ((wimp_colour) 0x0u)
+#define wimp_COLOUR_VERY_LIGHT_GREY ((wimp_colour) 0x1u)
+#define wimp_COLOUR_LIGHT_GREY ((wimp_colour) 0x2u)
+#define wimp_COLOUR_MID_LIGHT_GREY ((wimp_colour) 0x3u)
+#define wimp_COLOUR_DARK_GREY ((wimp_colour) 0x5u)
+#define wimp_COLOUR_BLACK ((wimp_colour) 0x7u)
+#define wimp_COLOUR_CREAM ((wimp_colour) 0xCu)
+#define wimp_COLOUR_ORANGE ((wimp_colour) 0xEu)
+
+#define wimp_ICON_TEXT ((wimp_icon_flags) 0x1u)
+#define wimp_ICON_BORDER ((wimp_icon_flags) 0x4u)
+#define wimp_ICON_HCENTRED ((wimp_icon_flags) 0x8u)
+#define wimp_ICON_VCENTRED ((wimp_icon_flags) 0x10u)
+#define wimp_ICON_FILLED ((wimp_icon_flags) 0x20u)
+#define wimp_ICON_INDIRECTED ((wimp_icon_flags) 0x100u)
+#define wimp_ICON_FG_COLOUR_SHIFT 24
+#define wimp_ICON_BG_COLOUR_SHIFT 28
+
+#define wimp_MENU_LAST ((wimp_menu_flags) 0x80u)
+#define wimp_MENU_TITLE_INDIRECTED ((wimp_menu_flags) 0x100u)
+#define wimp_MENU_ITEM_HEIGHT 44
+#define wimp_MENU_ITEM_GAP 0
+
+#define wimp_QUEUE_REDRAW ((wimp_poll_flags) 0x1000000u)
+#define wimp_MASK_LEAVING ((wimp_poll_flags) 0x10u)
+#define wimp_MASK_ENTERING ((wimp_poll_flags) 0x20u)
+#define wimp_MASK_LOSE ((wimp_poll_flags) 0x800u)
+#define wimp_MASK_GAIN ((wimp_poll_flags) 0x1000u)
+#define wimp_MASK_MESSAGE ((wimp_poll_flags) 0x20000u)
+#define wimp_MASK_RECORDED ((wimp_poll_flags) 0x40000u)
+#define wimp_MASK_ACKNOWLEDGE ((wimp_poll_flags) 0x80000u)
+
+os_error *xwimp_create_window(wimp_window const *window, wimp_w *w);
+os_error *xwimp_delete_window(wimp_w w);
+os_error *xwimp_get_window_state(wimp_window_state *state);
+os_error *xwimp_open_window(wimp_open *open);
+os_error *xwimp_set_icon_state(wimp_w w, wimp_i i, wimp_icon_flags eor_bits,
+		wimp_icon_flags clear_bits);
+os_error *xwimp_resize_icon(wimp_w w, wimp_i i, int x0, int y0, int x1,
+		int y1);
+os_error *xwimp_poll(wimp_poll_flags mask, wimp_block *block, int *pollword,
+		wimp_event_no *event);
+
+#endif
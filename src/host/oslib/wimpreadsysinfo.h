@@ -0,0 +1,16 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host subset of OSLib's oslib/wimpreadsysinfo.h, as used by RUfl. */
+
+#ifndef RUFL_HOST_OSLIB_WIMPREADSYSINFO_H
+#define RUFL_HOST_OSLIB_WIMPREADSYSINFO_H
+
+#include "oslib/wimp.h"
+
+os_error *xwimpreadsysinfo_task(wimp_t *task, int *version);
+
+#endif
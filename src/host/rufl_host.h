@@ -0,0 +1,86 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host backend: a stand-in for the RISC OS Font Manager and the other OSLib
+ * veneers used by RUfl, so that the library can be built, tested and
+ * profiled on other systems.
+ *
+ * Fonts are read from directories laid out like Font$Path, given as a
+ * comma-separated list in the environment variable RUFL_FONT_PATH (default
+ * "Fonts"). A directory containing a file named Metrics is a font, and its
+ * identifier is its path below the root with '.' as separator, so that
+ * <root>/Homerton/Medium/Metrics is the font Homerton.Medium.
+ *
+ * Metrics is a text file with one item per line, in units of 1/1000 em:
+ *
+ *   # comment
+ *   bbox <x0> <y0> <x1> <y1>
+ *   ascender <n>, descender <n>, xheight <n>, capheight <n>, italic <n>
+ *   underline <position> <thickness>
+ *   char <first>[-<last>] <advance> <x0> <y0> <x1> <y1>
+ *   outline <u> m <x> <y> | l <x> <y> | c <x1> <y1> <x2> <y2> <x> <y> | z ...
+ *
+ * Character codes are Unicode in hex. A char line with a range gives every
+ * character in it the same metrics. Characters without an outline line are
+ * drawn as an ellipse filling their bounding box.
+ *
+ * Paint calls are recorded, unless output is redirected to a buffer. The
+ * environment variable RUFL_HOST_LATENCY may give a latency model as
+ * "<call>,<character>,<load>" in nanoseconds (see struct rufl_host_latency).
+ * Files which would be in <Wimp$ScrapDir> are placed in RUFL_SCRAP_DIR,
+ * TMPDIR, or /tmp.
+ *
+ * Calls may be made by several threads at once. Fonts, handles and recorded
+ * paints are shared; the current font, output redirection, error block and
+ * call count belong to the calling thread, as if each thread were a task.
+ * rufl_host_set_font_path() and rufl_host_reset() must not be called while
+ * other threads use fonts.
+ */
+
+#ifndef RUFL_HOST_H
+#define RUFL_HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/** Simulated cost of Font Manager calls, spent busy-waiting. */
+struct rufl_host_latency {
+	/** Cost of every call / ns. */
+	unsigned int call;
+	/** Additional cost per character scanned or painted / ns. */
+	unsigned int character;
+	/** Additional cost of finding a font which is not already open / ns. */
+	unsigned int load;
+};
+
+/** A recorded Font_Paint. */
+struct rufl_host_paint {
+	/** Font identifier. */
+	const char *font;
+	/** Font size / 16ths of a point. */
+	unsigned int xsize, ysize;
+	/** Start of string / millipoints. */
+	int x, y;
+	/** Font_Paint flags. */
+	unsigned int flags;
+	/** Number of characters painted. */
+	size_t length;
+	/** Unicode values of characters painted. */
+	const unsigned int *chars;
+};
+
+
+void rufl_host_set_font_path(const char *path);
+void rufl_host_set_latency(const struct rufl_host_latency *latency);
+unsigned long rufl_host_call_count(void);
+size_t rufl_host_paint_count(void);
+bool rufl_host_paint_get(size_t i, struct rufl_host_paint *paint);
+void rufl_host_paint_clear(void);
+void rufl_host_reset(void);
+const char *rufl_host_scrap_file(const char *leaf);
+
+#endif
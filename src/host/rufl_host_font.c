@@ -0,0 +1,1838 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host stand-in for the Font Manager. See rufl_host.h. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "oslib/font.h"
+#include "oslib/osfscontrol.h"
+#include "rufl_host.h"
+
+
+/** Number of font handles (handle 0 is never used). */
+#define rufl_HOST_HANDLES 256
+
+/** Name of metrics file in a font directory. */
+#define rufl_HOST_METRICS "Metrics"
+
+/** Bounding box of a string with no glyphs. */
+#define rufl_HOST_NO_BBOX 0x20000000
+
+/** Characters with the same metrics. */
+struct rufl_host_range {
+	unsigned int first, last;
+	int advance;
+	int bbox[4];
+};
+
+/** An outline, as Draw path elements in rufl_host_face.outline_data. */
+struct rufl_host_outline {
+	unsigned int u;
+	size_t start, words;
+};
+
+/** A font found in the font path. */
+struct rufl_host_face {
+	char *identifier;
+	/** Directory containing the metrics file. */
+	char *path;
+	/** Position of root in font path, for ordering. */
+	unsigned int root;
+	/** Metrics file has been read. */
+	bool loaded;
+	/** Metrics file is being read by a thread, without rufl_host_lock. */
+	bool loading;
+	struct rufl_host_range *ranges;
+	size_t range_count;
+	struct rufl_host_outline *outlines;
+	size_t outline_count;
+	int *outline_data;
+	size_t outline_data_size;
+	bool misc_present;
+	font_metrics_misc_info misc;
+	/** Font bounding box, from bbox or the union of characters. */
+	int bbox[4];
+};
+
+/** An open font handle. */
+struct rufl_host_handle {
+	/** Number of Font_FindFont calls not yet lost, or 0 if free. */
+	unsigned int usage;
+	unsigned int face;
+	int xsize, ysize;
+	/** Encoding is UTF-8 rather than the 8-bit base encoding. */
+	bool utf8;
+};
+
+/** A recorded paint, with characters in rufl_host_paint_chars. */
+struct rufl_host_paint_record {
+	unsigned int face;
+	unsigned int xsize, ysize;
+	int x, y;
+	unsigned int flags;
+	size_t start, length;
+};
+
+/** Kind of item in a string. */
+typedef enum {
+	rufl_HOST_END, rufl_HOST_CHAR, rufl_HOST_MOVE, rufl_HOST_FONT
+} rufl_host_item;
+
+
+/** Protects the faces, handles and recorded paints, which are shared by all
+ * threads. Face data does not change once loaded, so may be read without
+ * it while a handle to the face is held. */
+static pthread_mutex_t rufl_host_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Signalled when a thread finishes reading a metrics file. */
+static pthread_cond_t rufl_host_loaded = PTHREAD_COND_INITIALIZER;
+static pthread_once_t rufl_host_initialised = PTHREAD_ONCE_INIT;
+static char *rufl_host_font_path = 0;
+static struct rufl_host_latency rufl_host_latency_model = { 0, 0, 0 };
+static struct rufl_host_face *rufl_host_faces = 0;
+static size_t rufl_host_face_count = 0;
+static bool rufl_host_faces_scanned = false;
+static struct rufl_host_handle rufl_host_handles[rufl_HOST_HANDLES];
+/* Each thread has its own current font, output and error block, as if it
+ * were a separate task. */
+static __thread font_f rufl_host_current_font = 0;
+/** Output redirected by Font_SwitchOutputToBuffer. */
+static __thread bool rufl_host_redirected = false;
+static __thread bool rufl_host_count_only = false;
+static __thread uintptr_t rufl_host_output, rufl_host_output_limit;
+static struct rufl_host_paint_record *rufl_host_paints = 0;
+static size_t rufl_host_paints_used = 0, rufl_host_paints_size = 0;
+static unsigned int *rufl_host_paint_chars = 0;
+static size_t rufl_host_paint_chars_used = 0, rufl_host_paint_chars_size = 0;
+static __thread os_error rufl_host_error_block;
+static __thread unsigned long rufl_host_calls = 0;
+
+
+static void rufl_host_init(void);
+static void rufl_host_init_once(void);
+static os_error *rufl_host_open(char const *font_name, int xsize, int ysize,
+		font_f *font, bool *opened);
+static void rufl_host_swi(unsigned long characters);
+static void rufl_host_delay(unsigned long ns);
+static os_error *rufl_host_error(int errnum, const char *format, ...);
+static void rufl_host_scan_faces(void);
+static void rufl_host_scan_dir(const char *root, unsigned int index,
+		const char *relative);
+static int rufl_host_face_cmp(const void *a, const void *b);
+static struct rufl_host_face *rufl_host_face_find(const char *identifier,
+		size_t length, unsigned int *index);
+static os_error *rufl_host_face_load(struct rufl_host_face *face);
+static bool rufl_host_parse_ints(const char **p, int *v, unsigned int n);
+static bool rufl_host_parse_outline(struct rufl_host_face *face,
+		const char *p);
+static int rufl_host_range_cmp(const void *a, const void *b);
+static int rufl_host_outline_cmp(const void *a, const void *b);
+static const struct rufl_host_range *rufl_host_glyph(
+		const struct rufl_host_face *face, unsigned int u);
+static const int *rufl_host_glyph_outline(const struct rufl_host_face *face,
+		const struct rufl_host_range *glyph, unsigned int u,
+		size_t *words);
+static os_error *rufl_host_handle_get(font_f font,
+		struct rufl_host_handle *handle);
+static rufl_host_item rufl_host_read(const char **s, const char *end,
+		font_string_flags flags, bool utf8, unsigned int *u,
+		int *dx, int *dy);
+static os_error *rufl_host_draw_glyph(const struct rufl_host_handle *h,
+		const struct rufl_host_range *glyph, unsigned int u,
+		int x, int y, const os_trfm *trfm);
+static void rufl_host_record(const struct rufl_host_handle *h, int x, int y,
+		font_string_flags flags, const unsigned int *chars,
+		size_t length);
+static int rufl_host_scale(int v, int size);
+
+
+/**
+ * Set the font path, replacing RUFL_FONT_PATH, and forget all fonts.
+ *
+ * \param  path  comma-separated list of directories, or 0 to use the
+ *               environment again
+ */
+
+void rufl_host_set_font_path(const char *path)
+{
+	rufl_host_reset();
+	free(rufl_host_font_path);
+	rufl_host_font_path = path ? strdup(path) : 0;
+}
+
+
+/**
+ * Set the latency model, replacing RUFL_HOST_LATENCY.
+ *
+ * \param  latency  latency model, or 0 for none
+ */
+
+void rufl_host_set_latency(const struct rufl_host_latency *latency)
+{
+	static const struct rufl_host_latency none = { 0, 0, 0 };
+
+	rufl_host_init();
+	rufl_host_latency_model = latency ? *latency : none;
+}
+
+
+/**
+ * Return the number of Font Manager calls made so far by the calling thread.
+ */
+
+unsigned long rufl_host_call_count(void)
+{
+	return rufl_host_calls;
+}
+
+
+/**
+ * Return the number of recorded paints.
+ */
+
+size_t rufl_host_paint_count(void)
+{
+	size_t count;
+
+	pthread_mutex_lock(&rufl_host_lock);
+	count = rufl_host_paints_used;
+	pthread_mutex_unlock(&rufl_host_lock);
+
+	return count;
+}
+
+
+/**
+ * Read a recorded paint.
+ *
+ * \param  i      index of paint, in order of painting
+ * \param  paint  updated with paint, valid until the next paint or clear
+ * \return  true, or false if there is no such paint
+ */
+
+bool rufl_host_paint_get(size_t i, struct rufl_host_paint *paint)
+{
+	const struct rufl_host_paint_record *record;
+
+	pthread_mutex_lock(&rufl_host_lock);
+	if (rufl_host_paints_used <= i) {
+		pthread_mutex_unlock(&rufl_host_lock);
+		return false;
+	}
+
+	record = &rufl_host_paints[i];
+	paint->font = rufl_host_faces[record->face].identifier;
+	paint->xsize = record->xsize;
+	paint->ysize = record->ysize;
+	paint->x = record->x;
+	paint->y = record->y;
+	paint->flags = record->flags;
+	paint->length = record->length;
+	paint->chars = rufl_host_paint_chars + record->start;
+	pthread_mutex_unlock(&rufl_host_lock);
+
+	return true;
+}
+
+
+/**
+ * Discard all recorded paints.
+ */
+
+void rufl_host_paint_clear(void)
+{
+	pthread_mutex_lock(&rufl_host_lock);
+	rufl_host_paints_used = 0;
+	rufl_host_paint_chars_used = 0;
+	pthread_mutex_unlock(&rufl_host_lock);
+}
+
+
+/**
+ * Close all fonts, forget the fonts found, and free all memory.
+ *
+ * The font path is read again when next needed. No fonts may be in use by
+ * other threads. The current font and output of other threads are not
+ * reset.
+ */
+
+void rufl_host_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i != rufl_host_face_count; i++) {
+		free(rufl_host_faces[i].identifier);
+		free(rufl_host_faces[i].path);
+		free(rufl_host_faces[i].ranges);
+		free(rufl_host_faces[i].outlines);
+		free(rufl_host_faces[i].outline_data);
+	}
+	free(rufl_host_faces);
+	rufl_host_faces = 0;
+	rufl_host_face_count = 0;
+	rufl_host_faces_scanned = false;
+
+	memset(rufl_host_handles, 0, sizeof rufl_host_handles);
+	rufl_host_current_font = 0;
+	rufl_host_redirected = false;
+
+	free(rufl_host_paints);
+	rufl_host_paints = 0;
+	rufl_host_paints_used = rufl_host_paints_size = 0;
+	free(rufl_host_paint_chars);
+	rufl_host_paint_chars = 0;
+	rufl_host_paint_chars_used = rufl_host_paint_chars_size = 0;
+}
+
+
+os_error *xfont_cache_addr(int *version, int *cache_size, int *cache_used)
+{
+	rufl_host_swi(0);
+
+	/* 3.43, which supports background blending */
+	if (version)
+		*version = 343;
+	if (cache_size)
+		*cache_size = 0;
+	if (cache_used)
+		*cache_used = 0;
+
+	return 0;
+}
+
+
+os_error *xfont_find_font(char const *font_name, int xsize, int ysize,
+		int xres, int yres, font_f *font, int *xres_out,
+		int *yres_out)
+{
+	bool opened = false;
+	os_error *error;
+
+	(void) xres;
+	(void) yres;
+
+	rufl_host_swi(0);
+
+	pthread_mutex_lock(&rufl_host_lock);
+	error = rufl_host_open(font_name, xsize, ysize, font, &opened);
+	pthread_mutex_unlock(&rufl_host_lock);
+	if (error)
+		return error;
+	if (opened)
+		rufl_host_delay(rufl_host_latency_model.load);
+
+	if (xres_out)
+		*xres_out = 90;
+	if (yres_out)
+		*yres_out = 90;
+
+	return 0;
+}
+
+
+/**
+ * Open a font for Font_FindFont, with rufl_host_lock held. The lock is
+ * released while the metrics file is read, so that threads may load
+ * different faces at once.
+ *
+ * \param  opened  set to true if a new handle was opened
+ */
+
+os_error *rufl_host_open(char const *font_name, int xsize, int ysize,
+		font_f *font, bool *opened)
+{
+	struct rufl_host_face *face;
+	struct rufl_host_handle *h;
+	const char *identifier = font_name, *encoding = 0, *p;
+	size_t identifier_length, encoding_length = 0;
+	unsigned int index, i, free_handle = 0;
+	bool utf8 = false;
+	os_error *error;
+
+	/* name is <identifier>[\E<encoding>], or made of \F<identifier> and
+	 * \E<encoding> */
+	identifier_length = strcspn(font_name, "\\");
+	for (p = font_name + identifier_length; *p == '\\'; ) {
+		size_t n = strcspn(p + 1, "\\");
+		if (p[1] == 'F') {
+			identifier = p + 2;
+			identifier_length = n - 1;
+		} else if (p[1] == 'E') {
+			encoding = p + 2;
+			encoding_length = n - 1;
+		}
+		p += n + 1;
+	}
+
+	if (encoding) {
+		if (encoding_length == 4 &&
+				strncasecmp(encoding, "UTF8", 4) == 0)
+			utf8 = true;
+		else if (!(encoding_length == 6 &&
+				strncasecmp(encoding, "Latin1", 6) == 0))
+			return rufl_host_error(error_FONT_ENCODING_NOT_FOUND,
+					"Encoding '%.*s' not found",
+					(int) encoding_length, encoding);
+	}
+
+	face = rufl_host_face_find(identifier, identifier_length, &index);
+	if (!face)
+		return rufl_host_error(error_FONT_NOT_FOUND,
+				"Font '%.*s' not found",
+				(int) identifier_length, identifier);
+
+	while (!face->loaded) {
+		if (face->loading) {
+			pthread_cond_wait(&rufl_host_loaded, &rufl_host_lock);
+			continue;
+		}
+		face->loading = true;
+		pthread_mutex_unlock(&rufl_host_lock);
+		error = rufl_host_face_load(face);
+		pthread_mutex_lock(&rufl_host_lock);
+		face->loading = false;
+		face->loaded = !error;
+		pthread_cond_broadcast(&rufl_host_loaded);
+		if (error)
+			return error;
+	}
+
+	/* an identical font which is already open shares its handle */
+	for (i = 1; i != rufl_HOST_HANDLES; i++) {
+		h = &rufl_host_handles[i];
+		if (h->usage == 0) {
+			if (!free_handle)
+				free_handle = i;
+			continue;
+		}
+		if (h->face == index && h->xsize == xsize &&
+				h->ysize == ysize && h->utf8 == utf8)
+			break;
+	}
+
+	if (i == rufl_HOST_HANDLES) {
+		if (!free_handle)
+			return rufl_host_error(0x216, "Too many fonts");
+		*opened = true;
+		i = free_handle;
+		h = &rufl_host_handles[i];
+		h->face = index;
+		h->xsize = xsize;
+		h->ysize = ysize;
+		h->utf8 = utf8;
+	}
+
+	h->usage++;
+	*font = i;
+
+	return 0;
+}
+
+
+os_error *xfont_lose_font(font_f font)
+{
+	rufl_host_swi(0);
+
+	pthread_mutex_lock(&rufl_host_lock);
+	if (font == 0 || rufl_host_handles[font].usage == 0) {
+		pthread_mutex_unlock(&rufl_host_lock);
+		return rufl_host_error(0x200, "Undefined font handle");
+	}
+	rufl_host_handles[font].usage--;
+	pthread_mutex_unlock(&rufl_host_lock);
+
+	return 0;
+}
+
+
+os_error *xfont_read_info(font_f font, int *x0, int *y0, int *x1, int *y1)
+{
+	const struct rufl_host_face *face;
+	struct rufl_host_handle h;
+	os_error *error;
+
+	rufl_host_swi(0);
+
+	error = rufl_host_handle_get(font, &h);
+	if (error)
+		return error;
+	face = &rufl_host_faces[h.face];
+
+	/* OS units, rounded outwards */
+	*x0 = -((-rufl_host_scale(face->bbox[0], h.xsize) + 399) / 400);
+	*y0 = -((-rufl_host_scale(face->bbox[1], h.ysize) + 399) / 400);
+	*x1 = (rufl_host_scale(face->bbox[2], h.xsize) + 399) / 400;
+	*y1 = (rufl_host_scale(face->bbox[3], h.ysize) + 399) / 400;
+
+	return 0;
+}
+
+
+os_error *xfont_set_font(font_f font)
+{
+	struct rufl_host_handle h;
+	os_error *error;
+
+	rufl_host_swi(0);
+
+	error = rufl_host_handle_get(font, &h);
+	if (error)
+		return error;
+	rufl_host_current_font = font;
+
+	return 0;
+}
+
+
+os_error *xfont_paint(font_f font, char const *string,
+		font_string_flags flags, int xpos, int ypos,
+		font_paint_block const *block, os_trfm const *trfm,
+		int length)
+{
+	struct rufl_host_handle h, h0;
+	const struct rufl_host_range *glyph;
+	const char *s = string;
+	const char *end = (flags & font_GIVEN_LENGTH) ? string + length : 0;
+	unsigned int *chars = 0, *chars2;
+	size_t n = 0, size = 0, count = 0;
+	unsigned int u;
+	int x, y, dx, dy;
+	rufl_host_item item;
+	os_error *error;
+
+	(void) block;
+
+	error = rufl_host_handle_get((flags & font_GIVEN_FONT) ? font :
+			rufl_host_current_font, &h);
+	if (error) {
+		rufl_host_swi(0);
+		return error;
+	}
+	h0 = h;
+
+	/* millipoints */
+	if (flags & font_OS_UNITS) {
+		xpos *= 400;
+		ypos *= 400;
+	}
+	x = xpos;
+	y = ypos;
+	if (!(flags & font_GIVEN_TRFM))
+		trfm = 0;
+
+	while ((item = rufl_host_read(&s, end, flags, h.utf8, &u,
+			&dx, &dy)) != rufl_HOST_END) {
+		if (item == rufl_HOST_MOVE) {
+			x += dx;
+			y += dy;
+			continue;
+		} else if (item == rufl_HOST_FONT) {
+			error = rufl_host_handle_get(u, &h);
+			if (error)
+				break;
+			continue;
+		}
+
+		glyph = rufl_host_glyph(&rufl_host_faces[h.face], u);
+		if (!glyph)
+			continue;
+		count++;
+
+		if (rufl_host_redirected) {
+			error = rufl_host_draw_glyph(&h, glyph, u, x, y, trfm);
+			if (error)
+				break;
+		} else {
+			if (n == size) {
+				size = size ? size * 2 : 64;
+				chars2 = realloc(chars, size * sizeof *chars);
+				if (!chars2) {
+					error = rufl_host_error(0x101,
+							"Not enough memory");
+					break;
+				}
+				chars = chars2;
+			}
+			chars[n++] = u;
+		}
+
+		dx = rufl_host_scale(glyph->advance, h.xsize);
+		if (trfm) {
+			y += (int) (((long long) trfm->entries[0][1] * dx) >>
+					16);
+			dx = (int) (((long long) trfm->entries[0][0] * dx) >>
+					16);
+		}
+		x += dx;
+	}
+
+	rufl_host_swi(count);
+
+	if (!error && !rufl_host_redirected)
+		rufl_host_record(&h0, xpos, ypos, flags, chars, n);
+	free(chars);
+
+	return error;
+}
+
+
+os_error *xfont_scan_string(font_f font, char const *s,
+		font_string_flags flags, int x, int y,
+		font_scan_block *block, os_trfm const *trfm, int length,
+		char **split_point, int *x_out, int *y_out, int *length_out)
+{
+	struct rufl_host_handle h;
+	const struct rufl_host_range *glyph;
+	const char *p = s, *item_start = s;
+	const char *end = (flags & font_GIVEN_LENGTH) ? s + length : 0;
+	const char *split = 0;
+	unsigned int u, chars = 0;
+	int split_char = -1;
+	int cx = 0, cy = 0, split_x = 0, limit, advance, dx, dy;
+	int bbox[4] = { rufl_HOST_NO_BBOX, rufl_HOST_NO_BBOX,
+			-rufl_HOST_NO_BBOX, -rufl_HOST_NO_BBOX };
+	rufl_host_item item;
+	os_error *error;
+
+	(void) y;
+	(void) trfm;
+
+	error = rufl_host_handle_get((flags & font_GIVEN_FONT) ? font :
+			rufl_host_current_font, &h);
+	if (error) {
+		rufl_host_swi(0);
+		return error;
+	}
+
+	if ((flags & font_GIVEN_BLOCK) && block)
+		split_char = block->split_char;
+
+	/* millipoints */
+	limit = x;
+	if ((flags & font_OS_UNITS) && limit < 0x7fffffff / 400)
+		limit *= 400;
+
+	while ((item = rufl_host_read(&p, end, flags, h.utf8, &u,
+			&dx, &dy)) != rufl_HOST_END) {
+		if (item == rufl_HOST_MOVE) {
+			cx += dx;
+			cy += dy;
+			item_start = p;
+			continue;
+		} else if (item == rufl_HOST_FONT) {
+			error = rufl_host_handle_get(u, &h);
+			if (error)
+				break;
+			item_start = p;
+			continue;
+		}
+
+		chars++;
+		glyph = rufl_host_glyph(&rufl_host_faces[h.face], u);
+		advance = glyph ? rufl_host_scale(glyph->advance, h.xsize) :
+				0;
+		if ((flags & font_GIVEN_BLOCK) && block)
+			advance += (u == ' ') ? block->space.x :
+					block->letter.x;
+
+		if (limit < cx + advance) {
+			/* too wide: stop here, at the nearest caret position,
+			 * or at the last split character */
+			if ((flags & font_RETURN_CARET_POS) &&
+					cx + advance - limit < limit - cx) {
+				cx += advance;
+				item_start = p;
+			} else if (split_char != -1 && split) {
+				cx = split_x;
+				item_start = split;
+			}
+			break;
+		}
+
+		if (split_char != -1 && u == (unsigned int) split_char) {
+			split = item_start;
+			split_x = cx;
+		}
+
+		if (glyph && (glyph->bbox[0] != glyph->bbox[2] ||
+				glyph->bbox[1] != glyph->bbox[3])) {
+			int x0 = cx + rufl_host_scale(glyph->bbox[0],
+					h.xsize);
+			int y0 = cy + rufl_host_scale(glyph->bbox[1],
+					h.ysize);
+			int x1 = cx + rufl_host_scale(glyph->bbox[2],
+					h.xsize);
+			int y1 = cy + rufl_host_scale(glyph->bbox[3],
+					h.ysize);
+			if (x0 < bbox[0]) bbox[0] = x0;
+			if (y0 < bbox[1]) bbox[1] = y0;
+			if (bbox[2] < x1) bbox[2] = x1;
+			if (bbox[3] < y1) bbox[3] = y1;
+		} else if (glyph && bbox[0] == rufl_HOST_NO_BBOX) {
+			/* a glyph without ink has an empty box at its
+			 * origin */
+			bbox[0] = bbox[2] = cx;
+			bbox[1] = bbox[3] = cy;
+		}
+
+		cx += advance;
+		item_start = p;
+	}
+
+	rufl_host_swi(chars);
+	if (error)
+		return error;
+
+	if (flags & font_OS_UNITS) {
+		cx /= 400;
+		cy /= 400;
+		if (bbox[0] != rufl_HOST_NO_BBOX) {
+			bbox[0] /= 400;
+			bbox[1] /= 400;
+			bbox[2] /= 400;
+			bbox[3] /= 400;
+		}
+	}
+
+	if ((flags & font_RETURN_BBOX) && (flags & font_GIVEN_BLOCK) &&
+			block) {
+		block->bbox.x0 = bbox[0];
+		block->bbox.y0 = bbox[1];
+		block->bbox.x1 = bbox[2];
+		block->bbox.y1 = bbox[3];
+	}
+	if (split_point)
+		*split_point = (char *) item_start;
+	if (x_out)
+		*x_out = cx;
+	if (y_out)
+		*y_out = cy;
+	if (length_out)
+		*length_out = item_start - s;
+
+	return 0;
+}
+
+
+os_error *xfont_list_fonts(byte *buffer1, font_list_context context,
+		int size1, byte *buffer2, int size2, char const *tick_font,
+		font_list_context *context_out, int *used1, int *used2)
+{
+	unsigned int i = context & 0xffff;
+	const char *identifier;
+
+	(void) tick_font;
+
+	rufl_host_swi(0);
+	pthread_mutex_lock(&rufl_host_lock);
+	rufl_host_scan_faces();
+	pthread_mutex_unlock(&rufl_host_lock);
+
+	/* there is only one encoding per font, so listing encodings (bit 22)
+	 * is not supported */
+	if ((context & 0x400000) || rufl_host_face_count <= i) {
+		*context_out = -1;
+		return 0;
+	}
+
+	/* the local name is the identifier */
+	identifier = rufl_host_faces[i].identifier;
+	if ((context & font_RETURN_FONT_NAME) && buffer1 && 0 < size1)
+		snprintf((char *) buffer1, size1, "%s", identifier);
+	if ((context & font_RETURN_LOCAL_FONT_NAME) && buffer2 && 0 < size2)
+		snprintf((char *) buffer2, size2, "%s", identifier);
+	if (used1)
+		*used1 = strlen(identifier) + 1;
+	if (used2)
+		*used2 = strlen(identifier) + 1;
+
+	*context_out = i + 1;
+
+	return 0;
+}
+
+
+os_error *xfont_switch_output_to_buffer(font_output_flags flags,
+		byte *buffer, char **end)
+{
+	int size;
+
+	rufl_host_swi(0);
+
+	if (end)
+		*end = rufl_host_redirected ?
+				(char *) rufl_host_output : 0;
+
+	if (!buffer) {
+		rufl_host_redirected = false;
+		return 0;
+	}
+
+	/* the buffer starts with 0 and its size less 8 bytes; without
+	 * font_NO_OUTPUT, objects are written from the start */
+	rufl_host_redirected = true;
+	rufl_host_count_only = (flags & font_NO_OUTPUT) != 0;
+	rufl_host_output = (uintptr_t) buffer;
+	rufl_host_output_limit = UINTPTR_MAX;
+	if (!rufl_host_count_only) {
+		memcpy(&size, buffer + 4, sizeof size);
+		rufl_host_output_limit = (uintptr_t) buffer + 8 + size;
+	}
+
+	return 0;
+}
+
+
+os_error *xfont_read_font_metrics(font_f font, font_bbox_info *bbox_info,
+		font_width_info *xwidth_info, font_width_info *ywidth_info,
+		font_metrics_misc_info *misc_info, font_kern_info *kern_info,
+		font_metrics_flags *flags_out, int *bbox_info_size,
+		int *xwidth_info_size, int *ywidth_info_size,
+		int *misc_info_size, int *kern_info_size)
+{
+	const struct rufl_host_face *face;
+	const font_metrics_misc_info *misc;
+	struct rufl_host_handle h;
+	os_error *error;
+
+	(void) bbox_info;
+	(void) xwidth_info;
+	(void) ywidth_info;
+	(void) kern_info;
+
+	rufl_host_swi(0);
+
+	error = rufl_host_handle_get(font, &h);
+	if (error)
+		return error;
+	face = &rufl_host_faces[h.face];
+	misc = &face->misc;
+
+	/* only the miscellaneous information is available, in millipoints
+	 * at the size of the font */
+	if (misc_info && face->misc_present) {
+		misc_info->x0 = rufl_host_scale(misc->x0, h.xsize);
+		misc_info->y0 = rufl_host_scale(misc->y0, h.ysize);
+		misc_info->x1 = rufl_host_scale(misc->x1, h.xsize);
+		misc_info->y1 = rufl_host_scale(misc->y1, h.ysize);
+		misc_info->xkern = 0;
+		misc_info->ykern = 0;
+		misc_info->italic_correction = rufl_host_scale(
+				misc->italic_correction, h.xsize);
+		misc_info->underline_position = misc->underline_position;
+		misc_info->underline_thickness = misc->underline_thickness;
+		misc_info->cap_height = rufl_host_scale(misc->cap_height,
+				h.ysize);
+		misc_info->xheight = rufl_host_scale(misc->xheight, h.ysize);
+		misc_info->descender = rufl_host_scale(misc->descender,
+				h.ysize);
+		misc_info->ascender = rufl_host_scale(misc->ascender,
+				h.ysize);
+		misc_info->reserved = 0;
+	}
+
+	if (flags_out)
+		*flags_out = 0;
+	if (bbox_info_size)
+		*bbox_info_size = 0;
+	if (xwidth_info_size)
+		*xwidth_info_size = 0;
+	if (ywidth_info_size)
+		*ywidth_info_size = 0;
+	if (misc_info_size)
+		*misc_info_size = face->misc_present ? sizeof *misc : 0;
+	if (kern_info_size)
+		*kern_info_size = 0;
+
+	return 0;
+}
+
+
+os_error *xfont_read_encoding_filename(font_f font, char *buffer, int size,
+		char **end)
+{
+	(void) font;
+	(void) buffer;
+	(void) size;
+	(void) end;
+
+	rufl_host_swi(0);
+
+	return rufl_host_error(error_FONT_ENCODING_NOT_FOUND,
+			"Encoding files are not supported");
+}
+
+
+os_error *xfont_enumerate_characters(font_f font, int character,
+		int *next_character, int *internal_character_code)
+{
+	const struct rufl_host_face *face;
+	struct rufl_host_handle h;
+	unsigned int u = character;
+	size_t lo = 0, hi, mid;
+	os_error *error;
+
+	rufl_host_swi(0);
+
+	error = rufl_host_handle_get(font, &h);
+	if (error)
+		return error;
+	face = &rufl_host_faces[h.face];
+
+	/* first range ending after u */
+	hi = face->range_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (face->ranges[mid].last <= u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (next_character) {
+		if (lo == face->range_count)
+			*next_character = -1;
+		else if (face->ranges[lo].first <= u)
+			*next_character = u + 1;
+		else
+			*next_character = face->ranges[lo].first;
+	}
+	if (internal_character_code)
+		*internal_character_code = rufl_host_glyph(face, u) ?
+				(int) u : -1;
+
+	return 0;
+}
+
+
+os_error *xosfscontrol_canonicalise_path(char const *path_name,
+		char *buffer, char const *var, char const *path, int size,
+		int *spare)
+{
+	const struct rufl_host_face *face;
+	const char *result = path_name;
+	int length;
+
+	(void) path;
+
+	rufl_host_swi(0);
+
+	if (var && strcmp(var, "Font$Path") == 0) {
+		pthread_mutex_lock(&rufl_host_lock);
+		face = rufl_host_face_find(path_name, strlen(path_name), 0);
+		pthread_mutex_unlock(&rufl_host_lock);
+		if (face)
+			result = face->path;
+	}
+
+	/* spare is the buffer size less the space needed, including the
+	 * terminator, plus 1 */
+	length = strlen(result);
+	if (buffer && length < size)
+		memcpy(buffer, result, length + 1);
+	if (spare)
+		*spare = size - length;
+
+	return 0;
+}
+
+
+/**
+ * Read the configuration from the environment, if not yet done.
+ */
+
+void rufl_host_init(void)
+{
+	pthread_once(&rufl_host_initialised, rufl_host_init_once);
+}
+
+
+/**
+ * Read the configuration from the environment.
+ */
+
+void rufl_host_init_once(void)
+{
+	const char *latency;
+
+	latency = getenv("RUFL_HOST_LATENCY");
+	if (latency)
+		sscanf(latency, "%u,%u,%u", &rufl_host_latency_model.call,
+				&rufl_host_latency_model.character,
+				&rufl_host_latency_model.load);
+}
+
+
+/**
+ * Account for a Font Manager call.
+ *
+ * \param  characters  number of characters processed by the call
+ */
+
+void rufl_host_swi(unsigned long characters)
+{
+	rufl_host_init();
+	rufl_host_calls++;
+	rufl_host_delay(rufl_host_latency_model.call +
+			characters * rufl_host_latency_model.character);
+}
+
+
+/**
+ * Busy-wait, as a SWI would occupy the processor.
+ */
+
+void rufl_host_delay(unsigned long ns)
+{
+	struct timespec t0, t;
+
+	if (ns == 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do
+		clock_gettime(CLOCK_MONOTONIC, &t);
+	while ((unsigned long) ((t.tv_sec - t0.tv_sec) * 1000000000L +
+			(t.tv_nsec - t0.tv_nsec)) < ns);
+}
+
+
+/**
+ * Fill in the error block.
+ */
+
+os_error *rufl_host_error(int errnum, const char *format, ...)
+{
+	va_list ap;
+
+	rufl_host_error_block.errnum = errnum;
+	va_start(ap, format);
+	vsnprintf(rufl_host_error_block.errmess,
+			sizeof rufl_host_error_block.errmess, format, ap);
+	va_end(ap);
+
+	return &rufl_host_error_block;
+}
+
+
+/**
+ * Find the fonts in the font path, if not yet done.
+ *
+ * Fonts are sorted by identifier. If fonts in different roots have the same
+ * identifier, the first root in the path is used.
+ *
+ * Called with rufl_host_lock held.
+ */
+
+void rufl_host_scan_faces(void)
+{
+	const char *path, *p;
+	char *root;
+	size_t n, i, j;
+	unsigned int index = 0;
+
+	rufl_host_init();
+	if (rufl_host_faces_scanned)
+		return;
+	rufl_host_faces_scanned = true;
+
+	path = rufl_host_font_path;
+	if (!path)
+		path = getenv("RUFL_FONT_PATH");
+	if (!path)
+		path = "Fonts";
+
+	for (p = path; *p; p += n + (p[n] == ',')) {
+		n = strcspn(p, ",");
+		if (n == 0)
+			continue;
+		root = malloc(n + 1);
+		if (!root)
+			break;
+		memcpy(root, p, n);
+		while (1 < n && root[n - 1] == '/')
+			n--;
+		root[n] = 0;
+		rufl_host_scan_dir(root, index++, "");
+		free(root);
+	}
+
+	if (rufl_host_face_count == 0)
+		return;
+
+	qsort(rufl_host_faces, rufl_host_face_count, sizeof *rufl_host_faces,
+			rufl_host_face_cmp);
+
+	/* drop duplicates from later roots */
+	for (i = 1, j = 1; i != rufl_host_face_count; i++) {
+		if (strcasecmp(rufl_host_faces[i].identifier,
+				rufl_host_faces[j - 1].identifier) == 0) {
+			free(rufl_host_faces[i].identifier);
+			free(rufl_host_faces[i].path);
+			continue;
+		}
+		rufl_host_faces[j++] = rufl_host_faces[i];
+	}
+	rufl_host_face_count = j;
+}
+
+
+/**
+ * Add the fonts in a directory and its subdirectories.
+ *
+ * \param  root      root directory
+ * \param  index     position of root in font path
+ * \param  relative  directory relative to root, with trailing '/', or ""
+ */
+
+void rufl_host_scan_dir(const char *root, unsigned int index,
+		const char *relative)
+{
+	struct rufl_host_face *faces;
+	struct dirent *entry;
+	struct stat st;
+	size_t n, i;
+	char *dir, *file, *identifier;
+	DIR *d;
+
+	n = strlen(root) + 1 + strlen(relative) + 1;
+	dir = malloc(n);
+	if (!dir)
+		return;
+	snprintf(dir, n, "%s/%s", root, relative);
+
+	d = opendir(dir);
+	if (!d) {
+		free(dir);
+		return;
+	}
+
+	while ((entry = readdir(d))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		n = strlen(dir) + strlen(entry->d_name) + 2;
+		file = malloc(n);
+		if (!file)
+			break;
+		snprintf(file, n, "%s%s", dir, entry->d_name);
+		if (stat(file, &st)) {
+			free(file);
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			snprintf(file, n, "%s%s/", relative, entry->d_name);
+			rufl_host_scan_dir(root, index, file);
+		} else if (S_ISREG(st.st_mode) && relative[0] &&
+				strcmp(entry->d_name,
+						rufl_HOST_METRICS) == 0) {
+			faces = realloc(rufl_host_faces,
+					(rufl_host_face_count + 1) *
+					sizeof *rufl_host_faces);
+			identifier = strdup(relative);
+			if (!faces || !identifier) {
+				if (faces)
+					rufl_host_faces = faces;
+				free(identifier);
+				free(file);
+				break;
+			}
+			rufl_host_faces = faces;
+
+			/* Homerton/Medium/ => Homerton.Medium */
+			n = strlen(identifier) - 1;
+			identifier[n] = 0;
+			for (i = 0; i != n; i++)
+				if (identifier[i] == '/')
+					identifier[i] = '.';
+
+			/* directory, without trailing '/' */
+			file[strlen(dir) - 1] = 0;
+
+			memset(&rufl_host_faces[rufl_host_face_count], 0,
+					sizeof *rufl_host_faces);
+			rufl_host_faces[rufl_host_face_count].identifier =
+					identifier;
+			rufl_host_faces[rufl_host_face_count].path = file;
+			rufl_host_faces[rufl_host_face_count].root = index;
+			rufl_host_face_count++;
+			continue;
+		}
+		free(file);
+	}
+
+	closedir(d);
+	free(dir);
+}
+
+
+int rufl_host_face_cmp(const void *a, const void *b)
+{
+	const struct rufl_host_face *fa = a, *fb = b;
+	int c = strcasecmp(fa->identifier, fb->identifier);
+
+	if (c)
+		return c;
+	return (fa->root > fb->root) - (fa->root < fb->root);
+}
+
+
+/**
+ * Find a font by identifier.
+ *
+ * \param  identifier  font identifier (need not be terminated)
+ * \param  length      length of identifier
+ * \param  index       updated to index in rufl_host_faces, if not 0
+ * \return  font, or 0 if not found
+ */
+
+struct rufl_host_face *rufl_host_face_find(const char *identifier,
+		size_t length, unsigned int *index)
+{
+	size_t lo = 0, hi, mid;
+	int c;
+
+	rufl_host_scan_faces();
+
+	hi = rufl_host_face_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		c = strncasecmp(identifier, rufl_host_faces[mid].identifier,
+				length);
+		if (c == 0 && rufl_host_faces[mid].identifier[length])
+			c = -1;
+		if (c == 0) {
+			if (index)
+				*index = mid;
+			return &rufl_host_faces[mid];
+		}
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Read the metrics file of a font. The caller marks the face as loaded.
+ */
+
+os_error *rufl_host_face_load(struct rufl_host_face *face)
+{
+	struct rufl_host_range *ranges, *r;
+	char *name, *line = 0, *end;
+	const char *p;
+	size_t line_size = 0, n, i;
+	unsigned int line_number = 0;
+	bool bbox = false;
+	int v[5];
+	FILE *fp;
+
+	n = strlen(face->path) + sizeof "/" rufl_HOST_METRICS;
+	name = malloc(n);
+	if (!name)
+		return rufl_host_error(0x101, "Not enough memory");
+	snprintf(name, n, "%s/%s", face->path, rufl_HOST_METRICS);
+	fp = fopen(name, "r");
+	free(name);
+	if (!fp)
+		return rufl_host_error(error_FONT_BAD_FONT_FILE,
+				"Font '%s' unreadable: %s", face->identifier,
+				strerror(errno));
+
+	while (getline(&line, &line_size, fp) != -1) {
+		line_number++;
+		p = line + strspn(line, " \t");
+		n = strcspn(p, " \t\r\n");
+		if (n == 0 || p[0] == '#')
+			continue;
+
+		if (n == 4 && strncmp(p, "bbox", n) == 0) {
+			p += n;
+			if (!rufl_host_parse_ints(&p, face->bbox, 4))
+				break;
+			bbox = true;
+		} else if (n == 4 && strncmp(p, "char", n) == 0) {
+			ranges = realloc(face->ranges,
+					(face->range_count + 1) *
+					sizeof *face->ranges);
+			if (!ranges)
+				break;
+			face->ranges = ranges;
+			r = &ranges[face->range_count];
+			r->first = r->last = strtoul(p + n, &end, 16);
+			if (end == p + n)
+				break;
+			if (*end == '-') {
+				p = end + 1;
+				r->last = strtoul(p, &end, 16);
+				if (end == p || r->last < r->first)
+					break;
+			}
+			p = end;
+			if (!rufl_host_parse_ints(&p, v, 5))
+				break;
+			r->advance = v[0];
+			for (i = 0; i != 4; i++)
+				r->bbox[i] = v[i + 1];
+			face->range_count++;
+		} else if (n == 7 && strncmp(p, "outline", n) == 0) {
+			if (!rufl_host_parse_outline(face, p + n))
+				break;
+		} else if (n == 9 && strncmp(p, "underline", n) == 0) {
+			p += n;
+			if (!rufl_host_parse_ints(&p, v, 2))
+				break;
+			face->misc.underline_position = v[0];
+			face->misc.underline_thickness = v[1];
+			face->misc_present = true;
+		} else {
+			int *field;
+
+			if (n == 8 && strncmp(p, "ascender", n) == 0)
+				field = &face->misc.ascender;
+			else if (n == 9 && strncmp(p, "descender", n) == 0)
+				field = &face->misc.descender;
+			else if (n == 7 && strncmp(p, "xheight", n) == 0)
+				field = &face->misc.xheight;
+			else if (n == 9 && strncmp(p, "capheight", n) == 0)
+				field = &face->misc.cap_height;
+			else if (n == 6 && strncmp(p, "italic", n) == 0)
+				field = &face->misc.italic_correction;
+			else
+				break;
+			p += n;
+			if (!rufl_host_parse_ints(&p, field, 1))
+				break;
+			face->misc_present = true;
+		}
+	}
+
+	free(line);
+	if (!feof(fp)) {
+		fclose(fp);
+		return rufl_host_error(error_FONT_BAD_FONT_FILE,
+				"Font '%s' has a bad metrics file (line %u)",
+				face->identifier, line_number);
+	}
+	fclose(fp);
+
+	if (face->range_count)
+		qsort(face->ranges, face->range_count, sizeof *face->ranges,
+				rufl_host_range_cmp);
+	if (face->outline_count)
+		qsort(face->outlines, face->outline_count,
+				sizeof *face->outlines, rufl_host_outline_cmp);
+
+	if (!bbox) {
+		/* union of the characters */
+		face->bbox[0] = face->bbox[1] = face->bbox[2] =
+				face->bbox[3] = 0;
+		for (i = 0; i != face->range_count; i++) {
+			r = &face->ranges[i];
+			if (r->bbox[0] < face->bbox[0])
+				face->bbox[0] = r->bbox[0];
+			if (r->bbox[1] < face->bbox[1])
+				face->bbox[1] = r->bbox[1];
+			if (face->bbox[2] < r->bbox[2])
+				face->bbox[2] = r->bbox[2];
+			if (face->bbox[3] < r->bbox[3])
+				face->bbox[3] = r->bbox[3];
+		}
+	}
+	face->misc.x0 = face->bbox[0];
+	face->misc.y0 = face->bbox[1];
+	face->misc.x1 = face->bbox[2];
+	face->misc.y1 = face->bbox[3];
+
+	return 0;
+}
+
+
+/**
+ * Parse integers separated by spaces.
+ *
+ * \param  p  position in string, updated to after the integers
+ * \param  v  updated to integers
+ * \param  n  number of integers to parse
+ * \return  true if all were parsed
+ */
+
+bool rufl_host_parse_ints(const char **p, int *v, unsigned int n)
+{
+	char *end;
+	unsigned int i;
+
+	for (i = 0; i != n; i++) {
+		v[i] = strtol(*p, &end, 10);
+		if (end == *p)
+			return false;
+		*p = end;
+	}
+
+	return true;
+}
+
+
+/**
+ * Parse an outline line into Draw path elements.
+ *
+ * \param  face  font to add outline to
+ * \param  p     line following "outline"
+ * \return  true on success, false if malformed or memory was exhausted
+ */
+
+bool rufl_host_parse_outline(struct rufl_host_face *face, const char *p)
+{
+	struct rufl_host_outline *outlines, *outline;
+	int *data;
+	size_t start = face->outline_data_size;
+	char *end;
+	unsigned int u, points, tag;
+
+	u = strtoul(p, &end, 16);
+	if (end == p)
+		return false;
+	p = end;
+
+	while (1) {
+		p += strspn(p, " \t\r\n");
+		if (!*p)
+			break;
+		switch (*p++) {
+		case 'm': tag = 2; points = 1; break;
+		case 'l': tag = 8; points = 1; break;
+		case 'c': tag = 6; points = 3; break;
+		case 'z': tag = 5; points = 0; break;
+		default: return false;
+		}
+
+		data = realloc(face->outline_data,
+				(face->outline_data_size + 1 + points * 2 + 1) *
+				sizeof *data);
+		if (!data)
+			return false;
+		face->outline_data = data;
+		data[face->outline_data_size] = tag;
+		if (!rufl_host_parse_ints(&p,
+				data + face->outline_data_size + 1,
+				points * 2))
+			return false;
+		face->outline_data_size += 1 + points * 2;
+	}
+
+	outlines = realloc(face->outlines, (face->outline_count + 1) *
+			sizeof *face->outlines);
+	if (!outlines)
+		return false;
+	face->outlines = outlines;
+	outline = &outlines[face->outline_count++];
+	outline->u = u;
+	outline->start = start;
+	outline->words = face->outline_data_size - start;
+
+	return true;
+}
+
+
+int rufl_host_range_cmp(const void *a, const void *b)
+{
+	const struct rufl_host_range *ra = a, *rb = b;
+
+	return (ra->first > rb->first) - (ra->first < rb->first);
+}
+
+
+int rufl_host_outline_cmp(const void *a, const void *b)
+{
+	const struct rufl_host_outline *oa = a, *ob = b;
+
+	return (oa->u > ob->u) - (oa->u < ob->u);
+}
+
+
+/**
+ * Find the metrics of a character.
+ *
+ * \return  metrics, or 0 if the character is not in the font
+ */
+
+const struct rufl_host_range *rufl_host_glyph(
+		const struct rufl_host_face *face, unsigned int u)
+{
+	size_t lo = 0, hi = face->range_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (u < face->ranges[mid].first)
+			hi = mid;
+		else if (face->ranges[mid].last < u)
+			lo = mid + 1;
+		else
+			return &face->ranges[mid];
+	}
+
+	return 0;
+}
+
+
+/**
+ * Find the outline of a character, as Draw path elements in 1/1000 em.
+ *
+ * \param  words  updated to number of words in outline
+ * \return  outline, or 0 if the character has no ink
+ */
+
+const int *rufl_host_glyph_outline(const struct rufl_host_face *face,
+		const struct rufl_host_range *glyph, unsigned int u,
+		size_t *words)
+{
+	static __thread int ellipse[3 + 7 * 4 + 1];
+	size_t lo = 0, hi = face->outline_count, mid;
+	int cx, cy, rx, ry, kx, ky;
+	int *q = ellipse;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (u < face->outlines[mid].u)
+			hi = mid;
+		else if (face->outlines[mid].u < u)
+			lo = mid + 1;
+		else {
+			*words = face->outlines[mid].words;
+			return face->outline_data + face->outlines[mid].start;
+		}
+	}
+
+	if (glyph->bbox[0] == glyph->bbox[2] ||
+			glyph->bbox[1] == glyph->bbox[3])
+		return 0;
+
+	/* an ellipse filling the bounding box, from four cubic curves */
+	cx = (glyph->bbox[0] + glyph->bbox[2]) / 2;
+	cy = (glyph->bbox[1] + glyph->bbox[3]) / 2;
+	rx = (glyph->bbox[2] - glyph->bbox[0]) / 2;
+	ry = (glyph->bbox[3] - glyph->bbox[1]) / 2;
+	kx = rx * 552 / 1000;
+	ky = ry * 552 / 1000;
+	*q++ = 2; *q++ = cx + rx; *q++ = cy;
+	*q++ = 6; *q++ = cx + rx; *q++ = cy + ky; *q++ = cx + kx;
+	*q++ = cy + ry; *q++ = cx; *q++ = cy + ry;
+	*q++ = 6; *q++ = cx - kx; *q++ = cy + ry; *q++ = cx - rx;
+	*q++ = cy + ky; *q++ = cx - rx; *q++ = cy;
+	*q++ = 6; *q++ = cx - rx; *q++ = cy - ky; *q++ = cx - kx;
+	*q++ = cy - ry; *q++ = cx; *q++ = cy - ry;
+	*q++ = 6; *q++ = cx + kx; *q++ = cy - ry; *q++ = cx + rx;
+	*q++ = cy - ky; *q++ = cx + rx; *q++ = cy;
+	*q++ = 5;
+	*words = q - ellipse;
+
+	return ellipse;
+}
+
+
+/**
+ * Look up an open font handle.
+ *
+ * \param  font    font handle
+ * \param  handle  updated to a copy of the handle, which does not change
+ *                 while the font is open
+ */
+
+os_error *rufl_host_handle_get(font_f font, struct rufl_host_handle *handle)
+{
+	pthread_mutex_lock(&rufl_host_lock);
+	if (font == 0 || rufl_host_handles[font].usage == 0) {
+		pthread_mutex_unlock(&rufl_host_lock);
+		return rufl_host_error(0x200, "Undefined font handle");
+	}
+	*handle = rufl_host_handles[font];
+	pthread_mutex_unlock(&rufl_host_lock);
+
+	return 0;
+}
+
+
+/**
+ * Read the next item from a string.
+ *
+ * \param  s      position in string, updated past item
+ * \param  end    end of string, or 0 if terminated by a control character
+ * \param  flags  font_GIVEN16_BIT, font_GIVEN32_BIT, or neither
+ * \param  utf8   8-bit strings are UTF-8
+ * \param  u      updated to character, or font handle for rufl_HOST_FONT
+ * \param  dx     updated to horizontal move for rufl_HOST_MOVE
+ * \param  dy     updated to vertical move for rufl_HOST_MOVE
+ * \return  type of item
+ *
+ * Only 8-bit strings may contain control sequences. Moves are in
+ * millipoints.
+ */
+
+rufl_host_item rufl_host_read(const char **s, const char *end,
+		font_string_flags flags, bool utf8, unsigned int *u,
+		int *dx, int *dy)
+{
+	const unsigned char *p = (const unsigned char *) *s;
+	const unsigned char *e = (const unsigned char *) end;
+	unsigned short c16;
+	unsigned int c32;
+	int d;
+
+	*dx = *dy = 0;
+
+	if (flags & font_GIVEN16_BIT) {
+		if (e ? e - p < 2 : 0)
+			return rufl_HOST_END;
+		memcpy(&c16, p, 2);
+		if (!e && c16 < 32)
+			return rufl_HOST_END;
+		*s += 2;
+		*u = c16;
+		return rufl_HOST_CHAR;
+	}
+
+	if (flags & font_GIVEN32_BIT) {
+		if (e ? e - p < 4 : 0)
+			return rufl_HOST_END;
+		memcpy(&c32, p, 4);
+		if (!e && c32 < 32)
+			return rufl_HOST_END;
+		*s += 4;
+		*u = c32;
+		return rufl_HOST_CHAR;
+	}
+
+	if (e && e <= p)
+		return rufl_HOST_END;
+
+	switch (p[0]) {
+	case 9:
+	case 11:
+		if (e && e - p < 4)
+			return rufl_HOST_END;
+		d = p[1] | (p[2] << 8) | (p[3] << 16);
+		if (d & 0x800000)
+			d -= 0x1000000;
+		if (p[0] == 9)
+			*dx = d;
+		else
+			*dy = d;
+		*s += 4;
+		return rufl_HOST_MOVE;
+	case 17:
+	case 18:
+	case 19:
+	case 25:
+		/* colour and underline changes have no effect */
+		d = p[0] == 17 ? 2 : p[0] == 18 ? 4 : p[0] == 19 ? 8 : 3;
+		if (e && e - p < d)
+			return rufl_HOST_END;
+		*s += d;
+		return rufl_HOST_MOVE;
+	case 26:
+		if (e && e - p < 2)
+			return rufl_HOST_END;
+		*u = p[1];
+		*s += 2;
+		return rufl_HOST_FONT;
+	}
+
+	if (p[0] < 32 && !e)
+		return rufl_HOST_END;
+
+	if (!utf8 || p[0] < 0x80) {
+		*u = p[0];
+		*s += 1;
+	} else if ((p[0] & 0xe0) == 0xc0 && (!e || 2 <= e - p)) {
+		*u = ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+		*s += 2;
+	} else if ((p[0] & 0xf0) == 0xe0 && (!e || 3 <= e - p)) {
+		*u = ((p[0] & 0xf) << 12) | ((p[1] & 0x3f) << 6) |
+				(p[2] & 0x3f);
+		*s += 3;
+	} else if ((p[0] & 0xf8) == 0xf0 && (!e || 4 <= e - p)) {
+		*u = ((p[0] & 0x7) << 18) | ((p[1] & 0x3f) << 12) |
+				((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+		*s += 4;
+	} else {
+		*u = 0xfffd;
+		*s += 1;
+	}
+
+	return rufl_HOST_CHAR;
+}
+
+
+/**
+ * Write the outline of a glyph to the output buffer as a Draw path object.
+ *
+ * \param  h      font handle
+ * \param  glyph  metrics of glyph
+ * \param  u      character
+ * \param  x      origin / millipoints
+ * \param  y      origin / millipoints
+ * \param  trfm   transformation, or 0
+ */
+
+os_error *rufl_host_draw_glyph(const struct rufl_host_handle *h,
+		const struct rufl_host_range *glyph, unsigned int u,
+		int x, int y, const os_trfm *trfm)
+{
+	const int *outline;
+	size_t words, i, j, size;
+	int object[10], point[2], *out = 0;
+	long long ox, oy, px, py;
+	int bbox[4] = { INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN };
+
+	outline = rufl_host_glyph_outline(&rufl_host_faces[h->face], glyph,
+			u, &words);
+	if (!outline)
+		return 0;
+
+	size = (10 + words + 1) * sizeof (int);
+	if (rufl_host_output_limit - rufl_host_output < size)
+		return rufl_host_error(0x1e4, "Buffer overflow");
+
+	if (!rufl_host_count_only)
+		out = (int *) (void *) rufl_host_output;
+
+	/* 1/1000 em to Draw units: 1pt is 640 Draw units, and the size is in
+	 * 16ths of a point, so v * size / 16 * 640 / 1000 */
+	ox = (long long) x * 16 / 25;
+	oy = (long long) y * 16 / 25;
+	for (i = 0; i != words; ) {
+		unsigned int points = outline[i] == 6 ? 3 :
+				outline[i] == 5 ? 0 : 1;
+		if (out)
+			out[10 + i] = outline[i];
+		i++;
+		for (j = 0; j != points; j++, i += 2) {
+			px = (long long) outline[i] * h->xsize / 25;
+			py = (long long) outline[i + 1] * h->ysize / 25;
+			if (trfm) {
+				long long tx = (trfm->entries[0][0] * px +
+						trfm->entries[1][0] * py) >>
+						16;
+				long long ty = (trfm->entries[0][1] * px +
+						trfm->entries[1][1] * py) >>
+						16;
+				px = tx;
+				py = ty;
+			}
+			point[0] = (int) (ox + px);
+			point[1] = (int) (oy + py);
+			if (point[0] < bbox[0]) bbox[0] = point[0];
+			if (point[1] < bbox[1]) bbox[1] = point[1];
+			if (bbox[2] < point[0]) bbox[2] = point[0];
+			if (bbox[3] < point[1]) bbox[3] = point[1];
+			if (out) {
+				out[10 + i] = point[0];
+				out[10 + i + 1] = point[1];
+			}
+		}
+	}
+
+	if (out) {
+		/* path object: filled black, no outline, no dash pattern */
+		object[0] = 2;
+		object[1] = size;
+		object[2] = bbox[0];
+		object[3] = bbox[1];
+		object[4] = bbox[2];
+		object[5] = bbox[3];
+		object[6] = 0;
+		object[7] = -1;
+		object[8] = 0;
+		object[9] = 0;
+		memcpy(out, object, sizeof object);
+		out[10 + words] = 0;
+	}
+
+	rufl_host_output += size;
+
+	return 0;
+}
+
+
+/**
+ * Record a paint.
+ */
+
+void rufl_host_record(const struct rufl_host_handle *h, int x, int y,
+		font_string_flags flags, const unsigned int *chars,
+		size_t length)
+{
+	struct rufl_host_paint_record *paints, *record;
+	unsigned int *paint_chars;
+	size_t size;
+
+	pthread_mutex_lock(&rufl_host_lock);
+	if (rufl_host_paints_used == rufl_host_paints_size) {
+		size = rufl_host_paints_size ? rufl_host_paints_size * 2 : 64;
+		paints = realloc(rufl_host_paints, size * sizeof *paints);
+		if (!paints) {
+			pthread_mutex_unlock(&rufl_host_lock);
+			return;
+		}
+		rufl_host_paints = paints;
+		rufl_host_paints_size = size;
+	}
+	if (rufl_host_paint_chars_size < rufl_host_paint_chars_used + length) {
+		size = rufl_host_paint_chars_size ?
+				rufl_host_paint_chars_size : 256;
+		while (size < rufl_host_paint_chars_used + length)
+			size *= 2;
+		paint_chars = realloc(rufl_host_paint_chars,
+				size * sizeof *paint_chars);
+		if (!paint_chars) {
+			pthread_mutex_unlock(&rufl_host_lock);
+			return;
+		}
+		rufl_host_paint_chars = paint_chars;
+		rufl_host_paint_chars_size = size;
+	}
+
+	record = &rufl_host_paints[rufl_host_paints_used++];
+	record->face = h->face;
+	record->xsize = h->xsize;
+	record->ysize = h->ysize;
+	record->x = x;
+	record->y = y;
+	record->flags = flags;
+	record->start = rufl_host_paint_chars_used;
+	record->length = length;
+	if (length)
+		memcpy(rufl_host_paint_chars + rufl_host_paint_chars_used,
+				chars, length * sizeof *chars);
+	rufl_host_paint_chars_used += length;
+	pthread_mutex_unlock(&rufl_host_lock);
+}
+
+
+/**
+ * Scale a value in 1/1000 em to millipoints at a size in 16ths of a point.
+ */
+
+int rufl_host_scale(int v, int size)
+{
+	return (int) ((long long) v * size / 16);
+}
@@ -0,0 +1,227 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Host stand-ins for the OS, Hourglass, Wimp and TaskWindow calls. There is
+ * no desktop, so RUfl never opens its status window. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "oslib/hourglass.h"
+#include "oslib/os.h"
+#include "oslib/taskwindow.h"
+#include "oslib/wimp.h"
+#include "oslib/wimpreadsysinfo.h"
+#include "rufl_host.h"
+
+
+/**
+ * Find the name of a file in the scrap directory.
+ *
+ * \param  leaf  leaf name of file
+ * \return  path of file, valid until the next call by the same thread
+ *
+ * The scrap directory is RUFL_SCRAP_DIR, TMPDIR, or /tmp.
+ */
+
+const char *rufl_host_scrap_file(const char *leaf)
+{
+	static __thread char path[4096];
+	const char *dir;
+
+	dir = getenv("RUFL_SCRAP_DIR");
+	if (!dir)
+		dir = getenv("TMPDIR");
+	if (!dir)
+		dir = "/tmp";
+
+	snprintf(path, sizeof path, "%s/%s", dir, leaf);
+
+	return path;
+}
+
+
+os_error *xos_read_mode_variable(os_mode mode, os_mode_var var,
+		int *var_val, bits *psr)
+{
+	(void) mode;
+
+	/* 1920 x 1080 pixels, 2 OS units per pixel */
+	switch (var) {
+	case os_MODEVAR_XEIG_FACTOR:
+	case os_MODEVAR_YEIG_FACTOR:
+		*var_val = 1;
+		break;
+	case os_MODEVAR_XWIND_LIMIT:
+		*var_val = 1919;
+		break;
+	case os_MODEVAR_YWIND_LIMIT:
+		*var_val = 1079;
+		break;
+	default:
+		*var_val = 0;
+		break;
+	}
+	if (psr)
+		*psr = 0;
+
+	return 0;
+}
+
+
+os_error *xos_read_monotonic_time(os_t *t)
+{
+	struct timespec now;
+
+	/* centiseconds */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*t = (os_t) (now.tv_sec * 100 + now.tv_nsec / 10000000);
+
+	return 0;
+}
+
+
+os_error *xhourglass_on(void)
+{
+	return 0;
+}
+
+
+os_error *xhourglass_off(void)
+{
+	return 0;
+}
+
+
+os_error *xhourglass_percentage(int percent)
+{
+	(void) percent;
+
+	return 0;
+}
+
+
+os_error *xhourglass_leds(bits eor_mask, bits and_mask, bits *old_leds)
+{
+	(void) eor_mask;
+	(void) and_mask;
+
+	if (old_leds)
+		*old_leds = 0;
+
+	return 0;
+}
+
+
+os_error *xhourglass_colours(os_colour sand, os_colour glass,
+		os_colour *old_sand, os_colour *old_glass)
+{
+	(void) sand;
+	(void) glass;
+
+	if (old_sand)
+		*old_sand = 0;
+	if (old_glass)
+		*old_glass = 0;
+
+	return 0;
+}
+
+
+os_error *xwimpreadsysinfo_task(wimp_t *task, int *version)
+{
+	/* not a Wimp task */
+	*task = 0;
+	if (version)
+		*version = 0;
+
+	return 0;
+}
+
+
+os_error *xtaskwindowtaskinfo_window_task(osbool *window_task)
+{
+	*window_task = 0;
+
+	return 0;
+}
+
+
+os_error *xwimp_create_window(wimp_window const *window, wimp_w *w)
+{
+	(void) window;
+
+	*w = 0;
+
+	return 0;
+}
+
+
+os_error *xwimp_delete_window(wimp_w w)
+{
+	(void) w;
+
+	return 0;
+}
+
+
+os_error *xwimp_get_window_state(wimp_window_state *state)
+{
+	(void) state;
+
+	return 0;
+}
+
+
+os_error *xwimp_open_window(wimp_open *open)
+{
+	(void) open;
+
+	return 0;
+}
+
+
+os_error *xwimp_set_icon_state(wimp_w w, wimp_i i, wimp_icon_flags eor_bits,
+		wimp_icon_flags clear_bits)
+{
+	(void) w;
+	(void) i;
+	(void) eor_bits;
+	(void) clear_bits;
+
+	return 0;
+}
+
+
+os_error *xwimp_resize_icon(wimp_w w, wimp_i i, int x0, int y0, int x1,
+		int y1)
+{
+	(void) w;
+	(void) i;
+	(void) x0;
+	(void) y0;
+	(void) x1;
+	(void) y1;
+
+	return 0;
+}
+
+
+os_error *xwimp_poll(wimp_poll_flags mask, wimp_block *block, int *pollword,
+		wimp_event_no *event)
+{
+	(void) mask;
+	(void) block;
+	(void) pollword;
+
+	/* null event */
+	if (event)
+		*event = 0;
+
+	return 0;
+}
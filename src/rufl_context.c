@@ -0,0 +1,419 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <stdlib.h>
+#ifdef RUFL_HOST
+#include <pthread.h>
+#endif
+#include "rufl_internal.h"
+
+
+struct rufl_context rufl_default_context =
+		rufl_CONTEXT_INITIAL(rufl_default_context);
+rufl_THREAD_LOCAL struct rufl_context *rufl_context_current =
+		&rufl_default_context;
+#ifdef RUFL_HOST
+/** Protects the lazily read parts of font lists shared by contexts. */
+static pthread_mutex_t rufl_font_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+/**
+ * Create a context and initialise it.
+ *
+ * \param  ctx  updated to new context
+ * \return  rufl_OK, or an error from rufl_init() (the context is freed)
+ */
+
+rufl_code rufl_ctx_create(struct rufl_context **ctx)
+{
+	struct rufl_context *c;
+	rufl_code code;
+
+	c = malloc(sizeof *c);
+	if (!c)
+		return rufl_OUT_OF_MEMORY;
+	*c = (struct rufl_context) rufl_CONTEXT_INITIAL(*c);
+
+	code = rufl_init_context(c);
+	if (code != rufl_OK) {
+		rufl_ctx_destroy(c);
+		return code;
+	}
+
+	*ctx = c;
+	return rufl_OK;
+}
+
+
+/**
+ * Create a context which shares the fonts of another.
+ *
+ * \param  parent  context to share the fonts of
+ * \param  ctx     updated to new context
+ * \return  rufl_OK, or rufl_OUT_OF_MEMORY
+ */
+
+rufl_code rufl_ctx_create_shared(struct rufl_context *parent,
+		struct rufl_context **ctx)
+{
+	struct rufl_context *c, *fonts = parent->fonts;
+	unsigned int i, j;
+
+	c = malloc(sizeof *c);
+	if (!c)
+		return rufl_OUT_OF_MEMORY;
+	*c = (struct rufl_context) rufl_CONTEXT_INITIAL(*c);
+
+	c->fonts = fonts;
+	c->font_list = fonts->font_list;
+	c->font_list_entries = fonts->font_list_entries;
+	c->family_list = fonts->family_list;
+	c->family_list_entries = fonts->family_list_entries;
+	c->family_map = fonts->family_map;
+	c->family_menu = fonts->family_menu;
+	c->substitution_table = fonts->substitution_table;
+
+	/* font handles are opened as needed */
+	for (i = 0; i != rufl_OUTPUT_COUNT; i++) {
+		for (j = 0; j != rufl_CACHE_SIZE; j++) {
+			c->cache_pool[i][j].font = rufl_CACHE_NONE;
+			c->cache_pool[i][j].protected = false;
+		}
+	}
+
+	*ctx = c;
+	return rufl_OK;
+}
+
+
+/**
+ * Free all resources used by a context, and the context.
+ */
+
+void rufl_ctx_destroy(struct rufl_context *ctx)
+{
+	rufl_ctx_quit(ctx);
+
+	/* the caches are freed by rufl_quit(), but may be used without
+	 * fonts */
+	rufl_ctx_glyph_cache_set_budget(ctx, 0);
+	rufl_ctx_outline_cache_set_budget(ctx, 0);
+	rufl_ctx_bitmap_cache_set_budget(ctx, 0);
+
+	free(ctx);
+}
+
+
+os_error *rufl_ctx_fm_error(const struct rufl_context *ctx)
+{
+	return ctx->fm_error;
+}
+
+
+const char **rufl_ctx_family_list(const struct rufl_context *ctx,
+		unsigned int *entries)
+{
+	*entries = ctx->family_list_entries;
+	return ctx->family_list;
+}
+
+
+void *rufl_ctx_family_menu(const struct rufl_context *ctx)
+{
+	return ctx->family_menu;
+}
+
+
+/**
+ * Lock the font metrics and bounding boxes which are read into the font
+ * list on first use, as the list may be shared by contexts in other
+ * threads.
+ */
+
+void rufl_font_list_lock(void)
+{
+#ifdef RUFL_HOST
+	pthread_mutex_lock(&rufl_font_list_mutex);
+#endif
+}
+
+
+/**
+ * Unlock the font list, after rufl_font_list_lock().
+ */
+
+void rufl_font_list_unlock(void)
+{
+#ifdef RUFL_HOST
+	pthread_mutex_unlock(&rufl_font_list_mutex);
+#endif
+}
+
+
+/* The public functions without ctx_ use the default context. */
+
+rufl_code rufl_init(void)
+{
+	return rufl_default_return(rufl_init_context(&rufl_default_context));
+}
+
+
+rufl_code rufl_paint(const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y, unsigned int flags)
+{
+	return rufl_default_return(rufl_ctx_paint(&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			x, y, flags));
+}
+
+
+rufl_code rufl_width(const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int *width)
+{
+	return rufl_default_return(rufl_ctx_width(&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			width));
+}
+
+
+rufl_code rufl_x_to_offset(const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int click_x,
+		size_t *char_offset, int *actual_x)
+{
+	return rufl_default_return(rufl_ctx_x_to_offset(&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			click_x, char_offset, actual_x));
+}
+
+
+rufl_code rufl_split(const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int width,
+		size_t *char_offset, int *actual_x)
+{
+	return rufl_default_return(rufl_ctx_split(&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			width, char_offset, actual_x));
+}
+
+
+rufl_code rufl_paint_callback(const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		rufl_callback_t callback, void *context)
+{
+	return rufl_default_return(rufl_ctx_paint_callback(
+			&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			x, y, callback, context));
+}
+
+
+rufl_code rufl_decompose_glyph(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		struct rufl_decomp_funcs *funcs, void *user)
+{
+	return rufl_default_return(rufl_ctx_decompose_glyph(
+			&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			funcs, user));
+}
+
+
+rufl_code rufl_decompose_string(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		struct rufl_path *path)
+{
+	return rufl_default_return(rufl_ctx_decompose_string(
+			&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			path));
+}
+
+
+void rufl_outline_cache_set_budget(size_t bytes)
+{
+	rufl_ctx_outline_cache_set_budget(&rufl_default_context, bytes);
+}
+
+
+rufl_code rufl_outline_cache_save(void)
+{
+	return rufl_default_return(rufl_ctx_outline_cache_save(
+			&rufl_default_context));
+}
+
+
+rufl_code rufl_outline_cache_load(void)
+{
+	return rufl_default_return(rufl_ctx_outline_cache_load(
+			&rufl_default_context));
+}
+
+
+rufl_code rufl_render_to_buffer(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		unsigned char *buffer, int width, int height, int stride)
+{
+	return rufl_default_return(rufl_ctx_render_to_buffer(
+			&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			x, y, buffer, width, height, stride));
+}
+
+
+void rufl_bitmap_cache_set_budget(size_t bytes)
+{
+	rufl_ctx_bitmap_cache_set_budget(&rufl_default_context, bytes);
+}
+
+
+rufl_code rufl_font_metrics(const char *font_family, rufl_style font_style,
+		os_box *bbox, int *xkern, int *ykern, int *italic,
+		int *ascent, int *descent,
+		int *xheight, int *cap_height,
+		signed char *uline_position, unsigned char *uline_thickness)
+{
+	return rufl_default_return(rufl_ctx_font_metrics(
+			&rufl_default_context,
+			font_family, font_style, bbox, xkern, ykern, italic,
+			ascent, descent, xheight, cap_height,
+			uline_position, uline_thickness));
+}
+
+
+rufl_code rufl_glyph_metrics(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance)
+{
+	return rufl_default_return(rufl_ctx_glyph_metrics(
+			&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			x_bearing, y_bearing, width, height,
+			x_advance, y_advance));
+}
+
+
+rufl_code rufl_glyph_metrics_string(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance,
+		size_t *count)
+{
+	return rufl_default_return(rufl_ctx_glyph_metrics_string(
+			&rufl_default_context,
+			font_family, font_style, font_size, string, length,
+			x_bearing, y_bearing, width, height,
+			x_advance, y_advance, count));
+}
+
+
+void rufl_glyph_cache_set_budget(size_t bytes)
+{
+	rufl_ctx_glyph_cache_set_budget(&rufl_default_context, bytes);
+}
+
+
+void rufl_glyph_cache_get_stats(struct rufl_glyph_cache_stats *stats)
+{
+	rufl_ctx_glyph_cache_get_stats(&rufl_default_context, stats);
+}
+
+
+void rufl_glyph_cache_reset_stats(void)
+{
+	rufl_ctx_glyph_cache_reset_stats(&rufl_default_context);
+}
+
+
+rufl_code rufl_font_bbox(const char *font_family, rufl_style font_style,
+		unsigned int font_size,
+		int *bbox)
+{
+	return rufl_default_return(rufl_ctx_font_bbox(&rufl_default_context,
+			font_family, font_style, font_size, bbox));
+}
+
+
+void rufl_dump_state(void)
+{
+	rufl_ctx_dump_state(&rufl_default_context);
+}
+
+
+void rufl_invalidate_cache(void)
+{
+	rufl_ctx_invalidate_cache(&rufl_default_context);
+}
+
+
+void rufl_invalidate_cache_reason(unsigned int reasons)
+{
+	rufl_ctx_invalidate_cache_reason(&rufl_default_context, reasons);
+}
+
+
+void rufl_set_output(rufl_output output)
+{
+	rufl_ctx_set_output(&rufl_default_context, output);
+}
+
+
+void rufl_quit(void)
+{
+	rufl_ctx_quit(&rufl_default_context);
+	rufl_default_return(rufl_OK);
+}
+
+
+/* The process-global variables of rufl.h are copies of the state of the
+ * default context. */
+#undef rufl_fm_error
+#undef rufl_family_list
+#undef rufl_family_list_entries
+#undef rufl_family_menu
+
+os_error *rufl_fm_error = 0;
+const char **rufl_family_list = 0;
+unsigned int rufl_family_list_entries = 0;
+void *rufl_family_menu = 0;
+
+
+/**
+ * Update the process-global variables of rufl.h after a public function has
+ * used the default context.
+ *
+ * \param  code  return code of the function
+ * \return  code
+ */
+
+rufl_code rufl_default_return(rufl_code code)
+{
+	rufl_fm_error = rufl_default_context.fm_error;
+	rufl_family_list = rufl_default_context.family_list;
+	rufl_family_list_entries = rufl_default_context.family_list_entries;
+	rufl_family_menu = rufl_default_context.family_menu;
+
+	return code;
+}
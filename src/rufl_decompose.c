@@ -6,7 +6,10 @@
  */
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "oslib/font.h"
 
@@ -65,97 +68,940 @@ static int *process_path(int *path, struct rufl_decomp_funcs *funcs,
 	return path + 1;
 }
 
-rufl_code rufl_decompose_glyph(const char *font_family,
+/** Maximum number of lines used to flatten a curve. */
+#define rufl_FLATTEN_MAX 256
+
+/** Remembered size estimates, replaced in rotation. */
+#define rufl_decompose_estimates					\
+	(rufl_context_current->decompose_estimates)
+/** Next entry of rufl_decompose_estimates to replace. */
+#define rufl_decompose_estimate_next					\
+	(rufl_context_current->decompose_estimate_next)
+/** Decomposition buffer, reused by each call to rufl_decompose_glyph(). */
+#define rufl_decompose_buffer (rufl_context_current->decompose_buffer)
+/** Size of rufl_decompose_buffer / bytes. */
+#define rufl_decompose_buffer_size					\
+	(rufl_context_current->decompose_buffer_size)
+
+static rufl_code rufl_decompose_to_buffer(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, int **end);
+static rufl_code rufl_decompose_paint(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, int **end);
+static void rufl_decompose_parse(int *p, int *ep,
+		struct rufl_decomp_funcs *funcs, void *user);
+static bool rufl_decompose_single_glyph(const char *font_family,
+		rufl_style font_style, const char *string, size_t len,
+		unsigned int *font, unsigned int *u, unsigned int *flags);
+static void rufl_decompose_scale(int *p, int *ep, unsigned int num,
+		unsigned int den);
+static int rufl_decompose_scale_value(int v, unsigned int num,
+		unsigned int den);
+static rufl_code rufl_decompose_reserve(size_t size);
+static rufl_code rufl_decompose_measure(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, size_t *size);
+static rufl_code rufl_decompose_fill(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, size_t size, int **end);
+static struct rufl_decompose_estimate *rufl_decompose_estimate_find(
+		unsigned int font, unsigned int font_size);
+static void rufl_path_start(struct rufl_path *path);
+static rufl_code rufl_path_append(struct rufl_path *path,
+		const int *p, const int *ep);
+static rufl_code rufl_path_reserve(void **array, size_t *size,
+		size_t needed, size_t element_size, bool allocated);
+static rufl_code rufl_path_add(struct rufl_path *path, unsigned char verb,
+		const os_coord *points, unsigned int verbs, unsigned int count);
+static unsigned int rufl_path_flatten_count(const os_coord *curve,
+		int tolerance);
+static void rufl_path_flatten_cubic(const os_coord *curve, unsigned int n,
+		os_coord *points);
+
+
+/**
+ * Decompose a glyph to a path.
+ *
+ * Font handles used for output to the decomposition buffer are kept in their
+ * own pool, so decomposing does not evict the screen handles.
+ */
+rufl_code rufl_ctx_decompose_glyph(struct rufl_context *ctx,
+		const char *font_family,
 		rufl_style font_style, unsigned int font_size,
 		const char *string, size_t len,
 		struct rufl_decomp_funcs *funcs, void *user)
 {
-	int *buf, *p, *ep;
-	int buf_size;
+	struct rufl_cache_entry *cache = ctx->cache;
+	int *ep;
+	struct rufl_outer outer;
+	rufl_code err;
+
+	rufl_api_enter(ctx, rufl_API_DECOMPOSE_GLYPH, outer);
+	rufl_ctx_set_output(ctx, rufl_OUTPUT_BUFFER);
+	err = rufl_decompose_to_buffer(font_family, font_style,
+			font_size, string, len, &ep);
+	rufl_cache = cache;
+	rufl_api_leave(outer);
+	if (err != rufl_OK)
+		return err;
+
+	rufl_decompose_parse(ctx->decompose_buffer, ep, funcs, user);
+
+	return rufl_OK;
+}
+
+
+/**
+ * Decompose a string to flat arrays of path verbs and points.
+ *
+ * Each character is decomposed separately, so that single glyph outlines
+ * come from the outline cache, and its advance is found with
+ * rufl_glyph_metrics(). Kerning is not applied.
+ */
+
+rufl_code rufl_ctx_decompose_string(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		struct rufl_path *path)
+{
+	struct rufl_cache_entry *cache = ctx->cache;
+	struct rufl_path_glyph *glyph;
+	const char *s;
+	size_t n;
+	unsigned int u;
+	int *ep;
+	int x_advance, y_advance;
+	struct rufl_outer outer;
+	rufl_code err = rufl_OK;
+
+	rufl_path_start(path);
+
+	rufl_api_enter(ctx, rufl_API_DECOMPOSE_STRING, outer);
+	rufl_ctx_set_output(ctx, rufl_OUTPUT_BUFFER);
+
+	while (length) {
+		s = string;
+		rufl_utf8_read(string, length, u);
+		(void) u;
+		n = string - s;
+
+		err = rufl_path_reserve((void **) &path->glyphs,
+				&path->glyphs_size, path->glyphs_used + 1,
+				sizeof path->glyphs[0], path->allocated);
+		if (err != rufl_OK)
+			break;
+
+		err = rufl_ctx_glyph_metrics(ctx, font_family, font_style,
+				font_size, s, n, 0, 0, 0, 0,
+				&x_advance, &y_advance);
+		if (err != rufl_OK)
+			break;
+
+		err = rufl_decompose_to_buffer(font_family, font_style,
+				font_size, s, n, &ep);
+		if (err != rufl_OK)
+			break;
+
+		glyph = &path->glyphs[path->glyphs_used++];
+		glyph->verb = path->verbs_used;
+		glyph->point = path->points_used;
+		/* millipoints to Draw units */
+		glyph->x_advance = x_advance * 16 / 25;
+		glyph->y_advance = y_advance * 16 / 25;
+
+		err = rufl_path_append(path, rufl_decompose_buffer, ep);
+		if (err != rufl_OK)
+			break;
+	}
+
+	rufl_cache = cache;
+	rufl_api_leave(outer);
+
+	return err;
+}
+
+
+/**
+ * Flatten the curves of a path to straight lines.
+ *
+ * \param  in         path from rufl_decompose_string()
+ * \param  tolerance  maximum distance of lines from curves / Draw units
+ * \param  out        path to receive result (as for rufl_decompose_string())
+ * \return  rufl_OK, or rufl_OUT_OF_MEMORY if memory was exhausted or caller
+ *          provided arrays in out are too small
+ *
+ * The number of lines for each curve is found from the tolerance using Wang's
+ * formula, and the lines are generated by forward differencing.
+ */
+
+rufl_code rufl_path_flatten(const struct rufl_path *in, int tolerance,
+		struct rufl_path *out)
+{
+	const os_coord *p = in->points;
+	os_coord curve[4];
+	os_coord start = { 0, 0 }, current = { 0, 0 };
+	size_t i, g = 0;
+	unsigned int n;
+	rufl_code err;
+
+	rufl_path_start(out);
+
+	if (tolerance < 1)
+		tolerance = 1;
+
+	err = rufl_path_reserve((void **) &out->glyphs, &out->glyphs_size,
+			in->glyphs_used, sizeof out->glyphs[0],
+			out->allocated);
+	if (err != rufl_OK)
+		return err;
+
+	for (i = 0; i != in->verbs_used; i++) {
+		/* start any glyphs beginning at this verb */
+		for (; g != in->glyphs_used && in->glyphs[g].verb == i; g++) {
+			out->glyphs[g] = in->glyphs[g];
+			out->glyphs[g].verb = out->verbs_used;
+			out->glyphs[g].point = out->points_used;
+		}
+
+		switch (in->verbs[i]) {
+		case rufl_PATH_MOVE_TO:
+			start = current = p[0];
+			n = 1;
+			break;
+		case rufl_PATH_LINE_TO:
+			current = p[0];
+			n = 1;
+			break;
+		case rufl_PATH_CLOSE:
+			current = start;
+			n = 0;
+			break;
+		default:
+			n = 3;
+			break;
+		}
+
+		if (in->verbs[i] == rufl_PATH_CUBIC_TO) {
+			curve[0] = current;
+			memcpy(curve + 1, p, sizeof curve[0] * 3);
+			current = p[2];
+			n = rufl_path_flatten_count(curve, tolerance);
+			err = rufl_path_add(out, rufl_PATH_LINE_TO, 0, n, n);
+			if (err != rufl_OK)
+				return err;
+			rufl_path_flatten_cubic(curve, n,
+					out->points + out->points_used - n);
+			p += 3;
+			continue;
+		}
+
+		err = rufl_path_add(out, in->verbs[i], p, 1, n);
+		if (err != rufl_OK)
+			return err;
+		p += n;
+	}
+
+	/* glyphs with no verbs at the end */
+	for (; g != in->glyphs_used; g++) {
+		out->glyphs[g] = in->glyphs[g];
+		out->glyphs[g].verb = out->verbs_used;
+		out->glyphs[g].point = out->points_used;
+	}
+	out->glyphs_used = in->glyphs_used;
+
+	return rufl_OK;
+}
+
+
+/**
+ * Append verbs and points to a path.
+ *
+ * \param  path    path to append to
+ * \param  verb    verb to append
+ * \param  points  points to append, or 0 to leave them to the caller
+ * \param  verbs   number of copies of verb
+ * \param  count   number of points
+ */
+
+rufl_code rufl_path_add(struct rufl_path *path, unsigned char verb,
+		const os_coord *points, unsigned int verbs, unsigned int count)
+{
+	rufl_code err;
+
+	err = rufl_path_reserve((void **) &path->verbs, &path->verbs_size,
+			path->verbs_used + verbs, sizeof path->verbs[0],
+			path->allocated);
+	if (err != rufl_OK)
+		return err;
+	err = rufl_path_reserve((void **) &path->points, &path->points_size,
+			path->points_used + count, sizeof path->points[0],
+			path->allocated);
+	if (err != rufl_OK)
+		return err;
+
+	memset(path->verbs + path->verbs_used, verb, verbs);
+	path->verbs_used += verbs;
+	if (points)
+		memcpy(path->points + path->points_used, points,
+				count * sizeof path->points[0]);
+	path->points_used += count;
+
+	return rufl_OK;
+}
+
+
+/**
+ * Find the number of lines needed to flatten a cubic Bezier curve.
+ *
+ * By Wang's formula, n lines are within tolerance of the curve if
+ * n^2 >= 3/4 * M / tolerance, where M is the larger second difference of the
+ * control points. The result is clamped to [1, rufl_FLATTEN_MAX].
+ */
+
+unsigned int rufl_path_flatten_count(const os_coord *curve, int tolerance)
+{
+	double dx0 = curve[0].x - 2.0 * curve[1].x + curve[2].x;
+	double dy0 = curve[0].y - 2.0 * curve[1].y + curve[2].y;
+	double dx1 = curve[1].x - 2.0 * curve[2].x + curve[3].x;
+	double dy1 = curve[1].y - 2.0 * curve[2].y + curve[3].y;
+	double m2 = dx0 * dx0 + dy0 * dy0;
+	double t = (double) tolerance * tolerance;
+	double n;
+
+	if (m2 < dx1 * dx1 + dy1 * dy1)
+		m2 = dx1 * dx1 + dy1 * dy1;
+
+	/* m2 and t are squared, so n^4 >= 9/16 M^2 / tolerance^2 */
+	n = ceil(sqrt(sqrt(0.5625 * m2 / t)));
+	if (n < 1)
+		return 1;
+	if (rufl_FLATTEN_MAX < n)
+		return rufl_FLATTEN_MAX;
+
+	return n;
+}
+
+
+/**
+ * Generate the end points of the lines approximating a cubic Bezier curve by
+ * forward differencing.
+ *
+ * \param  curve   start point, two control points, and end point
+ * \param  n       number of lines
+ * \param  points  receives n points
+ */
+
+void rufl_path_flatten_cubic(const os_coord *curve, unsigned int n,
+		os_coord *points)
+{
+	double h = 1.0 / n, h2 = h * h, h3 = h2 * h;
+	double ax, ay, bx, by, cx, cy;
+	double fx, fy, dfx, dfy, ddfx, ddfy, dddfx, dddfy;
+	unsigned int i;
+
+	/* polynomial coefficients: B(t) = a t^3 + b t^2 + c t + p0 */
+	ax = -curve[0].x + 3.0 * (curve[1].x - curve[2].x) + curve[3].x;
+	ay = -curve[0].y + 3.0 * (curve[1].y - curve[2].y) + curve[3].y;
+	bx = 3.0 * (curve[0].x - 2.0 * curve[1].x + curve[2].x);
+	by = 3.0 * (curve[0].y - 2.0 * curve[1].y + curve[2].y);
+	cx = 3.0 * (curve[1].x - curve[0].x);
+	cy = 3.0 * (curve[1].y - curve[0].y);
+
+	fx = curve[0].x;
+	fy = curve[0].y;
+	dfx = ax * h3 + bx * h2 + cx * h;
+	dfy = ay * h3 + by * h2 + cy * h;
+	ddfx = 6.0 * ax * h3 + 2.0 * bx * h2;
+	ddfy = 6.0 * ay * h3 + 2.0 * by * h2;
+	dddfx = 6.0 * ax * h3;
+	dddfy = 6.0 * ay * h3;
+
+	for (i = 0; i != n - 1; i++) {
+		fx += dfx;
+		fy += dfy;
+		dfx += ddfx;
+		dfy += ddfy;
+		ddfx += dddfx;
+		ddfy += dddfy;
+		points[i].x = (int) (fx < 0 ? fx - 0.5 : fx + 0.5);
+		points[i].y = (int) (fy < 0 ? fy - 0.5 : fy + 0.5);
+	}
+
+	/* end exactly on the curve's end point */
+	points[n - 1] = curve[3];
+}
+
+
+/**
+ * Free arrays allocated by rufl_decompose_string().
+ */
+
+void rufl_path_free(struct rufl_path *path)
+{
+	if (!path->allocated)
+		return;
+
+	free(path->verbs);
+	free(path->points);
+	free(path->glyphs);
+	path->verbs = 0;
+	path->points = 0;
+	path->glyphs = 0;
+	path->verbs_size = path->verbs_used = 0;
+	path->points_size = path->points_used = 0;
+	path->glyphs_size = path->glyphs_used = 0;
+}
+
+
+/**
+ * Decompose a string into the decomposition buffer.
+ *
+ * Single glyphs are taken from the outline cache, or decomposed at
+ * rufl_OUTLINE_REFERENCE_SIZE and added to it, and scaled to font_size.
+ *
+ * \param  end  updated to end of output in rufl_decompose_buffer
+ */
+
+rufl_code rufl_decompose_to_buffer(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, int **end)
+{
+	const int *outline;
+	int *ep;
+	unsigned int font, u, flags;
+	size_t words;
+	rufl_code err;
+
+	if (!rufl_decompose_single_glyph(font_family, font_style, string, len,
+			&font, &u, &flags)) {
+		return rufl_decompose_paint(font_family, font_style,
+				font_size, string, len, end);
+	}
+
+	outline = rufl_outline_cache_get(font, u, flags, &words);
+	if (outline) {
+		err = rufl_decompose_reserve(words * sizeof outline[0]);
+		if (err != rufl_OK)
+			return err;
+		memcpy(rufl_decompose_buffer, outline,
+				words * sizeof outline[0]);
+	} else {
+		err = rufl_decompose_paint(font_family, font_style,
+				rufl_OUTLINE_REFERENCE_SIZE, string, len, &ep);
+		if (err != rufl_OK)
+			return err;
+		words = ep - rufl_decompose_buffer;
+		/* if it can't be cached, it is still in the buffer */
+		rufl_outline_cache_put(font, u, flags, rufl_decompose_buffer,
+				words);
+	}
+
+	*end = rufl_decompose_buffer + words;
+	rufl_decompose_scale(rufl_decompose_buffer, *end, font_size,
+			rufl_OUTLINE_REFERENCE_SIZE);
+
+	return rufl_OK;
+}
+
+
+/**
+ * Decompose a string into the decomposition buffer.
+ *
+ * The buffer is filled in a single pass, sized from the space used by earlier
+ * strings in the same font and size. The exact size is only measured, by
+ * painting with font_NO_OUTPUT, when there is no estimate or the estimate
+ * was too small.
+ *
+ * \param  end  updated to end of output in rufl_decompose_buffer
+ */
+
+rufl_code rufl_decompose_paint(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, int **end)
+{
+	int *ep = 0;
+	unsigned int font;
+	size_t size, used;
+	struct rufl_decompose_estimate *estimate;
+	rufl_code err;
+
+	err = rufl_find_font_family(font_family, font_style, &font, 0, 0);
+	if (err != rufl_OK)
+		return err;
+
+	estimate = rufl_decompose_estimate_find(font, font_size);
+	err = rufl_FONT_MANAGER_ERROR;
+	if (estimate->size && len) {
+		/* allow some slack for glyphs more complex than before */
+		size = 8 + estimate->bytes_per_byte * len +
+				estimate->bytes_per_byte * len / 2;
+		err = rufl_decompose_fill(font_family, font_style, font_size,
+				string, len, size, &ep);
+		if (err == rufl_FONT_MANAGER_ERROR)
+			LOG_DEBUG("estimate of %zu bytes too small", size);
+		else if (err != rufl_OK)
+			return err;
+	}
+
+	if (err != rufl_OK) {
+		/* no estimate, or the buffer overflowed: measure exactly */
+		err = rufl_decompose_measure(font_family, font_style,
+				font_size, string, len, &size);
+		if (err != rufl_OK)
+			return err;
+		err = rufl_decompose_fill(font_family, font_style, font_size,
+				string, len, size, &ep);
+		if (err != rufl_OK)
+			return err;
+	}
+
+	/* remember the space used for next time */
+	used = (char *) ep - (char *) rufl_decompose_buffer;
+	if (len) {
+		if (estimate->font != font || estimate->size != font_size) {
+			estimate->font = font;
+			estimate->size = font_size;
+			estimate->bytes_per_byte = 0;
+		}
+		if (estimate->bytes_per_byte < (used + len - 1) / len)
+			estimate->bytes_per_byte = (used + len - 1) / len;
+	}
+
+	*end = ep;
+
+	return rufl_OK;
+}
+
+
+/**
+ * Parse Draw path objects, calling callbacks as required.
+ */
+
+void rufl_decompose_parse(int *p, int *ep,
+		struct rufl_decomp_funcs *funcs, void *user)
+{
+	while (p < ep) {
+		if (p[0] != 2) {
+			LOG_ERROR("Object type %d not known", p[0]);
+			break;
+		}
+
+		p = process_path(p, funcs, user);
+
+		/* Have the callbacks asked for us to stop? */
+		if (p == NULL)
+			break;
+	}
+}
+
+
+/**
+ * Determine whether a string is a single glyph which may use the outline
+ * cache, and find its key.
+ *
+ * \param  font   updated to font number containing glyph
+ * \param  u      updated to Unicode value
+ * \param  flags  updated to rufl_OUTLINE_* flags
+ * \return  true if the outline cache may be used
+ */
+
+bool rufl_decompose_single_glyph(const char *font_family,
+		rufl_style font_style, const char *string, size_t len,
+		unsigned int *font, unsigned int *u, unsigned int *flags)
+{
+	unsigned int font0, font1, slant;
+	struct rufl_character_set *charset;
+
+	if (len == 0)
+		return false;
+
+	if (rufl_find_font_family(font_family, font_style, &font0, &slant,
+			&charset) != rufl_OK)
+		return false;
+
+	rufl_utf8_read(string, len, *u);
+	if (len != 0)
+		return false;
+
+	if (charset && rufl_character_set_test(charset, *u))
+		font1 = font0;
+	else if (*u < 0x10000)
+		font1 = rufl_substitution_table[*u];
+	else
+		font1 = rufl_CACHE_CORPUS;
+	/* hex substitutions don't come from a font */
+	if (font1 == NOT_AVAILABLE || font1 == rufl_CACHE_CORPUS)
+		return false;
+
+	*font = font1;
+	*flags = 0;
+	if (slant && !rufl_font_list[font1].slant)
+		*flags |= rufl_OUTLINE_OBLIQUE;
+
+	return true;
+}
+
+
+/**
+ * Scale Draw path objects in place.
+ *
+ * \param  p    first object
+ * \param  ep   end of objects
+ * \param  num  numerator of scale factor
+ * \param  den  denominator of scale factor
+ */
+
+void rufl_decompose_scale(int *p, int *ep, unsigned int num,
+		unsigned int den)
+{
+	int *q, *r;
+
+	if (num == den)
+		return;
+
+	while (p < ep && p[0] == 2) {
+		/* bounding box and outline width */
+		for (q = p + 2; q != p + 6; q++)
+			*q = rufl_decompose_scale_value(*q, num, den);
+		p[8] = rufl_decompose_scale_value(p[8], num, den);
+
+		/* skip header and dash pattern, as process_path() does */
+		q = p + 9;
+		if (q[0] & (1<<7))
+			q += q[2] + 2;
+		q++;
+
+		while (q < ep && q[0] != 0) {
+			switch (q[0]) {
+			case 2: /* Move to */
+			case 8: /* Line to */
+				q[1] = rufl_decompose_scale_value(q[1],
+						num, den);
+				q[2] = rufl_decompose_scale_value(q[2],
+						num, den);
+				q += 3;
+				break;
+			case 5: /* Close path */
+				q++;
+				break;
+			case 6: /* Cubic Bezier to */
+				for (r = q + 1; r != q + 7; r++)
+					*r = rufl_decompose_scale_value(*r,
+							num, den);
+				q += 7;
+				break;
+			default: /* Anything else is broken */
+				assert(0);
+				return;
+			}
+		}
+
+		p = q + 1;
+	}
+}
+
+
+/**
+ * Scale a coordinate, rounding to nearest.
+ */
+
+int rufl_decompose_scale_value(int v, unsigned int num, unsigned int den)
+{
+	long long x = (long long) v * num;
+
+	if (x < 0)
+		return -(int) ((-x + den / 2) / den);
+	return (int) ((x + den / 2) / den);
+}
+
+
+/**
+ * Find the exact buffer size needed to decompose a string.
+ */
+
+rufl_code rufl_decompose_measure(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, size_t *size)
+{
 	char *buf_end;
 	rufl_code err;
 
-	/* Get required buffer size */
+	rufl_fm_count(rufl_FM_SWITCH_OUTPUT_TO_BUFFER);
 	rufl_fm_error = xfont_switch_output_to_buffer(
 			font_NO_OUTPUT | font_ADD_HINTS, (byte *)8, 0);
 	if (rufl_fm_error) {
-		LOG("xfont_switch_output_to_buffer: 0x%x: %s",
+		LOG_ERROR("xfont_switch_output_to_buffer: 0x%x: %s",
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
 	}
 
-	err = rufl_paint(font_family, font_style, font_size, string, len,
-			0, 0, rufl_BLEND_FONT);
+	err = rufl_ctx_paint(rufl_context_current, font_family, font_style,
+			font_size, string, len, 0, 0, rufl_BLEND_FONT);
 	if (err) {
 		/* reset font redirection - too bad if this fails */
+		rufl_fm_count(rufl_FM_SWITCH_OUTPUT_TO_BUFFER);
 		xfont_switch_output_to_buffer(0, 0, 0);
 		return err;
 	}
 
+	rufl_fm_count(rufl_FM_SWITCH_OUTPUT_TO_BUFFER);
 	rufl_fm_error = xfont_switch_output_to_buffer(0, NULL, &buf_end);
 	if (rufl_fm_error) {
-		LOG("xfont_switch_output_to_buffer: 0x%x: %s",
+		LOG_ERROR("xfont_switch_output_to_buffer: 0x%x: %s",
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
 	}
-	buf_size = buf_end - (char *)NULL;
+	*size = buf_end - (char *)NULL;
 
-	/* Allocate and initialise buffer */
-	buf = malloc(buf_size);
-	if (!buf) {
-		LOG("Failed to allocate decompose buffer of size %i", buf_size);
-		return rufl_OUT_OF_MEMORY;
-	}
+	return rufl_OK;
+}
+
+
+/**
+ * Decompose a string into the decomposition buffer.
+ *
+ * \param  size  minimum buffer size / bytes
+ * \param  end   updated to end of output in buffer
+ * \return  rufl_OK on success, rufl_FONT_MANAGER_ERROR if the buffer
+ *          overflowed or the Font Manager failed
+ */
+
+rufl_code rufl_decompose_fill(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t len, size_t size, int **end)
+{
+	int *buf;
+	char *buf_end;
+	rufl_code err;
+
+	err = rufl_decompose_reserve(size);
+	if (err != rufl_OK)
+		return err;
+	buf = rufl_decompose_buffer;
 	buf[0] = 0;
-	buf[1] = buf_size - 8;
+	buf[1] = rufl_decompose_buffer_size - 8;
 
-	/* Populate buffer */
+	rufl_fm_count(rufl_FM_SWITCH_OUTPUT_TO_BUFFER);
 	rufl_fm_error = xfont_switch_output_to_buffer(
 			font_ADD_HINTS, (byte *)buf, 0);
 	if (rufl_fm_error) {
-		LOG("xfont_switch_output_to_buffer: 0x%x: %s",
+		LOG_ERROR("xfont_switch_output_to_buffer: 0x%x: %s",
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
-		free(buf);
 		return rufl_FONT_MANAGER_ERROR;
 	}
 
-	err = rufl_paint(font_family, font_style, font_size, string, len,
-			0, 0, rufl_BLEND_FONT);
+	err = rufl_ctx_paint(rufl_context_current, font_family, font_style,
+			font_size, string, len, 0, 0, rufl_BLEND_FONT);
 	if (err) {
 		/* reset font redirection - too bad if this fails */
+		rufl_fm_count(rufl_FM_SWITCH_OUTPUT_TO_BUFFER);
 		xfont_switch_output_to_buffer(0, 0, 0);
-		free(buf);
 		return err;
 	}
 
+	rufl_fm_count(rufl_FM_SWITCH_OUTPUT_TO_BUFFER);
 	rufl_fm_error = xfont_switch_output_to_buffer(0, 0, &buf_end);
 	if (rufl_fm_error) {
-		LOG("xfont_switch_output_to_buffer: 0x%x: %s",
+		LOG_ERROR("xfont_switch_output_to_buffer: 0x%x: %s",
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
-		free(buf);
 		return rufl_FONT_MANAGER_ERROR;
 	}
-	ep = (int *)(void *)buf_end;
+	*end = (int *)(void *)buf_end;
 
-	/* Parse buffer, calling callbacks as required */
-	for (p = buf; p < ep;) {
-		if (p[0] != 2) {
-			LOG("Object type %d not known", p[0]);
-			break;
+	return rufl_OK;
+}
+
+
+/**
+ * Ensure the decomposition buffer is at least a given size.
+ */
+
+rufl_code rufl_decompose_reserve(size_t size)
+{
+	int *buf;
+
+	size = (size + 3) & ~(size_t) 3;
+	if (rufl_decompose_buffer_size < size) {
+		buf = realloc(rufl_decompose_buffer, size);
+		if (!buf) {
+			LOG_ERROR("Failed to allocate decompose buffer of size %zu",
+					size);
+			return rufl_OUT_OF_MEMORY;
 		}
+		rufl_decompose_buffer = buf;
+		rufl_decompose_buffer_size = size;
+	}
 
-		p = process_path(p, funcs, user);
+	return rufl_OK;
+}
 
-		/* Have the callbacks asked for us to stop? */
-		if (p == NULL)
-			break;
+
+/**
+ * Find the size estimate for a font and size.
+ *
+ * \return  matching entry, or an entry to replace (with size 0 if unused)
+ */
+
+struct rufl_decompose_estimate *rufl_decompose_estimate_find(
+		unsigned int font, unsigned int font_size)
+{
+	struct rufl_decompose_estimate *estimate;
+	unsigned int i;
+
+	for (i = 0; i != rufl_DECOMPOSE_ESTIMATES; i++) {
+		if (rufl_decompose_estimates[i].size == font_size &&
+				rufl_decompose_estimates[i].font == font)
+			return &rufl_decompose_estimates[i];
 	}
 
-	free(buf);
+	estimate = &rufl_decompose_estimates[rufl_decompose_estimate_next];
+	rufl_decompose_estimate_next = (rufl_decompose_estimate_next + 1) %
+			rufl_DECOMPOSE_ESTIMATES;
+	estimate->size = 0;
+
+	return estimate;
+}
+
+
+/**
+ * Append Draw path objects to flat path arrays.
+ */
+
+rufl_code rufl_path_append(struct rufl_path *path,
+		const int *p, const int *ep)
+{
+	const int *q;
+	unsigned int points;
+	unsigned char verb;
+	rufl_code err;
+
+	while (p < ep && p[0] == 2) {
+		/* skip header and dash pattern, as process_path() does */
+		q = p + 9;
+		if (q[0] & (1<<7))
+			q += q[2] + 2;
+		q++;
+
+		for (; q[0] != 0; q += 1 + points * 2) {
+			switch (q[0]) {
+			case 2: /* Move to */
+				verb = rufl_PATH_MOVE_TO;
+				points = 1;
+				break;
+			case 5: /* Close path */
+				verb = rufl_PATH_CLOSE;
+				points = 0;
+				break;
+			case 6: /* Cubic Bezier to */
+				verb = rufl_PATH_CUBIC_TO;
+				points = 3;
+				break;
+			case 8: /* Line to */
+				verb = rufl_PATH_LINE_TO;
+				points = 1;
+				break;
+			default: /* Anything else is broken */
+				assert(0);
+				return rufl_OK;
+			}
+
+			err = rufl_path_reserve((void **) &path->verbs,
+					&path->verbs_size,
+					path->verbs_used + 1,
+					sizeof path->verbs[0],
+					path->allocated);
+			if (err != rufl_OK)
+				return err;
+			err = rufl_path_reserve((void **) &path->points,
+					&path->points_size,
+					path->points_used + points,
+					sizeof path->points[0],
+					path->allocated);
+			if (err != rufl_OK)
+				return err;
+
+			path->verbs[path->verbs_used++] = verb;
+			memcpy(path->points + path->points_used, q + 1,
+					points * sizeof path->points[0]);
+			path->points_used += points;
+		}
+
+		p = q + 1;
+	}
+
+	return rufl_OK;
+}
+
+
+/**
+ * Empty a path before it is filled, and decide who owns its arrays.
+ *
+ * Arrays allocated by the library for an earlier call are reused and may be
+ * grown. Otherwise, if the caller provided any arrays, they are never grown or
+ * freed.
+ */
+
+void rufl_path_start(struct rufl_path *path)
+{
+	path->verbs_used = 0;
+	path->points_used = 0;
+	path->glyphs_used = 0;
+	if (!path->allocated)
+		path->allocated = !path->verbs && !path->points &&
+				!path->glyphs;
+}
+
+
+/**
+ * Ensure an array in a struct rufl_path has space for a number of elements.
+ *
+ * \param  array         array to grow
+ * \param  size          capacity of array, updated if grown
+ * \param  needed        number of elements required
+ * \param  element_size  size of each element
+ * \param  allocated     the library allocated the array, so may grow it
+ * \return  rufl_OK, or rufl_OUT_OF_MEMORY if memory was exhausted or a
+ *          caller provided array is full
+ */
+
+rufl_code rufl_path_reserve(void **array, size_t *size,
+		size_t needed, size_t element_size, bool allocated)
+{
+	void *array2;
+	size_t size2;
+
+	if (needed <= *size)
+		return rufl_OK;
+	if (!allocated)
+		return rufl_OUT_OF_MEMORY;
+
+	size2 = *size ? *size * 2 : 64;
+	if (size2 < needed)
+		size2 = needed;
+	array2 = realloc(*array, size2 * element_size);
+	if (!array2)
+		return rufl_OUT_OF_MEMORY;
+	*array = array2;
+	*size = size2;
 
 	return rufl_OK;
 }
+
+
+/**
+ * Free the decomposition buffer and forget size estimates.
+ */
+
+void rufl_decompose_quit(void)
+{
+	free(rufl_decompose_buffer);
+	rufl_decompose_buffer = 0;
+	rufl_decompose_buffer_size = 0;
+	memset(rufl_decompose_estimates, 0, sizeof rufl_decompose_estimates);
+}
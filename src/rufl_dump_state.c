@@ -15,12 +15,15 @@ static void rufl_dump_substitution_table(void);
 
 
 /**
- * Dump the internal library state to stdout.
+ * Dump the internal state of a context to stdout.
  */
 
-void rufl_dump_state(void)
+void rufl_ctx_dump_state(struct rufl_context *ctx)
 {
 	unsigned int i, j;
+	struct rufl_outer outer;
+
+	rufl_context_enter(ctx, outer);
 
 	printf("rufl_font_list:\n");
 	for (i = 0; i != rufl_font_list_entries; i++) {
@@ -66,6 +69,14 @@ void rufl_dump_state(void)
 
 	printf("rufl_substitution_table:\n");
 	rufl_dump_substitution_table();
+
+#ifdef RUFL_PROFILE
+	rufl_latency_dump();
+#endif
+
+	rufl_log_dump();
+
+	rufl_context_leave(outer);
 }
 
 
@@ -98,26 +98,14 @@ rufl_code rufl_find_font(unsigned int font, unsigned int font_size,
 
 	assert(fhandle != NULL);
 
-	for (i = 0; i != rufl_CACHE_SIZE; i++) {
-		/* Comparing pointers for the encoding is fine, as the 
-		 * encoding string passed to us is either:
-		 *
-		 *    a) NULL
-		 * or b) statically allocated
-		 * or c) resides in the font's umap, which is constant
-		 *       for the lifetime of the application.
-		 */
-		if (rufl_cache[i].font == font &&
-				rufl_cache[i].size == font_size &&
-				rufl_cache[i].encoding == encoding)
-			break;
-	}
+	i = rufl_cache_lookup(font, font_size, encoding);
 	if (i != rufl_CACHE_SIZE) {
 		/* found in cache */
 		f = rufl_cache[i].f;
-		rufl_cache[i].last_used = rufl_cache_time++;
+		rufl_trace(rufl_TRACE_CACHE_HIT, font, font_size, 0, 0);
 	} else {
 		/* not found */
+		rufl_trace(rufl_TRACE_CACHE_MISS, font, font_size, 0, 0);
 		if (font == rufl_CACHE_CORPUS) {
 			if (encoding)
 				snprintf(font_name, sizeof font_name,
@@ -136,10 +124,11 @@ rufl_code rufl_find_font(unsigned int font, unsigned int font_size,
 					rufl_font_list[font].identifier);
 		}
 
+		rufl_fm_count(rufl_FM_FIND_FONT);
 		rufl_fm_error = xfont_find_font(font_name,
 				font_size, font_size, 0, 0, &f, 0, 0);
 		if (rufl_fm_error) {
-			LOG("xfont_find_font: 0x%x: %s",
+			LOG_ERROR("xfont_find_font: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
 			return rufl_FONT_MANAGER_ERROR;
@@ -171,31 +160,141 @@ int rufl_family_list_cmp(const void *keyval, const void *datum)
 rufl_code rufl_place_in_cache(unsigned int font, unsigned int font_size,
 		const char *encoding, font_f f)
 {
-	unsigned int i;
-	unsigned int max_age = 0;
-	unsigned int evict = 0;
+	unsigned int evict;
 
-	for (i = 0; i != rufl_CACHE_SIZE; i++) {
-		if (rufl_cache[i].font == rufl_CACHE_NONE) {
-			evict = i;
-			break;
-		} else if (max_age < rufl_cache_time -
-				rufl_cache[i].last_used) {
-			max_age = rufl_cache_time -
-					rufl_cache[i].last_used;
-			evict = i;
-		}
-	}
+	evict = rufl_cache_victim();
 	if (rufl_cache[evict].font != rufl_CACHE_NONE) {
+		rufl_trace(rufl_TRACE_CACHE_EVICT, rufl_cache[evict].font,
+				rufl_cache[evict].size, 0, 0);
+		rufl_fm_count(rufl_FM_LOSE_FONT);
 		rufl_fm_error = xfont_lose_font(rufl_cache[evict].f);
 		if (rufl_fm_error)
 			return rufl_FONT_MANAGER_ERROR;
 	}
-	rufl_cache[evict].font = font;
-	rufl_cache[evict].size = font_size;
-	rufl_cache[evict].encoding = encoding;
-	rufl_cache[evict].f = f;
-	rufl_cache[evict].last_used = rufl_cache_time++;
+	rufl_cache_fill(evict, font, font_size, encoding, f);
 
 	return rufl_OK;
 }
+
+
+/**
+ * Look up a font in the recent-use cache, marking it as used if present.
+ *
+ * \param  font       font number, or rufl_CACHE_CORPUS
+ * \param  font_size  font size
+ * \param  encoding   font encoding, or NULL
+ * \return  slot in rufl_cache, or rufl_CACHE_SIZE if not present
+ *
+ * Under rufl_CACHE_POLICY_SLRU, an entry which is used again while in the
+ * probationary segment is promoted to the protected segment. If that makes
+ * the protected segment too large, its least recently used entry is demoted
+ * back to probation (but keeps its handle).
+ */
+
+unsigned int rufl_cache_lookup(unsigned int font, unsigned int font_size,
+		const char *encoding)
+{
+	unsigned int i, j;
+	unsigned int protected = 0;
+	unsigned int max_age = 0;
+	unsigned int demote = rufl_CACHE_SIZE;
+
+	for (i = 0; i != rufl_CACHE_SIZE; i++) {
+		/* Comparing pointers for the encoding is fine, as the 
+		 * encoding string passed to us is either:
+		 *
+		 *    a) NULL
+		 * or b) statically allocated
+		 * or c) resides in the font's umap, which is constant
+		 *       for the lifetime of the application.
+		 */
+		if (rufl_cache[i].font == font &&
+				rufl_cache[i].size == font_size &&
+				rufl_cache[i].encoding == encoding)
+			break;
+	}
+	if (i == rufl_CACHE_SIZE)
+		return i;
+
+	rufl_cache[i].last_used = rufl_cache_time++;
+
+	if (rufl_cache_policy != rufl_CACHE_POLICY_SLRU ||
+			rufl_cache[i].protected)
+		return i;
+
+	/* promote, and demote the oldest protected entry if over capacity */
+	rufl_cache[i].protected = true;
+	for (j = 0; j != rufl_CACHE_SIZE; j++) {
+		if (rufl_cache[j].font == rufl_CACHE_NONE ||
+				!rufl_cache[j].protected)
+			continue;
+		protected++;
+		if (max_age < rufl_cache_time - rufl_cache[j].last_used) {
+			max_age = rufl_cache_time - rufl_cache[j].last_used;
+			demote = j;
+		}
+	}
+	if (rufl_CACHE_PROTECTED < protected && demote != rufl_CACHE_SIZE)
+		rufl_cache[demote].protected = false;
+
+	return i;
+}
+
+
+/**
+ * Choose a slot in the recent-use cache to be reused for a new entry.
+ *
+ * \return  slot in rufl_cache
+ *
+ * An empty slot is used if there is one. Otherwise the least recently used
+ * entry is chosen, considering only the probationary segment under
+ * rufl_CACHE_POLICY_SLRU (unless it is empty).
+ */
+
+unsigned int rufl_cache_victim(void)
+{
+	unsigned int i;
+	unsigned int age;
+	unsigned int max_age = 0, max_age_probation = 0;
+	unsigned int evict = 0, evict_probation = rufl_CACHE_SIZE;
+
+	for (i = 0; i != rufl_CACHE_SIZE; i++) {
+		if (rufl_cache[i].font == rufl_CACHE_NONE)
+			return i;
+		age = rufl_cache_time - rufl_cache[i].last_used;
+		if (max_age < age) {
+			max_age = age;
+			evict = i;
+		}
+		if (!rufl_cache[i].protected && (max_age_probation < age ||
+				evict_probation == rufl_CACHE_SIZE)) {
+			max_age_probation = age;
+			evict_probation = i;
+		}
+	}
+
+	if (rufl_cache_policy == rufl_CACHE_POLICY_SLRU &&
+			evict_probation != rufl_CACHE_SIZE)
+		return evict_probation;
+
+	return evict;
+}
+
+
+/**
+ * Store a font handle in a slot of the recent-use cache.
+ *
+ * The slot must be empty, or its previous handle already lost. The new entry
+ * starts in the probationary segment.
+ */
+
+void rufl_cache_fill(unsigned int slot, unsigned int font,
+		unsigned int font_size, const char *encoding, font_f f)
+{
+	rufl_cache[slot].font = font;
+	rufl_cache[slot].size = font_size;
+	rufl_cache[slot].encoding = encoding;
+	rufl_cache[slot].f = f;
+	rufl_cache[slot].protected = false;
+	rufl_cache[slot].last_used = rufl_cache_time++;
+}
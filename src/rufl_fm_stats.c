@@ -0,0 +1,55 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <string.h>
+#include "rufl_internal.h"
+
+
+rufl_THREAD_LOCAL struct rufl_fm_stats rufl_fm_stats;
+rufl_THREAD_LOCAL rufl_api rufl_api_current = rufl_API_NONE;
+
+
+/**
+ * Read the Font Manager call statistics.
+ *
+ * \param  stats  updated to current statistics
+ */
+
+void rufl_fm_get_stats(struct rufl_fm_stats *stats)
+{
+	*stats = rufl_fm_stats;
+}
+
+
+/**
+ * Reset the Font Manager call statistics to 0.
+ */
+
+void rufl_fm_reset_stats(void)
+{
+	memset(&rufl_fm_stats, 0, sizeof rufl_fm_stats);
+}
+
+
+/**
+ * Count the Font Manager calls made by a public function.
+ *
+ * \param  stats  statistics from rufl_fm_get_stats()
+ * \param  api    public function
+ * \return  number of SWIs called
+ */
+
+unsigned long rufl_fm_stats_total(const struct rufl_fm_stats *stats,
+		rufl_api api)
+{
+	unsigned long total = 0;
+	unsigned int i;
+
+	for (i = 0; i != rufl_FM_COUNT; i++)
+		total += stats->swis[api][i];
+
+	return total;
+}
@@ -0,0 +1,193 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <stdlib.h>
+#include "rufl_internal.h"
+
+
+/** Number of hash chains. */
+#define rufl_GLYPH_CACHE_BUCKETS 1024
+
+/** Key of an entry in the glyph metrics cache. */
+struct rufl_glyph_cache_key {
+	/** Font number (index in rufl_font_list). */
+	unsigned int font;
+	/** Font size. */
+	unsigned int size;
+	/** Unicode value. */
+	unsigned int u;
+};
+
+/** An entry in the glyph metrics cache. */
+struct rufl_glyph_cache_entry {
+	/** Links in the cache. */
+	struct rufl_lru_entry lru;
+	/** Font, size, and character of glyph. */
+	struct rufl_glyph_cache_key key;
+	/** Metrics of glyph. */
+	struct rufl_glyph_cache_metrics metrics;
+};
+
+/** The glyph metrics cache. */
+#define rufl_glyph_cache (rufl_context_current->glyph_cache)
+
+
+static unsigned int rufl_glyph_cache_hash(const void *key);
+static const void *rufl_glyph_cache_key(const struct rufl_lru_entry *entry);
+static size_t rufl_glyph_cache_entry_size(
+		const struct rufl_lru_entry *entry);
+
+
+const struct rufl_lru_type rufl_glyph_cache_type = {
+	rufl_GLYPH_CACHE_BUCKETS,
+	sizeof (struct rufl_glyph_cache_key),
+	rufl_glyph_cache_hash,
+	rufl_glyph_cache_key,
+	rufl_glyph_cache_entry_size,
+	0
+};
+
+
+/**
+ * Look up the metrics of a glyph in the cache.
+ *
+ * \param  font     font number
+ * \param  size     font size
+ * \param  u        Unicode value
+ * \param  metrics  updated to metrics, if found
+ * \return  true if found
+ */
+
+bool rufl_glyph_cache_get(unsigned int font, unsigned int size,
+		unsigned int u, struct rufl_glyph_cache_metrics *metrics)
+{
+	struct rufl_glyph_cache_key key = { font, size, u };
+	struct rufl_glyph_cache_entry *entry;
+
+	entry = (struct rufl_glyph_cache_entry *)
+			rufl_lru_get(&rufl_glyph_cache, &key);
+	if (!entry) {
+		rufl_context_current->glyph_cache_misses++;
+		return false;
+	}
+
+	*metrics = entry->metrics;
+	rufl_context_current->glyph_cache_hits++;
+	return true;
+}
+
+
+/**
+ * Add the metrics of a glyph to the cache.
+ *
+ * \param  font     font number
+ * \param  size     font size
+ * \param  u        Unicode value
+ * \param  metrics  metrics of glyph
+ *
+ * Least recently used entries are discarded to keep within the budget. If
+ * memory is exhausted, the metrics are simply not cached.
+ */
+
+void rufl_glyph_cache_put(unsigned int font, unsigned int size,
+		unsigned int u, const struct rufl_glyph_cache_metrics *metrics)
+{
+	struct rufl_glyph_cache_entry *entry;
+
+	if (rufl_glyph_cache.budget < sizeof *entry)
+		return;
+
+	entry = malloc(sizeof *entry);
+	if (!entry)
+		return;
+	entry->key.font = font;
+	entry->key.size = size;
+	entry->key.u = u;
+	entry->metrics = *metrics;
+
+	if (!rufl_lru_put(&rufl_glyph_cache, &entry->lru))
+		free(entry);
+}
+
+
+/**
+ * Discard all entries in the cache and free its memory.
+ */
+
+void rufl_glyph_cache_clear(void)
+{
+	rufl_lru_clear(&rufl_glyph_cache);
+}
+
+
+/**
+ * Set the memory budget of the glyph metrics cache.
+ *
+ * \param  bytes  maximum memory used by entries, or 0 to disable the cache
+ */
+
+void rufl_ctx_glyph_cache_set_budget(struct rufl_context *ctx, size_t bytes)
+{
+	struct rufl_outer outer;
+
+	rufl_context_enter(ctx, outer);
+
+	rufl_lru_set_budget(&rufl_glyph_cache, bytes);
+
+	rufl_context_leave(outer);
+}
+
+
+/**
+ * Read the statistics of the glyph metrics cache.
+ *
+ * \param  stats  updated to current statistics
+ */
+
+void rufl_ctx_glyph_cache_get_stats(struct rufl_context *ctx,
+		struct rufl_glyph_cache_stats *stats)
+{
+	stats->budget = ctx->glyph_cache.budget;
+	stats->used = ctx->glyph_cache.used;
+	stats->entries = ctx->glyph_cache.entries;
+	stats->hits = ctx->glyph_cache_hits;
+	stats->misses = ctx->glyph_cache_misses;
+	stats->evictions = ctx->glyph_cache.evictions;
+}
+
+
+/**
+ * Reset the hit, miss, and eviction counts of the glyph metrics cache.
+ */
+
+void rufl_ctx_glyph_cache_reset_stats(struct rufl_context *ctx)
+{
+	ctx->glyph_cache_hits = 0;
+	ctx->glyph_cache_misses = 0;
+	ctx->glyph_cache.evictions = 0;
+}
+
+
+unsigned int rufl_glyph_cache_hash(const void *key)
+{
+	const struct rufl_glyph_cache_key *k = key;
+
+	return (k->font * 31 + k->size) * 0x9e3779b1u ^ k->u;
+}
+
+
+const void *rufl_glyph_cache_key(const struct rufl_lru_entry *entry)
+{
+	return &((const struct rufl_glyph_cache_entry *) entry)->key;
+}
+
+
+size_t rufl_glyph_cache_entry_size(const struct rufl_lru_entry *entry)
+{
+	(void) entry;
+
+	return sizeof (struct rufl_glyph_cache_entry);
+}
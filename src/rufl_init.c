@@ -21,22 +21,53 @@
 #include <oslib/taskwindow.h>
 #include <oslib/wimp.h>
 #include <oslib/wimpreadsysinfo.h>
+#ifdef RUFL_HOST
+#include <pthread.h>
+#include <unistd.h>
+#endif
 #include "rufl_internal.h"
 
 
-struct rufl_font_list_entry *rufl_font_list = 0;
-size_t rufl_font_list_entries = 0;
-const char **rufl_family_list = 0;
-unsigned int rufl_family_list_entries = 0;
-struct rufl_family_map_entry *rufl_family_map = 0;
-os_error *rufl_fm_error = 0;
-void *rufl_family_menu = 0;
-unsigned short *rufl_substitution_table = 0;
-struct rufl_cache_entry rufl_cache[rufl_CACHE_SIZE];
-int rufl_cache_time = 0;
+rufl_cache_policy_type rufl_cache_policy = rufl_CACHE_POLICY_SLRU;
 bool rufl_old_font_manager = false;
 wimp_w rufl_status_w = 0;
 char rufl_status_buffer[80];
+void (*rufl_init_phase_hook)(const char *phase) = 0;
+
+#ifdef RUFL_HOST
+unsigned int rufl_scan_threads = 0;
+
+/** A thread scanning fonts, and the fonts it has yet to scan. */
+struct rufl_scan_worker {
+	pthread_t thread;
+	/** The thread was started (worker 0 is the calling thread). */
+	bool started;
+	unsigned int index;
+	struct rufl_scan_pool *pool;
+	/** Protects next and end, which other workers steal from. */
+	pthread_mutex_t lock;
+	/** Positions in pool->fonts still to scan. */
+	size_t next, end;
+	/** Context for the Font Manager errors of the worker, sharing the
+	 * font list being initialised. */
+	struct rufl_context ctx;
+	/** Font Manager call statistics of the worker's thread. */
+	struct rufl_fm_stats stats;
+};
+
+/** Fonts to scan in parallel, and the results. */
+struct rufl_scan_pool {
+	/** Indices of fonts to scan, ascending. */
+	unsigned int *fonts;
+	/** Result of scanning each font in fonts. */
+	rufl_code *codes;
+	size_t count;
+	struct rufl_scan_worker *workers;
+	unsigned int worker_count;
+	/** Public function the scan is counted against. */
+	rufl_api api;
+};
+#endif
 
 /** An entry in rufl_weight_table. */
 struct rufl_weight_table_entry {
@@ -68,12 +99,20 @@ const struct rufl_weight_table_entry rufl_weight_table[] = {
 };
 
 
+static rufl_code rufl_init_library(void);
 static rufl_code rufl_init_font_list(void);
 static rufl_code rufl_init_add_font(const char *identifier, 
 		const char *local_name);
 static int rufl_weight_table_cmp(const void *keyval, const void *datum);
 static rufl_code rufl_init_scan_font(unsigned int font);
 static rufl_code rufl_init_scan_font_no_enumerate(unsigned int font);
+#ifdef RUFL_HOST
+static void rufl_init_scan_parallel(unsigned int *first,
+		unsigned int *changes);
+static void *rufl_init_scan_worker(void *p);
+static bool rufl_init_scan_take(struct rufl_scan_worker *worker,
+		size_t *position);
+#endif
 static bool rufl_is_space(unsigned int u);
 static rufl_code rufl_init_scan_font_old(unsigned int font_index);
 static rufl_code rufl_init_scan_font_in_encoding(const char *font_name, 
@@ -81,29 +120,45 @@ static rufl_code rufl_init_scan_font_in_encoding(const char *font_name,
 		struct rufl_unicode_map *umap, unsigned int *last);
 static rufl_code rufl_init_read_encoding(font_f font,
 		struct rufl_unicode_map *umap);
-static int rufl_glyph_map_cmp(const void *keyval, const void *datum);
 static int rufl_unicode_map_cmp(const void *z1, const void *z2);
 static rufl_code rufl_init_substitution_table(void);
-static rufl_code rufl_save_cache(void);
 static rufl_code rufl_load_cache(void);
 static int rufl_font_list_cmp(const void *keyval, const void *datum);
 static rufl_code rufl_init_family_menu(void);
 static void rufl_init_status_open(void);
 static void rufl_init_status(const char *status, float progress);
 static void rufl_init_status_close(void);
+static void rufl_init_phase(const char *phase);
 
 
 /**
- * Initialise RUfl.
+ * Initialise a context, for rufl_init() and rufl_ctx_create().
  *
  * All available fonts are scanned. May take some time.
  */
 
-rufl_code rufl_init(void)
+rufl_code rufl_init_context(struct rufl_context *ctx)
+{
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_INIT, outer);
+	code = rufl_init_library();
+	rufl_api_leave(outer);
+
+	return code;
+}
+
+
+/**
+ * Scan the fonts and load or save the cache, for rufl_init().
+ */
+
+rufl_code rufl_init_library(void)
 {
 	bool rufl_broken_font_enumerate_characters = false;
 	unsigned int changes = 0;
-	unsigned int i;
+	unsigned int i, j;
 	int fm_version;
 	rufl_code code;
 	font_f font;
@@ -113,21 +168,32 @@ rufl_code rufl_init(void)
 		/* already initialized */
 		return rufl_OK;
 
+	for (i = 0; i != rufl_OUTPUT_COUNT; i++) {
+		for (j = 0; j != rufl_CACHE_SIZE; j++) {
+			rufl_cache_pool[i][j].font = rufl_CACHE_NONE;
+			rufl_cache_pool[i][j].protected = false;
+		}
+	}
+	rufl_cache = rufl_cache_pool[rufl_OUTPUT_SCREEN];
+
+	rufl_init_phase("detect");
+
 	xhourglass_on();
 
 	rufl_init_status_open();
 
 	/* determine if the font manager supports Unicode */
+	rufl_fm_count(rufl_FM_FIND_FONT);
 	rufl_fm_error = xfont_find_font("Homerton.Medium\\EUTF8", 160, 160,
 			0, 0, &font, 0, 0);
 	if (rufl_fm_error) {
 		if (rufl_fm_error->errnum == error_FONT_ENCODING_NOT_FOUND) {
 			rufl_old_font_manager = true;
 		} else {
-			LOG("xfont_find_font: 0x%x: %s",
+			LOG_ERROR("xfont_find_font: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
-			rufl_quit();
+			rufl_ctx_quit(rufl_context_current);
 			xhourglass_off();
 			return rufl_FONT_MANAGER_ERROR;
 		}
@@ -135,6 +201,7 @@ rufl_code rufl_init(void)
 		/* New font manager; see if character enumeration works */
 		int next;
 
+		rufl_fm_count(rufl_FM_ENUMERATE_CHARACTERS);
 		rufl_fm_error = xfont_enumerate_characters(font, 0, 
 				&next, NULL);
 		/* Broken if SWI fails or it doesn't return 0x20 as the first
@@ -149,13 +216,15 @@ rufl_code rufl_init(void)
 		if (rufl_fm_error || next != 0x20)
 			rufl_broken_font_enumerate_characters = true;
 
+		rufl_fm_count(rufl_FM_LOSE_FONT);
 		xfont_lose_font(font);
 	}
 
 	/* test if the font manager supports background blending */
+	rufl_fm_count(rufl_FM_CACHE_ADDR);
 	rufl_fm_error = xfont_cache_addr(&fm_version, 0, 0);
 	if (rufl_fm_error) {
-		LOG("xfont_cache_addr: 0x%x: %s",
+		LOG_ERROR("xfont_cache_addr: 0x%x: %s",
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
@@ -163,39 +232,50 @@ rufl_code rufl_init(void)
 	if (fm_version >= 335)
 		rufl_can_background_blend = true;
 
-	LOG("%s font manager (v %d.%d)%s",
+	LOG_INFO("%s font manager (v %d.%d)%s",
 		rufl_old_font_manager ? "old" : "new",
 		fm_version / 100, fm_version % 100,
 		rufl_broken_font_enumerate_characters ? " (broken fec)" : "");
 
+	rufl_init_phase("font_list");
 	code = rufl_init_font_list();
 	if (code != rufl_OK) {
-		LOG("rufl_init_font_list: 0x%x", code);
-		rufl_quit();
+		LOG_ERROR("rufl_init_font_list: 0x%x", code);
+		rufl_ctx_quit(rufl_context_current);
 		xhourglass_off();
 		return code;
 	}
-	LOG("%zu faces, %u families", rufl_font_list_entries,
+	LOG_INFO("%zu faces, %u families", rufl_font_list_entries,
 			rufl_family_list_entries);
 
+	rufl_init_phase("load_cache");
 	code = rufl_load_cache();
 	if (code != rufl_OK) {
-		LOG("rufl_load_cache: 0x%x", code);
-		rufl_quit();
+		LOG_ERROR("rufl_load_cache: 0x%x", code);
+		rufl_ctx_quit(rufl_context_current);
 		xhourglass_off();
 		return code;
 	}
 
+	rufl_init_phase("scan");
 	xhourglass_leds(1, 0, 0);
-	for (i = 0; i != rufl_font_list_entries; i++) {
+	i = 0;
+#ifdef RUFL_HOST
+	/* fonts from the first failure on are scanned again below, so that
+	 * the error is reported as by a sequential scan */
+	if (!rufl_old_font_manager && !rufl_broken_font_enumerate_characters)
+		rufl_init_scan_parallel(&i, &changes);
+#endif
+	for (; i != rufl_font_list_entries; i++) {
 		if (rufl_font_list[i].charset) {
 			/* character set loaded from cache */
 			continue;
 		}
-		LOG("scanning %u \"%s\"", i, rufl_font_list[i].identifier);
+		LOG_DEBUG("scanning %u \"%s\"", i, rufl_font_list[i].identifier);
 		xhourglass_percentage(100 * i / rufl_font_list_entries);
 		rufl_init_status(rufl_font_list[i].identifier,
 				(float) i / rufl_font_list_entries);
+		rufl_trace(rufl_TRACE_SCAN, i, 0, rufl_font_list_entries, 0);
 		if (rufl_old_font_manager)
 			code = rufl_init_scan_font_old(i);
 		else if (rufl_broken_font_enumerate_characters)
@@ -203,44 +283,44 @@ rufl_code rufl_init(void)
 		else
 			code = rufl_init_scan_font(i);
 		if (code != rufl_OK) {
-			LOG("rufl_init_scan_font: 0x%x", code);
-			rufl_quit();
+			LOG_ERROR("rufl_init_scan_font: 0x%x", code);
+			rufl_ctx_quit(rufl_context_current);
 			xhourglass_off();
 			return code;
 		}
 		changes++;
 	}
 
+	rufl_init_phase("substitution_table");
 	xhourglass_leds(2, 0, 0);
 	xhourglass_colours(0x0000ff, 0x00ffff, &old_sand, &old_glass);
 	code = rufl_init_substitution_table();
 	if (code != rufl_OK) {
-		LOG("rufl_init_substitution_table: 0x%x", code);
-		rufl_quit();
+		LOG_ERROR("rufl_init_substitution_table: 0x%x", code);
+		rufl_ctx_quit(rufl_context_current);
 		xhourglass_off();
 		return code;
 	}
 	xhourglass_colours(old_sand, old_glass, 0, 0);
 
 	if (changes) {
-		LOG("%u new charsets", changes);
+		LOG_INFO("%u new charsets", changes);
+		rufl_init_phase("save_cache");
 		xhourglass_leds(3, 0, 0);
 		code = rufl_save_cache();
 		if (code != rufl_OK) {
-			LOG("rufl_save_cache: 0x%x", code);
-			rufl_quit();
+			LOG_ERROR("rufl_save_cache: 0x%x", code);
+			rufl_ctx_quit(rufl_context_current);
 			xhourglass_off();
 			return code;
 		}
 	}
 
-	for (i = 0; i != rufl_CACHE_SIZE; i++)
-		rufl_cache[i].font = rufl_CACHE_NONE;
-
+	rufl_init_phase("family_menu");
 	code = rufl_init_family_menu();
 	if (code != rufl_OK) {
-		LOG("rufl_init_family_menu: 0x%x", code);
-		rufl_quit();
+		LOG_ERROR("rufl_init_family_menu: 0x%x", code);
+		rufl_ctx_quit(rufl_context_current);
 		xhourglass_off();
 		return code;
 	}
@@ -249,10 +329,23 @@ rufl_code rufl_init(void)
 
 	xhourglass_off();
 
+	rufl_init_phase(0);
+
 	return rufl_OK;
 }
 
 
+/**
+ * Report the start of a phase of rufl_init() to rufl_init_phase_hook.
+ */
+
+void rufl_init_phase(const char *phase)
+{
+	if (rufl_init_phase_hook)
+		rufl_init_phase_hook(phase);
+}
+
+
 /**
  * Build list of font in rufl_font_list and list of font families
  * in rufl_family_list.
@@ -266,6 +359,7 @@ rufl_code rufl_init_font_list(void)
 
 	while (context != -1) {
 		/* read identifier */
+		rufl_fm_count(rufl_FM_LIST_FONTS);
 		rufl_fm_error = xfont_list_fonts((byte *)identifier,
 				font_RETURN_FONT_NAME |
 				font_RETURN_LOCAL_FONT_NAME |
@@ -274,7 +368,7 @@ rufl_code rufl_init_font_list(void)
 				(byte *)local_name, sizeof local_name, 0,
 				&context, 0, 0);
 		if (rufl_fm_error) {
-			LOG("xfont_list_fonts: 0x%x: %s",
+			LOG_ERROR("xfont_list_fonts: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
 			return rufl_FONT_MANAGER_ERROR;
@@ -284,7 +378,7 @@ rufl_code rufl_init_font_list(void)
 
 		code = rufl_init_add_font(identifier, local_name);
 		if (code != rufl_OK) {
-			LOG("rufl_init_add_font: 0x%x", code);
+			LOG_ERROR("rufl_init_add_font: 0x%x", code);
 			return code;
 		}
 	}
@@ -315,7 +409,7 @@ rufl_code rufl_init_add_font(const char *identifier, const char *local_name)
 	rufl_fm_error = xosfscontrol_canonicalise_path(identifier, 0,
 			"Font$Path", 0, 0, &size);
 	if (rufl_fm_error) {
-		LOG("xosfscontrol_canonicalise_path(\"%s\", ...): 0x%x: %s",
+		LOG_ERROR("xosfscontrol_canonicalise_path(\"%s\", ...): 0x%x: %s",
 				identifier,
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
@@ -329,14 +423,14 @@ rufl_code rufl_init_add_font(const char *identifier, const char *local_name)
 	rufl_fm_error = xosfscontrol_canonicalise_path(identifier,
 			fullpath, "Font$Path", 0, size, 0);
 	if (rufl_fm_error) {
-		LOG("xosfscontrol_canonicalise_path(\"%s\", ...): 0x%x: %s",
+		LOG_ERROR("xosfscontrol_canonicalise_path(\"%s\", ...): 0x%x: %s",
 				identifier,
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
 		return rufl_OK;
 	}
 
-	/* LOG("%s", fullpath); */
+	/* LOG_DEBUG("%s", fullpath); */
 
 	if (strstr(fullpath, "RiScript") || strstr(fullpath, "!TeXFonts"))
 		/* Ignore this font */
@@ -353,6 +447,9 @@ rufl_code rufl_init_add_font(const char *identifier, const char *local_name)
 		return rufl_OUT_OF_MEMORY;
 	rufl_font_list[rufl_font_list_entries].charset = 0;
 	rufl_font_list[rufl_font_list_entries].umap = 0;
+	rufl_font_list[rufl_font_list_entries].lookup = 0;
+	rufl_font_list[rufl_font_list_entries].metrics = rufl_METRICS_UNKNOWN;
+	rufl_font_list[rufl_font_list_entries].bbox_known = false;
 	rufl_font_list_entries++;
 
 	/* determine family, weight, and slant */
@@ -453,7 +550,7 @@ rufl_code rufl_init_scan_font(unsigned int font_index)
 	font_f font;
 	font_scan_block block = { { 0, 0 }, { 0, 0 }, -1, { 0, 0, 0, 0 } };
 
-	/*LOG("font %u \"%s\"", font_index,
+	/*LOG_DEBUG("font %u \"%s\"", font_index,
 			rufl_font_list[font_index].identifier);*/
 
 	charset = calloc(1, sizeof *charset);
@@ -465,9 +562,10 @@ rufl_code rufl_init_scan_font(unsigned int font_index)
 	snprintf(font_name, sizeof font_name, "%s\\EUTF8",
 			rufl_font_list[font_index].identifier);
 
+	rufl_fm_count(rufl_FM_FIND_FONT);
 	rufl_fm_error = xfont_find_font(font_name, 160, 160, 0, 0, &font, 0, 0);
 	if (rufl_fm_error) {
-		LOG("xfont_find_font(\"%s\"): 0x%x: %s", font_name,
+		LOG_ERROR("xfont_find_font(\"%s\"): 0x%x: %s", font_name,
 				rufl_fm_error->errnum, rufl_fm_error->errmess);
 		free(charset);
 		return rufl_OK;
@@ -477,14 +575,16 @@ rufl_code rufl_init_scan_font(unsigned int font_index)
 	for (u = 0; u != (unsigned int) -1; u = next) {
 		unsigned int internal;
 
+		rufl_fm_count(rufl_FM_ENUMERATE_CHARACTERS);
 		rufl_fm_error = xfont_enumerate_characters(font, u, 
 				(int *) &next, (int *) &internal);
 		if (rufl_fm_error) {
-			LOG("xfont_enumerate_characters(\"%s\", "
+			LOG_ERROR("xfont_enumerate_characters(\"%s\", "
 			    "U+%x, ...): 0x%x: %s",
 					font_name, u,
 					rufl_fm_error->errnum, 
 					rufl_fm_error->errmess);
+			rufl_fm_count(rufl_FM_LOSE_FONT);
 			xfont_lose_font(font);
 			free(charset);
 			return rufl_OK;
@@ -507,6 +607,7 @@ rufl_code rufl_init_scan_font(unsigned int font_index)
 
 		/* Character is mapped, let's see if it's really there */
 		string[0] = u;
+		rufl_fm_count(rufl_FM_SCAN_STRING);
 		rufl_fm_error = xfont_scan_string(font, (char *) string,
 				font_RETURN_BBOX | font_GIVEN32_BIT |
 				font_GIVEN_FONT | font_GIVEN_LENGTH |
@@ -545,11 +646,12 @@ rufl_code rufl_init_scan_font(unsigned int font_index)
 		}
 	}
 
+	rufl_fm_count(rufl_FM_LOSE_FONT);
 	xfont_lose_font(font);
 
 	if (rufl_fm_error) {
 		free(charset);
-		LOG("xfont_scan_string(\"%s\", U+%x, ...): 0x%x: %s",
+		LOG_ERROR("xfont_scan_string(\"%s\", U+%x, ...): 0x%x: %s",
 				font_name, u,
 				rufl_fm_error->errnum, rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
@@ -563,14 +665,14 @@ rufl_code rufl_init_scan_font(unsigned int font_index)
 		bit = 0xff;
 
 		for (byte = 0; byte != 32; byte++)
-			bit &= charset->block[u][byte];
+			bit &= charset->block[charset->index[u]][byte];
 
 		if (bit == 0xff) {
 			/* Block is full */
-			charset->index[u] = BLOCK_FULL;
-
 			for (byte = 0; byte != 32; byte++)
-				charset->block[u][byte] = 0;
+				charset->block[charset->index[u]][byte] = 0;
+
+			charset->index[u] = BLOCK_FULL;
 		}
 	}
 
@@ -583,11 +685,197 @@ rufl_code rufl_init_scan_font(unsigned int font_index)
 		return rufl_OUT_OF_MEMORY;
 	}
 
-	rufl_font_list[font_index].charset = charset;
+	rufl_font_list[font_index].charset = charset2;
 
 	return rufl_OK;
 }
 
+#ifdef RUFL_HOST
+/**
+ * Scan the fonts which are not in the cache with rufl_init_scan_font(), using
+ * a work-stealing pool of one thread per processor.
+ *
+ * Each worker starts with an equal share of the fonts, in order, and steals
+ * half of the remaining share of another when it runs out. The scan of each
+ * font only writes its own font list entry, so the results do not depend on
+ * the order of scanning.
+ *
+ * \param  first    set to the first font which failed to scan, or the
+ *                  number of fonts; fonts before it have been scanned
+ * \param  changes  updated with the number of fonts scanned
+ */
+
+void rufl_init_scan_parallel(unsigned int *first, unsigned int *changes)
+{
+	struct rufl_scan_pool pool;
+	struct rufl_scan_worker *worker;
+	struct rufl_context *ctx = rufl_context_current;
+	unsigned int i, j, k, n;
+	size_t position;
+	long processors;
+
+	n = rufl_scan_threads;
+	if (n == 0) {
+		processors = sysconf(_SC_NPROCESSORS_ONLN);
+		n = processors < 1 ? 1 : (unsigned int) processors;
+	}
+
+	pool.count = 0;
+	for (i = 0; i != rufl_font_list_entries; i++)
+		if (!rufl_font_list[i].charset)
+			pool.count++;
+	if (pool.count < n)
+		n = pool.count;
+	if (n < 2)
+		/* nothing to gain: the sequential scan does it */
+		return;
+
+	pool.fonts = malloc(pool.count * sizeof *pool.fonts);
+	pool.codes = malloc(pool.count * sizeof *pool.codes);
+	pool.workers = calloc(n, sizeof *pool.workers);
+	if (!pool.fonts || !pool.codes || !pool.workers) {
+		free(pool.fonts);
+		free(pool.codes);
+		free(pool.workers);
+		return;
+	}
+	pool.worker_count = n;
+	pool.api = rufl_api_current;
+
+	for (i = 0, position = 0; i != rufl_font_list_entries; i++)
+		if (!rufl_font_list[i].charset)
+			pool.fonts[position++] = i;
+
+	for (i = 0; i != n; i++) {
+		worker = &pool.workers[i];
+		worker->index = i;
+		worker->pool = &pool;
+		pthread_mutex_init(&worker->lock, 0);
+		worker->next = pool.count * i / n;
+		worker->end = pool.count * (i + 1) / n;
+		worker->ctx = (struct rufl_context)
+				rufl_CONTEXT_INITIAL(worker->ctx);
+		worker->ctx.fonts = ctx->fonts;
+		worker->ctx.font_list = ctx->font_list;
+		worker->ctx.font_list_entries = ctx->font_list_entries;
+	}
+
+	/* this thread is worker 0; a worker which fails to start leaves its
+	 * fonts to be stolen */
+	for (i = 1; i != n; i++)
+		pool.workers[i].started = pthread_create(
+				&pool.workers[i].thread, 0,
+				rufl_init_scan_worker, &pool.workers[i]) == 0;
+	rufl_init_scan_worker(&pool.workers[0]);
+	rufl_context_current = ctx;
+
+	for (i = 1; i != n; i++) {
+		worker = &pool.workers[i];
+		if (!worker->started)
+			continue;
+		pthread_join(worker->thread, 0);
+		for (j = 0; j != rufl_API_COUNT; j++)
+			for (k = 0; k != rufl_FM_COUNT; k++)
+				rufl_fm_stats.swis[j][k] +=
+						worker->stats.swis[j][k];
+	}
+	for (i = 0; i != n; i++)
+		pthread_mutex_destroy(&pool.workers[i].lock);
+
+	*first = rufl_font_list_entries;
+	for (position = 0; position != pool.count; position++) {
+		if (pool.codes[position] == rufl_OK)
+			(*changes)++;
+		else if (*first == rufl_font_list_entries)
+			*first = pool.fonts[position];
+	}
+
+	free(pool.fonts);
+	free(pool.codes);
+	free(pool.workers);
+}
+
+
+/**
+ * Scan fonts until there are none left, for rufl_init_scan_parallel().
+ */
+
+void *rufl_init_scan_worker(void *p)
+{
+	struct rufl_scan_worker *worker = p;
+	struct rufl_scan_pool *pool = worker->pool;
+	unsigned int font;
+	size_t position;
+
+	rufl_context_current = &worker->ctx;
+	rufl_api_current = pool->api;
+
+	while (rufl_init_scan_take(worker, &position)) {
+		font = pool->fonts[position];
+		LOG_DEBUG("scanning %u \"%s\"", font,
+				rufl_font_list[font].identifier);
+		rufl_trace(rufl_TRACE_SCAN, font, 0, rufl_font_list_entries,
+				0);
+		pool->codes[position] = rufl_init_scan_font(font);
+	}
+
+	worker->stats = rufl_fm_stats;
+
+	return 0;
+}
+
+
+/**
+ * Take the next font for a worker to scan, stealing from another worker if
+ * its own share is done.
+ *
+ * \param  worker    worker wanting a font
+ * \param  position  updated to position of font in pool fonts
+ * \return  true, or false if all fonts have been taken
+ */
+
+bool rufl_init_scan_take(struct rufl_scan_worker *worker, size_t *position)
+{
+	struct rufl_scan_pool *pool = worker->pool;
+	struct rufl_scan_worker *victim;
+	size_t start, end;
+	unsigned int i;
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->next != worker->end) {
+		*position = worker->next++;
+		pthread_mutex_unlock(&worker->lock);
+		return true;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	for (i = 1; i != pool->worker_count; i++) {
+		victim = &pool->workers[(worker->index + i) %
+				pool->worker_count];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->next == victim->end) {
+			pthread_mutex_unlock(&victim->lock);
+			continue;
+		}
+		/* the back half, which the victim would reach last */
+		end = victim->end;
+		start = end - (end - victim->next + 1) / 2;
+		victim->end = start;
+		pthread_mutex_unlock(&victim->lock);
+
+		*position = start;
+		pthread_mutex_lock(&worker->lock);
+		worker->next = start + 1;
+		worker->end = end;
+		pthread_mutex_unlock(&worker->lock);
+		return true;
+	}
+
+	return false;
+}
+#endif
+
+
 /**
  * Scan a font for available characters (version without character enumeration)
  */
@@ -606,7 +894,7 @@ rufl_code rufl_init_scan_font_no_enumerate(unsigned int font_index)
 	font_f font;
 	font_scan_block block = { { 0, 0 }, { 0, 0 }, -1, { 0, 0, 0, 0 } };
 
-	/*LOG("font %u \"%s\"", font_index,
+	/*LOG_DEBUG("font %u \"%s\"", font_index,
  			rufl_font_list[font_index].identifier);*/
 
 	charset = calloc(1, sizeof *charset);
@@ -616,9 +904,10 @@ rufl_code rufl_init_scan_font_no_enumerate(unsigned int font_index)
 	snprintf(font_name, sizeof font_name, "%s\\EUTF8",
 			rufl_font_list[font_index].identifier);
 
+	rufl_fm_count(rufl_FM_FIND_FONT);
 	rufl_fm_error = xfont_find_font(font_name, 160, 160, 0, 0, &font, 0, 0);
 	if (rufl_fm_error) {
-		LOG("xfont_find_font(\"%s\"): 0x%x: %s", font_name,
+		LOG_ERROR("xfont_find_font(\"%s\"): 0x%x: %s", font_name,
 				rufl_fm_error->errnum, rufl_fm_error->errmess);
 		free(charset);
 		return rufl_OK;
@@ -636,6 +925,7 @@ rufl_code rufl_init_scan_font_no_enumerate(unsigned int font_index)
 			rufl_init_status(0, 0);
 
 		string[0] = u;
+		rufl_fm_count(rufl_FM_SCAN_STRING);
 		rufl_fm_error = xfont_scan_string(font, (char *) string,
 				font_RETURN_BBOX | font_GIVEN32_BIT |
 				font_GIVEN_FONT | font_GIVEN_LENGTH |
@@ -685,11 +975,12 @@ rufl_code rufl_init_scan_font_no_enumerate(unsigned int font_index)
 		}
 	}
 
+	rufl_fm_count(rufl_FM_LOSE_FONT);
 	xfont_lose_font(font);
 
 	if (rufl_fm_error) {
 		free(charset);
-		LOG("xfont_scan_string(\"%s\", U+%x, ...): 0x%x: %s",
+		LOG_ERROR("xfont_scan_string(\"%s\", U+%x, ...): 0x%x: %s",
 				font_name, u,
 				rufl_fm_error->errnum, rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
@@ -704,7 +995,7 @@ rufl_code rufl_init_scan_font_no_enumerate(unsigned int font_index)
 		return rufl_OUT_OF_MEMORY;
 	}
 
-	rufl_font_list[font_index].charset = charset;
+	rufl_font_list[font_index].charset = charset2;
 
 	return rufl_OK;
 }
@@ -738,7 +1029,7 @@ rufl_code rufl_init_scan_font_old(unsigned int font_index)
 	font_list_context context = 0;
 	char encoding[80];
 
-	/*LOG("font %u \"%s\"", font_index, font_name);*/
+	/*LOG_DEBUG("font %u \"%s\"", font_index, font_name);*/
 
 	charset = calloc(1, sizeof *charset);
 	if (!charset)
@@ -750,6 +1041,7 @@ rufl_code rufl_init_scan_font_old(unsigned int font_index)
 	while (context != -1) {
 		struct rufl_unicode_map *temp;
 
+		rufl_fm_count(rufl_FM_LIST_FONTS);
 		rufl_fm_error = xfont_list_fonts((byte *) encoding, 
 				font_RETURN_FONT_NAME |
 				0x400000 /* Return encoding name, instead */ |
@@ -757,7 +1049,7 @@ rufl_code rufl_init_scan_font_old(unsigned int font_index)
 				sizeof(encoding), NULL, 0, NULL, 
 				&context, NULL, NULL);
 		if (rufl_fm_error) {
-			LOG("xfont_list_fonts: 0x%x: %s",
+			LOG_ERROR("xfont_list_fonts: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
 			free(charset);
@@ -786,7 +1078,7 @@ rufl_code rufl_init_scan_font_old(unsigned int font_index)
 		code = rufl_init_scan_font_in_encoding(font_name, encoding,
 				charset, umap + (num_umaps - 1), &last_used);
 		if (code != rufl_OK) {
-			LOG("rufl_init_scan_font_in_encoding(\"%s\", \"%s\", "
+			LOG_ERROR("rufl_init_scan_font_in_encoding(\"%s\", \"%s\", "
 			    "...): 0x%x (0x%x: %s)",
 					font_name, encoding, code,
 					code == rufl_FONT_MANAGER_ERROR ?
@@ -850,7 +1142,7 @@ rufl_code rufl_init_scan_font_old(unsigned int font_index)
 		code = rufl_init_scan_font_in_encoding(font_name, NULL,
 				charset, umap, &last_used);
 		if (code != rufl_OK) {
-			LOG("rufl_init_scan_font_in_encoding(\"%s\", NULL, "
+			LOG_ERROR("rufl_init_scan_font_in_encoding(\"%s\", NULL, "
 			    "...): 0x%x (0x%x: %s)",
 					font_name, code,
 					code == rufl_FONT_MANAGER_ERROR ?
@@ -896,10 +1188,15 @@ rufl_code rufl_init_scan_font_old(unsigned int font_index)
 		return rufl_OUT_OF_MEMORY;
 	}
 
-	rufl_font_list[font_index].charset = charset;
+	rufl_font_list[font_index].charset = charset2;
 	rufl_font_list[font_index].umap = umap;
 	rufl_font_list[font_index].num_umaps = num_umaps;
 
+	rufl_font_list[font_index].lookup = rufl_unicode_lookup_create(umap,
+			num_umaps);
+	if (!rufl_font_list[font_index].lookup)
+		return rufl_OUT_OF_MEMORY;
+
 	return rufl_OK;
 }
 
@@ -928,17 +1225,19 @@ rufl_code rufl_init_scan_font_in_encoding(const char *font_name,
 	else
 		snprintf(buf, sizeof buf, "%s", font_name);
 
+	rufl_fm_count(rufl_FM_FIND_FONT);
 	rufl_fm_error = xfont_find_font(buf, 160, 160, 0, 0, &font, 0, 0);
 	if (rufl_fm_error) {
-		LOG("xfont_find_font(\"%s\"): 0x%x: %s", buf,
+		LOG_ERROR("xfont_find_font(\"%s\"): 0x%x: %s", buf,
 				rufl_fm_error->errnum, rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
 	}
 
 	code = rufl_init_read_encoding(font, umap);
 	if (code != rufl_OK) {
-		LOG("rufl_init_read_encoding(\"%s\", ...): 0x%x",
+		LOG_ERROR("rufl_init_read_encoding(\"%s\", ...): 0x%x",
 				buf, code);
+		rufl_fm_count(rufl_FM_LOSE_FONT);
 		xfont_lose_font(font);
 		return code;
 	}
@@ -946,6 +1245,7 @@ rufl_code rufl_init_scan_font_in_encoding(const char *font_name,
 	for (i = 0; i != umap->entries; i++) {
 		u = umap->map[i].u;
 		string[0] = umap->map[i].c;
+		rufl_fm_count(rufl_FM_SCAN_STRING);
 		rufl_fm_error = xfont_scan_string(font, (char *) string,
 				font_RETURN_BBOX | font_GIVEN_FONT |
 				font_GIVEN_LENGTH | font_GIVEN_BLOCK,
@@ -983,10 +1283,11 @@ rufl_code rufl_init_scan_font_in_encoding(const char *font_name,
 		}
 	}
 
+	rufl_fm_count(rufl_FM_LOSE_FONT);
 	xfont_lose_font(font);
 
 	if (rufl_fm_error) {
-		LOG("xfont_scan_string(\"%s\", U+%x, ...) (c=%x): 0x%x: %s",
+		LOG_ERROR("xfont_scan_string(\"%s\", U+%x, ...) (c=%x): 0x%x: %s",
 				buf, umap->map[i].u, umap->map[i].c,
 				rufl_fm_error->errnum, rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
@@ -1023,13 +1324,15 @@ rufl_code rufl_init_read_encoding(font_f font,
 	int c;
 	char filename[200];
 	char s[200];
-	struct rufl_glyph_map_entry *entry;
+	const struct rufl_glyph_map_entry *entry;
+	unsigned int count;
 	FILE *fp;
 
+	rufl_fm_count(rufl_FM_READ_ENCODING_FILENAME);
 	rufl_fm_error = xfont_read_encoding_filename(font, filename,
 			sizeof filename, 0);
 	if (rufl_fm_error) {
-		LOG("xfont_read_encoding_filename: 0x%x: %s",
+		LOG_ERROR("xfont_read_encoding_filename: 0x%x: %s",
 				rufl_fm_error->errnum, rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
 	}
@@ -1085,23 +1388,13 @@ rufl_code rufl_init_read_encoding(font_f font,
 
 		/* Ignore first 32 character codes (these are control chars) */
 		if (emit && i > 31 && i < 256 && u < 256) {
-			entry = bsearch(s, rufl_glyph_map,
-					rufl_glyph_map_size,
-					sizeof rufl_glyph_map[0],
-					rufl_glyph_map_cmp);
-			if (entry) {
-				/* may be more than one unicode for the glyph
-				 * sentinels stop overshooting array */
-				while (strcmp(s, (entry - 1)->glyph_name) == 0)
-					entry--;
-				for (; strcmp(s, entry->glyph_name) == 0;
-						entry++) {
-					umap->map[u].u = entry->u;
-					umap->map[u].c = i;
-					u++;
-					if (u == 256)
-						break;
-				}
+			/* may be more than one unicode for the glyph */
+			entry = rufl_glyph_map_find(s, &count);
+			for (; entry && count != 0 && u != 256;
+					entry++, count--) {
+				umap->map[u].u = entry->u;
+				umap->map[u].c = i;
+				u++;
 			}
 		}
 
@@ -1122,14 +1415,6 @@ rufl_code rufl_init_read_encoding(font_f font,
 }
 
 
-int rufl_glyph_map_cmp(const void *keyval, const void *datum)
-{
-	const char *key = keyval;
-	const struct rufl_glyph_map_entry *entry = datum;
-	return strcmp(key, entry->glyph_name);
-}
-
-
 int rufl_unicode_map_cmp(const void *z1, const void *z2)
 {
 	const struct rufl_unicode_map_entry *entry1 = z1;
@@ -1158,7 +1443,7 @@ rufl_code rufl_init_substitution_table(void)
 	rufl_substitution_table = malloc(65536 *
 			sizeof rufl_substitution_table[0]);
 	if (!rufl_substitution_table) {
-		LOG("malloc(%zu) failed", 65536 *
+		LOG_ERROR("malloc(%zu) failed", 65536 *
 				sizeof rufl_substitution_table[0]);
 		return rufl_OUT_OF_MEMORY;
 	}
@@ -1203,25 +1488,26 @@ rufl_code rufl_init_substitution_table(void)
 
 
 /**
- * Save character sets to cache.
+ * Save character sets and any font metrics read so far to cache.
  */
 
 rufl_code rufl_save_cache(void)
 {
 	unsigned int i;
 	const unsigned int version = rufl_CACHE_VERSION;
+	unsigned char metrics;
 	size_t len;
 	FILE *fp;
 
 	fp = fopen(rufl_CACHE, "wb");
 	if (!fp) {
-		LOG("fopen: 0x%x: %s", errno, strerror(errno));
+		LOG_ERROR("fopen: 0x%x: %s", errno, strerror(errno));
 		return rufl_OK;
 	}
 
 	/* cache format version */
 	if (fwrite(&version, sizeof version, 1, fp) != 1) {
-		LOG("fwrite: 0x%x: %s", errno, strerror(errno));
+		LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
 		fclose(fp);
 		return rufl_OK;
 	}
@@ -1229,7 +1515,7 @@ rufl_code rufl_save_cache(void)
 	/* font manager type flag */
 	if (fwrite(&rufl_old_font_manager, sizeof rufl_old_font_manager, 1,
 			fp) != 1) {
-		LOG("fwrite: 0x%x: %s", errno, strerror(errno));
+		LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
 		fclose(fp);
 		return rufl_OK;
 	}
@@ -1241,14 +1527,14 @@ rufl_code rufl_save_cache(void)
 		/* length of font identifier */
 		len = strlen(rufl_font_list[i].identifier);
 		if (fwrite(&len, sizeof len, 1, fp) != 1) {
-			LOG("fwrite: 0x%x: %s", errno, strerror(errno));
+			LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
 			fclose(fp);
 			return rufl_OK;
 		}
 
 		/* font identifier */
 		if (fwrite(rufl_font_list[i].identifier, len, 1, fp) != 1) {
-			LOG("fwrite: 0x%x: %s", errno, strerror(errno));
+			LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
 			fclose(fp);
 			return rufl_OK;
 		}
@@ -1256,7 +1542,7 @@ rufl_code rufl_save_cache(void)
 		/* character set */
 		if (fwrite(rufl_font_list[i].charset,
 				rufl_font_list[i].charset->size, 1, fp) != 1) {
-			LOG("fwrite: 0x%x: %s", errno, strerror(errno));
+			LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
 			fclose(fp);
 			return rufl_OK;
 		}
@@ -1268,7 +1554,7 @@ rufl_code rufl_save_cache(void)
 			if (fwrite(&rufl_font_list[i].num_umaps,
 					sizeof rufl_font_list[i].num_umaps, 1,
 					fp) != 1) {
-				LOG("fwrite: 0x%x: %s", errno, strerror(errno));
+				LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
 				fclose(fp);
 				return rufl_OK;
 			}
@@ -1281,7 +1567,7 @@ rufl_code rufl_save_cache(void)
 						strlen(umap->encoding) : 0;
 
 				if (fwrite(&len, sizeof len, 1, fp) != 1) {
-					LOG("fwrite: 0x%x: %s", 
+					LOG_ERROR("fwrite: 0x%x: %s", 
 							errno, strerror(errno));
 					fclose(fp);
 					return rufl_OK;
@@ -1290,7 +1576,7 @@ rufl_code rufl_save_cache(void)
 				if (umap->encoding) {
 					if (fwrite(umap->encoding, len, 1, 
 							fp) != 1) {
-						LOG("fwrite: 0x%x: %s",
+						LOG_ERROR("fwrite: 0x%x: %s",
 							errno, strerror(errno));
 						fclose(fp);
 						return rufl_OK;
@@ -1299,7 +1585,7 @@ rufl_code rufl_save_cache(void)
 
 				if (fwrite(&umap->entries, sizeof umap->entries,
 						1, fp) != 1) {
-					LOG("fwrite: 0x%x: %s", 
+					LOG_ERROR("fwrite: 0x%x: %s", 
 							errno, strerror(errno));
 					fclose(fp);
 					return rufl_OK;
@@ -1308,28 +1594,46 @@ rufl_code rufl_save_cache(void)
 				if (fwrite(umap->map, umap->entries * 
 					sizeof(struct rufl_unicode_map_entry), 
 						1, fp) != 1) {
-					LOG("fwrite: 0x%x: %s", 
+					LOG_ERROR("fwrite: 0x%x: %s", 
 							errno, strerror(errno));
 					fclose(fp);
 					return rufl_OK;
 				}
 			}
 		}
+
+		/* font metrics state, followed by metrics if present */
+		metrics = rufl_font_list[i].metrics;
+		if (fwrite(&metrics, sizeof metrics, 1, fp) != 1) {
+			LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
+			fclose(fp);
+			return rufl_OK;
+		}
+		if (metrics == rufl_METRICS_PRESENT &&
+				fwrite(&rufl_font_list[i].misc_info,
+				sizeof rufl_font_list[i].misc_info, 1,
+				fp) != 1) {
+			LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
+			fclose(fp);
+			return rufl_OK;
+		}
 	}
 
 	if (fclose(fp) == EOF) {
-		LOG("fclose: 0x%x: %s", errno, strerror(errno));
+		LOG_ERROR("fclose: 0x%x: %s", errno, strerror(errno));
 		return rufl_OK;
 	}
 
-	LOG("%u charsets saved", i);
+	LOG_INFO("%u charsets saved", i);
+
+	rufl_metrics_changed = false;
 
 	return rufl_OK;
 }
 
 
 /**
- * Load character sets from cache.
+ * Load character sets and font metrics from cache.
  */
 
 rufl_code rufl_load_cache(void)
@@ -1344,25 +1648,27 @@ rufl_code rufl_load_cache(void)
 	struct rufl_character_set *charset;
 	struct rufl_unicode_map *umap = NULL;
 	unsigned int num_umaps = 0;
+	unsigned char metrics;
+	font_metrics_misc_info misc_info;
 
 	fp = fopen(rufl_CACHE, "rb");
 	if (!fp) {
-		LOG("fopen: 0x%x: %s", errno, strerror(errno));
+		LOG_WARNING("fopen: 0x%x: %s", errno, strerror(errno));
 		return rufl_OK;
 	}
 
 	/* cache format version */
 	if (fread(&version, sizeof version, 1, fp) != 1) {
 		if (feof(fp))
-			LOG("fread: %s", "unexpected eof");
+			LOG_ERROR("fread: %s", "unexpected eof");
 		else
-			LOG("fread: 0x%x: %s", errno, strerror(errno));
+			LOG_ERROR("fread: 0x%x: %s", errno, strerror(errno));
 		fclose(fp);
 		return rufl_OK;
 	}
 	if (version != rufl_CACHE_VERSION) {
 		/* incompatible cache format */
-		LOG("cache version %u (now %u)", version, rufl_CACHE_VERSION);
+		LOG_WARNING("cache version %u (now %u)", version, rufl_CACHE_VERSION);
 		fclose(fp);
 		return rufl_OK;
 	}
@@ -1370,15 +1676,15 @@ rufl_code rufl_load_cache(void)
 	/* font manager type flag */
 	if (fread(&old_font_manager, sizeof old_font_manager, 1, fp) != 1) {
 		if (feof(fp))
-			LOG("fread: %s", "unexpected eof");
+			LOG_ERROR("fread: %s", "unexpected eof");
 		else
-			LOG("fread: 0x%x: %s", errno, strerror(errno));
+			LOG_ERROR("fread: 0x%x: %s", errno, strerror(errno));
 		fclose(fp);
 		return rufl_OK;
 	}
 	if (old_font_manager != rufl_old_font_manager) {
 		/* font manager type has changed */
-		LOG("font manager %u (now %u)", old_font_manager,
+		LOG_WARNING("font manager %u (now %u)", old_font_manager,
 				rufl_old_font_manager);
 		fclose(fp);
 		return rufl_OK;
@@ -1390,13 +1696,13 @@ rufl_code rufl_load_cache(void)
 			/* eof at this point simply means that the whole cache
 			 * file has been loaded */
 			if (!feof(fp))
-				LOG("fread: 0x%x: %s", errno, strerror(errno));
+				LOG_ERROR("fread: 0x%x: %s", errno, strerror(errno));
 			break;
 		}
 
 		identifier = malloc(len + 1);
 		if (!identifier) {
-			LOG("malloc(%zu) failed", len + 1);
+			LOG_ERROR("malloc(%zu) failed", len + 1);
 			fclose(fp);
 			return rufl_OUT_OF_MEMORY;
 		}
@@ -1404,9 +1710,9 @@ rufl_code rufl_load_cache(void)
 		/* font identifier */
 		if (fread(identifier, len, 1, fp) != 1) {
 			if (feof(fp))
-				LOG("fread: %s", "unexpected eof");
+				LOG_ERROR("fread: %s", "unexpected eof");
 			else
-				LOG("fread: 0x%x: %s", errno, strerror(errno));
+				LOG_ERROR("fread: 0x%x: %s", errno, strerror(errno));
 			free(identifier);
 			break;
 		}
@@ -1415,16 +1721,16 @@ rufl_code rufl_load_cache(void)
 		/* character set */
 		if (fread(&size, sizeof size, 1, fp) != 1) {
 			if (feof(fp))
-				LOG("fread: %s", "unexpected eof");
+				LOG_ERROR("fread: %s", "unexpected eof");
 			else
-				LOG("fread: 0x%x: %s", errno, strerror(errno));
+				LOG_ERROR("fread: 0x%x: %s", errno, strerror(errno));
 			free(identifier);
 			break;
 		}
 
 		charset = malloc(size);
 		if (!charset) {
-			LOG("malloc(%zu) failed", size);
+			LOG_ERROR("malloc(%zu) failed", size);
 			free(identifier);
 			fclose(fp);
 			return rufl_OUT_OF_MEMORY;
@@ -1433,9 +1739,9 @@ rufl_code rufl_load_cache(void)
 		charset->size = size;
 		if (fread(charset->index, size - sizeof size, 1, fp) != 1) {
 			if (feof(fp))
-				LOG("fread: %s", "unexpected eof");
+				LOG_ERROR("fread: %s", "unexpected eof");
 			else
-				LOG("fread: 0x%x: %s", errno, strerror(errno));
+				LOG_ERROR("fread: 0x%x: %s", errno, strerror(errno));
 			free(charset);
 			free(identifier);
 			break;
@@ -1449,9 +1755,9 @@ rufl_code rufl_load_cache(void)
 			/* Number of maps */
 			if (fread(&num_umaps, sizeof num_umaps, 1, fp) != 1) {
 				if (feof(fp))
-					LOG("fread: %s", "unexpected eof");
+					LOG_ERROR("fread: %s", "unexpected eof");
 				else
-					LOG("fread: 0x%x: %s", errno,
+					LOG_ERROR("fread: 0x%x: %s", errno,
 							strerror(errno));
 				free(charset);
 				free(identifier);
@@ -1460,7 +1766,7 @@ rufl_code rufl_load_cache(void)
 
 			umap = calloc(num_umaps, sizeof *umap);
 			if (!umap) {
-				LOG("malloc(%zu) failed", sizeof *umap);
+				LOG_ERROR("malloc(%zu) failed", sizeof *umap);
 				free(charset);
 				free(identifier);
 				fclose(fp);
@@ -1473,10 +1779,10 @@ rufl_code rufl_load_cache(void)
 
 				if (fread(&len, sizeof(len), 1, fp) != 1) {
 					if (feof(fp))
-						LOG("fread: %s", 
+						LOG_ERROR("fread: %s", 
 							"unexpected eof");
 					else
-						LOG("fread: 0x%x: %s", errno,
+						LOG_ERROR("fread: 0x%x: %s", errno,
 							strerror(errno));
 					break;
 				}
@@ -1484,7 +1790,7 @@ rufl_code rufl_load_cache(void)
 				if (len > 0) {
 					map->encoding = malloc(len + 1);
 					if (!map->encoding) {
-						LOG("malloc(%zu) failed", 
+						LOG_ERROR("malloc(%zu) failed", 
 								len + 1);
 						code = rufl_OUT_OF_MEMORY;
 						break;
@@ -1493,10 +1799,10 @@ rufl_code rufl_load_cache(void)
 					if (fread(map->encoding, len, 1, 
 							fp) != 1) {
 						if (feof(fp))
-							LOG("fread: %s", 
+							LOG_ERROR("fread: %s", 
 							"unexpected eof");
 						else
-							LOG("fread: 0x%x: %s", 
+							LOG_ERROR("fread: 0x%x: %s", 
 							errno,
 							strerror(errno));
 						break;
@@ -1507,10 +1813,10 @@ rufl_code rufl_load_cache(void)
 				if (fread(&map->entries, sizeof(map->entries),
 						1, fp) != 1) {
 					if (feof(fp))
-						LOG("fread: %s", 
+						LOG_ERROR("fread: %s", 
 							"unexpected eof");
 					else
-						LOG("fread: 0x%x: %s", errno,
+						LOG_ERROR("fread: 0x%x: %s", errno,
 							strerror(errno));
 					break;
 				}
@@ -1519,10 +1825,10 @@ rufl_code rufl_load_cache(void)
 					sizeof(struct rufl_unicode_map_entry), 
 						1, fp) != 1) {
 					if (feof(fp))
-						LOG("fread: %s", 
+						LOG_ERROR("fread: %s", 
 							"unexpected eof");
 					else
-						LOG("fread: 0x%x: %s", errno,
+						LOG_ERROR("fread: 0x%x: %s", errno,
 							strerror(errno));
 					break;
 				}
@@ -1548,6 +1854,25 @@ rufl_code rufl_load_cache(void)
 			}
 		}
 
+		/* font metrics state, followed by metrics if present */
+		if (fread(&metrics, sizeof metrics, 1, fp) != 1 ||
+				(metrics == rufl_METRICS_PRESENT &&
+				fread(&misc_info, sizeof misc_info, 1,
+				fp) != 1)) {
+			if (feof(fp))
+				LOG_ERROR("fread: %s", "unexpected eof");
+			else
+				LOG_ERROR("fread: 0x%x: %s", errno, strerror(errno));
+			while (num_umaps > 0) {
+				free(umap[num_umaps - 1].encoding);
+				num_umaps--;
+			}
+			free(umap);
+			free(charset);
+			free(identifier);
+			break;
+		}
+
 		/* put in rufl_font_list */
 		entry = lfind(identifier, rufl_font_list,
 				&rufl_font_list_entries,
@@ -1556,9 +1881,22 @@ rufl_code rufl_load_cache(void)
 			entry->charset = charset;
 			entry->umap = umap;
 			entry->num_umaps = num_umaps;
+			if (metrics <= rufl_METRICS_PRESENT)
+				entry->metrics = metrics;
+			if (metrics == rufl_METRICS_PRESENT)
+				entry->misc_info = misc_info;
+			if (umap) {
+				entry->lookup = rufl_unicode_lookup_create(
+						umap, num_umaps);
+				if (!entry->lookup) {
+					free(identifier);
+					fclose(fp);
+					return rufl_OUT_OF_MEMORY;
+				}
+			}
 	                i++;
 		} else {
-			LOG("\"%s\" not in font list", identifier);
+			LOG_WARNING("\"%s\" not in font list", identifier);
 			while (num_umaps > 0) {
 				struct rufl_unicode_map *map = 
 						umap + num_umaps - 1;
@@ -1575,7 +1913,7 @@ rufl_code rufl_load_cache(void)
 	}
 	fclose(fp);
 
-	LOG("%u charsets loaded", i);
+	LOG_INFO("%u charsets loaded", i);
 
 	return rufl_OK;
 }
@@ -1697,7 +2035,7 @@ void rufl_init_status_open(void)
 
 	error = xwimpreadsysinfo_task(&task, 0);
 	if (error) {
-		LOG("xwimpreadsysinfo_task: 0x%x: %s",
+		LOG_ERROR("xwimpreadsysinfo_task: 0x%x: %s",
 				error->errnum, error->errmess);
 		return;
 	}
@@ -1706,7 +2044,7 @@ void rufl_init_status_open(void)
 
 	error = xtaskwindowtaskinfo_window_task(&window_task);
 	if (error) {
-		LOG("xtaskwindowtaskinfo_window_task: 0x%x: %s",
+		LOG_ERROR("xtaskwindowtaskinfo_window_task: 0x%x: %s",
 				error->errnum, error->errmess);
 		return;
 	}
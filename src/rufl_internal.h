@@ -11,6 +11,18 @@
 #ifdef __CC_NORCROFT
 #include "strfuncs.h"
 #endif
+#ifdef RUFL_HOST
+#include "rufl_host.h"
+#endif
+
+
+#ifdef RUFL_HOST
+/** Storage class of state kept for each thread. */
+#define rufl_THREAD_LOCAL __thread
+#else
+/* RISC OS tasks have a single thread */
+#define rufl_THREAD_LOCAL
+#endif
 
 
 /** The available characters in a font. The range which can be represented is
@@ -63,6 +75,31 @@ struct rufl_unicode_map {
 };
 
 
+/** Old font manager: direct-indexed map from Unicode to the first unicode map
+ * containing each character, and the character code in that map. Laid out
+ * like struct rufl_character_set, so that lookup takes constant time. */
+struct rufl_unicode_lookup {
+	/** Size of structure / bytes. */
+	size_t size;
+	/** Some characters did not fit, because there were more than 255 maps
+	 * or 254 blocks, and must be searched for in the maps. */
+	bool partial;
+
+	/** Index table. Each entry represents a block of 256 characters, so
+	 * i[k] refers to characters [256*k, 256*(k+1)). The value is either
+	 * BLOCK_EMPTY or an offset into the block table. */
+	unsigned char index[256];
+
+	/** Block table. */
+	struct {
+		/** Index in the font's umap plus 1, or 0 if absent. */
+		unsigned char map[256];
+		/** Character code in that map. */
+		unsigned char c[256];
+	} block[254];
+};
+
+
 /** An entry in rufl_font_list. */
 struct rufl_font_list_entry {
 	/** Font identifier (name). */
@@ -73,6 +110,8 @@ struct rufl_font_list_entry {
 	unsigned int num_umaps;
 	/** Mappings from Unicode to character code. */
 	struct rufl_unicode_map *umap;
+	/** Direct-indexed lookup into umap, or 0 if there is no umap. */
+	struct rufl_unicode_lookup *lookup;
 	/** Family that this font belongs to (index in rufl_family_list and
 	 * rufl_family_map). */
 	unsigned int family;
@@ -80,11 +119,22 @@ struct rufl_font_list_entry {
 	unsigned int weight;
 	/** Font slant (0 or 1). */
 	unsigned int slant;
+	/** State of misc_info. */
+	enum {
+		/** Not yet read from the Font Manager. */
+		rufl_METRICS_UNKNOWN,
+		/** The font has no miscellaneous metrics. */
+		rufl_METRICS_NONE,
+		/** misc_info is valid. */
+		rufl_METRICS_PRESENT,
+	} metrics;
+	/** Miscellaneous metrics for a 1pt font, read on first use. */
+	font_metrics_misc_info misc_info;
+	/** bbox is valid. */
+	bool bbox_known;
+	/** Maximum bounding box at rufl_BBOX_REFERENCE_SIZE / OS units. */
+	int bbox[4];
 };
-/** List of all available fonts. */
-extern struct rufl_font_list_entry *rufl_font_list;
-/** Number of entries in rufl_font_list. */
-extern size_t rufl_font_list_entries;
 
 
 /** An entry in rufl_family_map. */
@@ -94,20 +144,24 @@ struct rufl_family_map_entry {
 	/** Map from weight and slant to index in rufl_font_list, or NO_FONT. */
 	unsigned int font[9][2];
 };
-/** Map from font family to fonts, rufl_family_list_entries entries. */
-extern struct rufl_family_map_entry *rufl_family_map;
 
 
 /** No font contains this character. */
 #define NOT_AVAILABLE 65535
-/** Font substitution table. */
-extern unsigned short *rufl_substitution_table;
 
 
 /** Number of slots in recent-use cache. This is the maximum number of RISC OS
- * font handles that will be used at any time by the library. */
+ * font handles that will be used at any time by the library for each output
+ * context. */
 #define rufl_CACHE_SIZE 10
 
+/** Maximum number of slots in the protected segment of the cache. The
+ * remaining slots form the probationary segment, which takes all new
+ * entries. A long run of fonts which are each used once (for example, a font
+ * chooser drawing previews) therefore only evicts probationary entries, and
+ * the handles in repeated use by a document survive. */
+#define rufl_CACHE_PROTECTED 6
+
 /** An entry in rufl_cache. */
 struct rufl_cache_entry {
 	/** Font number (index in rufl_font_list), or rufl_CACHE_*. */
@@ -122,13 +176,246 @@ struct rufl_cache_entry {
 	const char *encoding;
 	/** Value of rufl_cache_time when last used. */
 	unsigned int last_used;
+	/** Entry has been used since it was placed in the cache, so is in the
+	 * protected segment. */
+	bool protected;
 	/** RISC OS font handle. */
 	font_f f;
 };
-/** Cache of rufl_CACHE_SIZE most recently used font handles. */
-extern struct rufl_cache_entry rufl_cache[rufl_CACHE_SIZE];
-/** Counter for measuring age of cache entries. */
-extern int rufl_cache_time;
+/** Number of output contexts (values of rufl_output). */
+#define rufl_OUTPUT_COUNT 3
+
+/** Eviction policy for rufl_cache. */
+typedef enum {
+	/** Segmented LRU (default). */
+	rufl_CACHE_POLICY_SLRU,
+	/** Plain least recently used. */
+	rufl_CACHE_POLICY_LRU,
+} rufl_cache_policy_type;
+/** Eviction policy in use. */
+extern rufl_cache_policy_type rufl_cache_policy;
+
+/** Links of an entry in a cache with least recently used eviction (see
+ * rufl_lru.c). It must be the first member of the entry. */
+struct rufl_lru_entry {
+	/** Next entry in hash chain. */
+	struct rufl_lru_entry *hash_next;
+	/** Adjacent entries in recent-use list. */
+	struct rufl_lru_entry *prev, *next;
+};
+
+/** The kind of entry held by a struct rufl_lru. */
+struct rufl_lru_type {
+	/** Number of hash chains. */
+	unsigned int buckets;
+	/** Size of a key / bytes. Keys are compared with memcmp(). */
+	size_t key_size;
+	/** Hash of a key. */
+	unsigned int (*hash)(const void *key);
+	/** Key of an entry. */
+	const void *(*key)(const struct rufl_lru_entry *entry);
+	/** Memory used by an entry / bytes. */
+	size_t (*size)(const struct rufl_lru_entry *entry);
+	/** Free an entry, or 0 to use free(). */
+	void (*destroy)(struct rufl_lru_entry *entry);
+};
+
+/** A hash table of entries within a memory budget, discarding the least
+ * recently used entries to stay within it. */
+struct rufl_lru {
+	/** Kind of entry. */
+	const struct rufl_lru_type *type;
+	/** Maximum memory used by entries / bytes. */
+	size_t budget;
+	/** Memory used by entries / bytes. */
+	size_t used;
+	/** Number of entries. */
+	unsigned int entries;
+	/** Number of entries discarded to keep within the budget. */
+	unsigned long evictions;
+	/** Hash chains, or 0 if not yet allocated. */
+	struct rufl_lru_entry **table;
+	/** Most and least recently used entries. */
+	struct rufl_lru_entry *head, *tail;
+};
+
+/** Metrics of a glyph, as returned by rufl_glyph_metrics(). */
+struct rufl_glyph_cache_metrics {
+	int x_bearing;
+	int y_bearing;
+	int width;
+	int height;
+	int x_advance;
+	int y_advance;
+};
+/** Default memory budget of the glyph metrics cache / bytes. */
+#define rufl_GLYPH_CACHE_BUDGET 65536
+
+/** Font size at which glyph outlines are cached (100pt). Outlines for other
+ * sizes are scaled from this size. */
+#define rufl_OUTLINE_REFERENCE_SIZE 1600
+/** Default memory budget of the outline cache / bytes. */
+#define rufl_OUTLINE_CACHE_BUDGET 262144
+/** Outline was slanted because the font has no slanted variant. */
+#define rufl_OUTLINE_OBLIQUE 0x1
+
+/** Size of a pixel for software rendering / Draw units (1/90 inch). */
+#define rufl_PIXEL 512
+/** Number of horizontal positions within a pixel that glyphs are rendered
+ * at. */
+#define rufl_RENDER_SUBPIXELS 4
+/** Default memory budget of the glyph bitmap cache / bytes. */
+#define rufl_BITMAP_CACHE_BUDGET 262144
+
+/** An 8-bit coverage bitmap of a glyph. */
+struct rufl_bitmap {
+	/** Offset of left column from glyph origin / pixels. */
+	int left;
+	/** Offset of top row above baseline / pixels. */
+	int top;
+	/** Size / pixels. */
+	int width;
+	int height;
+	/** Coverage, top row first. */
+	unsigned char data[];
+};
+
+/** Font size at which maximum bounding boxes are read (100pt). */
+#define rufl_BBOX_REFERENCE_SIZE 1600
+/** Font size below which hinting makes scaled bounding boxes inexact
+ * (24pt). */
+#define rufl_BBOX_HINT_SIZE 384
+
+/** Number of remembered bounding boxes for sizes below
+ * rufl_BBOX_HINT_SIZE. */
+#define rufl_BBOX_MEMO_SIZE 16
+
+/** A remembered bounding box of a font at a small size. */
+struct rufl_bbox_memo {
+	/** Font number (index in rufl_font_list). */
+	unsigned int font;
+	/** Font size, or 0 if unused. */
+	unsigned int size;
+	/** Bounding box / OS units. */
+	int bbox[4];
+};
+
+/** Number of remembered decomposition buffer size estimates. */
+#define rufl_DECOMPOSE_ESTIMATES 16
+
+/** Decomposition buffer size estimate for a font and size. */
+struct rufl_decompose_estimate {
+	/** Font number (index in rufl_font_list). */
+	unsigned int font;
+	/** Font size, or 0 if this entry is unused. */
+	unsigned int size;
+	/** Largest number of buffer bytes used per byte of string. */
+	size_t bytes_per_byte;
+};
+
+/** Library context (see rufl.h). */
+struct rufl_context {
+	/** Context which owns the font list, family list and substitution
+	 * table: this context, or the one it was created from by
+	 * rufl_ctx_create_shared(). Lazily read font metrics and bounding
+	 * boxes in the font list are protected by rufl_font_list_lock(). */
+	struct rufl_context *fonts;
+	/** List of all available fonts. */
+	struct rufl_font_list_entry *font_list;
+	/** Number of entries in font_list. */
+	size_t font_list_entries;
+	/** List of available font families. */
+	const char **family_list;
+	/** Number of entries in family_list. */
+	unsigned int family_list_entries;
+	/** Map from font family to fonts, family_list_entries entries. */
+	struct rufl_family_map_entry *family_map;
+	/** Menu of font families. */
+	void *family_menu;
+	/** Font metrics have been read since the cache was loaded or
+	 * saved. Only used in the context which owns the fonts. */
+	bool metrics_changed;
+	/** Font substitution table. */
+	unsigned short *substitution_table;
+
+	/** Caches of rufl_CACHE_SIZE most recently used font handles, one
+	 * for each output context. */
+	struct rufl_cache_entry cache_pool[rufl_OUTPUT_COUNT][rufl_CACHE_SIZE];
+	/** Cache for the current output context (an entry in cache_pool). */
+	struct rufl_cache_entry *cache;
+	/** Counter for measuring age of cache entries. */
+	int cache_time;
+
+	/** Last Font Manager error. */
+	os_error *fm_error;
+
+	/** Glyph metrics cache (see rufl_glyph_cache.c). */
+	struct rufl_lru glyph_cache;
+	/** Number of lookups satisfied by and missing the glyph metrics
+	 * cache. */
+	unsigned long glyph_cache_hits, glyph_cache_misses;
+
+	/** Glyph outline cache (see rufl_outline_cache.c). */
+	struct rufl_lru outline_cache;
+
+	/** Glyph bitmap cache (see rufl_render.c). */
+	struct rufl_lru bitmap_cache;
+
+	/** Bounding boxes of fonts at small sizes, replaced in rotation. */
+	struct rufl_bbox_memo bbox_memo[rufl_BBOX_MEMO_SIZE];
+	/** Next entry of bbox_memo to replace. */
+	unsigned int bbox_memo_next;
+
+	/** Remembered decomposition buffer size estimates, replaced in
+	 * rotation. */
+	struct rufl_decompose_estimate
+			decompose_estimates[rufl_DECOMPOSE_ESTIMATES];
+	/** Next entry of decompose_estimates to replace. */
+	unsigned int decompose_estimate_next;
+	/** Decomposition buffer, reused by each call to
+	 * rufl_decompose_glyph(). */
+	int *decompose_buffer;
+	/** Size of decompose_buffer / bytes. */
+	size_t decompose_buffer_size;
+};
+
+/** Initial value of struct rufl_context ctx. */
+#define rufl_CONTEXT_INITIAL(ctx) {					\
+	.fonts = &(ctx),						\
+	.cache = (ctx).cache_pool[rufl_OUTPUT_SCREEN],			\
+	.glyph_cache = { &rufl_glyph_cache_type, rufl_GLYPH_CACHE_BUDGET }, \
+	.outline_cache = { &rufl_outline_cache_type,			\
+			rufl_OUTLINE_CACHE_BUDGET },			\
+	.bitmap_cache = { &rufl_bitmap_cache_type,			\
+			rufl_BITMAP_CACHE_BUDGET },			\
+}
+
+/** Kinds of entry of the caches in struct rufl_context. */
+extern const struct rufl_lru_type rufl_glyph_cache_type;
+extern const struct rufl_lru_type rufl_outline_cache_type;
+extern const struct rufl_lru_type rufl_bitmap_cache_type;
+
+/** Default context, used by the functions without ctx_. */
+extern struct rufl_context rufl_default_context;
+/** Context of the public function being executed by this thread, or the
+ * default context outside any public function. */
+extern rufl_THREAD_LOCAL struct rufl_context *rufl_context_current;
+
+/* The state of the context in use, by the names it had when it was
+ * process-global. rufl_fm_error and the family list are also process-global
+ * variables in rufl.h, which rufl_default_return() updates. */
+#define rufl_font_list (rufl_context_current->font_list)
+#define rufl_font_list_entries (rufl_context_current->font_list_entries)
+#define rufl_family_list (rufl_context_current->family_list)
+#define rufl_family_list_entries (rufl_context_current->family_list_entries)
+#define rufl_family_map (rufl_context_current->family_map)
+#define rufl_family_menu (rufl_context_current->family_menu)
+#define rufl_metrics_changed (rufl_context_current->fonts->metrics_changed)
+#define rufl_substitution_table (rufl_context_current->substitution_table)
+#define rufl_cache_pool (rufl_context_current->cache_pool)
+#define rufl_cache (rufl_context_current->cache)
+#define rufl_cache_time (rufl_context_current->cache_time)
+#define rufl_fm_error (rufl_context_current->fm_error)
 
 /** Font manager does not support Unicode. */
 extern bool rufl_old_font_manager;
@@ -136,13 +423,142 @@ extern bool rufl_old_font_manager;
 /** Font manager supports background blending */
 extern bool rufl_can_background_blend;
 
+/** Called with the name of each phase of rufl_init() as it starts, and with
+ * 0 when it has succeeded, if not 0. For benchmarks. */
+extern void (*rufl_init_phase_hook)(const char *phase);
+
+#ifdef RUFL_HOST
+/** Number of threads scanning fonts in rufl_init(), or 0 for one per
+ * processor. For tests and benchmarks. */
+extern unsigned int rufl_scan_threads;
+#endif
+
+/** Number of single-font spans processed by rufl_process() in this thread.
+ * For benchmarks. */
+extern rufl_THREAD_LOCAL unsigned long rufl_span_count;
+
+/** Font Manager call statistics of this thread. */
+extern rufl_THREAD_LOCAL struct rufl_fm_stats rufl_fm_stats;
+
+/** Outermost public function being executed by this thread, or
+ * rufl_API_NONE. */
+extern rufl_THREAD_LOCAL rufl_api rufl_api_current;
+
+/** State of the caller of a public function, restored on leaving it. */
+struct rufl_outer {
+	rufl_api api;
+	struct rufl_context *ctx;
+};
+
+/** Enter public function (rufl_API_*) using context ctx. Font Manager calls
+ * are counted against the outermost public function, so only that call is
+ * counted and timed. The previous values of rufl_api_current and
+ * rufl_context_current are stored in outer, for rufl_api_leave(). */
+#define rufl_api_enter(ctx, function, outer)				\
+	do {								\
+		rufl_context_enter(ctx, outer);				\
+		outer.api = rufl_api_current;				\
+		if (outer.api == rufl_API_NONE) {			\
+			rufl_api_current = function;			\
+			rufl_fm_stats.calls[function]++;		\
+			rufl_latency_start();				\
+		}							\
+	} while (0)
+
+/** Leave a public function entered by rufl_api_enter(). */
+#define rufl_api_leave(outer)						\
+	do {								\
+		if ((outer).api == rufl_API_NONE)			\
+			rufl_latency_stop(rufl_api_current);		\
+		rufl_api_current = (outer).api;				\
+		rufl_context_leave(outer);				\
+	} while (0)
+
+/** Use context ctx in a public function which is not counted. */
+#define rufl_context_enter(ctx, outer)					\
+	do {								\
+		outer.ctx = rufl_context_current;			\
+		rufl_context_current = (ctx);				\
+	} while (0)
+
+/** Leave a public function entered by rufl_context_enter(). */
+#define rufl_context_leave(outer)					\
+	do {								\
+		rufl_context_current = (outer).ctx;			\
+	} while (0)
+
+/** Function receiving trace events, or 0. */
+extern rufl_trace_func rufl_tracer;
+
+/** Emit a trace event, if there is a tracer. See rufl_trace_emit(). */
+#define rufl_trace(type, font, size, length, action)			\
+	do {								\
+		if (rufl_tracer)					\
+			rufl_trace_emit(type, font, size, length,	\
+					action);			\
+	} while (0)
+
+void rufl_trace_emit(rufl_trace_type type, unsigned int font,
+		unsigned int size, unsigned int length, unsigned int action);
+unsigned long long rufl_time_ns(void);
+
+#ifdef RUFL_PROFILE
+void rufl_latency_start(void);
+void rufl_latency_stop(rufl_api api);
+void rufl_latency_dump(void);
+#else
+#define rufl_latency_start() ((void) 0)
+#define rufl_latency_stop(api) ((void) 0)
+#endif
+
+/** Count a call of a Font Manager SWI (rufl_FM_*). */
+#define rufl_fm_count(swi) (rufl_fm_stats.swis[rufl_api_current][swi]++)
+
+rufl_code rufl_default_return(rufl_code code);
+void rufl_font_list_lock(void);
+void rufl_font_list_unlock(void);
+rufl_code rufl_init_context(struct rufl_context *ctx);
+void rufl_ctx_quit(struct rufl_context *ctx);
 rufl_code rufl_find_font_family(const char *family, rufl_style font_style,
 		unsigned int *font, unsigned int *slanted,
 		struct rufl_character_set **charset);
 rufl_code rufl_find_font(unsigned int font, unsigned int font_size,
 		const char *encoding, font_f *fhandle);
+unsigned int rufl_cache_lookup(unsigned int font, unsigned int font_size,
+		const char *encoding);
+unsigned int rufl_cache_victim(void);
+void rufl_cache_fill(unsigned int slot, unsigned int font,
+		unsigned int font_size, const char *encoding, font_f f);
 bool rufl_character_set_test(struct rufl_character_set *charset,
 		unsigned int c);
+rufl_code rufl_save_cache(void);
+bool rufl_glyph_cache_get(unsigned int font, unsigned int size,
+		unsigned int u, struct rufl_glyph_cache_metrics *metrics);
+void rufl_glyph_cache_put(unsigned int font, unsigned int size,
+		unsigned int u, const struct rufl_glyph_cache_metrics *metrics);
+struct rufl_lru_entry *rufl_lru_get(struct rufl_lru *lru, const void *key);
+bool rufl_lru_put(struct rufl_lru *lru, struct rufl_lru_entry *entry);
+void rufl_lru_set_budget(struct rufl_lru *lru, size_t bytes);
+void rufl_lru_clear(struct rufl_lru *lru);
+void rufl_glyph_cache_clear(void);
+void rufl_decompose_quit(void);
+const int *rufl_outline_cache_get(unsigned int font, unsigned int u,
+		unsigned int flags, size_t *words);
+const int *rufl_outline_cache_put(unsigned int font, unsigned int u,
+		unsigned int flags, const int *path, size_t words);
+void rufl_outline_cache_clear(void);
+rufl_code rufl_raster_glyph(const struct rufl_path *path, size_t glyph,
+		int offset, struct rufl_bitmap **bitmap);
+void rufl_bitmap_cache_clear(void);
+void rufl_font_bbox_clear(void);
+void rufl_not_available_metrics(unsigned int font_size,
+		struct rufl_glyph_cache_metrics *metrics);
+struct rufl_unicode_lookup *rufl_unicode_lookup_create(
+		const struct rufl_unicode_map *umap, unsigned int num_umaps);
+bool rufl_unicode_lookup_get(const struct rufl_unicode_lookup *lookup,
+		const struct rufl_unicode_map *umap, unsigned int num_umaps,
+		unsigned int u, unsigned int *map, unsigned char *c);
+int rufl_unicode_map_search_cmp(const void *keyval, const void *datum);
 
 
 #define rufl_utf8_read(s, l, u)						       \
@@ -169,8 +585,19 @@ bool rufl_character_set_test(struct rufl_character_set *charset,
 		s++; l--;						       \
 	}
 
+#ifdef RUFL_HOST
+#define rufl_CACHE rufl_host_scrap_file("RUfl_cache")
+#else
 #define rufl_CACHE "<Wimp$ScrapDir>.RUfl_cache"
-#define rufl_CACHE_VERSION 3
+#endif
+#define rufl_CACHE_VERSION 4
+
+#ifdef RUFL_HOST
+#define rufl_OUTLINE_CACHE rufl_host_scrap_file("RUfl_outlines")
+#else
+#define rufl_OUTLINE_CACHE "<Wimp$ScrapDir>.RUfl_outlines"
+#endif
+#define rufl_OUTLINE_CACHE_VERSION 2
 
 
 struct rufl_glyph_map_entry {
@@ -178,30 +605,67 @@ struct rufl_glyph_map_entry {
 	unsigned short u;
 };
 
+/** A glyph name, in the perfect hash generated by tools/makeglyphs. */
+struct rufl_glyph_map_name {
+	/** Index in rufl_glyph_map of the first entry for the name. */
+	unsigned short first;
+	/** Number of entries for the name, which are consecutive. */
+	unsigned short count;
+};
+
+/** Glyph names and Unicode values, sorted by name. */
 extern const struct rufl_glyph_map_entry rufl_glyph_map[];
 extern const size_t rufl_glyph_map_size;
+/** Glyph names by hash slot. */
+extern const struct rufl_glyph_map_name rufl_glyph_map_names[];
+extern const unsigned int rufl_glyph_map_slots;
+/** Hash displacement of each bucket of names. */
+extern const unsigned short rufl_glyph_map_displacement[];
+extern const unsigned int rufl_glyph_map_buckets;
 
+const struct rufl_glyph_map_entry *rufl_glyph_map_find(const char *name,
+		unsigned int *count);
 
-#if 1 /*ndef NDEBUG*/
-#ifdef __CC_NORCROFT
-#define __PRETTY_FUNCTION__ __func__
+
+/** Most verbose log level compiled in. */
+#ifndef RUFL_LOG_LEVEL
+#define RUFL_LOG_LEVEL rufl_LOG_DEBUG
 #endif
-#include <time.h>
-bool log_got_start_time;
-time_t log_start_time;
-#define LOG(format, ...)						\
+
+/** Most verbose log level recorded. */
+extern int rufl_log_level;
+
+void rufl_log(int level, const char *file, const char *func, int line,
+		const char *format, ...);
+
+/** Log a message, if level is recorded. The arguments are only read, not
+ * formatted, and may be integers (%c, %d, %i, %u, %x, %X, with l, ll, or z),
+ * pointers (%p), doubles (%e, %f, %g), or strings (%s), which are copied. */
+#define rufl_LOG(level, format, ...)					\
 	do {								\
-		if (log_got_start_time == false) {			\
-			log_start_time = time(NULL);			\
-			log_got_start_time = true;			\
-		}							\
-									\
-		fprintf(stderr,"(%.6fs) " __FILE__ " %s %i: ",		\
-				difftime(time(NULL), log_start_time),	\
-				__PRETTY_FUNCTION__, __LINE__);		\
-		fprintf(stderr, format, __VA_ARGS__);			\
-		fprintf(stderr, "\n");					\
+		if ((level) <= rufl_log_level)				\
+			rufl_log(level, __FILE__, __func__, __LINE__,	\
+					format, __VA_ARGS__);		\
 	} while (0)
+
+#if rufl_LOG_ERROR <= RUFL_LOG_LEVEL
+#define LOG_ERROR(format, ...) rufl_LOG(rufl_LOG_ERROR, format, __VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) ((void) 0)
+#endif
+#if rufl_LOG_WARNING <= RUFL_LOG_LEVEL
+#define LOG_WARNING(format, ...)					\
+	rufl_LOG(rufl_LOG_WARNING, format, __VA_ARGS__)
+#else
+#define LOG_WARNING(format, ...) ((void) 0)
+#endif
+#if rufl_LOG_INFO <= RUFL_LOG_LEVEL
+#define LOG_INFO(format, ...) rufl_LOG(rufl_LOG_INFO, format, __VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) ((void) 0)
+#endif
+#if rufl_LOG_DEBUG <= RUFL_LOG_LEVEL
+#define LOG_DEBUG(format, ...) rufl_LOG(rufl_LOG_DEBUG, format, __VA_ARGS__)
 #else
-#define LOG(format, ...) ((void) 0)
+#define LOG_DEBUG(format, ...) ((void) 0)
 #endif
@@ -5,24 +5,97 @@
  * Copyright 2005 James Bursa <james@semichrome.net>
  */
 
+#include <assert.h>
 #include "oslib/font.h"
 #include "rufl_internal.h"
 
 
+static void rufl_invalidate_pool(rufl_output output);
+
+
 /**
  * Clear the internal font handle cache.
  *
- * Call this function on mode changes or output redirection changes.
+ * All handles in every output context are lost, and cached glyph metrics and
+ * font bounding boxes are discarded.
+ */
+
+void rufl_ctx_invalidate_cache(struct rufl_context *ctx)
+{
+	unsigned int i;
+	struct rufl_outer outer;
+
+	rufl_api_enter(ctx, rufl_API_INVALIDATE_CACHE, outer);
+	for (i = 0; i != rufl_OUTPUT_COUNT; i++)
+		rufl_invalidate_pool(i);
+	rufl_glyph_cache_clear();
+	rufl_font_bbox_clear();
+	rufl_api_leave(outer);
+}
+
+
+/**
+ * Clear the font handles affected by a change in the output environment.
+ *
+ * \param  reasons  combination of rufl_INVALIDATE_* values
+ *
+ * Cached glyph metrics are hinted for the screen resolution, and are not
+ * keyed by output context, so they are discarded on a mode change or
+ * redirection. Font bounding boxes are discarded for any reason.
+ */
+
+void rufl_ctx_invalidate_cache_reason(struct rufl_context *ctx,
+		unsigned int reasons)
+{
+	struct rufl_outer outer;
+
+	rufl_api_enter(ctx, rufl_API_INVALIDATE_CACHE, outer);
+
+	/* the pixel size of the screen (or sprite) determines how screen
+	 * handles are rasterised; other outputs are independent of it */
+	if (reasons & (rufl_INVALIDATE_MODE_CHANGE |
+			rufl_INVALIDATE_REDIRECTION)) {
+		rufl_invalidate_pool(rufl_OUTPUT_SCREEN);
+		rufl_glyph_cache_clear();
+	}
+	if (reasons & rufl_INVALIDATE_PRINTER)
+		rufl_invalidate_pool(rufl_OUTPUT_PRINTER);
+	if (reasons & rufl_INVALIDATE_BUFFER)
+		rufl_invalidate_pool(rufl_OUTPUT_BUFFER);
+	if (reasons)
+		rufl_font_bbox_clear();
+
+	rufl_api_leave(outer);
+}
+
+
+/**
+ * Select the output context for subsequent rendering and measurement.
+ *
+ * \param  output  output context
+ */
+
+void rufl_ctx_set_output(struct rufl_context *ctx, rufl_output output)
+{
+	assert(output < rufl_OUTPUT_COUNT);
+
+	ctx->cache = ctx->cache_pool[output];
+}
+
+
+/**
+ * Lose all font handles in the pool for an output context.
  */
 
-void rufl_invalidate_cache(void)
+void rufl_invalidate_pool(rufl_output output)
 {
 	unsigned int i;
 
 	for (i = 0; i != rufl_CACHE_SIZE; i++) {
-		if (rufl_cache[i].font != rufl_CACHE_NONE) {
-			xfont_lose_font(rufl_cache[i].f);
-			rufl_cache[i].font = rufl_CACHE_NONE;
+		if (rufl_cache_pool[output][i].font != rufl_CACHE_NONE) {
+			rufl_fm_count(rufl_FM_LOSE_FONT);
+			xfont_lose_font(rufl_cache_pool[output][i].f);
+			rufl_cache_pool[output][i].font = rufl_CACHE_NONE;
 		}
-        }
+	}
 }
@@ -0,0 +1,169 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "rufl_internal.h"
+
+
+#ifdef RUFL_PROFILE
+
+/** Names of public functions, indexed by rufl_api. */
+static const char *const rufl_latency_names[rufl_API_COUNT] = {
+	"(none)",
+	"rufl_init",
+	"rufl_paint",
+	"rufl_width",
+	"rufl_x_to_offset",
+	"rufl_split",
+	"rufl_paint_callback",
+	"rufl_decompose_glyph",
+	"rufl_decompose_string",
+	"rufl_render_to_buffer",
+	"rufl_font_metrics",
+	"rufl_glyph_metrics",
+	"rufl_glyph_metrics_string",
+	"rufl_font_bbox",
+	"rufl_invalidate_cache",
+	"rufl_quit",
+};
+
+/** Histograms of this thread, indexed by rufl_api. */
+static rufl_THREAD_LOCAL struct rufl_latency_histogram
+		rufl_latency[rufl_API_COUNT];
+/** Time the outermost public function was entered / ns. */
+static rufl_THREAD_LOCAL unsigned long long rufl_latency_entered;
+
+
+static unsigned long long rufl_latency_percentile(
+		const struct rufl_latency_histogram *histogram,
+		unsigned int percent);
+
+
+/**
+ * Start timing a call of a public function.
+ */
+
+void rufl_latency_start(void)
+{
+	rufl_latency_entered = rufl_time_ns();
+}
+
+
+/**
+ * Stop timing a call of a public function and record it.
+ *
+ * \param  api  public function that was entered
+ */
+
+void rufl_latency_stop(rufl_api api)
+{
+	struct rufl_latency_histogram *histogram = &rufl_latency[api];
+	unsigned long long t = rufl_time_ns() - rufl_latency_entered;
+	unsigned int i;
+
+	for (i = 0; i != rufl_LATENCY_BUCKETS - 1 && (2ull << i) <= t; i++)
+		;
+
+	histogram->count++;
+	histogram->total += t;
+	if (histogram->max < t)
+		histogram->max = t;
+	histogram->bucket[i]++;
+}
+
+
+/**
+ * Print the latency histograms to stdout, for rufl_dump_state().
+ */
+
+void rufl_latency_dump(void)
+{
+	const struct rufl_latency_histogram *histogram;
+	unsigned int api, i;
+
+	printf("rufl_latency: (count, mean, 50%%, 90%%, 99%%, max / us; "
+			"buckets as 2^i ns: count)\n");
+	for (api = 0; api != rufl_API_COUNT; api++) {
+		histogram = &rufl_latency[api];
+		if (histogram->count == 0)
+			continue;
+
+		printf("  %s %lu %.1f %.1f %.1f %.1f %.1f\n   ",
+				rufl_latency_names[api], histogram->count,
+				histogram->total / 1e3 / histogram->count,
+				rufl_latency_percentile(histogram, 50) / 1e3,
+				rufl_latency_percentile(histogram, 90) / 1e3,
+				rufl_latency_percentile(histogram, 99) / 1e3,
+				histogram->max / 1e3);
+		for (i = 0; i != rufl_LATENCY_BUCKETS; i++)
+			if (histogram->bucket[i])
+				printf(" %u:%lu", i, histogram->bucket[i]);
+		printf("\n");
+	}
+}
+
+
+/**
+ * Estimate a percentile of a histogram.
+ *
+ * \return  upper bound of the bucket containing the percentile / ns
+ */
+
+unsigned long long rufl_latency_percentile(
+		const struct rufl_latency_histogram *histogram,
+		unsigned int percent)
+{
+	unsigned long long want, seen = 0;
+	unsigned int i;
+
+	want = ((unsigned long long) histogram->count * percent + 99) / 100;
+	for (i = 0; i != rufl_LATENCY_BUCKETS - 1; i++) {
+		seen += histogram->bucket[i];
+		if (want <= seen)
+			break;
+	}
+
+	if (i == rufl_LATENCY_BUCKETS - 1 || histogram->max < (2ull << i))
+		return histogram->max;
+	return 2ull << i;
+}
+
+#endif
+
+
+/**
+ * Read the latency histogram of a public function.
+ *
+ * \param  api        public function
+ * \param  histogram  updated to histogram
+ * \return  true, or false if latencies are not recorded (histogram is
+ *          cleared)
+ */
+
+bool rufl_latency_get(rufl_api api, struct rufl_latency_histogram *histogram)
+{
+#ifdef RUFL_PROFILE
+	*histogram = rufl_latency[api];
+	return true;
+#else
+	(void) api;
+	memset(histogram, 0, sizeof *histogram);
+	return false;
+#endif
+}
+
+
+/**
+ * Reset all latency histograms to 0.
+ */
+
+void rufl_latency_reset(void)
+{
+#ifdef RUFL_PROFILE
+	memset(rufl_latency, 0, sizeof rufl_latency);
+#endif
+}
@@ -0,0 +1,401 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef RUFL_HOST
+#include <pthread.h>
+#endif
+#include "rufl_internal.h"
+
+
+/** Number of messages kept. */
+#define rufl_LOG_ENTRIES 256
+/** Maximum arguments recorded per message. */
+#define rufl_LOG_ARGS 6
+/** Space for copies of %s arguments per message. */
+#define rufl_LOG_TEXT 96
+
+/** Kinds of conversion in a format. */
+typedef enum {
+	rufl_LOG_CONV_END,
+	rufl_LOG_CONV_PERCENT,
+	rufl_LOG_CONV_INT,
+	rufl_LOG_CONV_UNSIGNED,
+	rufl_LOG_CONV_DOUBLE,
+	rufl_LOG_CONV_POINTER,
+	rufl_LOG_CONV_STRING,
+} rufl_log_conv;
+
+/** A conversion in a format, from % to the conversion character. */
+struct rufl_log_spec {
+	const char *start;
+	/** End of flags, width and precision (start of length modifier). */
+	const char *modifier;
+	/** Conversion character. */
+	char conversion;
+	/** Length modifier: 0, 'H' (hh), 'h', 'l', 'L' (ll), 'z', 'D' (L). */
+	char length;
+};
+
+/** A recorded message. */
+struct rufl_log_entry {
+	unsigned long long time;
+	const char *file;
+	const char *func;
+	const char *format;
+	int line;
+	int level;
+	/** Number of arguments recorded, or rufl_LOG_ARGS + 1 if there were
+	 * more. */
+	unsigned int argc;
+	union {
+		long long i;
+		unsigned long long u;
+		double d;
+		const void *p;
+		/** Offset of string in text, for %s. */
+		unsigned int s;
+	} arg[rufl_LOG_ARGS];
+	char text[rufl_LOG_TEXT];
+};
+
+
+int rufl_log_level = rufl_LOG_INFO;
+/** Write messages to stderr as they are logged. */
+static bool rufl_log_echo = false;
+/** Ring of recent messages. */
+static struct rufl_log_entry rufl_log_ring[rufl_LOG_ENTRIES];
+/** Index of the next entry to use in rufl_log_ring. */
+static unsigned int rufl_log_next = 0;
+/** Number of messages logged since the log was cleared. */
+static unsigned long rufl_log_count = 0;
+/** Time of the first message since the log was cleared / ns. */
+static unsigned long long rufl_log_start;
+
+#ifdef RUFL_HOST
+/** Protects the ring, which is shared by all threads. */
+static pthread_mutex_t rufl_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define rufl_log_lock() pthread_mutex_lock(&rufl_log_mutex)
+#define rufl_log_unlock() pthread_mutex_unlock(&rufl_log_mutex)
+#else
+#define rufl_log_lock() ((void) 0)
+#define rufl_log_unlock() ((void) 0)
+#endif
+
+
+static rufl_log_conv rufl_log_parse(const char **format,
+		struct rufl_log_spec *spec);
+static void rufl_log_print(FILE *fp, const struct rufl_log_entry *entry);
+
+
+/**
+ * Record a message. Use the LOG_ERROR(), LOG_WARNING(), LOG_INFO() and
+ * LOG_DEBUG() macros.
+ *
+ * \param  level   level of message, rufl_LOG_ERROR to rufl_LOG_DEBUG
+ * \param  file    source file, which must be a string literal
+ * \param  func    function, which must be a string literal
+ * \param  line    source line
+ * \param  format  printf format, which must be a string literal
+ */
+
+void rufl_log(int level, const char *file, const char *func, int line,
+		const char *format, ...)
+{
+	struct rufl_log_entry *entry;
+	struct rufl_log_spec spec;
+	const char *f = format;
+	const char *s;
+	size_t text_used = 0, n;
+	rufl_log_conv conv;
+	va_list ap;
+
+	rufl_log_lock();
+	entry = &rufl_log_ring[rufl_log_next];
+	entry->time = rufl_time_ns();
+	if (rufl_log_count == 0)
+		rufl_log_start = entry->time;
+	entry->file = file;
+	entry->func = func;
+	entry->format = format;
+	entry->line = line;
+	entry->level = level;
+	entry->argc = 0;
+
+	va_start(ap, format);
+	while ((conv = rufl_log_parse(&f, &spec)) != rufl_LOG_CONV_END) {
+		if (conv == rufl_LOG_CONV_PERCENT)
+			continue;
+		if (entry->argc == rufl_LOG_ARGS) {
+			entry->argc++;
+			break;
+		}
+
+		switch (conv) {
+		case rufl_LOG_CONV_INT:
+			if (spec.length == 'L')
+				entry->arg[entry->argc].i = va_arg(ap, long long);
+			else if (spec.length == 'l')
+				entry->arg[entry->argc].i = va_arg(ap, long);
+			else if (spec.length == 'z')
+				entry->arg[entry->argc].i = va_arg(ap, size_t);
+			else
+				entry->arg[entry->argc].i = va_arg(ap, int);
+			break;
+		case rufl_LOG_CONV_UNSIGNED:
+			if (spec.length == 'L')
+				entry->arg[entry->argc].u =
+						va_arg(ap, unsigned long long);
+			else if (spec.length == 'l')
+				entry->arg[entry->argc].u =
+						va_arg(ap, unsigned long);
+			else if (spec.length == 'z')
+				entry->arg[entry->argc].u = va_arg(ap, size_t);
+			else
+				entry->arg[entry->argc].u =
+						va_arg(ap, unsigned int);
+			break;
+		case rufl_LOG_CONV_DOUBLE:
+			entry->arg[entry->argc].d = va_arg(ap, double);
+			break;
+		case rufl_LOG_CONV_POINTER:
+			entry->arg[entry->argc].p = va_arg(ap, void *);
+			break;
+		case rufl_LOG_CONV_STRING:
+			s = va_arg(ap, const char *);
+			if (!s)
+				s = "(null)";
+			n = strlen(s);
+			if (rufl_LOG_TEXT - 1 - text_used < n)
+				n = rufl_LOG_TEXT - 1 - text_used;
+			memcpy(entry->text + text_used, s, n);
+			entry->text[text_used + n] = 0;
+			entry->arg[entry->argc].s = text_used;
+			text_used += n;
+			if (text_used != rufl_LOG_TEXT - 1)
+				text_used++;
+			break;
+		default:
+			break;
+		}
+		entry->argc++;
+	}
+	va_end(ap);
+
+	rufl_log_next = (rufl_log_next + 1) % rufl_LOG_ENTRIES;
+	rufl_log_count++;
+
+	if (rufl_log_echo)
+		rufl_log_print(stderr, entry);
+	rufl_log_unlock();
+}
+
+
+/**
+ * Find the next conversion in a format.
+ *
+ * \param  format  updated to the character after the conversion
+ * \param  spec    updated with the conversion
+ * \return  kind of conversion, or rufl_LOG_CONV_END at the end of format
+ */
+
+rufl_log_conv rufl_log_parse(const char **format, struct rufl_log_spec *spec)
+{
+	const char *f = strchr(*format, '%');
+
+	if (!f) {
+		*format += strlen(*format);
+		return rufl_LOG_CONV_END;
+	}
+
+	spec->start = f++;
+	while (*f && strchr("-+ #0123456789.", *f))
+		f++;
+	spec->modifier = f;
+	spec->length = 0;
+	if (f[0] == 'h' && f[1] == 'h')
+		spec->length = 'H', f += 2;
+	else if (f[0] == 'l' && f[1] == 'l')
+		spec->length = 'L', f += 2;
+	else if (*f == 'h' || *f == 'l' || *f == 'z')
+		spec->length = *f++;
+	else if (*f == 'L')
+		spec->length = 'D', f++;
+	spec->conversion = *f;
+	if (!*f) {
+		*format = f;
+		return rufl_LOG_CONV_END;
+	}
+	*format = f + 1;
+
+	switch (spec->conversion) {
+	case '%':
+		return rufl_LOG_CONV_PERCENT;
+	case 'c':
+	case 'd':
+	case 'i':
+		return rufl_LOG_CONV_INT;
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		return rufl_LOG_CONV_UNSIGNED;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+		return rufl_LOG_CONV_DOUBLE;
+	case 'p':
+		return rufl_LOG_CONV_POINTER;
+	case 's':
+		return rufl_LOG_CONV_STRING;
+	default:
+		/* unknown conversion: print it literally */
+		return rufl_LOG_CONV_PERCENT;
+	}
+}
+
+
+/**
+ * Format a recorded message.
+ *
+ * \param  fp     stream to write to
+ * \param  entry  message
+ */
+
+void rufl_log_print(FILE *fp, const struct rufl_log_entry *entry)
+{
+	struct rufl_log_spec spec;
+	const char *f = entry->format;
+	const char *literal = f;
+	char conversion[24];
+	unsigned int i = 0;
+	size_t n;
+	rufl_log_conv conv;
+
+	fprintf(fp, "(%.6fs) %s %s %i: ",
+			(entry->time - rufl_log_start) / 1e9,
+			entry->file, entry->func, entry->line);
+
+	while (true) {
+		conv = rufl_log_parse(&f, &spec);
+		if (conv == rufl_LOG_CONV_END) {
+			fputs(literal, fp);
+			break;
+		}
+
+		fwrite(literal, 1, spec.start - literal, fp);
+		literal = f;
+		if (conv == rufl_LOG_CONV_PERCENT) {
+			fwrite(spec.start, 1, f - spec.start, fp);
+			continue;
+		}
+		if (i == rufl_LOG_ARGS) {
+			fputs("...", fp);
+			break;
+		}
+
+		/* rebuild the conversion for the recorded type */
+		n = spec.modifier - spec.start;
+		if (sizeof conversion - 4 < n)
+			n = sizeof conversion - 4;
+		memcpy(conversion, spec.start, n);
+		if (conv == rufl_LOG_CONV_INT || conv == rufl_LOG_CONV_UNSIGNED) {
+			if (spec.conversion != 'c') {
+				conversion[n++] = 'l';
+				conversion[n++] = 'l';
+			}
+		}
+		conversion[n++] = spec.conversion;
+		conversion[n] = 0;
+
+		switch (conv) {
+		case rufl_LOG_CONV_INT:
+			if (spec.conversion == 'c')
+				fprintf(fp, conversion, (int) entry->arg[i].i);
+			else
+				fprintf(fp, conversion, entry->arg[i].i);
+			break;
+		case rufl_LOG_CONV_UNSIGNED:
+			fprintf(fp, conversion, entry->arg[i].u);
+			break;
+		case rufl_LOG_CONV_DOUBLE:
+			fprintf(fp, conversion, entry->arg[i].d);
+			break;
+		case rufl_LOG_CONV_POINTER:
+			fprintf(fp, conversion, entry->arg[i].p);
+			break;
+		case rufl_LOG_CONV_STRING:
+			fprintf(fp, conversion, entry->text + entry->arg[i].s);
+			break;
+		default:
+			break;
+		}
+		i++;
+	}
+
+	fputc('\n', fp);
+}
+
+
+/**
+ * Set the most verbose level of message to log.
+ */
+
+void rufl_log_set_level(int level)
+{
+	rufl_log_level = level;
+}
+
+
+/**
+ * Also write each message to stderr as it is logged.
+ */
+
+void rufl_log_set_echo(bool echo)
+{
+	rufl_log_echo = echo;
+}
+
+
+/**
+ * Write the messages in the log to stdout, oldest first.
+ */
+
+void rufl_log_dump(void)
+{
+	unsigned int i, n, first;
+
+	rufl_log_lock();
+	n = rufl_log_count < rufl_LOG_ENTRIES ? rufl_log_count :
+			rufl_LOG_ENTRIES;
+	first = (rufl_log_next + rufl_LOG_ENTRIES - n) % rufl_LOG_ENTRIES;
+
+	printf("rufl_log: (%lu messages, last %u)\n", rufl_log_count, n);
+	for (i = 0; i != n; i++) {
+		printf("  ");
+		rufl_log_print(stdout, &rufl_log_ring[(first + i) %
+				rufl_LOG_ENTRIES]);
+	}
+	rufl_log_unlock();
+}
+
+
+/**
+ * Discard the messages in the log.
+ */
+
+void rufl_log_clear(void)
+{
+	rufl_log_lock();
+	rufl_log_next = 0;
+	rufl_log_count = 0;
+	rufl_log_unlock();
+}
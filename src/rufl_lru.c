@@ -0,0 +1,217 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rufl_internal.h"
+
+
+static struct rufl_lru_entry **rufl_lru_chain(struct rufl_lru *lru,
+		const void *key);
+static void rufl_lru_unlink(struct rufl_lru *lru,
+		struct rufl_lru_entry *entry);
+static void rufl_lru_push(struct rufl_lru *lru, struct rufl_lru_entry *entry);
+static void rufl_lru_evict(struct rufl_lru *lru);
+static void rufl_lru_destroy(struct rufl_lru *lru,
+		struct rufl_lru_entry *entry);
+
+
+/**
+ * Look up an entry and make it the most recently used.
+ *
+ * \param  lru  cache
+ * \param  key  key of entry
+ * \return  entry, or 0 if not found
+ */
+
+struct rufl_lru_entry *rufl_lru_get(struct rufl_lru *lru, const void *key)
+{
+	const struct rufl_lru_type *type = lru->type;
+	struct rufl_lru_entry *entry;
+
+	if (!lru->table)
+		return 0;
+
+	for (entry = *rufl_lru_chain(lru, key); entry;
+			entry = entry->hash_next) {
+		if (memcmp(type->key(entry), key, type->key_size) == 0) {
+			if (entry != lru->head) {
+				rufl_lru_unlink(lru, entry);
+				rufl_lru_push(lru, entry);
+			}
+			return entry;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Add an entry as the most recently used.
+ *
+ * \param  lru    cache
+ * \param  entry  entry, which must not have the key of an entry in the cache
+ * \return  true if the entry was added and is now owned by the cache, false
+ *          if it exceeds the budget or memory was exhausted
+ *
+ * Least recently used entries are discarded to keep within the budget.
+ */
+
+bool rufl_lru_put(struct rufl_lru *lru, struct rufl_lru_entry *entry)
+{
+	struct rufl_lru_entry **chain;
+	size_t size = lru->type->size(entry);
+
+	if (lru->budget < size)
+		return false;
+
+	if (!lru->table) {
+		lru->table = calloc(lru->type->buckets, sizeof *lru->table);
+		if (!lru->table)
+			return false;
+	}
+
+	while (lru->budget < lru->used + size)
+		rufl_lru_evict(lru);
+
+	chain = rufl_lru_chain(lru, lru->type->key(entry));
+	entry->hash_next = *chain;
+	*chain = entry;
+	rufl_lru_push(lru, entry);
+
+	lru->used += size;
+	lru->entries++;
+
+	return true;
+}
+
+
+/**
+ * Change the memory budget, discarding entries to keep within it.
+ *
+ * \param  lru    cache
+ * \param  bytes  maximum memory used by entries, or 0 to disable the cache
+ */
+
+void rufl_lru_set_budget(struct rufl_lru *lru, size_t bytes)
+{
+	lru->budget = bytes;
+
+	while (bytes < lru->used)
+		rufl_lru_evict(lru);
+
+	if (bytes == 0)
+		rufl_lru_clear(lru);
+}
+
+
+/**
+ * Discard all entries and free the memory of the cache.
+ *
+ * \param  lru  cache
+ */
+
+void rufl_lru_clear(struct rufl_lru *lru)
+{
+	struct rufl_lru_entry *entry, *next;
+
+	for (entry = lru->head; entry; entry = next) {
+		next = entry->next;
+		rufl_lru_destroy(lru, entry);
+	}
+	lru->head = lru->tail = 0;
+
+	free(lru->table);
+	lru->table = 0;
+
+	lru->used = 0;
+	lru->entries = 0;
+}
+
+
+/**
+ * Find the hash chain for a key.
+ */
+
+struct rufl_lru_entry **rufl_lru_chain(struct rufl_lru *lru,
+		const void *key)
+{
+	unsigned int h = lru->type->hash(key);
+
+	return &lru->table[(h ^ (h >> 16)) % lru->type->buckets];
+}
+
+
+/**
+ * Remove an entry from the recent-use list.
+ */
+
+void rufl_lru_unlink(struct rufl_lru *lru, struct rufl_lru_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		lru->head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		lru->tail = entry->prev;
+}
+
+
+/**
+ * Insert an entry at the most recently used end of the recent-use list.
+ */
+
+void rufl_lru_push(struct rufl_lru *lru, struct rufl_lru_entry *entry)
+{
+	entry->prev = 0;
+	entry->next = lru->head;
+	if (lru->head)
+		lru->head->prev = entry;
+	else
+		lru->tail = entry;
+	lru->head = entry;
+}
+
+
+/**
+ * Discard the least recently used entry.
+ */
+
+void rufl_lru_evict(struct rufl_lru *lru)
+{
+	struct rufl_lru_entry *entry = lru->tail;
+	struct rufl_lru_entry **link;
+
+	if (!entry)
+		return;
+
+	link = rufl_lru_chain(lru, lru->type->key(entry));
+	while (*link != entry)
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+
+	rufl_lru_unlink(lru, entry);
+	lru->used -= lru->type->size(entry);
+	lru->entries--;
+	lru->evictions++;
+	rufl_lru_destroy(lru, entry);
+}
+
+
+/**
+ * Free an entry which is no longer in the cache.
+ */
+
+void rufl_lru_destroy(struct rufl_lru *lru, struct rufl_lru_entry *entry)
+{
+	if (lru->type->destroy)
+		lru->type->destroy(entry);
+	else
+		free(entry);
+}
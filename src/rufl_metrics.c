@@ -5,7 +5,6 @@
  * Copyright 2005 John-Mark Bell <jmb202@ecs.soton.ac.uk>
  */
 
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -13,21 +12,64 @@
 
 #include "rufl_internal.h"
 
-static int rufl_unicode_map_search_cmp(const void *keyval, const void *datum);
+static rufl_code rufl_font_metrics_find(const char *font_family,
+		rufl_style font_style,
+		os_box *bbox, int *xkern, int *ykern, int *italic,
+		int *ascent, int *descent,
+		int *xheight, int *cap_height,
+		signed char *uline_position, unsigned char *uline_thickness);
+static rufl_code rufl_font_metrics_read(unsigned int font);
+static rufl_code rufl_glyph_metrics_find(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance);
+static void rufl_glyph_metrics_copy(
+		const struct rufl_glyph_cache_metrics *metrics,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance);
 
 /**
  * Read a font's metrics (sized for a 1pt font)
+ *
+ * The metrics are read from the Font Manager on first use and kept in
+ * rufl_font_list, so later calls for the same font only read memory.
+ */
+rufl_code rufl_ctx_font_metrics(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
+		os_box *bbox, int *xkern, int *ykern, int *italic,
+		int *ascent, int *descent,
+		int *xheight, int *cap_height,
+		signed char *uline_position, unsigned char *uline_thickness)
+{
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_FONT_METRICS, outer);
+	rufl_font_list_lock();
+	code = rufl_font_metrics_find(font_family, font_style, bbox, xkern,
+			ykern, italic, ascent, descent, xheight, cap_height,
+			uline_position, uline_thickness);
+	rufl_font_list_unlock();
+	rufl_api_leave(outer);
+
+	return code;
+}
+
+/**
+ * Find a font's metrics, for rufl_font_metrics().
  */
-rufl_code rufl_font_metrics(const char *font_family, rufl_style font_style,
+rufl_code rufl_font_metrics_find(const char *font_family,
+		rufl_style font_style,
 		os_box *bbox, int *xkern, int *ykern, int *italic,
 		int *ascent, int *descent,
 		int *xheight, int *cap_height,
 		signed char *uline_position, unsigned char *uline_thickness)
 {
 	unsigned int font;
-	font_f f;
-	int misc_size;
-	font_metrics_misc_info *misc_info;
+	const font_metrics_misc_info *misc_info;
 	rufl_code code;
 
 	code = rufl_find_font_family(font_family, font_style, &font,
@@ -35,39 +77,18 @@ rufl_code rufl_font_metrics(const char *font_family, rufl_style font_style,
 	if (code != rufl_OK)
 		return code;
 
-	code = rufl_find_font(font, 16 /* 1pt */, NULL, &f);
-	if (code != rufl_OK)
-		return code;
-
-	rufl_fm_error = xfont_read_font_metrics(f, 0, 0, 0, 0, 0,
-			0, 0, 0, 0, &misc_size, 0);
-	if (rufl_fm_error) {
-		LOG("xfont_read_font_metrics: 0x%x: %s",
-				rufl_fm_error->errnum,
-				rufl_fm_error->errmess);
-		return rufl_FONT_MANAGER_ERROR;
+	if (rufl_font_list[font].metrics == rufl_METRICS_UNKNOWN) {
+		code = rufl_font_metrics_read(font);
+		if (code != rufl_OK)
+			return code;
 	}
 
-	if (misc_size == 0) {
-		LOG("no miscellaneous information in metrics for %s",
-				rufl_font_list[font].identifier);
+	if (rufl_font_list[font].metrics == rufl_METRICS_NONE) {
 		/** \todo better error code */
 		return rufl_FONT_NOT_FOUND;
 	}
 
-	misc_info = (font_metrics_misc_info *)malloc(misc_size);
-	if (!misc_info)
-		return rufl_OUT_OF_MEMORY;
-
-	rufl_fm_error = xfont_read_font_metrics(f, 0, 0, 0, misc_info, 0,
-			0, 0, 0, 0, 0, 0);
-	if (rufl_fm_error) {
-		LOG("xfont_read_font_metrics: 0x%x: %s",
-				rufl_fm_error->errnum,
-				rufl_fm_error->errmess);
-		free(misc_info);
-		return rufl_FONT_MANAGER_ERROR;
-	}
+	misc_info = &rufl_font_list[font].misc_info;
 
 	/* and fill in output */
 	if (bbox) {
@@ -104,6 +125,64 @@ rufl_code rufl_font_metrics(const char *font_family, rufl_style font_style,
 	if (uline_thickness)
 		(*uline_thickness) = misc_info->underline_thickness;
 
+	return rufl_OK;
+}
+
+
+/**
+ * Read a font's miscellaneous metrics from the Font Manager into
+ * rufl_font_list.
+ */
+rufl_code rufl_font_metrics_read(unsigned int font)
+{
+	font_f f;
+	int misc_size;
+	font_metrics_misc_info *misc_info;
+	rufl_code code;
+
+	code = rufl_find_font(font, 16 /* 1pt */, NULL, &f);
+	if (code != rufl_OK)
+		return code;
+
+	rufl_fm_count(rufl_FM_READ_FONT_METRICS);
+	rufl_fm_error = xfont_read_font_metrics(f, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, &misc_size, 0);
+	if (rufl_fm_error) {
+		LOG_ERROR("xfont_read_font_metrics: 0x%x: %s",
+				rufl_fm_error->errnum,
+				rufl_fm_error->errmess);
+		return rufl_FONT_MANAGER_ERROR;
+	}
+
+	if (misc_size == 0) {
+		LOG_WARNING("no miscellaneous information in metrics for %s",
+				rufl_font_list[font].identifier);
+		rufl_font_list[font].metrics = rufl_METRICS_NONE;
+		rufl_metrics_changed = true;
+		return rufl_OK;
+	}
+
+	/* the Font Manager may return more than we know about */
+	misc_info = calloc(1, (size_t) misc_size < sizeof *misc_info ?
+			sizeof *misc_info : (size_t) misc_size);
+	if (!misc_info)
+		return rufl_OUT_OF_MEMORY;
+
+	rufl_fm_count(rufl_FM_READ_FONT_METRICS);
+	rufl_fm_error = xfont_read_font_metrics(f, 0, 0, 0, misc_info, 0,
+			0, 0, 0, 0, 0, 0);
+	if (rufl_fm_error) {
+		LOG_ERROR("xfont_read_font_metrics: 0x%x: %s",
+				rufl_fm_error->errnum,
+				rufl_fm_error->errmess);
+		free(misc_info);
+		return rufl_FONT_MANAGER_ERROR;
+	}
+
+	rufl_font_list[font].misc_info = *misc_info;
+	rufl_font_list[font].metrics = rufl_METRICS_PRESENT;
+	rufl_metrics_changed = true;
+
 	free(misc_info);
 
 	return rufl_OK;
@@ -112,7 +191,30 @@ rufl_code rufl_font_metrics(const char *font_family, rufl_style font_style,
 /**
  * Read a glyph's metrics
  */
-rufl_code rufl_glyph_metrics(const char *font_family,
+rufl_code rufl_ctx_glyph_metrics(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance)
+{
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_GLYPH_METRICS, outer);
+	code = rufl_glyph_metrics_find(font_family, font_style, font_size,
+			string, length, x_bearing, y_bearing, width, height,
+			x_advance, y_advance);
+	rufl_api_leave(outer);
+
+	return code;
+}
+
+/**
+ * Find a glyph's metrics, for rufl_glyph_metrics().
+ */
+rufl_code rufl_glyph_metrics_find(const char *font_family,
 		rufl_style font_style, unsigned int font_size,
 		const char *string, size_t length,
 		int *x_bearing, int *y_bearing,
@@ -123,12 +225,13 @@ rufl_code rufl_glyph_metrics(const char *font_family,
 	unsigned int font, font1, u;
 	unsigned short u1[2];
 	struct rufl_character_set *charset;
-	struct rufl_unicode_map_entry *umap_entry = NULL;
+	unsigned char c = 0;
 	font_f f;
 	rufl_code code;
 	font_scan_block block;
 	font_string_flags flags;
 	int xa, ya;
+	struct rufl_glyph_cache_metrics metrics;
 
 	/* Find font family containing glyph */
 	code = rufl_find_font_family(font_family, font_style,
@@ -143,26 +246,38 @@ rufl_code rufl_glyph_metrics(const char *font_family,
 		font1 = rufl_substitution_table[u];
 	else
 		font1 = rufl_CACHE_CORPUS;
+	if (font1 == NOT_AVAILABLE)
+		font1 = rufl_CACHE_CORPUS;
+	if (font1 == rufl_CACHE_CORPUS) {
+		/* the box of hex digits that is painted instead */
+		rufl_trace(rufl_TRACE_NOT_AVAILABLE, font1, font_size, 1,
+				rufl_API_GLYPH_METRICS);
+		rufl_not_available_metrics(font_size, &metrics);
+		rufl_glyph_metrics_copy(&metrics, x_bearing, y_bearing,
+				width, height, x_advance, y_advance);
+		return rufl_OK;
+	}
+
+	/* Measured recently? */
+	if (rufl_glyph_cache_get(font1, font_size, u, &metrics)) {
+		rufl_glyph_metrics_copy(&metrics, x_bearing, y_bearing,
+				width, height, x_advance, y_advance);
+		return rufl_OK;
+	}
 
 	/* Old font managers need the font encoding, too */
-	if (rufl_old_font_manager && font1 != rufl_CACHE_CORPUS) {
-		unsigned int i;
-		unsigned short u16 = (unsigned short) u;
-
-		for (i = 0; i < rufl_font_list[font1].num_umaps; i++) {
-			struct rufl_unicode_map *map =
-					rufl_font_list[font1].umap + i;
-
-			umap_entry = bsearch(&u16, map->map, map->entries,
-					sizeof map->map[0],
-					rufl_unicode_map_search_cmp);
-			if (umap_entry) {
-				font_encoding = map->encoding;
-				break;
-			}
+	if (rufl_old_font_manager) {
+		const struct rufl_font_list_entry *entry =
+				&rufl_font_list[font1];
+		unsigned int map = 0;
+
+		if (!rufl_unicode_lookup_get(entry->lookup, entry->umap,
+				entry->num_umaps, u, &map, &c)) {
+			LOG_ERROR("U+%x not in unicode maps of \"%s\"",
+					u, entry->identifier);
+			return rufl_FONT_NOT_FOUND;
 		}
-
-		assert(umap_entry != NULL);
+		font_encoding = entry->umap[map].encoding;
 	}
 
 	code = rufl_find_font(font1, font_size, font_encoding, &f);
@@ -238,39 +353,34 @@ rufl_code rufl_glyph_metrics(const char *font_family,
 	u1[0] = (unsigned short)u;
 	u1[1] = 0;
 
-	if (font1 == rufl_CACHE_CORPUS) {
-		/* Fallback Glyph */
-		/** \todo implement this properly */
-		xa = 1000 * font_size;
-		ya = 0;
-		block.bbox.x0 = block.bbox.y0 = 0;
-		block.bbox.x1 = block.bbox.y1 = xa;
-	} else if (rufl_old_font_manager) {
+	if (rufl_old_font_manager) {
 		/* Old Font Manager */
 		char s[2];
 
-		/* We found the correct umap entry when 
+		/* We found the character code when
 		 * looking for the font encoding */
-		s[0] = umap_entry->c;
+		s[0] = c;
 		s[1] = 0;
 
+		rufl_fm_count(rufl_FM_SCAN_STRING);
 		rufl_fm_error = xfont_scan_string(f, s, flags,
 				0x7fffffff, 0x7fffffff, &block, 0, 1,
 				0, &xa, &ya, 0);
 		if (rufl_fm_error) {
-			LOG("xfont_scan_string: 0x%x: %s",
+			LOG_ERROR("xfont_scan_string: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
 			return rufl_FONT_MANAGER_ERROR;
 		}
 	} else {
 		/* UCS Font Manager */
+		rufl_fm_count(rufl_FM_SCAN_STRING);
 		rufl_fm_error = xfont_scan_string(f, (const char *)u1,
 				flags | font_GIVEN16_BIT,
 				0x7fffffff, 0x7fffffff, &block, 0, 2,
 				0, &xa, &ya, 0);
 		if (rufl_fm_error) {
-			LOG("xfont_scan_string: 0x%x: %s",
+			LOG_ERROR("xfont_scan_string: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
 			return rufl_FONT_MANAGER_ERROR;
@@ -278,35 +388,47 @@ rufl_code rufl_glyph_metrics(const char *font_family,
 	}
 
 	/** \todo handle vertical text */
+	metrics.x_bearing = block.bbox.x0;
+	metrics.y_bearing = block.bbox.y1;
+	metrics.width = block.bbox.x1 - block.bbox.x0;
+	metrics.height = block.bbox.y1 - block.bbox.y0;
+	metrics.x_advance = xa;
+	metrics.y_advance = ya;
+
+	rufl_glyph_cache_put(font1, font_size, u, &metrics);
+
+	rufl_glyph_metrics_copy(&metrics, x_bearing, y_bearing,
+			width, height, x_advance, y_advance);
+
+	return rufl_OK;
+}
+
+
+/**
+ * Copy glyph metrics to the requested outputs.
+ */
+
+void rufl_glyph_metrics_copy(const struct rufl_glyph_cache_metrics *metrics,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance)
+{
 	if (x_bearing)
-		(*x_bearing) = block.bbox.x0;
+		(*x_bearing) = metrics->x_bearing;
 
 	if (y_bearing)
-		(*y_bearing) = block.bbox.y1;
+		(*y_bearing) = metrics->y_bearing;
 
 	if (width)
-		(*width) = block.bbox.x1 - block.bbox.x0;
+		(*width) = metrics->width;
 
 	if (height)
-		(*height) = block.bbox.y1 - block.bbox.y0;
+		(*height) = metrics->height;
 
 	if (x_advance)
-		(*x_advance) = xa;
+		(*x_advance) = metrics->x_advance;
 
 	if (y_advance)
-		(*y_advance) = ya;
-
-	return rufl_OK;
+		(*y_advance) = metrics->y_advance;
 }
 
-
-int rufl_unicode_map_search_cmp(const void *keyval, const void *datum)
-{
-	const unsigned short *key = keyval;
-	const struct rufl_unicode_map_entry *entry = datum;
-	if (*key < entry->u)
-		return -1;
-	else if (entry->u < *key)
-		return 1;
-	return 0;
-}
@@ -0,0 +1,433 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "rufl_internal.h"
+
+
+/** Number of hash chains. */
+#define rufl_OUTLINE_CACHE_BUCKETS 256
+
+/** Key of an entry in the outline cache. */
+struct rufl_outline_cache_key {
+	/** Font number (index in rufl_font_list). */
+	unsigned int font;
+	/** Unicode value. */
+	unsigned int u;
+	/** rufl_OUTLINE_* flags. */
+	unsigned int flags;
+};
+
+/** An entry in the outline cache. */
+struct rufl_outline_cache_entry {
+	/** Links in the cache. */
+	struct rufl_lru_entry lru;
+	/** Font, character, and variant of glyph. */
+	struct rufl_outline_cache_key key;
+	/** Number of words in path. */
+	size_t words;
+	/** Draw path objects at rufl_OUTLINE_REFERENCE_SIZE. */
+	int path[1];
+};
+
+/** The outline cache. */
+#define rufl_outline_cache (rufl_context_current->outline_cache)
+
+
+static unsigned int rufl_outline_cache_hash(const void *key);
+static const void *rufl_outline_cache_key(
+		const struct rufl_lru_entry *entry);
+static size_t rufl_outline_cache_entry_size(
+		const struct rufl_lru_entry *entry);
+static rufl_code rufl_outline_cache_write(void);
+static rufl_code rufl_outline_cache_read(void);
+static bool rufl_outline_cache_valid(const int *path, size_t words);
+
+
+const struct rufl_lru_type rufl_outline_cache_type = {
+	rufl_OUTLINE_CACHE_BUCKETS,
+	sizeof (struct rufl_outline_cache_key),
+	rufl_outline_cache_hash,
+	rufl_outline_cache_key,
+	rufl_outline_cache_entry_size,
+	0
+};
+
+
+/**
+ * Look up the outline of a glyph in the cache.
+ *
+ * \param  font   font number
+ * \param  u      Unicode value
+ * \param  flags  rufl_OUTLINE_* flags
+ * \param  words  updated to number of words in path, if found
+ * \return  Draw path objects at rufl_OUTLINE_REFERENCE_SIZE, or 0 if not
+ *          found
+ */
+
+const int *rufl_outline_cache_get(unsigned int font, unsigned int u,
+		unsigned int flags, size_t *words)
+{
+	struct rufl_outline_cache_key key = { font, u, flags };
+	struct rufl_outline_cache_entry *entry;
+
+	entry = (struct rufl_outline_cache_entry *)
+			rufl_lru_get(&rufl_outline_cache, &key);
+	if (!entry)
+		return 0;
+
+	*words = entry->words;
+	return entry->path;
+}
+
+
+/**
+ * Add the outline of a glyph to the cache.
+ *
+ * \param  font   font number
+ * \param  u      Unicode value
+ * \param  flags  rufl_OUTLINE_* flags
+ * \param  path   Draw path objects at rufl_OUTLINE_REFERENCE_SIZE
+ * \param  words  number of words in path
+ * \return  cached copy of path, or 0 if it was not cached because it
+ *          exceeds the budget or memory was exhausted
+ */
+
+const int *rufl_outline_cache_put(unsigned int font, unsigned int u,
+		unsigned int flags, const int *path, size_t words)
+{
+	struct rufl_outline_cache_entry *entry;
+	size_t size = offsetof(struct rufl_outline_cache_entry, path) +
+			words * sizeof path[0];
+
+	if (rufl_outline_cache.budget < size)
+		return 0;
+
+	entry = malloc(size);
+	if (!entry)
+		return 0;
+	entry->key.font = font;
+	entry->key.u = u;
+	entry->key.flags = flags;
+	entry->words = words;
+	memcpy(entry->path, path, words * sizeof path[0]);
+
+	if (!rufl_lru_put(&rufl_outline_cache, &entry->lru)) {
+		free(entry);
+		return 0;
+	}
+
+	return entry->path;
+}
+
+
+/**
+ * Discard all entries in the cache and free its memory.
+ */
+
+void rufl_outline_cache_clear(void)
+{
+	rufl_lru_clear(&rufl_outline_cache);
+}
+
+
+/**
+ * Set the memory budget of the outline cache.
+ *
+ * \param  bytes  maximum memory used by entries, or 0 to disable the cache
+ */
+
+void rufl_ctx_outline_cache_set_budget(struct rufl_context *ctx,
+		size_t bytes)
+{
+	struct rufl_outer outer;
+
+	rufl_context_enter(ctx, outer);
+
+	rufl_lru_set_budget(&rufl_outline_cache, bytes);
+
+	rufl_context_leave(outer);
+}
+
+
+/**
+ * Save the outline cache to disk.
+ */
+
+rufl_code rufl_ctx_outline_cache_save(struct rufl_context *ctx)
+{
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_context_enter(ctx, outer);
+	code = rufl_outline_cache_write();
+	rufl_context_leave(outer);
+
+	return code;
+}
+
+
+/**
+ * Write the outline cache to disk, for rufl_outline_cache_save().
+ *
+ * Entries are written least recently used first, so that loading them again
+ * restores the order of use.
+ */
+
+rufl_code rufl_outline_cache_write(void)
+{
+	const unsigned int version = rufl_OUTLINE_CACHE_VERSION;
+	const unsigned int reference = rufl_OUTLINE_REFERENCE_SIZE;
+	const struct rufl_outline_cache_entry *entry;
+	struct rufl_lru_entry *link;
+	unsigned int i = 0;
+	size_t len;
+	FILE *fp;
+
+	fp = fopen(rufl_OUTLINE_CACHE, "wb");
+	if (!fp) {
+		LOG_ERROR("fopen: 0x%x: %s", errno, strerror(errno));
+		return rufl_IO_ERROR;
+	}
+
+	/* cache format version and reference size */
+	if (fwrite(&version, sizeof version, 1, fp) != 1 ||
+			fwrite(&reference, sizeof reference, 1, fp) != 1) {
+		LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
+		fclose(fp);
+		return rufl_IO_ERROR;
+	}
+
+	for (link = rufl_outline_cache.tail; link; link = link->prev) {
+		const char *identifier;
+
+		entry = (const struct rufl_outline_cache_entry *) link;
+		identifier = rufl_font_list[entry->key.font].identifier;
+
+		/* font identifier, glyph, and path */
+		len = strlen(identifier);
+		if (fwrite(&len, sizeof len, 1, fp) != 1 ||
+				fwrite(identifier, len, 1, fp) != 1 ||
+				fwrite(&entry->key.u, sizeof entry->key.u, 1,
+						fp) != 1 ||
+				fwrite(&entry->key.flags,
+						sizeof entry->key.flags, 1,
+						fp) != 1 ||
+				fwrite(&entry->words, sizeof entry->words, 1,
+						fp) != 1 ||
+				fwrite(entry->path, sizeof entry->path[0],
+						entry->words,
+						fp) != entry->words) {
+			LOG_ERROR("fwrite: 0x%x: %s", errno, strerror(errno));
+			fclose(fp);
+			return rufl_IO_ERROR;
+		}
+		i++;
+	}
+
+	if (fclose(fp) == EOF) {
+		LOG_ERROR("fclose: 0x%x: %s", errno, strerror(errno));
+		return rufl_IO_ERROR;
+	}
+
+	LOG_INFO("%u outlines saved", i);
+
+	return rufl_OK;
+}
+
+
+/**
+ * Load outlines saved by rufl_outline_cache_save().
+ */
+
+rufl_code rufl_ctx_outline_cache_load(struct rufl_context *ctx)
+{
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_context_enter(ctx, outer);
+	code = rufl_outline_cache_read();
+	rufl_context_leave(outer);
+
+	return code;
+}
+
+
+/**
+ * Read outlines from disk, for rufl_outline_cache_load().
+ *
+ * Outlines for fonts which are no longer available are ignored. A missing or
+ * incompatible file is not an error. Reading stops at an outline larger than
+ * the budget or one which is not a well formed path, since the file is then
+ * probably corrupt.
+ */
+
+rufl_code rufl_outline_cache_read(void)
+{
+	unsigned int version, reference, u, flags;
+	unsigned int font, i = 0;
+	char identifier[256];
+	int *path = 0, *path2;
+	size_t len, words, path_words = 0;
+	rufl_code code = rufl_OK;
+	FILE *fp;
+
+	fp = fopen(rufl_OUTLINE_CACHE, "rb");
+	if (!fp) {
+		LOG_WARNING("fopen: 0x%x: %s", errno, strerror(errno));
+		return rufl_OK;
+	}
+
+	if (fread(&version, sizeof version, 1, fp) != 1 ||
+			fread(&reference, sizeof reference, 1, fp) != 1 ||
+			version != rufl_OUTLINE_CACHE_VERSION ||
+			reference != rufl_OUTLINE_REFERENCE_SIZE) {
+		LOG_WARNING("%s", "incompatible outline cache");
+		fclose(fp);
+		return rufl_OK;
+	}
+
+	while (fread(&len, sizeof len, 1, fp) == 1) {
+		if (sizeof identifier <= len ||
+				fread(identifier, len, 1, fp) != 1 ||
+				fread(&u, sizeof u, 1, fp) != 1 ||
+				fread(&flags, sizeof flags, 1, fp) != 1 ||
+				fread(&words, sizeof words, 1, fp) != 1) {
+			LOG_WARNING("%s", "outline cache truncated");
+			break;
+		}
+		identifier[len] = 0;
+
+		if (rufl_outline_cache.budget / sizeof path[0] < words) {
+			LOG_WARNING("%s", "outline cache corrupt");
+			break;
+		}
+
+		if (path_words < words) {
+			path2 = realloc(path, words * sizeof path[0]);
+			if (!path2) {
+				code = rufl_OUT_OF_MEMORY;
+				break;
+			}
+			path = path2;
+			path_words = words;
+		}
+		if (fread(path, sizeof path[0], words, fp) != words) {
+			LOG_WARNING("%s", "outline cache truncated");
+			break;
+		}
+		if (!rufl_outline_cache_valid(path, words)) {
+			LOG_WARNING("%s", "outline cache corrupt");
+			break;
+		}
+
+		for (font = 0; font != rufl_font_list_entries; font++)
+			if (strcasecmp(identifier,
+					rufl_font_list[font].identifier) == 0)
+				break;
+		if (font == rufl_font_list_entries)
+			continue;
+
+		if (!rufl_outline_cache_get(font, u, flags, &len) &&
+				rufl_outline_cache_put(font, u, flags, path,
+						words))
+			i++;
+	}
+
+	free(path);
+	fclose(fp);
+
+	LOG_INFO("%u outlines loaded", i);
+
+	return code;
+}
+
+
+/**
+ * Check that a loaded outline is a sequence of Draw path objects.
+ *
+ * The rest of the library walks paths without bounds checks, so every object
+ * and path element must lie inside the outline, and the last must end it.
+ *
+ * \param  path   Draw path objects
+ * \param  words  number of words in path
+ * \return  true if the path is well formed
+ */
+
+bool rufl_outline_cache_valid(const int *path, size_t words)
+{
+	const int *p = path, *q, *end, *ep = path + words;
+	size_t operands;
+
+	while (p < ep) {
+		/* object header and path style */
+		if (ep - p < 10 || p[0] != 2 || p[1] < 0 ||
+				p[1] % sizeof p[0] != 0 ||
+				(size_t) (ep - p) < p[1] / sizeof p[0])
+			return false;
+		end = p + p[1] / sizeof p[0];
+		if (end - p < 10)
+			return false;
+
+		/* dash pattern */
+		q = p + 9;
+		if (q[0] & (1<<7)) {
+			if (end - q < 3 || q[2] < 0 || end - q - 3 < q[2])
+				return false;
+			q += q[2] + 2;
+		}
+		q++;
+
+		/* path elements, ending with a 0 word */
+		for (; q != end && q[0] != 0; q += 1 + operands) {
+			switch (q[0]) {
+			case 2: case 8: operands = 2; break;
+			case 5: operands = 0; break;
+			case 6: operands = 6; break;
+			default: return false;
+			}
+			if ((size_t) (end - q - 1) < operands)
+				return false;
+		}
+		if (q == end)
+			return false;
+
+		p = q + 1;
+	}
+
+	return true;
+}
+
+
+unsigned int rufl_outline_cache_hash(const void *key)
+{
+	const struct rufl_outline_cache_key *k = key;
+
+	return (k->font * 4 + k->flags) * 0x9e3779b1u ^ k->u;
+}
+
+
+const void *rufl_outline_cache_key(const struct rufl_lru_entry *entry)
+{
+	return &((const struct rufl_outline_cache_entry *) entry)->key;
+}
+
+
+/**
+ * Memory used by an entry.
+ */
+
+size_t rufl_outline_cache_entry_size(const struct rufl_lru_entry *entry)
+{
+	return offsetof(struct rufl_outline_cache_entry, path) +
+			((const struct rufl_outline_cache_entry *)
+			entry)->words * sizeof (int);
+}
@@ -15,10 +15,40 @@
 
 
 typedef enum { rufl_PAINT, rufl_WIDTH, rufl_X_TO_OFFSET,
-		rufl_SPLIT, rufl_PAINT_CALLBACK, rufl_FONT_BBOX } rufl_action;
+		rufl_SPLIT, rufl_PAINT_CALLBACK, rufl_FONT_BBOX,
+		rufl_GLYPH_METRICS } rufl_action;
+/** Public function of each action, for trace events. */
+static const rufl_api rufl_action_api[] = { rufl_API_PAINT, rufl_API_WIDTH,
+		rufl_API_X_TO_OFFSET, rufl_API_SPLIT, rufl_API_PAINT_CALLBACK,
+		rufl_API_FONT_BBOX, rufl_API_GLYPH_METRICS_STRING };
 #define rufl_PROCESS_CHUNK 200
+/** Length of the Font_Paint string for each unavailable character: four
+ * digits and four moves. */
+#define rufl_NOT_AVAILABLE_BYTES 20
+/** Advance of the box for each unavailable character / OS units. */
+#define rufl_NOT_AVAILABLE_WIDTH(font_size) (7 * (font_size) / 64)
+/** Height of the top row of digits above the baseline / OS units. */
+#define rufl_NOT_AVAILABLE_RISE(font_size) (5 * (font_size) / 64)
 
 bool rufl_can_background_blend = false;
+rufl_THREAD_LOCAL unsigned long rufl_span_count = 0;
+
+/** Output arrays for rufl_GLYPH_METRICS, passed as the context. */
+struct rufl_glyph_metrics_out {
+	int *x_bearing;
+	int *y_bearing;
+	int *width;
+	int *height;
+	int *x_advance;
+	int *y_advance;
+	/** Number of glyphs stored so far. */
+	size_t count;
+};
+
+/** Bounding boxes of fonts at small sizes, replaced in rotation. */
+#define rufl_bbox_memo (rufl_context_current->bbox_memo)
+/** Next entry of rufl_bbox_memo to replace. */
+#define rufl_bbox_memo_next (rufl_context_current->bbox_memo_next)
 
 static const os_trfm trfm_oblique =
 		{ { { 65536, 0 }, { 13930, 65536 }, { 0, 0 } } };
@@ -31,6 +61,8 @@ static rufl_code rufl_process(rufl_action action,
 		int x, int y, unsigned int flags,
 		int *width, int click_x, size_t *char_offset, int *actual_x,
 		rufl_callback_t callback, void *context);
+static rufl_code rufl_font_bbox_find(const char *font_family,
+		rufl_style font_style, unsigned int font_size, int *bbox);
 static rufl_code rufl_process_span(rufl_action action,
 		unsigned short *s, unsigned int n,
 		unsigned int font, unsigned int font_size, unsigned int slant,
@@ -43,27 +75,44 @@ static rufl_code rufl_process_span_old(rufl_action action,
 		int *x, int y, unsigned int flags,
 		int click_x, size_t *offset,
 		rufl_callback_t callback, void *context);
-static int rufl_unicode_map_search_cmp(const void *keyval, const void *datum);
 static rufl_code rufl_process_not_available(rufl_action action,
 		unsigned short *s, unsigned int n,
 		unsigned int font_size, int *x, int y,
 		unsigned int flags,
 		int click_x, size_t *offset,
 		rufl_callback_t callback, void *context);
+static char *rufl_paint_move(char *p, char code, int d);
+static rufl_code rufl_process_glyph_metrics(const char *encoding,
+		const char *s, unsigned int n,
+		unsigned int char_size, font_string_flags flags,
+		unsigned int font, unsigned int font_size,
+		const unsigned short *u,
+		int *x, struct rufl_glyph_metrics_out *out);
+static void rufl_glyph_metrics_store(struct rufl_glyph_metrics_out *out,
+		int x_bearing, int y_bearing, int width, int height,
+		int x_advance, int y_advance);
 
 
 /**
  * Render Unicode text.
  */
 
-rufl_code rufl_paint(const char *font_family, rufl_style font_style,
+rufl_code rufl_ctx_paint(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
 		unsigned int font_size,
 		const char *string, size_t length,
 		int x, int y, unsigned int flags)
 {
-	return rufl_process(rufl_PAINT,
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_PAINT, outer);
+	code = rufl_process(rufl_PAINT,
 			font_family, font_style, font_size, string,
 			length, x, y, flags, 0, 0, 0, 0, 0, 0);
+	rufl_api_leave(outer);
+
+	return code;
 }
 
 
@@ -71,14 +120,22 @@ rufl_code rufl_paint(const char *font_family, rufl_style font_style,
  * Measure the width of Unicode text.
  */
 
-rufl_code rufl_width(const char *font_family, rufl_style font_style,
+rufl_code rufl_ctx_width(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
 		unsigned int font_size,
 		const char *string, size_t length,
 		int *width)
 {
-	return rufl_process(rufl_WIDTH,
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_WIDTH, outer);
+	code = rufl_process(rufl_WIDTH,
 			font_family, font_style, font_size, string,
 			length, 0, 0, 0, width, 0, 0, 0, 0, 0);
+	rufl_api_leave(outer);
+
+	return code;
 }
 
 
@@ -87,16 +144,24 @@ rufl_code rufl_width(const char *font_family, rufl_style font_style,
  * falls.
  */
 
-rufl_code rufl_x_to_offset(const char *font_family, rufl_style font_style,
+rufl_code rufl_ctx_x_to_offset(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
 		unsigned int font_size,
 		const char *string, size_t length,
 		int click_x,
 		size_t *char_offset, int *actual_x)
 {
-	return rufl_process(rufl_X_TO_OFFSET,
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_X_TO_OFFSET, outer);
+	code = rufl_process(rufl_X_TO_OFFSET,
 			font_family, font_style, font_size, string,
 			length, 0, 0, 0, 0,
 			click_x, char_offset, actual_x, 0, 0);
+	rufl_api_leave(outer);
+
+	return code;
 }
 
 
@@ -104,16 +169,24 @@ rufl_code rufl_x_to_offset(const char *font_family, rufl_style font_style,
  * Find the prefix of a string that will fit in a specified width.
  */
 
-rufl_code rufl_split(const char *font_family, rufl_style font_style,
+rufl_code rufl_ctx_split(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
 		unsigned int font_size,
 		const char *string, size_t length,
 		int width,
 		size_t *char_offset, int *actual_x)
 {
-	return rufl_process(rufl_SPLIT,
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_SPLIT, outer);
+	code = rufl_process(rufl_SPLIT,
 			font_family, font_style, font_size, string,
 			length, 0, 0, 0, 0,
 			width, char_offset, actual_x, 0, 0);
+	rufl_api_leave(outer);
+
+	return code;
 }
 
 
@@ -121,29 +194,164 @@ rufl_code rufl_split(const char *font_family, rufl_style font_style,
  * Render text, but call a callback instead of each call to Font_Paint.
  */
 
-rufl_code rufl_paint_callback(const char *font_family, rufl_style font_style,
+rufl_code rufl_ctx_paint_callback(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
 		unsigned int font_size,
 		const char *string, size_t length,
 		int x, int y,
 		rufl_callback_t callback, void *context)
 {
-	return rufl_process(rufl_PAINT_CALLBACK,
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_PAINT_CALLBACK, outer);
+	code = rufl_process(rufl_PAINT_CALLBACK,
 			font_family, font_style, font_size, string,
 			length, x, y, 0, 0, 0, 0, 0, callback, context);
+	rufl_api_leave(outer);
+
+	return code;
 }
 
 
 /**
  * Determine the maximum bounding box of a font.
+ *
+ * The bounding box at rufl_BBOX_REFERENCE_SIZE is read once for each font and
+ * scaled. Below rufl_BBOX_HINT_SIZE, where hinting makes scaling inexact, the
+ * bounding box is read for the size requested and remembered.
  */
 
-rufl_code rufl_font_bbox(const char *font_family, rufl_style font_style,
+rufl_code rufl_ctx_font_bbox(struct rufl_context *ctx,
+		const char *font_family, rufl_style font_style,
 		unsigned int font_size,
 		int *bbox)
 {
-	return rufl_process(rufl_FONT_BBOX,
-			font_family, font_style, font_size, 0,
-			0, 0, 0, 0, bbox, 0, 0, 0, 0, 0);
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_FONT_BBOX, outer);
+	rufl_font_list_lock();
+	code = rufl_font_bbox_find(font_family, font_style, font_size, bbox);
+	rufl_font_list_unlock();
+	rufl_api_leave(outer);
+
+	return code;
+}
+
+
+/**
+ * Find the maximum bounding box of a font, for rufl_font_bbox().
+ */
+
+rufl_code rufl_font_bbox_find(const char *font_family,
+		rufl_style font_style, unsigned int font_size, int *bbox)
+{
+	struct rufl_font_list_entry *entry;
+	unsigned int font, i;
+	rufl_code code;
+
+	code = rufl_find_font_family(font_family, font_style, &font, 0, 0);
+	if (code != rufl_OK)
+		return code;
+	entry = &rufl_font_list[font];
+
+	if (font_size < rufl_BBOX_HINT_SIZE) {
+		for (i = 0; i != rufl_BBOX_MEMO_SIZE; i++) {
+			if (rufl_bbox_memo[i].size == font_size &&
+					rufl_bbox_memo[i].font == font) {
+				memcpy(bbox, rufl_bbox_memo[i].bbox,
+						sizeof rufl_bbox_memo[i].bbox);
+				return rufl_OK;
+			}
+		}
+
+		code = rufl_process(rufl_FONT_BBOX,
+				font_family, font_style, font_size, 0,
+				0, 0, 0, 0, bbox, 0, 0, 0, 0, 0);
+		if (code != rufl_OK)
+			return code;
+
+		i = rufl_bbox_memo_next;
+		rufl_bbox_memo_next = (i + 1) % rufl_BBOX_MEMO_SIZE;
+		rufl_bbox_memo[i].font = font;
+		rufl_bbox_memo[i].size = font_size;
+		memcpy(rufl_bbox_memo[i].bbox, bbox,
+				sizeof rufl_bbox_memo[i].bbox);
+		return rufl_OK;
+	}
+
+	if (!entry->bbox_known) {
+		code = rufl_process(rufl_FONT_BBOX,
+				font_family, font_style,
+				rufl_BBOX_REFERENCE_SIZE, 0,
+				0, 0, 0, 0, entry->bbox, 0, 0, 0, 0, 0);
+		if (code != rufl_OK)
+			return code;
+		entry->bbox_known = true;
+	}
+
+	/* scale outwards, so the box still contains every glyph */
+	for (i = 0; i != 4; i++) {
+		long long v = (long long) entry->bbox[i] * font_size;
+		long long d = rufl_BBOX_REFERENCE_SIZE;
+
+		if ((i < 2) == (v < 0))
+			bbox[i] = (int) ((v < 0 ? v - d + 1 : v + d - 1) / d);
+		else
+			bbox[i] = (int) (v / d);
+	}
+
+	return rufl_OK;
+}
+
+
+/**
+ * Forget bounding boxes remembered by rufl_font_bbox(), which depend on the
+ * resolution of the output.
+ */
+
+void rufl_font_bbox_clear(void)
+{
+	unsigned int i;
+
+	for (i = 0; i != rufl_BBOX_MEMO_SIZE; i++)
+		rufl_bbox_memo[i].size = 0;
+
+	if (!rufl_font_list)
+		return;
+	rufl_font_list_lock();
+	for (i = 0; i != rufl_font_list_entries; i++)
+		rufl_font_list[i].bbox_known = false;
+	rufl_font_list_unlock();
+}
+
+
+/**
+ * Read metrics for every glyph of a string.
+ */
+
+rufl_code rufl_ctx_glyph_metrics_string(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int *x_bearing, int *y_bearing,
+		int *width, int *height,
+		int *x_advance, int *y_advance,
+		size_t *count)
+{
+	struct rufl_glyph_metrics_out out = { x_bearing, y_bearing,
+			width, height, x_advance, y_advance, 0 };
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_GLYPH_METRICS_STRING, outer);
+	code = rufl_process(rufl_GLYPH_METRICS,
+			font_family, font_style, font_size, string,
+			length, 0, 0, 0, 0, 0, 0, 0, 0, &out);
+	rufl_api_leave(outer);
+	*count = out.count;
+	return code;
 }
 
 
@@ -179,7 +387,8 @@ rufl_code rufl_process(rufl_action action,
 			(action == rufl_SPLIT && char_offset &&
 					actual_x) ||
 			(action == rufl_PAINT_CALLBACK && callback) ||
-			(action == rufl_FONT_BBOX && width));
+			(action == rufl_FONT_BBOX && width) ||
+			(action == rufl_GLYPH_METRICS && context));
 
 	if ((flags & rufl_BLEND_FONT) && !rufl_can_background_blend) {
 		/* unsuitable FM => clear blending bit */
@@ -258,6 +467,10 @@ rufl_code rufl_process(rufl_action action,
 		if (length == 0 && font1 == font0)
 			offset_map[n] = string - string0;
 
+		rufl_span_count++;
+		rufl_trace(font0 == NOT_AVAILABLE ? rufl_TRACE_NOT_AVAILABLE :
+				rufl_TRACE_SPAN, font0, font_size, n,
+				rufl_action_api[action]);
 		if (font0 == NOT_AVAILABLE)
 			code = rufl_process_not_available(action, s, n,
 					font_size, &x, y, flags,
@@ -303,17 +516,24 @@ rufl_code rufl_process_span(rufl_action action,
 {
 	unsigned short *split_point;
 	int x_out, y_out;
-	unsigned int i;
 	char font_name[80];
 	bool oblique = slant && !rufl_font_list[font].slant;
 	font_f f;
 	rufl_code code;
 
+	/* metrics are often all cached, so the handle is found only when
+	 * one is missing */
+	if (action == rufl_GLYPH_METRICS)
+		return rufl_process_glyph_metrics("UTF8", (const char *) s, n,
+				2, font_GIVEN16_BIT, font, font_size, s,
+				x, context);
+
 	code = rufl_find_font(font, font_size, "UTF8", &f);
 	if (code != rufl_OK)
 		return code;
 
 	if (action == rufl_FONT_BBOX) {
+		rufl_fm_count(rufl_FM_READ_INFO);
 		rufl_fm_error = xfont_read_info(f, &x[0], &x[1], &x[2], &x[3]);
 		if (rufl_fm_error)
 			return rufl_FONT_MANAGER_ERROR;
@@ -322,6 +542,7 @@ rufl_code rufl_process_span(rufl_action action,
 
 	if (action == rufl_PAINT) {
 		/* paint span */
+		rufl_fm_count(rufl_FM_PAINT);
 		rufl_fm_error = xfont_paint(f, (const char *) s,
 				font_OS_UNITS |
 				(oblique ? font_GIVEN_TRFM : 0) |
@@ -332,12 +553,11 @@ rufl_code rufl_process_span(rufl_action action,
 						font_BLEND_FONT : 0),
 				*x, y, 0, &trfm_oblique, n * 2);
 		if (rufl_fm_error) {
-			LOG("xfont_paint: 0x%x: %s",
+			LOG_ERROR("xfont_paint: 0x%x: %s "
+					"(%u characters, U+%x to U+%x)",
 					rufl_fm_error->errnum,
-					rufl_fm_error->errmess);
-			for (i = 0; i != n; i++)
-				fprintf(stderr, "0x%x ", s[i]);
-			fprintf(stderr, " (%u)\n", n);
+					rufl_fm_error->errmess,
+					n, s[0], s[n - 1]);
 			return rufl_FONT_MANAGER_ERROR;
 		}
 	} else if (action == rufl_PAINT_CALLBACK) {
@@ -348,6 +568,7 @@ rufl_code rufl_process_span(rufl_action action,
 
 	/* increment x by width of span */
 	if (action == rufl_X_TO_OFFSET || action == rufl_SPLIT) {
+		rufl_fm_count(rufl_FM_SCAN_STRING);
 		rufl_fm_error = xfont_scan_string(f, (const char *) s,
 				font_GIVEN_LENGTH | font_GIVEN_FONT |
 				font_KERN | font_GIVEN16_BIT |
@@ -359,6 +580,7 @@ rufl_code rufl_process_span(rufl_action action,
 				&x_out, &y_out, 0);
 		*offset = split_point - s;
 	} else {
+		rufl_fm_count(rufl_FM_SCAN_STRING);
 		rufl_fm_error = xfont_scan_string(f, (const char *) s,
 				font_GIVEN_LENGTH | font_GIVEN_FONT |
 				font_KERN | font_GIVEN16_BIT,
@@ -366,7 +588,7 @@ rufl_code rufl_process_span(rufl_action action,
 				0, &x_out, &y_out, 0);
 	}
 	if (rufl_fm_error) {
-		LOG("xfont_scan_string: 0x%x: %s",
+		LOG_ERROR("xfont_scan_string: 0x%x: %s",
 				rufl_fm_error->errnum,
 				rufl_fm_error->errmess);
 		return rufl_FONT_MANAGER_ERROR;
@@ -394,6 +616,9 @@ rufl_code rufl_process_span_old(rufl_action action,
 	int x_out, y_out;
 	unsigned int i;
 	bool oblique = slant && !rufl_font_list[font].slant;
+	const struct rufl_unicode_lookup *lookup = rufl_font_list[font].lookup;
+	const struct rufl_unicode_map *umap = rufl_font_list[font].umap;
+	unsigned int num_umaps = rufl_font_list[font].num_umaps;
 	font_f f;
 	rufl_code code;
 
@@ -403,9 +628,10 @@ rufl_code rufl_process_span_old(rufl_action action,
 		if (code != rufl_OK)
 			return code;
 
+		rufl_fm_count(rufl_FM_READ_INFO);
 		rufl_fm_error = xfont_read_info(f, &x[0], &x[1], &x[2], &x[3]);
 		if (rufl_fm_error) {
-			LOG("xfont_read_info: 0x%x: %s",
+			LOG_ERROR("xfont_read_info: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
 			return rufl_FONT_MANAGER_ERROR;
@@ -418,37 +644,52 @@ rufl_code rufl_process_span_old(rufl_action action,
 
 	/* Process the span in map-coherent chunks */
 	do {
-		struct rufl_unicode_map *map = NULL;
-		struct rufl_unicode_map_entry *entry = NULL;
-		unsigned int j;
+		struct rufl_unicode_map *map;
+		struct rufl_unicode_map_entry *entry;
+		unsigned int m = 0, j;
+		unsigned char c;
 
 		i = 0;
 
 		/* Find map for first character */
-		for (j = 0; j < rufl_font_list[font].num_umaps; j++) {
-			map = rufl_font_list[font].umap + j;
-
-			entry = bsearch(&s[i], map->map, map->entries,
-				sizeof map->map[0],
-				rufl_unicode_map_search_cmp);
-			if (entry)
-				break;
+		if (!rufl_unicode_lookup_get(lookup, umap, num_umaps, s[0],
+				&m, &c)) {
+			LOG_ERROR("U+%x not in unicode maps of \"%s\"",
+					s[0], rufl_font_list[font].identifier);
+			return rufl_FONT_NOT_FOUND;
 		}
-		assert(map != NULL);
-		assert(entry != NULL);
+		map = rufl_font_list[font].umap + m;
 
 		/* Collect characters: s[0..i) use map */
 		do {
+			if (rufl_unicode_lookup_get(lookup, umap, num_umaps,
+					s[i], &j, &c) && j == m) {
+				s2[i++] = c;
+				continue;
+			}
+
+			/* the first map containing this character is a
+			 * different one, but it may also be in this map */
 			entry = bsearch(&s[i], map->map, map->entries,
 				sizeof map->map[0],
 				rufl_unicode_map_search_cmp);
-
-			if (entry)
-				s2[i++] = entry->c;
-		} while (i != n && entry != NULL);
+			if (!entry)
+				break;
+			s2[i++] = entry->c;
+		} while (i != n);
 
 		s2[i] = 0;
 
+		if (action == rufl_GLYPH_METRICS) {
+			code = rufl_process_glyph_metrics(map->encoding, s2, i,
+					1, 0, font, font_size, s, x, context);
+			if (code != rufl_OK)
+				return code;
+			s += i;
+			n -= i;
+			continue;
+		}
+
 		code = rufl_find_font(font, font_size, map->encoding, &f);
 		if (code != rufl_OK)
 			return code;
@@ -458,14 +699,16 @@ rufl_code rufl_process_span_old(rufl_action action,
 			/* call Font_SetFont to work around broken PS printer 
 			 * driver, which doesn't use the font handle from 
 			 * Font_Paint */
+			rufl_fm_count(rufl_FM_SET_FONT);
 			rufl_fm_error = xfont_set_font(f);
 			if (rufl_fm_error) {
-				LOG("xfont_set_font: 0x%x: %s",
+				LOG_ERROR("xfont_set_font: 0x%x: %s",
 						rufl_fm_error->errnum,
 						rufl_fm_error->errmess);
 				return rufl_FONT_MANAGER_ERROR;
 			}
 
+			rufl_fm_count(rufl_FM_PAINT);
 			rufl_fm_error = xfont_paint(f, s2, font_OS_UNITS |
 					(oblique ? font_GIVEN_TRFM : 0) |
 					font_GIVEN_LENGTH | font_GIVEN_FONT |
@@ -474,7 +717,7 @@ rufl_code rufl_process_span_old(rufl_action action,
 							font_BLEND_FONT : 0),
 					*x, y, 0, &trfm_oblique, i);
 			if (rufl_fm_error) {
-				LOG("xfont_paint: 0x%x: %s",
+				LOG_ERROR("xfont_paint: 0x%x: %s",
 						rufl_fm_error->errnum,
 						rufl_fm_error->errmess);
 				return rufl_FONT_MANAGER_ERROR;
@@ -496,6 +739,7 @@ rufl_code rufl_process_span_old(rufl_action action,
 
 		/* increment x by width of span */
 		if (action == rufl_X_TO_OFFSET || action == rufl_SPLIT) {
+			rufl_fm_count(rufl_FM_SCAN_STRING);
 			rufl_fm_error = xfont_scan_string(f, s2,
 					font_GIVEN_LENGTH | font_GIVEN_FONT |
 					font_KERN |
@@ -506,6 +750,7 @@ rufl_code rufl_process_span_old(rufl_action action,
 					&split_point, &x_out, &y_out, 0);
 			*offset += split_point - s2;
 		} else {
+			rufl_fm_count(rufl_FM_SCAN_STRING);
 			rufl_fm_error = xfont_scan_string(f, s2,
 					font_GIVEN_LENGTH | font_GIVEN_FONT | 
 					font_KERN,
@@ -513,7 +758,7 @@ rufl_code rufl_process_span_old(rufl_action action,
 					0, &x_out, &y_out, 0);
 		}
 		if (rufl_fm_error) {
-			LOG("xfont_scan_string: 0x%x: %s",
+			LOG_ERROR("xfont_scan_string: 0x%x: %s",
 					rufl_fm_error->errnum,
 					rufl_fm_error->errmess);
 			return rufl_FONT_MANAGER_ERROR;
@@ -529,20 +774,12 @@ rufl_code rufl_process_span_old(rufl_action action,
 }
 
 
-int rufl_unicode_map_search_cmp(const void *keyval, const void *datum)
-{
-	const unsigned short *key = keyval;
-	const struct rufl_unicode_map_entry *entry = datum;
-	if (*key < entry->u)
-		return -1;
-	else if (entry->u < *key)
-		return 1;
-	return 0;
-}
-
-
 /**
  * Render a string of characters not available in any font as their hex code.
+ *
+ * Each character is drawn as a box of four hex digits in two rows, using
+ * Corpus.Medium at half size. When painting, the whole span is drawn by a
+ * single Font_Paint, using move control sequences to position the rows.
  */
 
 rufl_code rufl_process_not_available(rufl_action action,
@@ -552,16 +789,29 @@ rufl_code rufl_process_not_available(rufl_action action,
 		int click_x, size_t *offset,
 		rufl_callback_t callback, void *context)
 {
-	char missing[] = "0000";
-	int dx = 7 * font_size / 64;
-	int top_y = y + 5 * font_size / 64;
+	char missing[rufl_PROCESS_CHUNK][4];
+	char paint[rufl_PROCESS_CHUNK * rufl_NOT_AVAILABLE_BYTES];
+	char *p = paint;
+	int dx = rufl_NOT_AVAILABLE_WIDTH(font_size);
+	int top_y = y + rufl_NOT_AVAILABLE_RISE(font_size);
+	int pair_width, y_out;
 	unsigned int i;
+	struct rufl_glyph_cache_metrics metrics;
 	font_f f;
 	rufl_code code;
 
 	if (action == rufl_WIDTH) {
 		*x += n * dx;
 		return rufl_OK;
+	} else if (action == rufl_GLYPH_METRICS) {
+		rufl_not_available_metrics(font_size, &metrics);
+		for (i = 0; i != n; i++)
+			rufl_glyph_metrics_store(context, metrics.x_bearing,
+					metrics.y_bearing, metrics.width,
+					metrics.height, metrics.x_advance,
+					metrics.y_advance);
+		*x += n * dx;
+		return rufl_OK;
 	} else if (action == rufl_X_TO_OFFSET || action == rufl_SPLIT) {
 		if (click_x - *x < (int) (n * dx))
 			*offset = (click_x - *x) / dx;
@@ -571,51 +821,230 @@ rufl_code rufl_process_not_available(rufl_action action,
 		return rufl_OK;
 	}
 
-	code = rufl_find_font(rufl_CACHE_CORPUS, font_size / 2, "Latin1", &f);
-	if (code != rufl_OK)
-		return code;
+	assert(n <= rufl_PROCESS_CHUNK);
 
 	for (i = 0; i != n; i++) {
-		missing[0] = "0123456789abcdef"[(s[i] >> 12) & 0xf];
-		missing[1] = "0123456789abcdef"[(s[i] >> 8) & 0xf];
-		missing[2] = "0123456789abcdef"[(s[i] >> 4) & 0xf];
-		missing[3] = "0123456789abcdef"[(s[i] >> 0) & 0xf];
+		missing[i][0] = "0123456789abcdef"[(s[i] >> 12) & 0xf];
+		missing[i][1] = "0123456789abcdef"[(s[i] >> 8) & 0xf];
+		missing[i][2] = "0123456789abcdef"[(s[i] >> 4) & 0xf];
+		missing[i][3] = "0123456789abcdef"[(s[i] >> 0) & 0xf];
+	}
 
-		/* first two characters in top row */
-		if (action == rufl_PAINT) {
-			rufl_fm_error = xfont_paint(f, missing, font_OS_UNITS |
-					font_GIVEN_LENGTH | font_GIVEN_FONT |
-					font_KERN |
-					((flags & rufl_BLEND_FONT) ?
-							font_BLEND_FONT : 0),
-					*x, top_y, 0, 0, 2);
-			if (rufl_fm_error)
-				return rufl_FONT_MANAGER_ERROR;
-		} else {
+	if (action == rufl_PAINT_CALLBACK) {
+		/* callbacks have no way to express moves, so each box needs
+		 * a call per row, but no font handle is required */
+		for (i = 0; i != n; i++) {
+			/* first two characters in top row */
 			callback(context, "Corpus.Medium\\ELatin1",
-					font_size / 2, missing, 0, 2,
+					font_size / 2, missing[i], 0, 2,
 					*x, top_y);
+			/* last two characters underneath */
+			callback(context, "Corpus.Medium\\ELatin1",
+					font_size / 2, missing[i] + 2, 0, 2,
+					*x, y);
+			*x += dx;
 		}
+		return rufl_OK;
+	}
 
-		/* last two characters underneath */
-		if (action == rufl_PAINT) {
-			rufl_fm_error = xfont_paint(f, missing + 2,
-					font_OS_UNITS |
-					font_GIVEN_LENGTH | font_GIVEN_FONT |
-					font_KERN |
-					((flags & rufl_BLEND_FONT) ?
-							font_BLEND_FONT : 0),
-					*x, y, 0, 0, 2);
-			if (rufl_fm_error)
+	code = rufl_find_font(rufl_CACHE_CORPUS, font_size / 2, "Latin1", &f);
+	if (code != rufl_OK)
+		return code;
+
+	/* Corpus is monospaced, so one measurement gives the width of every
+	 * pair of digits */
+	rufl_fm_count(rufl_FM_SCAN_STRING);
+	rufl_fm_error = xfont_scan_string(f, "00",
+			font_GIVEN_LENGTH | font_GIVEN_FONT | font_KERN,
+			0x7fffffff, 0x7fffffff, 0, 0, 2,
+			0, &pair_width, &y_out, 0);
+	if (rufl_fm_error) {
+		LOG_ERROR("xfont_scan_string: 0x%x: %s",
+				rufl_fm_error->errnum,
+				rufl_fm_error->errmess);
+		return rufl_FONT_MANAGER_ERROR;
+	}
+
+	/* moves are in millipoints: 400 per OS unit */
+	for (i = 0; i != n; i++) {
+		*p++ = missing[i][0];
+		*p++ = missing[i][1];
+		p = rufl_paint_move(p, 11, (y - top_y) * 400);
+		p = rufl_paint_move(p, 9, -pair_width);
+		*p++ = missing[i][2];
+		*p++ = missing[i][3];
+		p = rufl_paint_move(p, 11, (top_y - y) * 400);
+		p = rufl_paint_move(p, 9, dx * 400 - pair_width);
+	}
+
+	rufl_fm_count(rufl_FM_PAINT);
+	rufl_fm_error = xfont_paint(f, paint, font_OS_UNITS |
+			font_GIVEN_LENGTH | font_GIVEN_FONT | font_KERN |
+			((flags & rufl_BLEND_FONT) ? font_BLEND_FONT : 0),
+			*x, top_y, 0, 0, p - paint);
+	if (rufl_fm_error) {
+		LOG_ERROR("xfont_paint: 0x%x: %s",
+				rufl_fm_error->errnum,
+				rufl_fm_error->errmess);
+		return rufl_FONT_MANAGER_ERROR;
+	}
+
+	*x += n * dx;
+
+	return rufl_OK;
+}
+
+
+/**
+ * Find the metrics of the box drawn by rufl_process_not_available() for a
+ * character which is in no font.
+ *
+ * \param  font_size  size of font / 16ths of a point
+ * \param  metrics    updated to metrics of the box of two rows of digits, in
+ *                    millipoints
+ */
+
+void rufl_not_available_metrics(unsigned int font_size,
+		struct rufl_glyph_cache_metrics *metrics)
+{
+	int dx = rufl_NOT_AVAILABLE_WIDTH(font_size);
+	int rise = rufl_NOT_AVAILABLE_RISE(font_size);
+
+	metrics->x_bearing = 0;
+	metrics->y_bearing = rise * 800;
+	metrics->width = dx * 400;
+	metrics->height = rise * 800;
+	metrics->x_advance = dx * 400;
+	metrics->y_advance = 0;
+}
+
+
+/**
+ * Append a Font Manager move control sequence to a string.
+ *
+ * \param  p     position in string
+ * \param  code  9 for a horizontal move, 11 for a vertical move
+ * \param  d     distance in millipoints
+ * \return  position after the sequence
+ */
+
+char *rufl_paint_move(char *p, char code, int d)
+{
+	p[0] = code;
+	p[1] = d & 0xff;
+	p[2] = (d >> 8) & 0xff;
+	p[3] = (d >> 16) & 0xff;
+	return p + 4;
+}
+
+
+/**
+ * Read the metrics of each character of a string from a single RISC OS font.
+ *
+ * \param  encoding   encoding of s, for rufl_find_font()
+ * \param  s          string of characters in the font's encoding
+ * \param  n          number of characters in s
+ * \param  char_size  bytes per character in s
+ * \param  flags      font_GIVEN16_BIT or 0
+ * \param  font       font number (index in rufl_font_list)
+ * \param  font_size  size of font
+ * \param  u          Unicode value of each character of s
+ * \param  x          x coordinate, updated by the width of the string
+ * \param  out        output arrays
+ * \return  rufl_OK on success, or error code
+ *
+ * The Font Manager only gives the bounding box of a whole string, so this
+ * makes a Font_ScanString per character not in the glyph metrics cache. The
+ * font handle is looked up at the first such character, and only once for the
+ * span, so a span with every character cached needs no handle.
+ */
+
+rufl_code rufl_process_glyph_metrics(const char *encoding, const char *s,
+		unsigned int n, unsigned int char_size, font_string_flags flags,
+		unsigned int font, unsigned int font_size,
+		const unsigned short *u,
+		int *x, struct rufl_glyph_metrics_out *out)
+{
+	font_scan_block block;
+	struct rufl_glyph_cache_metrics metrics;
+	int xa, ya;
+	int total = 0;
+	unsigned int i;
+	bool found = false;
+	font_f f = 0;
+	rufl_code code;
+
+	block.space.x = block.space.y = 0;
+	block.letter.x = block.letter.y = 0;
+	block.split_char = -1;
+
+	for (i = 0; i != n; i++) {
+		if (!rufl_glyph_cache_get(font, font_size, u[i], &metrics)) {
+			if (!found) {
+				code = rufl_find_font(font, font_size,
+						encoding, &f);
+				if (code != rufl_OK)
+					return code;
+				found = true;
+			}
+
+			rufl_fm_count(rufl_FM_SCAN_STRING);
+			rufl_fm_error = xfont_scan_string(f, s + i * char_size,
+					font_GIVEN_BLOCK | font_GIVEN_LENGTH |
+					font_GIVEN_FONT | font_RETURN_BBOX |
+					flags,
+					0x7fffffff, 0x7fffffff, &block, 0,
+					char_size, 0, &xa, &ya, 0);
+			if (rufl_fm_error) {
+				LOG_ERROR("xfont_scan_string: 0x%x: %s",
+						rufl_fm_error->errnum,
+						rufl_fm_error->errmess);
 				return rufl_FONT_MANAGER_ERROR;
-		} else {
-			callback(context, "Corpus.Medium\\ELatin1",
-					font_size / 2, missing + 2, 0, 2,
-					*x, y);
+			}
+
+			/* see rufl_glyph_metrics() */
+			metrics.x_bearing = block.bbox.x0;
+			metrics.y_bearing = block.bbox.y1;
+			metrics.width = block.bbox.x1 - block.bbox.x0;
+			metrics.height = block.bbox.y1 - block.bbox.y0;
+			metrics.x_advance = xa;
+			metrics.y_advance = ya;
+			rufl_glyph_cache_put(font, font_size, u[i], &metrics);
 		}
 
-		*x += dx;
+		rufl_glyph_metrics_store(out, metrics.x_bearing,
+				metrics.y_bearing, metrics.width,
+				metrics.height, metrics.x_advance,
+				metrics.y_advance);
+		total += metrics.x_advance;
 	}
 
+	*x += total / 400;
+
 	return rufl_OK;
 }
+
+
+/**
+ * Store the metrics of the next glyph in the output arrays.
+ */
+
+void rufl_glyph_metrics_store(struct rufl_glyph_metrics_out *out,
+		int x_bearing, int y_bearing, int width, int height,
+		int x_advance, int y_advance)
+{
+	size_t i = out->count++;
+
+	if (out->x_bearing)
+		out->x_bearing[i] = x_bearing;
+	if (out->y_bearing)
+		out->y_bearing[i] = y_bearing;
+	if (out->width)
+		out->width[i] = width;
+	if (out->height)
+		out->height[i] = height;
+	if (out->x_advance)
+		out->x_advance[i] = x_advance;
+	if (out->y_advance)
+		out->y_advance[i] = y_advance;
+}
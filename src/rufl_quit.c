@@ -11,39 +11,63 @@
 
 
 /**
- * Free all resources used by the library.
+ * Free all resources used by a context, for rufl_quit() and
+ * rufl_ctx_destroy(). The font list is only freed by the context which owns
+ * it.
  */
 
-void rufl_quit(void)
+void rufl_ctx_quit(struct rufl_context *ctx)
 {
-	unsigned int i;
+	unsigned int i, j;
+	struct rufl_outer outer;
 
-	if (!rufl_font_list)
+	if (!ctx->font_list)
 		return;
 
-	for (i = 0; i != rufl_font_list_entries; i++) {
-		free(rufl_font_list[i].identifier);
-		free(rufl_font_list[i].charset);
+	rufl_api_enter(ctx, rufl_API_QUIT, outer);
+
+	if (ctx->fonts == ctx) {
+		/* keep font metrics read since initialisation for next
+		 * time */
+		if (rufl_metrics_changed)
+			rufl_save_cache();
+		rufl_metrics_changed = false;
+
+		for (i = 0; i != rufl_font_list_entries; i++) {
+			free(rufl_font_list[i].identifier);
+			free(rufl_font_list[i].charset);
+			free(rufl_font_list[i].lookup);
+		}
+		free(rufl_font_list);
+
+		for (i = 0; i != rufl_family_list_entries; i++)
+			free((void *) rufl_family_list[i]);
+		free(rufl_family_list);
+		free(rufl_family_map);
+		free(rufl_family_menu);
+		free(rufl_substitution_table);
 	}
-	free(rufl_font_list);
 	rufl_font_list = 0;
-
-	for (i = 0; i != rufl_family_list_entries; i++)
-		free((void *) rufl_family_list[i]);
-	free(rufl_family_list);
-	free(rufl_family_map);
 	rufl_family_list = 0;
+	rufl_family_map = 0;
+	rufl_family_menu = 0;
+	rufl_substitution_table = 0;
 
-	for (i = 0; i != rufl_CACHE_SIZE; i++) {
-		if (rufl_cache[i].font != rufl_CACHE_NONE) {
-			xfont_lose_font(rufl_cache[i].f);
-			rufl_cache[i].font = rufl_CACHE_NONE;
+	for (i = 0; i != rufl_OUTPUT_COUNT; i++) {
+		for (j = 0; j != rufl_CACHE_SIZE; j++) {
+			if (rufl_cache_pool[i][j].font != rufl_CACHE_NONE) {
+				rufl_fm_count(rufl_FM_LOSE_FONT);
+				xfont_lose_font(rufl_cache_pool[i][j].f);
+				rufl_cache_pool[i][j].font = rufl_CACHE_NONE;
+			}
 		}
-        }
+	}
 
-        free(rufl_family_menu);
-        rufl_family_menu = 0;
+	rufl_glyph_cache_clear();
+	rufl_decompose_quit();
+	rufl_outline_cache_clear();
+	rufl_bitmap_cache_clear();
+	rufl_font_bbox_clear();
 
-        free(rufl_substitution_table);
-        rufl_substitution_table = 0;
+	rufl_api_leave(outer);
 }
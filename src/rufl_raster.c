@@ -0,0 +1,227 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rufl_internal.h"
+
+
+static void rufl_raster_line(float *acc, int width, int height,
+		float x0, float y0, float x1, float y1);
+
+
+/**
+ * Rasterise a glyph of a flattened path to an anti-aliased coverage bitmap.
+ *
+ * \param  path    flattened path from rufl_path_flatten()
+ * \param  glyph   index of glyph in path
+ * \param  offset  horizontal offset of glyph origin / Draw units
+ * \param  bitmap  updated to bitmap, which the caller must free, or 0 if the
+ *                 glyph has no ink
+ * \return  rufl_OK, or rufl_OUT_OF_MEMORY if memory was exhausted
+ *
+ * Each line adds its signed area to an accumulation buffer, which is summed
+ * along the rows to give coverage. Overlapping contours are combined as for
+ * the nonzero winding rule.
+ */
+
+rufl_code rufl_raster_glyph(const struct rufl_path *path, size_t glyph,
+		int offset, struct rufl_bitmap **bitmap)
+{
+	size_t verb0, verb1, point0, point1, i;
+	const os_coord *p;
+	os_coord start = { 0, 0 }, current = { 0, 0 };
+	int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+	int left, top, width, height;
+	struct rufl_bitmap *b;
+	float *acc, sum, x, y;
+
+	*bitmap = 0;
+
+	verb0 = path->glyphs[glyph].verb;
+	point0 = path->glyphs[glyph].point;
+	if (glyph + 1 < path->glyphs_used) {
+		verb1 = path->glyphs[glyph + 1].verb;
+		point1 = path->glyphs[glyph + 1].point;
+	} else {
+		verb1 = path->verbs_used;
+		point1 = path->points_used;
+	}
+
+	/* bounding box in Draw units */
+	for (p = path->points + point0; p != path->points + point1; p++) {
+		if (p->x < x0) x0 = p->x;
+		if (p->y < y0) y0 = p->y;
+		if (x1 < p->x) x1 = p->x;
+		if (y1 < p->y) y1 = p->y;
+	}
+	if (x1 <= x0 || y1 <= y0)
+		return rufl_OK;
+
+	/* in pixels, with a spare column for the rasteriser */
+	x0 += offset;
+	x1 += offset;
+	left = x0 < 0 ? -((-x0 + rufl_PIXEL - 1) / rufl_PIXEL) :
+			x0 / rufl_PIXEL;
+	top = y1 < 0 ? -(-y1 / rufl_PIXEL) :
+			(y1 + rufl_PIXEL - 1) / rufl_PIXEL;
+	width = (x1 - left * rufl_PIXEL + rufl_PIXEL - 1) / rufl_PIXEL + 1;
+	height = (top * rufl_PIXEL - y0 + rufl_PIXEL - 1) / rufl_PIXEL;
+
+	acc = calloc((size_t) width * height + 1, sizeof *acc);
+	if (!acc)
+		return rufl_OUT_OF_MEMORY;
+
+	p = path->points + point0;
+	for (i = verb0; i != verb1; i++) {
+		os_coord to;
+
+		switch (path->verbs[i]) {
+		case rufl_PATH_MOVE_TO:
+			/* close the previous contour */
+			rufl_raster_line(acc, width, height,
+					(current.x + offset) / (float) rufl_PIXEL -
+					left,
+					top - current.y / (float) rufl_PIXEL,
+					(start.x + offset) / (float) rufl_PIXEL -
+					left,
+					top - start.y / (float) rufl_PIXEL);
+			start = current = *p++;
+			continue;
+		case rufl_PATH_CLOSE:
+			to = start;
+			break;
+		case rufl_PATH_LINE_TO:
+			to = *p++;
+			break;
+		default:
+			/* curves must have been flattened */
+			p += 3;
+			continue;
+		}
+
+		rufl_raster_line(acc, width, height,
+				(current.x + offset) / (float) rufl_PIXEL - left,
+				top - current.y / (float) rufl_PIXEL,
+				(to.x + offset) / (float) rufl_PIXEL - left,
+				top - to.y / (float) rufl_PIXEL);
+		current = to;
+	}
+	rufl_raster_line(acc, width, height,
+			(current.x + offset) / (float) rufl_PIXEL - left,
+			top - current.y / (float) rufl_PIXEL,
+			(start.x + offset) / (float) rufl_PIXEL - left,
+			top - start.y / (float) rufl_PIXEL);
+
+	b = malloc(sizeof *b + (size_t) width * height);
+	if (!b) {
+		free(acc);
+		return rufl_OUT_OF_MEMORY;
+	}
+	b->left = left;
+	b->top = top;
+	b->width = width;
+	b->height = height;
+
+	sum = 0;
+	for (i = 0; i != (size_t) width * height; i++) {
+		sum += acc[i];
+		x = sum < 0 ? -sum : sum;
+		y = x < 1 ? x * 255 + 0.5f : 255;
+		b->data[i] = (unsigned char) y;
+	}
+
+	free(acc);
+
+	*bitmap = b;
+
+	return rufl_OK;
+}
+
+
+/**
+ * Add the signed area of a line to an accumulation buffer.
+ *
+ * Coordinates are in pixels, with y increasing downwards, and must lie within
+ * the buffer, leaving the last column free.
+ */
+
+void rufl_raster_line(float *acc, int width, int height,
+		float x0, float y0, float x1, float y1)
+{
+	float dir, dxdy, x, xnext, dy, d;
+	float xa, xb, xmf, s, x0f, x1f, a0, a1, a2, am;
+	int y, yend, xai, xbi, xi;
+	float *row;
+
+	if (y0 == y1)
+		return;
+	if (y0 < y1) {
+		dir = 1;
+	} else {
+		dir = -1;
+		x = x0; x0 = x1; x1 = x;
+		x = y0; y0 = y1; y1 = x;
+	}
+	dxdy = (x1 - x0) / (y1 - y0);
+	x = x0;
+	if (y0 < 0) {
+		x -= y0 * dxdy;
+		y0 = 0;
+	}
+	yend = (int) y1;
+	if (yend < y1)
+		yend++;
+	if (height < yend)
+		yend = height;
+
+	for (y = (int) y0; y < yend; y++) {
+		row = acc + y * width;
+		dy = (y + 1 < y1 ? y + 1 : y1) - (y < y0 ? y0 : y);
+		xnext = x + dxdy * dy;
+		d = dy * dir;
+		if (x < xnext) {
+			xa = x; xb = xnext;
+		} else {
+			xa = xnext; xb = x;
+		}
+		if (xa < 0)
+			xa = 0;
+		xai = (int) xa;
+		xbi = (int) xb;
+		if (xbi < xb)
+			xbi++;
+		if (width - 1 < xbi)
+			xbi = width - 1;
+
+		if (xbi <= xai + 1) {
+			/* line within one pixel of this row */
+			xmf = 0.5f * (x + xnext) - xai;
+			row[xai] += d - d * xmf;
+			row[xai + 1] += d * xmf;
+		} else {
+			s = 1 / (xb - xa);
+			x0f = xa - xai;
+			a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+			x1f = xb - xbi + 1;
+			am = 0.5f * s * x1f * x1f;
+			row[xai] += d * a0;
+			if (xbi == xai + 2) {
+				row[xai + 1] += d * (1 - a0 - am);
+			} else {
+				a1 = s * (1.5f - x0f);
+				row[xai + 1] += d * (a1 - a0);
+				for (xi = xai + 2; xi < xbi - 1; xi++)
+					row[xi] += d * s;
+				a2 = a1 + (xbi - xai - 3) * s;
+				row[xbi - 1] += d * (1 - a2 - am);
+			}
+			row[xbi] += d * am;
+		}
+		x = xnext;
+	}
+}
@@ -0,0 +1,341 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rufl_internal.h"
+
+
+/** Number of hash chains. */
+#define rufl_BITMAP_CACHE_BUCKETS 512
+
+/** Curve flattening tolerance / Draw units (1/8 pixel). */
+#define rufl_RENDER_TOLERANCE (rufl_PIXEL / 8)
+
+/** Key of an entry in the glyph bitmap cache. */
+struct rufl_bitmap_cache_key {
+	/** Font number of family and style (index in rufl_font_list). */
+	unsigned int font;
+	/** Requested slant (0 or 1). */
+	unsigned int slant;
+	/** Font size. */
+	unsigned int size;
+	/** Unicode value. */
+	unsigned int u;
+	/** Horizontal offset of origin / (pixel / rufl_RENDER_SUBPIXELS). */
+	unsigned int subpixel;
+};
+
+/** An entry in the glyph bitmap cache. */
+struct rufl_bitmap_cache_entry {
+	/** Links in the cache. */
+	struct rufl_lru_entry lru;
+	/** Font, size, character, and position of glyph. */
+	struct rufl_bitmap_cache_key key;
+	/** Advance to next glyph / Draw units. */
+	int x_advance;
+	/** Bitmap, or 0 if the glyph has no ink. */
+	struct rufl_bitmap *bitmap;
+};
+
+/** The glyph bitmap cache. */
+#define rufl_bitmap_cache (rufl_context_current->bitmap_cache)
+
+
+static rufl_code rufl_render_string(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		unsigned char *buffer, int width, int height, int stride);
+static rufl_code rufl_render_glyph(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		unsigned int font, unsigned int slant, unsigned int u,
+		unsigned int subpixel,
+		struct rufl_bitmap_cache_entry **glyph, bool *cached);
+static void rufl_render_blit(const struct rufl_bitmap *bitmap, int x, int y,
+		unsigned char *buffer, int width, int height, int stride);
+static unsigned int rufl_bitmap_cache_hash(const void *key);
+static const void *rufl_bitmap_cache_key(const struct rufl_lru_entry *entry);
+static size_t rufl_bitmap_cache_entry_size(
+		const struct rufl_lru_entry *entry);
+static void rufl_bitmap_cache_destroy(struct rufl_lru_entry *entry);
+
+
+const struct rufl_lru_type rufl_bitmap_cache_type = {
+	rufl_BITMAP_CACHE_BUCKETS,
+	sizeof (struct rufl_bitmap_cache_key),
+	rufl_bitmap_cache_hash,
+	rufl_bitmap_cache_key,
+	rufl_bitmap_cache_entry_size,
+	rufl_bitmap_cache_destroy
+};
+
+
+/**
+ * Render Unicode text to an 8-bit coverage buffer.
+ *
+ * \param  x       position of text origin in buffer / pixels
+ * \param  y       position of baseline in buffer, from top / pixels
+ * \param  buffer  coverage buffer, one byte per pixel, top row first
+ * \param  width   width of buffer / pixels
+ * \param  height  height of buffer / pixels
+ * \param  stride  bytes from one row of buffer to the next
+ *
+ * Glyphs are rasterised from their outlines and cached, so repeated text only
+ * costs copying. Coverage is combined with the buffer by taking the maximum.
+ */
+
+rufl_code rufl_ctx_render_to_buffer(struct rufl_context *ctx,
+		const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		unsigned char *buffer, int width, int height, int stride)
+{
+	struct rufl_outer outer;
+	rufl_code code;
+
+	rufl_api_enter(ctx, rufl_API_RENDER_TO_BUFFER, outer);
+	code = rufl_render_string(font_family, font_style, font_size,
+			string, length, x, y, buffer, width, height, stride);
+	rufl_api_leave(outer);
+
+	return code;
+}
+
+
+/**
+ * Render text to a buffer, for rufl_render_to_buffer().
+ */
+
+rufl_code rufl_render_string(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		int x, int y,
+		unsigned char *buffer, int width, int height, int stride)
+{
+	struct rufl_bitmap_cache_key key;
+	struct rufl_bitmap_cache_entry *glyph;
+	unsigned int font, slant, u, subpixel;
+	bool cached;
+	const char *s;
+	size_t n;
+	int pen = 0, px;
+	rufl_code code;
+
+	code = rufl_find_font_family(font_family, font_style, &font, &slant,
+			0);
+	if (code != rufl_OK)
+		return code;
+
+	while (length) {
+		s = string;
+		rufl_utf8_read(string, length, u);
+		n = string - s;
+
+		/* split pen position into pixel and subpixel */
+		px = pen < 0 ? -((-pen + rufl_PIXEL - 1) / rufl_PIXEL) :
+				pen / rufl_PIXEL;
+		subpixel = (pen - px * rufl_PIXEL) * rufl_RENDER_SUBPIXELS /
+				rufl_PIXEL;
+
+		key.font = font;
+		key.slant = slant;
+		key.size = font_size;
+		key.u = u;
+		key.subpixel = subpixel;
+		glyph = (struct rufl_bitmap_cache_entry *)
+				rufl_lru_get(&rufl_bitmap_cache, &key);
+		cached = true;
+		if (!glyph) {
+			code = rufl_render_glyph(font_family, font_style,
+					font_size, s, n, font, slant, u,
+					subpixel, &glyph, &cached);
+			if (code != rufl_OK)
+				return code;
+		}
+
+		if (glyph->bitmap)
+			rufl_render_blit(glyph->bitmap, x + px, y,
+					buffer, width, height, stride);
+
+		pen += glyph->x_advance;
+		if (!cached)
+			rufl_bitmap_cache_destroy(&glyph->lru);
+	}
+
+	return rufl_OK;
+}
+
+
+/**
+ * Set the memory budget of the glyph bitmap cache.
+ *
+ * \param  bytes  maximum memory used by entries, or 0 to disable the cache
+ */
+
+void rufl_ctx_bitmap_cache_set_budget(struct rufl_context *ctx, size_t bytes)
+{
+	struct rufl_outer outer;
+
+	rufl_context_enter(ctx, outer);
+
+	rufl_lru_set_budget(&rufl_bitmap_cache, bytes);
+
+	rufl_context_leave(outer);
+}
+
+
+/**
+ * Discard all entries in the glyph bitmap cache and free its memory.
+ */
+
+void rufl_bitmap_cache_clear(void)
+{
+	rufl_lru_clear(&rufl_bitmap_cache);
+}
+
+
+/**
+ * Rasterise a glyph and add it to the cache.
+ *
+ * \param  glyph   updated to the new entry
+ * \param  cached  updated to false if the entry could not be cached, in which
+ *                 case it must be freed by the caller
+ */
+
+rufl_code rufl_render_glyph(const char *font_family,
+		rufl_style font_style, unsigned int font_size,
+		const char *string, size_t length,
+		unsigned int font, unsigned int slant, unsigned int u,
+		unsigned int subpixel,
+		struct rufl_bitmap_cache_entry **glyph, bool *cached)
+{
+	struct rufl_path path, flat;
+	struct rufl_bitmap_cache_entry *entry;
+	struct rufl_bitmap *bitmap = 0;
+	rufl_code code;
+
+	memset(&path, 0, sizeof path);
+	memset(&flat, 0, sizeof flat);
+
+	code = rufl_ctx_decompose_string(rufl_context_current, font_family,
+			font_style, font_size, string, length, &path);
+	if (code == rufl_OK)
+		code = rufl_path_flatten(&path, rufl_RENDER_TOLERANCE,
+				&flat);
+	if (code == rufl_OK && flat.glyphs_used)
+		code = rufl_raster_glyph(&flat, 0, subpixel * rufl_PIXEL /
+				rufl_RENDER_SUBPIXELS, &bitmap);
+	if (code != rufl_OK) {
+		rufl_path_free(&path);
+		rufl_path_free(&flat);
+		return code;
+	}
+
+	entry = malloc(sizeof *entry);
+	if (!entry) {
+		free(bitmap);
+		rufl_path_free(&path);
+		rufl_path_free(&flat);
+		return rufl_OUT_OF_MEMORY;
+	}
+	entry->key.font = font;
+	entry->key.slant = slant;
+	entry->key.size = font_size;
+	entry->key.u = u;
+	entry->key.subpixel = subpixel;
+	entry->x_advance = flat.glyphs_used ? flat.glyphs[0].x_advance : 0;
+	entry->bitmap = bitmap;
+
+	rufl_path_free(&path);
+	rufl_path_free(&flat);
+
+	*glyph = entry;
+	*cached = rufl_lru_put(&rufl_bitmap_cache, &entry->lru);
+
+	return rufl_OK;
+}
+
+
+/**
+ * Combine a glyph bitmap with a coverage buffer, clipping to the buffer.
+ *
+ * \param  x  position of glyph origin in buffer / pixels
+ * \param  y  position of baseline in buffer / pixels
+ */
+
+void rufl_render_blit(const struct rufl_bitmap *bitmap, int x, int y,
+		unsigned char *buffer, int width, int height, int stride)
+{
+	int x0 = x + bitmap->left, y0 = y - bitmap->top;
+	int bx0 = 0, by0 = 0, bx1 = bitmap->width, by1 = bitmap->height;
+	int bx, by;
+	const unsigned char *src;
+	unsigned char *dst;
+
+	if (x0 < 0)
+		bx0 = -x0;
+	if (y0 < 0)
+		by0 = -y0;
+	if (width < x0 + bx1)
+		bx1 = width - x0;
+	if (height < y0 + by1)
+		by1 = height - y0;
+
+	for (by = by0; by < by1; by++) {
+		src = bitmap->data + by * bitmap->width;
+		dst = buffer + (y0 + by) * stride + x0;
+		for (bx = bx0; bx < bx1; bx++)
+			if (dst[bx] < src[bx])
+				dst[bx] = src[bx];
+	}
+}
+
+
+unsigned int rufl_bitmap_cache_hash(const void *key)
+{
+	const struct rufl_bitmap_cache_key *k = key;
+
+	return ((k->font * 31 + k->size) * rufl_RENDER_SUBPIXELS +
+			k->subpixel) * 0x9e3779b1u ^ k->u;
+}
+
+
+const void *rufl_bitmap_cache_key(const struct rufl_lru_entry *entry)
+{
+	return &((const struct rufl_bitmap_cache_entry *) entry)->key;
+}
+
+
+/**
+ * Memory used by an entry.
+ */
+
+size_t rufl_bitmap_cache_entry_size(const struct rufl_lru_entry *entry)
+{
+	const struct rufl_bitmap *bitmap =
+			((const struct rufl_bitmap_cache_entry *) entry)->bitmap;
+	size_t size = sizeof (struct rufl_bitmap_cache_entry);
+
+	if (bitmap)
+		size += sizeof *bitmap +
+				(size_t) bitmap->width * bitmap->height;
+
+	return size;
+}
+
+
+/**
+ * Free an entry and its bitmap.
+ */
+
+void rufl_bitmap_cache_destroy(struct rufl_lru_entry *entry)
+{
+	free(((struct rufl_bitmap_cache_entry *) entry)->bitmap);
+	free(entry);
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <time.h>
+#include "rufl_internal.h"
+
+
+rufl_trace_func rufl_tracer = 0;
+/** Context for rufl_tracer. */
+static void *rufl_tracer_context = 0;
+
+
+/**
+ * Install a function to receive trace events, or remove it.
+ *
+ * \param  tracer   function to call for each event, or 0 for none
+ * \param  context  passed to tracer
+ */
+
+void rufl_set_tracer(rufl_trace_func tracer, void *context)
+{
+	rufl_tracer = tracer;
+	rufl_tracer_context = context;
+}
+
+
+/**
+ * Send an event to the tracer. Use the rufl_trace() macro, which only calls
+ * this if there is a tracer.
+ *
+ * \param  type    type of event
+ * \param  font    font number (index in rufl_font_list), rufl_CACHE_CORPUS,
+ *                 or NOT_AVAILABLE
+ * \param  size    font size
+ * \param  length  characters in span, or number of fonts for
+ *                 rufl_TRACE_SCAN
+ * \param  action  rufl_api value that the span is processed for
+ */
+
+void rufl_trace_emit(rufl_trace_type type, unsigned int font,
+		unsigned int size, unsigned int length, unsigned int action)
+{
+	struct rufl_trace_event event = { type, 0, rufl_api_current, 0, size,
+			0, rufl_API_NONE, 0, 0 };
+
+	event.time = rufl_time_ns();
+	if (font == rufl_CACHE_CORPUS)
+		event.font = "Corpus.Medium";
+	else if (font < rufl_font_list_entries)
+		event.font = rufl_font_list[font].identifier;
+
+	if (type == rufl_TRACE_SCAN) {
+		event.index = font;
+		event.total = length;
+	} else if (type == rufl_TRACE_SPAN ||
+			type == rufl_TRACE_NOT_AVAILABLE) {
+		event.length = length;
+		event.action = action;
+	}
+
+	rufl_tracer(&event, rufl_tracer_context);
+}
+
+
+/**
+ * Read a monotonic clock.
+ *
+ * \return  time / ns
+ */
+
+unsigned long long rufl_time_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+#else
+	return clock() * (1000000000ull / CLOCKS_PER_SEC);
+#endif
+}
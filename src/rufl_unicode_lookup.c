@@ -0,0 +1,192 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rufl_internal.h"
+
+
+static unsigned int rufl_glyph_map_mix(unsigned int h);
+
+
+/**
+ * Build the direct-indexed lookup for a font's unicode maps.
+ *
+ * \param  umap       array of unicode maps
+ * \param  num_umaps  number of maps in umap
+ * \return  lookup table, or 0 if memory was exhausted
+ *
+ * Where a character is present in several maps, the first is used, as it
+ * would be by searching the maps in order. Characters in maps after the 255th,
+ * or in blocks after the 254th, are left out and the lookup is marked partial.
+ */
+
+struct rufl_unicode_lookup *rufl_unicode_lookup_create(
+		const struct rufl_unicode_map *umap, unsigned int num_umaps)
+{
+	unsigned int i, j, u;
+	unsigned int last_used = 0;
+	struct rufl_unicode_lookup *lookup;
+	struct rufl_unicode_lookup *lookup2;
+
+	lookup = calloc(1, sizeof *lookup);
+	if (!lookup)
+		return 0;
+	for (i = 0; i != 256; i++)
+		lookup->index[i] = BLOCK_EMPTY;
+
+	/* map indices must fit in a byte, with 0 reserved */
+	if (255 < num_umaps) {
+		num_umaps = 255;
+		lookup->partial = true;
+	}
+
+	for (i = 0; i != num_umaps; i++) {
+		for (j = 0; j != umap[i].entries; j++) {
+			u = umap[i].map[j].u;
+			if (lookup->index[u >> 8] == BLOCK_EMPTY) {
+				if (last_used == BLOCK_EMPTY) {
+					/* too many blocks */
+					lookup->partial = true;
+					continue;
+				}
+				lookup->index[u >> 8] = last_used++;
+			}
+			if (lookup->block[lookup->index[u >> 8]].
+					map[u & 0xff])
+				/* present in an earlier map */
+				continue;
+			lookup->block[lookup->index[u >> 8]].map[u & 0xff] =
+					i + 1;
+			lookup->block[lookup->index[u >> 8]].c[u & 0xff] =
+					umap[i].map[j].c;
+		}
+	}
+
+	/* shrink-wrap */
+	lookup->size = offsetof(struct rufl_unicode_lookup, block) +
+			sizeof lookup->block[0] * last_used;
+	lookup2 = realloc(lookup, lookup->size);
+	if (!lookup2)
+		return lookup;
+
+	return lookup2;
+}
+
+
+/**
+ * Find the unicode map and character code for a character.
+ *
+ * \param  lookup     lookup table
+ * \param  umap       unicode maps the lookup was created from
+ * \param  num_umaps  number of maps in umap
+ * \param  u          character
+ * \param  map        updated to index of unicode map containing u
+ * \param  c          updated to character code in that map
+ * \return  true if present, false if absent
+ */
+
+bool rufl_unicode_lookup_get(const struct rufl_unicode_lookup *lookup,
+		const struct rufl_unicode_map *umap, unsigned int num_umaps,
+		unsigned int u, unsigned int *map, unsigned char *c)
+{
+	unsigned int block = u >> 8;
+	unsigned int m;
+	unsigned short u16 = u;
+	const struct rufl_unicode_map_entry *entry;
+
+	if (256 <= block)
+		return false;
+
+	if (lookup->index[block] != BLOCK_EMPTY) {
+		m = lookup->block[lookup->index[block]].map[u & 0xff];
+		if (m != 0) {
+			*map = m - 1;
+			*c = lookup->block[lookup->index[block]].c[u & 0xff];
+			return true;
+		}
+	}
+
+	if (!lookup->partial)
+		return false;
+
+	/* not in the table, but it may be in a map which was left out */
+	for (m = 0; m != num_umaps; m++) {
+		entry = bsearch(&u16, umap[m].map, umap[m].entries,
+				sizeof umap[m].map[0],
+				rufl_unicode_map_search_cmp);
+		if (entry) {
+			*map = m;
+			*c = entry->c;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+int rufl_unicode_map_search_cmp(const void *keyval, const void *datum)
+{
+	const unsigned short *key = keyval;
+	const struct rufl_unicode_map_entry *entry = datum;
+	if (*key < entry->u)
+		return -1;
+	else if (entry->u < *key)
+		return 1;
+	return 0;
+}
+
+
+/**
+ * Find the Unicode values of a glyph name, from the Adobe Glyph List.
+ *
+ * \param  name   glyph name
+ * \param  count  updated to number of entries for the name
+ * \return  first entry in rufl_glyph_map for the name, or 0 if unknown
+ *
+ * The hashes must match those of tools/makeglyphs. The name is hashed once to
+ * find its only possible slot, and compared once to reject unknown names.
+ */
+
+const struct rufl_glyph_map_entry *rufl_glyph_map_find(const char *name,
+		unsigned int *count)
+{
+	const struct rufl_glyph_map_name *slot;
+	const struct rufl_glyph_map_entry *entry;
+	const unsigned char *c;
+	unsigned int h = 2166136261u;
+
+	/* FNV-1a */
+	for (c = (const unsigned char *) name; *c; c++)
+		h = ((h ^ *c) * 16777619u) & 0xffffffffu;
+
+	slot = &rufl_glyph_map_names[rufl_glyph_map_mix(h ^
+			rufl_glyph_map_displacement[h % rufl_glyph_map_buckets]) %
+			rufl_glyph_map_slots];
+	entry = &rufl_glyph_map[slot->first];
+	if (strcmp(name, entry->glyph_name) != 0)
+		return 0;
+
+	*count = slot->count;
+	return entry;
+}
+
+
+/**
+ * Mix the bits of a 32-bit hash (the MurmurHash3 finaliser).
+ */
+
+unsigned int rufl_glyph_map_mix(unsigned int h)
+{
+	h ^= h >> 16;
+	h = (h * 0x85ebca6bu) & 0xffffffffu;
+	h ^= h >> 13;
+	h = (h * 0xc2b2ae35u) & 0xffffffffu;
+	h ^= h >> 16;
+	return h;
+}
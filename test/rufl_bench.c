@@ -0,0 +1,499 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Benchmark rufl_init() on synthetic font collections, using the host
+ * backend.
+ *
+ * For each collection size, rufl_init() is timed cold (no cache), warm
+ * (valid cache) and partial (a tenth of the fonts are not in the cache).
+ * Each run is in a new process, so that the peak memory is its own. One line
+ * is printed per run, with times in microseconds and memory in bytes, except
+ * for the maximum resident set size, which is in kilobytes. Allocations are
+ * only counted with glibc, and are -1 otherwise.
+ *
+ * Usage: rufl_bench [-n runs] [-j threads] [faces ...]
+ *
+ * The default is 3 runs of 10 100 1000 faces. -j gives the number of threads
+ * scanning fonts (default one per processor). */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "rufl_internal.h"
+
+
+/** Phases of rufl_init(), as reported to rufl_init_phase_hook. */
+static const char *const phases[] = {
+	"detect", "font_list", "load_cache", "scan", "substitution_table",
+	"save_cache", "family_menu"
+};
+#define PHASES (sizeof phases / sizeof phases[0])
+
+/** Benchmark cases. */
+enum bench_case { CASE_COLD, CASE_WARM, CASE_PARTIAL };
+static const char *const cases[] = { "cold", "warm", "partial" };
+
+/** Time spent in each phase / s. */
+static double phase_time[PHASES];
+/** Current phase, or -1. */
+static int phase_current = -1;
+/** Start of current phase. */
+static struct timespec phase_start;
+
+/** Threads scanning fonts, or 0 for the default. */
+static unsigned int scan_threads = 0;
+
+/** Allocations are being counted. */
+static bool counting = false;
+/** Protects the counts, as fonts are scanned by several threads. */
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+static long allocs = 0;
+static long long alloc_bytes = 0;
+static long long heap = 0, heap_peak = 0;
+
+
+static void phase(const char *name);
+static double seconds(const struct timespec *t0, const struct timespec *t1);
+static bool make_collection(const char *dir, unsigned int faces,
+		unsigned int fresh);
+static bool make_dirs(const char *path);
+static bool write_metrics(const char *path, unsigned int i);
+static bool copy_file(const char *from, const char *to);
+static bool run(const char *font_path, const char *scrap, unsigned int faces,
+		enum bench_case c, unsigned int r, bool print);
+static int remove_entry(const char *path, const struct stat *st, int flag,
+		struct FTW *ftw);
+static void count(void *p, size_t size, size_t old_size);
+
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int default_faces[] = { 10, 100, 1000 };
+	unsigned int runs = 3, faces, r, c;
+	char work[] = "/tmp/rufl_bench.XXXXXX";
+	char base[64], partial[64], scrap[64], cache[80], warm[80];
+	int i = 1, j, count;
+	bool ok = true;
+
+	while (i + 1 < argc && argv[i][0] == '-') {
+		if (strcmp(argv[i], "-n") == 0)
+			runs = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-j") == 0)
+			scan_threads = atoi(argv[i + 1]);
+		else
+			break;
+		i += 2;
+	}
+	for (j = i; j != argc; j++) {
+		if (atoi(argv[j]) <= 0) {
+			fprintf(stderr, "usage: %s [-n runs] [-j threads] "
+					"[faces ...]\n", argv[0]);
+			return 1;
+		}
+	}
+	count = i == argc ? 3 : argc - i;
+
+	if (!mkdtemp(work)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	printf("# faces case run total_us");
+	for (j = 0; j != (int) PHASES; j++)
+		printf(" %s_us", phases[j]);
+	printf(" allocs alloc_bytes peak_heap max_rss_kb\n");
+	fflush(stdout);
+
+	for (j = 0; ok && j != count; j++) {
+		faces = i == argc ? default_faces[j] : (unsigned int)
+				atoi(argv[i + j]);
+		snprintf(base, sizeof base, "%s/%u", work, faces);
+		snprintf(partial, sizeof partial, "%s/%u.partial", work,
+				faces);
+		snprintf(scrap, sizeof scrap, "%s/%u.scrap", work, faces);
+		snprintf(cache, sizeof cache, "%s/RUfl_cache", scrap);
+		snprintf(warm, sizeof warm, "%s/warm_cache", scrap);
+
+		if (mkdir(scrap, 0777) ||
+				!make_collection(base, faces, faces) ||
+				!make_collection(partial, faces,
+						faces - faces / 10)) {
+			ok = false;
+			break;
+		}
+
+		/* the cache for the warm and partial cases */
+		if (!run(base, scrap, faces, CASE_COLD, 0, false) ||
+				!copy_file(cache, warm)) {
+			ok = false;
+			break;
+		}
+
+		for (c = CASE_COLD; ok && c <= CASE_PARTIAL; c++) {
+			for (r = 0; ok && r != runs; r++) {
+				if (c == CASE_COLD)
+					remove(cache);
+				else if (!copy_file(warm, cache))
+					ok = false;
+				if (ok)
+					ok = run(c == CASE_PARTIAL ? partial :
+							base, scrap, faces, c,
+							r, true);
+			}
+		}
+	}
+
+	nftw(work, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	return ok ? 0 : 1;
+}
+
+
+/**
+ * Record the start of a phase of rufl_init().
+ */
+
+void phase(const char *name)
+{
+	struct timespec now;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (phase_current != -1)
+		phase_time[phase_current] += seconds(&phase_start, &now);
+
+	phase_current = -1;
+	for (i = 0; name && i != PHASES; i++)
+		if (strcmp(name, phases[i]) == 0)
+			phase_current = i;
+	phase_start = now;
+}
+
+
+double seconds(const struct timespec *t0, const struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+
+/**
+ * Create a collection of synthetic fonts, in families of four styles, and
+ * Homerton.Medium.
+ *
+ * \param  dir    directory to create, to use as the font path
+ * \param  faces  number of fonts
+ * \param  fresh  fonts from this one on are renamed, so are not in a cache
+ *                made from a collection without renaming
+ */
+
+bool make_collection(const char *dir, unsigned int faces, unsigned int fresh)
+{
+	static const char *const styles[] = {
+		"Medium", "Bold", "Medium/Oblique", "Bold/Oblique"
+	};
+	char path[256];
+	unsigned int i;
+
+	/* rufl_init() needs Homerton.Medium to detect the Font Manager */
+	snprintf(path, sizeof path, "%s/Homerton/Medium", dir);
+	if (!make_dirs(path) || !write_metrics(path, 0))
+		return false;
+
+	for (i = 0; i != faces; i++) {
+		/* family directory, weight, and style */
+		snprintf(path, sizeof path, "%s/%s%04u/%s", dir,
+				i < fresh ? "Synth" : "Fresh", i / 4,
+				styles[i % 4]);
+		if (!make_dirs(path))
+			return false;
+		if (!write_metrics(path, i))
+			return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Create a directory and any missing parents below the collection.
+ */
+
+bool make_dirs(const char *path)
+{
+	char parent[256];
+	char *slash;
+
+	if (mkdir(path, 0777) == 0 || errno == EEXIST)
+		return true;
+	if (errno == ENOENT) {
+		snprintf(parent, sizeof parent, "%s", path);
+		slash = strrchr(parent, '/');
+		if (slash) {
+			*slash = 0;
+			if (make_dirs(parent) && mkdir(path, 0777) == 0)
+				return true;
+		}
+	}
+
+	perror(path);
+	return false;
+}
+
+
+/**
+ * Write a metrics file for a synthetic font.
+ *
+ * Every font has ASCII, with widths varying between fonts, and Latin-1. Some
+ * fonts have Greek or Cyrillic, and a few have the CJK ideographs, which
+ * dominate the time to scan.
+ */
+
+bool write_metrics(const char *path, unsigned int i)
+{
+	char name[300];
+	unsigned int u;
+	int advance;
+	FILE *fp;
+
+	snprintf(name, sizeof name, "%s/Metrics", path);
+	fp = fopen(name, "w");
+	if (!fp) {
+		perror(name);
+		return false;
+	}
+
+	fprintf(fp, "bbox -100 -250 1100 950\n"
+			"ascender 720\ndescender -210\n"
+			"xheight 520\ncapheight 700\nunderline -100 50\n"
+			"char 0020 250 0 0 0 0\n");
+	for (u = 0x21; u != 0x7f; u++) {
+		advance = 400 + (u * 37 + i * 11) % 400;
+		fprintf(fp, "char %04X %i 40 %i %i %i\n", u, advance,
+				u < 0x60 ? 0 : -200, advance - 40,
+				u < 0x60 ? 700 : 520);
+	}
+	fprintf(fp, "char 00A0 250 0 0 0 0\n"
+			"char 00A1-00FF 550 40 -200 510 900\n");
+	if (i % 3 == 0)
+		fprintf(fp, "char 0391-03A1 650 40 0 610 700\n"
+				"char 03A3-03A9 650 40 0 610 700\n"
+				"char 03B1-03C9 550 40 -200 510 520\n");
+	if (i % 4 == 1)
+		fprintf(fp, "char 0400-04FF 600 40 -200 560 900\n");
+	if (i % 50 == 7)
+		fprintf(fp, "char 4E00-9FFF 1000 20 -120 980 880\n");
+
+	if (fclose(fp)) {
+		perror(name);
+		return false;
+	}
+
+	return true;
+}
+
+
+bool copy_file(const char *from, const char *to)
+{
+	char buffer[4096];
+	size_t n;
+	FILE *in, *out;
+	bool ok = true;
+
+	in = fopen(from, "rb");
+	if (!in) {
+		perror(from);
+		return false;
+	}
+	out = fopen(to, "wb");
+	if (!out) {
+		perror(to);
+		fclose(in);
+		return false;
+	}
+
+	while ((n = fread(buffer, 1, sizeof buffer, in)))
+		if (fwrite(buffer, 1, n, out) != n)
+			ok = false;
+	if (ferror(in))
+		ok = false;
+
+	fclose(in);
+	if (fclose(out))
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "failed to copy %s to %s\n", from, to);
+
+	return ok;
+}
+
+
+/**
+ * Time rufl_init() in a new process.
+ *
+ * \param  font_path  font path for the host backend
+ * \param  scrap      scrap directory, containing the cache
+ * \param  print      print the results
+ * \return  true if rufl_init() succeeded
+ */
+
+bool run(const char *font_path, const char *scrap, unsigned int faces,
+		enum bench_case c, unsigned int r, bool print)
+{
+	struct timespec t0, t1;
+	struct rusage usage;
+	rufl_code code;
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return false;
+	}
+
+	if (pid == 0) {
+		setenv("RUFL_SCRAP_DIR", scrap, 1);
+		rufl_host_set_font_path(font_path);
+		rufl_init_phase_hook = phase;
+		rufl_scan_threads = scan_threads;
+
+		counting = true;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		code = rufl_init();
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		counting = false;
+		if (code != rufl_OK) {
+			fprintf(stderr, "rufl_init: 0x%x\n", code);
+			_exit(1);
+		}
+
+		getrusage(RUSAGE_SELF, &usage);
+
+		if (print) {
+			printf("%u %s %u %.1f", faces, cases[c], r,
+					seconds(&t0, &t1) * 1e6);
+			for (i = 0; i != PHASES; i++)
+				printf(" %.1f", phase_time[i] * 1e6);
+#ifdef __GLIBC__
+			printf(" %li %lli %lli", allocs, alloc_bytes,
+					heap_peak);
+#else
+			printf(" -1 -1 -1");
+#endif
+			printf(" %li\n", (long) usage.ru_maxrss);
+			fflush(stdout);
+		}
+		_exit(0);
+	}
+
+	if (waitpid(pid, &status, 0) == -1) {
+		perror("waitpid");
+		return false;
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+int remove_entry(const char *path, const struct stat *st, int flag,
+		struct FTW *ftw)
+{
+	(void) st;
+	(void) flag;
+	(void) ftw;
+
+	return remove(path);
+}
+
+
+/**
+ * Count an allocation.
+ *
+ * \param  p         new block, or 0 if the allocation failed
+ * \param  size      size requested
+ * \param  old_size  usable size of block freed or reallocated, or 0
+ */
+
+void count(void *p, size_t size, size_t old_size)
+{
+	if (!counting)
+		return;
+
+	pthread_mutex_lock(&count_lock);
+	heap -= old_size;
+	if (p) {
+		allocs++;
+		alloc_bytes += size;
+#ifdef __GLIBC__
+		heap += malloc_usable_size(p);
+#endif
+		if (heap_peak < heap)
+			heap_peak = heap;
+	}
+	pthread_mutex_unlock(&count_lock);
+}
+
+
+#ifdef __GLIBC__
+/* Interpose the allocator, to count allocations. */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+void *malloc(size_t size)
+{
+	void *p = __libc_malloc(size);
+	count(p, size, 0);
+	return p;
+}
+
+
+void *calloc(size_t n, size_t size)
+{
+	void *p = __libc_calloc(n, size);
+	count(p, n * size, 0);
+	return p;
+}
+
+
+void *realloc(void *p, size_t size)
+{
+	size_t old_size = p ? malloc_usable_size(p) : 0;
+	void *q = __libc_realloc(p, size);
+	if (q || size == 0)
+		count(q, size, old_size);
+	return q;
+}
+
+
+void free(void *p)
+{
+	if (p && counting) {
+		pthread_mutex_lock(&count_lock);
+		heap -= malloc_usable_size(p);
+		pthread_mutex_unlock(&count_lock);
+	}
+	__libc_free(p);
+}
+#endif
@@ -0,0 +1,161 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Replay a recorded font handle cache access trace through each eviction
+ * policy and report how many Font_FindFont calls each would make.
+ *
+ * Usage: rufl_cache_bench [trace]   (default test/data/cache_trace) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "rufl_internal.h"
+
+
+/** One access in a trace. */
+struct access {
+	unsigned int font;
+	unsigned int size;
+};
+
+/** Number of times to replay the trace for timing. */
+#define REPEAT 1000
+
+
+static struct access *read_trace(const char *path, size_t *count);
+static void replay(rufl_cache_policy_type policy, const char *name,
+		const struct access *trace, size_t count);
+static void reset_cache(void);
+
+
+int main(int argc, char *argv[])
+{
+	const char *path = "test/data/cache_trace";
+	struct access *trace;
+	size_t count;
+
+	if (argc == 2)
+		path = argv[1];
+	else if (argc != 1) {
+		fprintf(stderr, "usage: %s [trace]\n", argv[0]);
+		return 1;
+	}
+
+	trace = read_trace(path, &count);
+	if (!trace)
+		return 1;
+
+	printf("# policy accesses hits misses hit_ratio ns_per_access\n");
+	replay(rufl_CACHE_POLICY_LRU, "lru", trace, count);
+	replay(rufl_CACHE_POLICY_SLRU, "slru", trace, count);
+
+	free(trace);
+
+	return 0;
+}
+
+
+/**
+ * Read a trace file of "font size" lines. Lines starting with # are ignored.
+ */
+
+struct access *read_trace(const char *path, size_t *count)
+{
+	char line[100];
+	size_t n = 0, allocated = 0;
+	struct access *trace = 0, *trace2;
+	unsigned int font, size;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return 0;
+	}
+
+	while (fgets(line, sizeof line, fp)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%u %u", &font, &size) != 2) {
+			fprintf(stderr, "%s: bad line \"%s\"\n", path, line);
+			fclose(fp);
+			free(trace);
+			return 0;
+		}
+		if (n == allocated) {
+			allocated = allocated ? allocated * 2 : 256;
+			trace2 = realloc(trace, allocated * sizeof *trace);
+			if (!trace2) {
+				fclose(fp);
+				free(trace);
+				return 0;
+			}
+			trace = trace2;
+		}
+		trace[n].font = font;
+		trace[n].size = size;
+		n++;
+	}
+
+	fclose(fp);
+
+	*count = n;
+	return trace;
+}
+
+
+/**
+ * Replay a trace through the cache using a policy, and print results.
+ *
+ * A miss is handled as rufl_find_font() does, but without calling the Font
+ * Manager, so only the policy is measured.
+ */
+
+void replay(rufl_cache_policy_type policy, const char *name,
+		const struct access *trace, size_t count)
+{
+	unsigned int hits = 0, misses = 0;
+	unsigned int r;
+	size_t i;
+	clock_t t0, t1;
+
+	rufl_cache_policy = policy;
+
+	t0 = clock();
+	for (r = 0; r != REPEAT; r++) {
+		reset_cache();
+		hits = misses = 0;
+		for (i = 0; i != count; i++) {
+			if (rufl_cache_lookup(trace[i].font, trace[i].size,
+					0) != rufl_CACHE_SIZE) {
+				hits++;
+			} else {
+				misses++;
+				rufl_cache_fill(rufl_cache_victim(),
+						trace[i].font, trace[i].size,
+						0, 0);
+			}
+		}
+	}
+	t1 = clock();
+
+	printf("%s %zu %u %u %.4f %.1f\n", name, count, hits, misses,
+			count ? (double) hits / count : 0.0,
+			(double) (t1 - t0) / CLOCKS_PER_SEC * 1e9 /
+			((double) count * REPEAT));
+}
+
+
+void reset_cache(void)
+{
+	unsigned int i;
+
+	for (i = 0; i != rufl_CACHE_SIZE; i++) {
+		rufl_cache[i].font = rufl_CACHE_NONE;
+		rufl_cache[i].protected = false;
+	}
+	rufl_cache_time = 0;
+}
@@ -7,8 +7,12 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "rufl.h"
+#ifdef RUFL_HOST
+#include "rufl_host.h"
+#endif
 
 
 static void try(rufl_code code, const char *context);
@@ -16,6 +20,9 @@ static int move_to(os_coord *to, void *user);
 static int line_to(os_coord *to, void *user);
 static int cubic_to(os_coord *control1, os_coord *control2, os_coord *to,
 		void *user);
+static void trace(const struct rufl_trace_event *event, void *context);
+static int ink_right(const unsigned char *buffer, int width, int height);
+static bool path_is_flat(const struct rufl_path *path);
 static void callback(void *context,
 		const char *font_name, unsigned int font_size,
 		const char *s8, unsigned short *s16, unsigned int n,
@@ -26,13 +33,46 @@ int main(void)
 {
 	char utf8_test[] = "Hello,	world! ὕαλον "
 			"Uherské Hradiště. 𐀀";
+	/* U+E000 is in no font */
+	char missing_test[] = "a\xee\x80\x80" "b";
+	static unsigned char buffer[40][200];
+	static unsigned char uncached[40][200];
+	int right;
 	int width;
 	size_t char_offset;
 	int x;
 	int actual_x;
 	struct rufl_decomp_funcs funcs = { move_to, line_to, cubic_to };
 	int bbox[4];
+	struct rufl_fm_stats stats;
+	struct rufl_latency_histogram histogram;
+	unsigned int events[rufl_TRACE_SCAN + 1] = { 0 };
+	struct rufl_context *ctx;
+	int ctx_width;
+	int x_advance[sizeof missing_test - 1];
+	int box_advance;
+	size_t count;
+	size_t i;
+	struct rufl_path path, flat, glyph;
+	unsigned char verbs[4];
+	os_coord points[4];
+	struct rufl_path_glyph glyphs[1];
+	int bbox_large[4], bbox_small[4], bbox_again[4];
+#ifdef RUFL_HOST
+	const char identifier[] = "Homerton.Medium";
+	const unsigned int outline_header[2] = { 2, 1600 };
+	const unsigned int outline_key[2] = { 'a', 0 };
+	const int truncated[3] = { 2, 12, 0 };
+	size_t outline_len = sizeof identifier - 1;
+	size_t outline_words = 3;
+	FILE *fp;
+#endif
 
+#ifdef RUFL_HOST
+	if (!getenv("RUFL_FONT_PATH"))
+		rufl_host_set_font_path("test/data/fonts");
+#endif
+	rufl_log_set_level(rufl_LOG_DEBUG);
 	try(rufl_init(), "rufl_init");
 	rufl_dump_state();
 	try(rufl_paint("NewHall", rufl_WEIGHT_400, 240,
@@ -65,6 +105,291 @@ int main(void)
 	try(rufl_font_bbox("NewHall", rufl_WEIGHT_400, 240, bbox),
 			"rufl_font_bbox");
 	printf("bbox: %i %i %i %i\n", bbox[0], bbox[1], bbox[2], bbox[3]);
+
+	/* the font is already open, so measuring a word is one SWI */
+	rufl_fm_reset_stats();
+	try(rufl_width("NewHall", rufl_WEIGHT_400, 240, "word", 4, &width),
+			"rufl_width");
+	rufl_fm_get_stats(&stats);
+	printf("rufl_width: %lu calls, %lu SWIs\n",
+			stats.calls[rufl_API_WIDTH],
+			rufl_fm_stats_total(&stats, rufl_API_WIDTH));
+	if (stats.calls[rufl_API_WIDTH] != 1 ||
+			1 < rufl_fm_stats_total(&stats, rufl_API_WIDTH)) {
+		printf("error: rufl_width: too many Font Manager calls\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* recorded if built with RUFL_PROFILE */
+	if (rufl_latency_get(rufl_API_WIDTH, &histogram)) {
+		printf("rufl_width: %lu calls, max %llu ns\n",
+				histogram.count, histogram.max);
+		if (histogram.count == 0) {
+			printf("error: rufl_width: no latencies recorded\n");
+			rufl_quit();
+			return 1;
+		}
+	}
+
+	/* the test string has characters in no font */
+	rufl_set_tracer(trace, events);
+	try(rufl_paint("NewHall", rufl_WEIGHT_400, 240,
+			utf8_test, sizeof utf8_test - 1,
+			1200, 1000, 0), "rufl_paint");
+	rufl_set_tracer(0, 0);
+	if (events[rufl_TRACE_SPAN] == 0 ||
+			events[rufl_TRACE_NOT_AVAILABLE] == 0) {
+		printf("error: rufl_paint: missing trace events\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* a character in no font advances by its box of hex digits, so the
+	 * text after it is rendered within the width of the string */
+	try(rufl_width("Homerton", rufl_WEIGHT_400, 240,
+			missing_test, sizeof missing_test - 1,
+			&width), "rufl_width");
+	try(rufl_render_to_buffer("Homerton", rufl_WEIGHT_400, 240,
+			missing_test, sizeof missing_test - 1, 0, 30,
+			buffer[0], 200, 40, 200), "rufl_render_to_buffer");
+	right = ink_right(buffer[0], 200, 40);
+	printf("render: ink to %i px, width %i OS units\n", right, width);
+	if (right < width / 2 - 8 || width / 2 + 2 < right) {
+		printf("error: rufl_render_to_buffer: ink ends at %i px, "
+				"not near %i\n", right, width / 2);
+		rufl_quit();
+		return 1;
+	}
+
+	/* so does a glyph rasterised without the bitmap cache */
+	rufl_bitmap_cache_set_budget(0);
+	try(rufl_render_to_buffer("Homerton", rufl_WEIGHT_400, 240,
+			missing_test, sizeof missing_test - 1, 0, 30,
+			uncached[0], 200, 40, 200), "rufl_render_to_buffer");
+	rufl_bitmap_cache_set_budget(65536);
+	if (memcmp(buffer, uncached, sizeof buffer) != 0) {
+		printf("error: rufl_render_to_buffer: differs without the "
+				"bitmap cache\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* the metrics of each character of a string are those of the
+	 * character alone, including the box for a character in no font */
+	try(rufl_glyph_metrics_string("Homerton", rufl_WEIGHT_400, 240,
+			missing_test, sizeof missing_test - 1,
+			0, 0, 0, 0, x_advance, 0, &count),
+			"rufl_glyph_metrics_string");
+	try(rufl_glyph_metrics("Homerton", rufl_WEIGHT_400, 240,
+			missing_test + 1, 3, 0, 0, 0, 0, &box_advance, 0),
+			"rufl_glyph_metrics");
+	try(rufl_width("Homerton", rufl_WEIGHT_400, 240,
+			missing_test + 1, 3, &width), "rufl_width");
+	printf("glyph metrics: %zu glyphs, advances %i %i %i, box %i "
+			"millipoints, %i OS units\n", count,
+			x_advance[0], x_advance[1], x_advance[2],
+			box_advance, width);
+	if (count != 3 || x_advance[1] != box_advance ||
+			box_advance / 400 != width) {
+		printf("error: rufl_glyph_metrics_string: wrong metrics\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* the metrics are now cached, so they are found without a handle
+	 * once the handles are lost */
+	rufl_set_output(rufl_OUTPUT_BUFFER);
+	rufl_invalidate_cache_reason(rufl_INVALIDATE_BUFFER);
+	rufl_fm_reset_stats();
+	try(rufl_glyph_metrics_string("Homerton", rufl_WEIGHT_400, 240,
+			missing_test, sizeof missing_test - 1,
+			0, 0, 0, 0, x_advance, 0, &count),
+			"rufl_glyph_metrics_string");
+	rufl_fm_get_stats(&stats);
+	rufl_set_output(rufl_OUTPUT_SCREEN);
+	if (stats.calls[rufl_API_GLYPH_METRICS_STRING] != 1 ||
+			rufl_fm_stats_total(&stats,
+				rufl_API_GLYPH_METRICS_STRING) != 0 ||
+			x_advance[1] != box_advance) {
+		printf("error: rufl_glyph_metrics_string: Font Manager "
+				"called for cached metrics\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* decomposed glyphs advance by the same amounts, in Draw units */
+	memset(&path, 0, sizeof path);
+	try(rufl_decompose_string("Homerton", rufl_WEIGHT_400, 240,
+			missing_test, sizeof missing_test - 1, &path),
+			"rufl_decompose_string");
+	for (i = 0; i != path.glyphs_used && i != count; i++)
+		if (path.glyphs[i].x_advance != x_advance[i] * 16 / 25)
+			break;
+	if (!path.allocated || path.glyphs_used != count || i != count ||
+			path_is_flat(&path)) {
+		printf("error: rufl_decompose_string: wrong path\n");
+		rufl_quit();
+		return 1;
+	}
+
+	memset(&flat, 0, sizeof flat);
+	try(rufl_path_flatten(&path, 16, &flat), "rufl_path_flatten");
+	printf("flatten: %zu verbs to %zu\n", path.verbs_used,
+			flat.verbs_used);
+	if (!path_is_flat(&flat) || flat.glyphs_used != path.glyphs_used ||
+			flat.verbs_used < path.verbs_used) {
+		printf("error: rufl_path_flatten: wrong path\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* arrays from the caller are not grown when they are too small */
+	glyph.verbs = verbs;
+	glyph.verbs_size = sizeof verbs / sizeof verbs[0];
+	glyph.points = points;
+	glyph.points_size = sizeof points / sizeof points[0];
+	glyph.glyphs = glyphs;
+	glyph.glyphs_size = sizeof glyphs / sizeof glyphs[0];
+	glyph.allocated = false;
+	if (rufl_decompose_string("Homerton", rufl_WEIGHT_400, 240,
+			"a", 1, &glyph) != rufl_OUT_OF_MEMORY ||
+			glyph.allocated || glyph.verbs != verbs ||
+			glyph.points != points || glyph.glyphs != glyphs) {
+		printf("error: rufl_decompose_string: caller arrays "
+				"overflowed\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* a path filled by the library is grown when it is used again */
+	memset(&glyph, 0, sizeof glyph);
+	try(rufl_decompose_string("Homerton", rufl_WEIGHT_400, 240,
+			"a", 1, &glyph), "rufl_decompose_string");
+	try(rufl_decompose_string("NewHall", rufl_WEIGHT_400, 240,
+			utf8_test, sizeof utf8_test - 1, &glyph),
+			"rufl_decompose_string");
+	printf("decompose again: %zu glyphs, %zu points\n",
+			glyph.glyphs_used, glyph.points_used);
+	if (!glyph.allocated || glyph.glyphs_used < 2) {
+		printf("error: rufl_decompose_string: path not reused\n");
+		rufl_quit();
+		return 1;
+	}
+	rufl_path_free(&glyph);
+	if (glyph.verbs || glyph.points || glyph.glyphs) {
+		printf("error: rufl_path_free: arrays not freed\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* a saved outline is loaded again, and is decomposed without the
+	 * Font Manager, the same as the first glyph of the string */
+	try(rufl_outline_cache_save(), "rufl_outline_cache_save");
+	rufl_outline_cache_set_budget(0);
+	rufl_outline_cache_set_budget(65536);
+	try(rufl_outline_cache_load(), "rufl_outline_cache_load");
+	rufl_fm_reset_stats();
+	memset(&glyph, 0, sizeof glyph);
+	try(rufl_decompose_string("Homerton", rufl_WEIGHT_400, 240,
+			"a", 1, &glyph), "rufl_decompose_string");
+	rufl_fm_get_stats(&stats);
+	if (rufl_fm_stats_total(&stats, rufl_API_DECOMPOSE_STRING) != 0 ||
+			glyph.verbs_used != path.glyphs[1].verb ||
+			glyph.points_used != path.glyphs[1].point ||
+			memcmp(glyph.verbs, path.verbs,
+				glyph.verbs_used) != 0 ||
+			memcmp(glyph.points, path.points,
+				glyph.points_used *
+				sizeof glyph.points[0]) != 0) {
+		printf("error: rufl_outline_cache_load: outline not "
+				"restored\n");
+		rufl_quit();
+		return 1;
+	}
+	rufl_path_free(&glyph);
+
+#ifdef RUFL_HOST
+	/* a truncated outline in the file is not loaded, so the glyph is
+	 * read from the font again */
+	fp = fopen(rufl_host_scrap_file("RUfl_outlines"), "wb");
+	if (!fp ||
+			fwrite(outline_header, sizeof outline_header, 1,
+				fp) != 1 ||
+			fwrite(&outline_len, sizeof outline_len, 1, fp) != 1 ||
+			fwrite(identifier, outline_len, 1, fp) != 1 ||
+			fwrite(outline_key, sizeof outline_key, 1, fp) != 1 ||
+			fwrite(&outline_words, sizeof outline_words, 1,
+				fp) != 1 ||
+			fwrite(truncated, sizeof truncated, 1, fp) != 1 ||
+			fclose(fp) == EOF) {
+		printf("error: fopen: %s\n", strerror(errno));
+		rufl_quit();
+		return 1;
+	}
+	rufl_outline_cache_set_budget(0);
+	rufl_outline_cache_set_budget(65536);
+	try(rufl_outline_cache_load(), "rufl_outline_cache_load");
+	rufl_fm_reset_stats();
+	try(rufl_decompose_string("Homerton", rufl_WEIGHT_400, 240,
+			"a", 1, &glyph), "rufl_decompose_string");
+	rufl_fm_get_stats(&stats);
+	if (rufl_fm_stats_total(&stats, rufl_API_DECOMPOSE_STRING) == 0 ||
+			glyph.verbs_used != path.glyphs[1].verb ||
+			memcmp(glyph.verbs, path.verbs,
+				glyph.verbs_used) != 0) {
+		printf("error: rufl_outline_cache_load: truncated outline "
+				"loaded\n");
+		rufl_quit();
+		return 1;
+	}
+	rufl_path_free(&glyph);
+#endif
+	rufl_path_free(&flat);
+	rufl_path_free(&path);
+
+	/* large sizes are scaled from a reference size, and small ones are
+	 * read again once the cache is invalidated */
+	try(rufl_font_bbox("Homerton", rufl_WEIGHT_400, 1600, bbox),
+			"rufl_font_bbox");
+	try(rufl_font_bbox("Homerton", rufl_WEIGHT_400, 3200, bbox_large),
+			"rufl_font_bbox");
+	try(rufl_font_bbox("Homerton", rufl_WEIGHT_400, 120, bbox_small),
+			"rufl_font_bbox");
+	rufl_invalidate_cache();
+	rufl_fm_reset_stats();
+	try(rufl_font_bbox("Homerton", rufl_WEIGHT_400, 120, bbox_again),
+			"rufl_font_bbox");
+	rufl_fm_get_stats(&stats);
+	printf("bbox: %i %i %i %i at 12pt\n", bbox_small[0], bbox_small[1],
+			bbox_small[2], bbox_small[3]);
+	for (i = 0; i != 4; i++)
+		if (bbox_large[i] != 2 * bbox[i] ||
+				bbox_again[i] != bbox_small[i] ||
+				2 < abs(bbox_small[i] - bbox[i] * 120 / 1600))
+			break;
+	if (i != 4 || stats.swis[rufl_API_FONT_BBOX][rufl_FM_READ_INFO] != 1) {
+		printf("error: rufl_font_bbox: wrong box\n");
+		rufl_quit();
+		return 1;
+	}
+
+	/* a second context is independent, but measures the same */
+	try(rufl_ctx_create(&ctx), "rufl_ctx_create");
+	try(rufl_ctx_width(ctx, "NewHall", rufl_WEIGHT_400, 240,
+			utf8_test, sizeof utf8_test - 1,
+			&ctx_width), "rufl_ctx_width");
+	rufl_ctx_destroy(ctx);
+	try(rufl_width("NewHall", rufl_WEIGHT_400, 240,
+			utf8_test, sizeof utf8_test - 1,
+			&width), "rufl_width");
+	if (ctx_width != width) {
+		printf("error: rufl_ctx_width: %i, not %i\n",
+				ctx_width, width);
+		rufl_quit();
+		return 1;
+	}
+
 	rufl_quit();
 
 	return 0;
@@ -129,6 +454,53 @@ int cubic_to(os_coord *control1, os_coord *control2, os_coord *to,
 }
 
 
+void trace(const struct rufl_trace_event *event, void *context)
+{
+	unsigned int *events = context;
+
+	events[event->type]++;
+	printf("trace: %i %i \"%s\" %u %u %i\n", event->type, event->api,
+			event->font ? event->font : "", event->size,
+			event->length, event->action);
+}
+
+
+/**
+ * Find the rightmost column of a coverage buffer with any ink.
+ *
+ * \return  column, or -1 if the buffer is blank
+ */
+
+int ink_right(const unsigned char *buffer, int width, int height)
+{
+	int x, y;
+
+	for (x = width - 1; x != -1; x--)
+		for (y = 0; y != height; y++)
+			if (buffer[y * width + x])
+				return x;
+	return -1;
+}
+
+
+/**
+ * Check that a path has no curves, and that its verbs use all its points.
+ */
+
+bool path_is_flat(const struct rufl_path *path)
+{
+	size_t i, points = 0;
+
+	for (i = 0; i != path->verbs_used; i++) {
+		if (path->verbs[i] == rufl_PATH_CUBIC_TO)
+			return false;
+		if (path->verbs[i] != rufl_PATH_CLOSE)
+			points++;
+	}
+	return points == path->points_used;
+}
+
+
 void callback(void *context,
 		const char *font_name, unsigned int font_size,
 		const char *s8, unsigned short *s16, unsigned int n,
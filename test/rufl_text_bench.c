@@ -0,0 +1,348 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Measure the throughput of rufl_width(), rufl_split(), rufl_x_to_offset()
+ * and rufl_paint_callback() over the corpora in test/data/corpus, using the
+ * host backend and the fonts in test/data/fonts.
+ *
+ * Each corpus has one string per line. Each entry point is called on every
+ * string, once to open the fonts, and then repeatedly for at least the
+ * minimum time. rufl_split() and rufl_x_to_offset() are given half the width
+ * of the string. The spans and Font Manager calls per string do not depend
+ * on the speed of the machine, so may be compared between runs.
+ *
+ * Usage: rufl_text_bench [-t ms] [-l call,character,load] [corpus ...]
+ *
+ * -t gives the minimum time for each entry point (default 200), and -l the
+ * latency model (see rufl_host.h). A corpus is the name of a file in
+ * test/data/corpus without ".txt", or a path. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rufl_internal.h"
+
+
+/** A corpus and the font family to use for it. */
+struct corpus {
+	const char *name;
+	const char *family;
+};
+
+/** A corpus read into memory. */
+struct strings {
+	size_t count;
+	char **string;
+	size_t *length;
+	/** Characters in each string. */
+	size_t *chars;
+	/** Width of each string, from rufl_width(). */
+	int *width;
+};
+
+/** Entry points measured. */
+enum entry { ENTRY_WIDTH, ENTRY_SPLIT, ENTRY_X_TO_OFFSET,
+		ENTRY_PAINT_CALLBACK, ENTRY_COUNT };
+static const char *const entries[] = {
+	"rufl_width", "rufl_split", "rufl_x_to_offset", "rufl_paint_callback"
+};
+
+/** Font size / 16ths of a point. */
+#define SIZE 192
+
+
+static bool read_corpus(const char *path, struct strings *strings);
+static void free_corpus(struct strings *strings);
+static bool measure(const struct corpus *corpus,
+		const struct strings *strings, enum entry entry,
+		double min_time);
+static rufl_code call(const char *family, const struct strings *strings,
+		size_t i, enum entry entry);
+static void callback(void *context,
+		const char *font_name, unsigned int font_size,
+		const char *s8, unsigned short *s16, unsigned int n,
+		int x, int y);
+static double now(void);
+
+
+int main(int argc, char *argv[])
+{
+	static const struct corpus default_corpora[] = {
+		{ "english", "Homerton" },
+		{ "mixed", "Homerton" },
+		{ "cjk", "Homerton" },
+		{ "missing", "Homerton" },
+		{ "long", "Corpus" },
+	};
+	struct rufl_host_latency latency = { 0, 0, 0 };
+	struct corpus corpus;
+	struct strings strings;
+	char path[300];
+	double min_time = 0.2;
+	int opt, i, count;
+	unsigned int e;
+	rufl_code code;
+	bool ok = true;
+
+	while ((opt = getopt(argc, argv, "t:l:")) != -1) {
+		switch (opt) {
+		case 't':
+			min_time = atoi(optarg) / 1000.0;
+			break;
+		case 'l':
+			if (sscanf(optarg, "%u,%u,%u", &latency.call,
+					&latency.character,
+					&latency.load) != 3)
+				opt = '?';
+			break;
+		}
+		if (opt == '?') {
+			fprintf(stderr, "usage: %s [-t ms] "
+					"[-l call,character,load] "
+					"[corpus ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!getenv("RUFL_FONT_PATH"))
+		rufl_host_set_font_path("test/data/fonts");
+	code = rufl_init();
+	if (code != rufl_OK) {
+		fprintf(stderr, "rufl_init: 0x%x\n", code);
+		return 1;
+	}
+	rufl_host_set_latency(&latency);
+
+	printf("# corpus entry strings_per_s chars_per_s spans_per_string "
+			"calls_per_string\n");
+
+	count = optind == argc ? (int) (sizeof default_corpora /
+			sizeof default_corpora[0]) : argc - optind;
+	for (i = 0; ok && i != count; i++) {
+		if (optind == argc)
+			corpus = default_corpora[i];
+		else {
+			corpus.name = argv[optind + i];
+			corpus.family = "Homerton";
+		}
+		if (strchr(corpus.name, '/'))
+			snprintf(path, sizeof path, "%s", corpus.name);
+		else
+			snprintf(path, sizeof path, "test/data/corpus/%s.txt",
+					corpus.name);
+
+		if (!read_corpus(path, &strings)) {
+			ok = false;
+			break;
+		}
+		for (e = 0; ok && e != ENTRY_COUNT; e++)
+			ok = measure(&corpus, &strings, e, min_time);
+		free_corpus(&strings);
+	}
+
+	rufl_quit();
+
+	return ok ? 0 : 1;
+}
+
+
+/**
+ * Read a corpus, one string per line.
+ */
+
+bool read_corpus(const char *path, struct strings *strings)
+{
+	char *line = 0;
+	size_t size = 0, allocated = 0, i;
+	ssize_t length;
+	void *p;
+	FILE *fp;
+
+	memset(strings, 0, sizeof *strings);
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return false;
+	}
+
+	while ((length = getline(&line, &size, fp)) != -1) {
+		if (0 < length && line[length - 1] == '\n')
+			line[--length] = 0;
+		if (length == 0)
+			continue;
+
+		if (strings->count == allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			p = realloc(strings->string,
+					allocated * sizeof *strings->string);
+			if (!p)
+				break;
+			strings->string = p;
+			p = realloc(strings->length,
+					allocated * sizeof *strings->length);
+			if (!p)
+				break;
+			strings->length = p;
+			p = realloc(strings->chars,
+					allocated * sizeof *strings->chars);
+			if (!p)
+				break;
+			strings->chars = p;
+			p = realloc(strings->width,
+					allocated * sizeof *strings->width);
+			if (!p)
+				break;
+			strings->width = p;
+		}
+
+		strings->string[strings->count] = strdup(line);
+		if (!strings->string[strings->count])
+			break;
+		strings->length[strings->count] = length;
+		strings->chars[strings->count] = 0;
+		for (i = 0; i != (size_t) length; i++)
+			if ((line[i] & 0xc0) != 0x80)
+				strings->chars[strings->count]++;
+		strings->count++;
+	}
+
+	free(line);
+	if (ferror(fp) || !feof(fp)) {
+		fprintf(stderr, "failed to read %s\n", path);
+		fclose(fp);
+		free_corpus(strings);
+		return false;
+	}
+	fclose(fp);
+
+	return true;
+}
+
+
+void free_corpus(struct strings *strings)
+{
+	size_t i;
+
+	for (i = 0; i != strings->count; i++)
+		free(strings->string[i]);
+	free(strings->string);
+	free(strings->length);
+	free(strings->chars);
+	free(strings->width);
+	memset(strings, 0, sizeof *strings);
+}
+
+
+/**
+ * Measure one entry point on a corpus and print the results.
+ */
+
+bool measure(const struct corpus *corpus, const struct strings *strings,
+		enum entry entry, double min_time)
+{
+	unsigned long spans, calls;
+	size_t i, passes = 0, chars = 0;
+	double t0, t;
+	rufl_code code;
+
+	/* open the fonts (rufl_width() is first, and finds the widths) */
+	for (i = 0; i != strings->count; i++) {
+		code = call(corpus->family, strings, i, entry);
+		if (code != rufl_OK) {
+			fprintf(stderr, "%s: %s: string %zu: 0x%x\n",
+					corpus->name, entries[entry], i, code);
+			return false;
+		}
+		chars += strings->chars[i];
+	}
+
+	spans = rufl_span_count;
+	calls = rufl_host_call_count();
+	t0 = now();
+	do {
+		for (i = 0; i != strings->count; i++)
+			call(corpus->family, strings, i, entry);
+		passes++;
+		t = now() - t0;
+	} while (t < min_time);
+	spans = rufl_span_count - spans;
+	calls = rufl_host_call_count() - calls;
+
+	printf("%s %s %.0f %.0f %.2f %.2f\n", corpus->name, entries[entry],
+			passes * strings->count / t, passes * chars / t,
+			(double) spans / (passes * strings->count),
+			(double) calls / (passes * strings->count));
+	fflush(stdout);
+
+	return true;
+}
+
+
+/**
+ * Call an entry point on a string.
+ */
+
+rufl_code call(const char *family, const struct strings *strings, size_t i,
+		enum entry entry)
+{
+	size_t char_offset;
+	int actual_x;
+
+	switch (entry) {
+	case ENTRY_WIDTH:
+		return rufl_width(family, rufl_WEIGHT_400, SIZE,
+				strings->string[i], strings->length[i],
+				&strings->width[i]);
+	case ENTRY_SPLIT:
+		return rufl_split(family, rufl_WEIGHT_400, SIZE,
+				strings->string[i], strings->length[i],
+				strings->width[i] / 2, &char_offset,
+				&actual_x);
+	case ENTRY_X_TO_OFFSET:
+		return rufl_x_to_offset(family, rufl_WEIGHT_400, SIZE,
+				strings->string[i], strings->length[i],
+				strings->width[i] / 2, &char_offset,
+				&actual_x);
+	case ENTRY_PAINT_CALLBACK:
+		return rufl_paint_callback(family, rufl_WEIGHT_400, SIZE,
+				strings->string[i], strings->length[i],
+				0, 0, callback, 0);
+	default:
+		break;
+	}
+
+	return rufl_OK;
+}
+
+
+void callback(void *context,
+		const char *font_name, unsigned int font_size,
+		const char *s8, unsigned short *s16, unsigned int n,
+		int x, int y)
+{
+	(void) context;
+	(void) font_name;
+	(void) font_size;
+	(void) s8;
+	(void) s16;
+	(void) n;
+	(void) x;
+	(void) y;
+}
+
+
+double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,401 @@
+/*
+ * This file is part of RUfl
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license
+ */
+
+/* Measure the corpora in test/data/corpus from several threads at once, each
+ * with a context sharing the fonts of the default context, and check that
+ * every result matches a single-threaded run. The throughput of one thread
+ * and of all threads is printed.
+ *
+ * Also check that scanning the fonts in parallel gives the same cache file
+ * and substitution table as scanning them in turn.
+ *
+ * Usage: rufl_thread_test [-n threads] [-p passes] */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rufl_internal.h"
+
+
+/** A corpus and the font family to use for it. */
+struct corpus {
+	const char *name;
+	const char *family;
+};
+
+/** A string to measure, and its results from the single-threaded run. */
+struct item {
+	const char *family;
+	char *string;
+	size_t length;
+	int width;
+	size_t split_offset;
+	int split_x;
+	size_t click_offset;
+	int click_x;
+};
+
+/** Work and results of one thread. */
+struct worker {
+	pthread_t thread;
+	unsigned int index;
+	struct rufl_context *ctx;
+	/** Number of results which differed from the single-threaded run. */
+	unsigned long mismatches;
+	/** Number of calls which failed. */
+	unsigned long errors;
+};
+
+/** Font size / 16ths of a point. */
+#define SIZE 192
+
+static struct item *items;
+static size_t item_count, items_allocated;
+static unsigned int passes = 20;
+
+
+static bool check_scan(unsigned int threads);
+static char *read_file(const char *path, size_t *size);
+static bool read_corpus(const char *path, const char *family);
+static void *run(void *p);
+static bool measure(struct rufl_context *ctx, size_t i,
+		struct item *result);
+static double now(void);
+
+
+int main(int argc, char *argv[])
+{
+	static const struct corpus corpora[] = {
+		{ "english", "Homerton" },
+		{ "mixed", "Homerton" },
+		{ "cjk", "Homerton" },
+		{ "missing", "Homerton" },
+		{ "long", "Corpus" },
+	};
+	struct worker *workers;
+	unsigned int threads = 4, i;
+	unsigned long mismatches = 0, errors = 0;
+	char path[300];
+	double t0, t1, tn;
+	rufl_code code;
+	size_t j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+		switch (opt) {
+		case 'n':
+			threads = atoi(optarg);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n threads] "
+					"[-p passes]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads == 0)
+		threads = 1;
+
+	if (!getenv("RUFL_FONT_PATH"))
+		rufl_host_set_font_path("test/data/fonts");
+	if (!check_scan(threads))
+		return 1;
+	code = rufl_init();
+	if (code != rufl_OK) {
+		fprintf(stderr, "rufl_init: 0x%x\n", code);
+		return 1;
+	}
+
+	for (i = 0; i != sizeof corpora / sizeof corpora[0]; i++) {
+		snprintf(path, sizeof path, "test/data/corpus/%s.txt",
+				corpora[i].name);
+		if (!read_corpus(path, corpora[i].family))
+			return 1;
+	}
+
+	/* results to compare with, from the default context */
+	for (j = 0; j != item_count; j++) {
+		if (!measure(&rufl_default_context, j, &items[j])) {
+			fprintf(stderr, "string %zu: failed\n", j);
+			return 1;
+		}
+	}
+
+	workers = calloc(threads, sizeof *workers);
+	if (!workers)
+		return 1;
+	for (i = 0; i != threads; i++) {
+		workers[i].index = i;
+		code = rufl_ctx_create_shared(&rufl_default_context,
+				&workers[i].ctx);
+		if (code != rufl_OK) {
+			fprintf(stderr, "rufl_ctx_create_shared: 0x%x\n",
+					code);
+			return 1;
+		}
+	}
+
+	/* one thread, then all at once */
+	t0 = now();
+	run(&workers[0]);
+	t1 = now() - t0;
+
+	t0 = now();
+	for (i = 0; i != threads; i++) {
+		if (pthread_create(&workers[i].thread, 0, run, &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+	for (i = 0; i != threads; i++)
+		pthread_join(workers[i].thread, 0);
+	tn = now() - t0;
+
+	for (i = 0; i != threads; i++) {
+		mismatches += workers[i].mismatches;
+		errors += workers[i].errors;
+		rufl_ctx_destroy(workers[i].ctx);
+	}
+	free(workers);
+
+	printf("# threads strings_per_s speedup\n");
+	printf("1 %.0f 1.00\n", passes * item_count / t1);
+	printf("%u %.0f %.2f\n", threads, threads * passes * item_count / tn,
+			threads * t1 / tn);
+	printf("%lu mismatches, %lu errors\n", mismatches, errors);
+
+	for (j = 0; j != item_count; j++)
+		free(items[j].string);
+	free(items);
+	rufl_quit();
+
+	return mismatches || errors ? 1 : 0;
+}
+
+
+/**
+ * Initialise a context scanning the fonts in turn and another scanning them
+ * in parallel, each without a cache, and compare the results.
+ */
+
+bool check_scan(unsigned int threads)
+{
+	struct rufl_context *ctx[2];
+	char *cache[2] = { 0, 0 };
+	size_t size[2] = { 0, 0 };
+	bool ok = true;
+	unsigned int i;
+	rufl_code code;
+
+	for (i = 0; i != 2; i++) {
+		remove(rufl_CACHE);
+		rufl_scan_threads = i == 0 ? 1 : threads;
+		code = rufl_ctx_create(&ctx[i]);
+		if (code != rufl_OK) {
+			fprintf(stderr, "rufl_ctx_create: 0x%x\n", code);
+			return false;
+		}
+		cache[i] = read_file(rufl_CACHE, &size[i]);
+	}
+	rufl_scan_threads = 0;
+
+	if (!cache[0] || !cache[1] || size[0] != size[1] ||
+			memcmp(cache[0], cache[1], size[0]) != 0) {
+		fprintf(stderr, "cache files differ\n");
+		ok = false;
+	}
+	if (memcmp(ctx[0]->substitution_table, ctx[1]->substitution_table,
+			65536 * sizeof *ctx[0]->substitution_table) != 0) {
+		fprintf(stderr, "substitution tables differ\n");
+		ok = false;
+	}
+	printf("scan with %u threads: %s\n", threads,
+			ok ? "identical" : "differs");
+
+	for (i = 0; i != 2; i++) {
+		free(cache[i]);
+		rufl_ctx_destroy(ctx[i]);
+	}
+	remove(rufl_CACHE);
+
+	return ok;
+}
+
+
+/**
+ * Read a whole file.
+ *
+ * \param  path  file name
+ * \param  size  updated to size of file
+ * \return  contents, or 0 on error
+ */
+
+char *read_file(const char *path, size_t *size)
+{
+	char *data = 0, *p;
+	size_t n;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return 0;
+	}
+
+	*size = 0;
+	do {
+		p = realloc(data, *size + 4096);
+		if (!p) {
+			free(data);
+			fclose(fp);
+			return 0;
+		}
+		data = p;
+		n = fread(data + *size, 1, 4096, fp);
+		*size += n;
+	} while (n == 4096);
+	fclose(fp);
+
+	return data;
+}
+
+
+/**
+ * Read a corpus, one string per line, and add its strings to items.
+ */
+
+bool read_corpus(const char *path, const char *family)
+{
+	char *line = 0;
+	size_t size = 0;
+	ssize_t length;
+	void *p;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return false;
+	}
+
+	while ((length = getline(&line, &size, fp)) != -1) {
+		if (0 < length && line[length - 1] == '\n')
+			line[--length] = 0;
+		if (length == 0)
+			continue;
+
+		if (item_count == items_allocated) {
+			items_allocated = items_allocated ?
+					items_allocated * 2 : 256;
+			p = realloc(items, items_allocated * sizeof *items);
+			if (!p)
+				break;
+			items = p;
+		}
+		items[item_count].family = family;
+		items[item_count].string = strdup(line);
+		if (!items[item_count].string)
+			break;
+		items[item_count].length = length;
+		item_count++;
+	}
+
+	free(line);
+	if (ferror(fp) || !feof(fp)) {
+		fprintf(stderr, "failed to read %s\n", path);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	return true;
+}
+
+
+/**
+ * Measure every string passes times, starting at a different string in each
+ * thread, and compare with the single-threaded results.
+ */
+
+void *run(void *p)
+{
+	struct worker *worker = p;
+	struct item result;
+	unsigned int pass;
+	size_t i, j;
+	os_box bbox;
+	int ascent, font_bbox[4];
+
+	for (pass = 0; pass != passes; pass++) {
+		for (j = 0; j != item_count; j++) {
+			i = (j + worker->index * item_count / 7) % item_count;
+			if (!measure(worker->ctx, i, &result)) {
+				worker->errors++;
+				continue;
+			}
+			if (result.width != items[i].width ||
+					result.split_offset !=
+					items[i].split_offset ||
+					result.split_x != items[i].split_x ||
+					result.click_offset !=
+					items[i].click_offset ||
+					result.click_x != items[i].click_x)
+				worker->mismatches++;
+		}
+
+		/* metrics which are read into the shared font list */
+		if (rufl_ctx_font_metrics(worker->ctx, "Homerton",
+				rufl_WEIGHT_400, &bbox, 0, 0, 0, &ascent,
+				0, 0, 0, 0, 0) != rufl_OK)
+			worker->errors++;
+		if (rufl_ctx_font_bbox(worker->ctx, "Corpus",
+				rufl_WEIGHT_400, SIZE, font_bbox) != rufl_OK)
+			worker->errors++;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Measure a string with rufl_width(), rufl_split() and rufl_x_to_offset().
+ */
+
+bool measure(struct rufl_context *ctx, size_t i, struct item *result)
+{
+	const struct item *item = &items[i];
+
+	if (rufl_ctx_width(ctx, item->family, rufl_WEIGHT_400, SIZE,
+			item->string, item->length,
+			&result->width) != rufl_OK)
+		return false;
+	if (rufl_ctx_split(ctx, item->family, rufl_WEIGHT_400, SIZE,
+			item->string, item->length, result->width / 2,
+			&result->split_offset, &result->split_x) != rufl_OK)
+		return false;
+	if (rufl_ctx_x_to_offset(ctx, item->family, rufl_WEIGHT_400, SIZE,
+			item->string, item->length, result->width / 3,
+			&result->click_offset, &result->click_x) != rufl_OK)
+		return false;
+
+	return true;
+}
+
+
+double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}